@@ -35,6 +35,8 @@
 
 #include "BSScriptFunction.h"
 #include "BSScriptVariable.h"
+#include "../dump_rtti/LogWriter.h"
+#include "../dump_rtti/PEImage.h"
 #include "../dump_rtti/RTTI.h"
 
 IDebugLog		gLog;
@@ -46,6 +48,8 @@ const UInt64 BIND_NATIVE_METHOD_VFT_OFFSET = 0x0194B598;
 typedef void (*BindNativeMethodFunction)(UInt64 thisObj, IFunction* fn);
 UInt64 bindNativeMethod_Orig;
 UInt64 baseAddr;
+ImageLayout g_layout;
+LogWriter g_out;        // flushed after each function
 
 void bindNativeMethod_Hook(uintptr_t thisObj, IFunction* fn)
 {
@@ -53,7 +57,8 @@ void bindNativeMethod_Hook(uintptr_t thisObj, IFunction* fn)
     UInt64 callback = *(UInt64*)((UInt64)fn + 0x50);   // previously 0x2C
     _MESSAGE("<%s> %s (%#010x) callback=%#010x", fn->GetClassName()->c_str(), 
              FunctionToString(fn).c_str(), fn, callback);
-    DumpObjectClassHierarchy(*(UInt64**)fn, false, baseAddr);
+    DumpObjectClassHierarchy(g_out, *(UInt64**)fn, false, g_layout);
+    FlushLogWriter(g_out);
     _MESSAGE("");
     ((BindNativeMethodFunction)bindNativeMethod_Orig)(thisObj, fn);
 }
@@ -67,6 +72,11 @@ void InstallHook()
     // address of the original BindNativeMethod function so our hook can return
     // to control to it after it's done.
     baseAddr = reinterpret_cast<UInt64>(GetModuleHandle(NULL));
+    if (!GetImageLayout(baseAddr, g_layout)) {
+        _ERROR("couldn't find the RTTI in the executable");
+        return;
+    }
+    OpenLogWriter(g_out, 0);
     UInt64 bindNativeMethod_VFT = baseAddr + BIND_NATIVE_METHOD_VFT_OFFSET;
     bindNativeMethod_Orig = (*(UInt64*)bindNativeMethod_VFT);
 
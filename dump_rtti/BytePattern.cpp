@@ -0,0 +1,278 @@
+// ============================================================================
+// dump_rtti/BytePattern.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "BytePattern.h"
+
+static bool ParseBytePattern(const char* pattern, UInt8* bytes, bool* fixed, BytePatternInfo& info);
+
+static UInt16 NewBytePatternState(BytePatternSet& set);
+
+// ============================================================================
+//   Add 'pattern' to 'set', as pattern number set.patterns.size(). Return
+//   FALSE if it's malformed or clashes with an earlier pattern, in which case
+//   it keeps its number but never matches.
+// ============================================================================
+bool AddBytePattern(BytePatternSet& set, const char* pattern)
+{
+    if (set.next.empty()) {
+        NewBytePatternState(set);
+    }
+
+    const UInt16 index = (UInt16)set.patterns.size();
+    set.patterns.emplace_back();
+    BytePatternInfo& info = set.patterns.back();
+
+    UInt8 bytes[BYTE_PATTERN_MAX_LENGTH];
+    bool fixed[BYTE_PATTERN_MAX_LENGTH];
+    if (index >= BYTE_PATTERN_ACCEPT ||
+        !ParseBytePattern(pattern, bytes, fixed, info)) {
+        info.length = 0;
+        return false;
+    }
+    SInt32 lastFixed = (SInt32)info.length - 1;
+    while (lastFixed >= 0 && !fixed[lastFixed]) --lastFixed;
+    if (lastFixed < 0) {
+        // Matching anything at all isn't a pattern.
+        info.length = 0;
+        return false;
+    }
+
+    // Walk the trie, adding states as we go, as far as the last fixed byte.
+    // If there are wildcards after it, the pattern matches on the first of
+    // them, whatever it is; if not, on the last fixed byte itself.
+    const bool endsFixed = lastFixed == (SInt32)info.length - 1;
+    UInt16 state = 0;
+    for (SInt32 i = 0; i <= lastFixed; ++i)
+    {
+        const std::size_t slot = (std::size_t)state * 256 + bytes[i];
+        UInt16 t = fixed[i] ? set.next[slot] : set.wild[state];
+
+        if (i == lastFixed && endsFixed)
+        {
+            if (t != 0) {
+                info.length = 0;
+                return false;
+            }
+            set.next[slot] = BYTE_PATTERN_ACCEPT | index;
+            return true;
+        }
+        if (t & BYTE_PATTERN_ACCEPT) {
+            // An earlier pattern is a prefix of this one.
+            info.length = 0;
+            return false;
+        }
+        if (t == 0)
+        {
+            t = NewBytePatternState(set);
+            if (t == 0) {
+                info.length = 0;
+                return false;
+            }
+            if (fixed[i]) set.next[slot] = t;
+            else set.wild[state] = t;
+        }
+        state = t;
+    }
+
+    if (set.wild[state] != 0) {
+        info.length = 0;
+        return false;
+    }
+    set.wild[state] = BYTE_PATTERN_ACCEPT | index;
+    return true;
+}
+
+// ============================================================================
+//   Turn the trie into the DFA: each state's wildcard transition becomes
+//   its transition for every byte that doesn't have one of its own. No
+//   patterns can be added afterwards.
+// ============================================================================
+void FinishBytePatterns(BytePatternSet& set)
+{
+    if (set.next.empty()) {
+        NewBytePatternState(set);
+    }
+
+    const std::size_t numStates = set.wild.size();
+    for (std::size_t s = 0; s < numStates; ++s)
+    {
+        const UInt16 wild = set.wild[s];
+        if (wild == 0) continue;
+        UInt16* next = &set.next[s * 256];
+        for (UInt32 b = 0; b < 256; ++b) {
+            if (next[b] == 0) next[b] = wild;
+        }
+    }
+    set.wild.clear();
+    set.wild.shrink_to_fit();
+}
+
+// ============================================================================
+//   Match the bytes at 'code' against the patterns in 'set'. Return the
+//   number of the pattern that matches, with the values of its captures in
+//   'captures' (BYTE_PATTERN_MAX_CAPTURES of them), or BYTE_PATTERN_NONE.
+// ============================================================================
+UInt32 MatchBytePatterns(const BytePatternSet& set, const UInt8* code, SInt64* captures)
+{
+    const UInt16* next = set.next.data();
+    UInt32 state = 0;
+    for (UInt32 i = 0; i < BYTE_PATTERN_MAX_LENGTH; ++i)
+    {
+        const UInt16 t = next[state * 256 + code[i]];
+        if (t == 0) return BYTE_PATTERN_NONE;
+        if (!(t & BYTE_PATTERN_ACCEPT))
+        {
+            state = t;
+            continue;
+        }
+
+        const UInt32 p = t & ~BYTE_PATTERN_ACCEPT;
+        const BytePatternInfo& info = set.patterns[p];
+        for (UInt32 c = 0; c < info.numCaptures; ++c)
+        {
+            const UInt8* operand = code + info.captureOffset[c];
+            switch (info.captureKind[c])
+            {
+            case kCapture_U8:
+                captures[c] = operand[0];
+                break;
+            case kCapture_I8:
+                captures[c] = (SInt8)operand[0];
+                break;
+            case kCapture_U32:
+            {
+                UInt32 value;
+                std::memcpy(&value, operand, sizeof(value));
+                captures[c] = value;
+            }
+            break;
+            case kCapture_I32:
+            {
+                SInt32 value;
+                std::memcpy(&value, operand, sizeof(value));
+                captures[c] = value;
+            }
+            break;
+            case kCapture_Rel32:
+            {
+                SInt32 value;
+                std::memcpy(&value, operand, sizeof(value));
+                captures[c] = (SInt64)((UInt64)code + info.length + (SInt64)value);
+            }
+            break;
+            }
+        }
+        return p;
+    }
+    return BYTE_PATTERN_NONE;
+}
+
+static bool ParseBytePattern(const char* pattern, UInt8* bytes, bool* fixed, BytePatternInfo& info)
+{
+    // ------------------------------------------------------------------------
+    // Parse 'pattern' into 'bytes', with fixed[i] FALSE for the wildcards and
+    // captures, and its length and captures into 'info'. Return FALSE if
+    // it's malformed.
+    // ------------------------------------------------------------------------
+    static const struct
+    {
+        const char*   token;
+        UInt8         kind;
+        UInt8         size;
+    } CAPTURES[] = {
+        { "u8",  kCapture_U8,    1 },
+        { "i8",  kCapture_I8,    1 },
+        { "u32", kCapture_U32,   4 },
+        { "i32", kCapture_I32,   4 },
+        { "r32", kCapture_Rel32, 4 },
+    };
+
+    std::memset(&info, 0, sizeof(info));
+    const char* p = pattern;
+    for (;;)
+    {
+        while (*p == ' ') ++p;
+        if (!*p) break;
+        const char* end = p;
+        while (*end && *end != ' ') ++end;
+        const std::size_t len = end - p;
+
+        UInt32 size = 1;
+        if (len == 2 && p[0] == '?' && p[1] == '?')
+        {
+            if (info.length + size > BYTE_PATTERN_MAX_LENGTH) return false;
+            fixed[info.length] = false;
+            bytes[info.length] = 0;
+        }
+        else if (len == 2 && std::isxdigit((unsigned char)p[0]) && std::isxdigit((unsigned char)p[1]))
+        {
+            if (info.length + size > BYTE_PATTERN_MAX_LENGTH) return false;
+            char hex[3] = { p[0], p[1], '\0' };
+            fixed[info.length] = true;
+            bytes[info.length] = (UInt8)std::strtoul(hex, nullptr, 16);
+        }
+        else
+        {
+            UInt32 c = 0;
+            const UInt32 numKinds = sizeof(CAPTURES) / sizeof(CAPTURES[0]);
+            while (c < numKinds && (std::strlen(CAPTURES[c].token) != len ||
+                                    std::strncmp(CAPTURES[c].token, p, len) != 0)) {
+                ++c;
+            }
+            if (c == numKinds || info.numCaptures == BYTE_PATTERN_MAX_CAPTURES) return false;
+            size = CAPTURES[c].size;
+            if (info.length + size > BYTE_PATTERN_MAX_LENGTH) return false;
+            info.captureKind[info.numCaptures] = CAPTURES[c].kind;
+            info.captureOffset[info.numCaptures] = info.length;
+            ++info.numCaptures;
+            for (UInt32 i = 0; i < size; ++i) {
+                fixed[info.length + i] = false;
+                bytes[info.length + i] = 0;
+            }
+        }
+        info.length += (UInt8)size;
+        p = end;
+    }
+    return info.length > 0;
+}
+
+static UInt16 NewBytePatternState(BytePatternSet& set)
+{
+    // ------------------------------------------------------------------------
+    // Add a state with no transitions, and return its number. There can be
+    // at most 0x7FFF of them, which is far more than any table of x86
+    // idioms needs; beyond that, return 0 (no transition).
+    // ------------------------------------------------------------------------
+    const std::size_t state = set.wild.size();
+    if (state >= BYTE_PATTERN_ACCEPT) return 0;
+    set.next.resize((state + 1) * 256, 0);
+    set.wild.push_back(0);
+    return (UInt16)state;
+}
@@ -0,0 +1,97 @@
+// ============================================================================
+// dump_rtti/BytePattern.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <vector>
+
+#include "Platform.h"
+
+// ============================================================================
+//                  Byte patterns, and an automaton for them.
+// ----------------------------------------------------------------------------
+// A pattern is a string of hex bytes, wildcards and captures, e.g.
+//     "48 8B 41 i8"           mov rax, [rcx+disp8]
+//     "F3 0F 10 05 r32"       movss xmm0, [rip+disp32]
+// "??" matches any byte. A capture matches the bytes of an operand, like a
+// wildcard, and hands back its value:
+//     u8    an unsigned byte           i8    a signed byte
+//     u32   an unsigned dword          i32   a signed dword
+//     r32   a RIP-relative dword; its value is the address it refers to,
+//           i.e. relative to the end of the pattern (the instruction)
+//
+// AddBytePattern adds patterns to a trie with one state per byte, and
+// FinishBytePatterns turns that into a DFA: 256 transitions per state, each
+// to another state, to a pattern that has matched, or to nothing. So
+// MatchBytePatterns makes one table lookup per byte, however many patterns
+// there are, and reads no further than the first fixed byte that rules them
+// all out.
+//
+// Where one pattern has a fixed byte and another a wildcard at the same
+// position, the byte wins and there's no going back: given "B0 01" and
+// "B0 u8", B0 01 only ever matches the former. A pattern matches as soon as
+// its last fixed byte (or the wildcard after it) has been read, so a pattern
+// can't be a prefix of another; AddBytePattern rejects such patterns, and
+// duplicates, and they never match.
+// ============================================================================
+const UInt32 BYTE_PATTERN_MAX_LENGTH   = 15;           // the longest x86 instruction
+const UInt32 BYTE_PATTERN_MAX_CAPTURES = 3;
+const UInt32 BYTE_PATTERN_NONE         = 0xFFFFFFFF;
+const UInt16 BYTE_PATTERN_ACCEPT       = 0x8000;       // transition flag: the low bits are a pattern, not a state
+
+enum BytePatternCapture
+{
+    kCapture_U8,
+    kCapture_I8,
+    kCapture_U32,
+    kCapture_I32,
+    kCapture_Rel32,
+};
+
+struct BytePatternInfo
+{
+    UInt8         length;                                   // 00: bytes matched, captures included
+    UInt8         numCaptures;                              // 01
+    UInt8         captureKind[BYTE_PATTERN_MAX_CAPTURES];   // 02: BytePatternCapture
+    UInt8         captureOffset[BYTE_PATTERN_MAX_CAPTURES]; // 05
+};
+
+struct BytePatternSet
+{
+    std::vector<UInt16> next;          // 256 transitions per state, state 0 first; 0 for no transition
+    std::vector<UInt16> wild;          // per state, the transition for any other byte (until Finish)
+    std::vector<BytePatternInfo> patterns;    // in the order they were added
+};
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+bool AddBytePattern(BytePatternSet& set, const char* pattern);
+
+void FinishBytePatterns(BytePatternSet& set);
+
+UInt32 MatchBytePatterns(const BytePatternSet& set, const UInt8* code, SInt64* captures);
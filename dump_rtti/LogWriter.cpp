@@ -0,0 +1,108 @@
+// ============================================================================
+// dump_rtti/LogWriter.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <cstdarg>
+#include <cstdio>
+
+#include "LogWriter.h"
+
+// ============================================================================
+//   Set up 'out' to write to 'sink', in chunks of about 'flushSize' bytes.
+// ----------------------------------------------------------------------------
+// The buffer is reserved with room for one more long line, so a writer that
+// is flushed by size never needs to grow it.
+// ============================================================================
+void OpenLogWriter(LogWriter& out, const std::size_t flushSize, LogSinkFn sink)
+{
+    out.buf.clear();
+    out.buf.reserve(flushSize + 2 * LOG_LINE_MAX);
+    out.flushSize = flushSize;
+    out.sink = sink;
+}
+
+// ============================================================================
+//   Hand everything written so far to the sink, and empty the buffer.
+// ============================================================================
+void FlushLogWriter(LogWriter& out)
+{
+    if (!out.buf.empty() && out.sink) {
+        out.sink(out.buf.data(), out.buf.size());
+    }
+    out.buf.clear();
+}
+
+// ============================================================================
+//   A whole line, printf style. For the odd line that isn't worth building a
+//   piece at a time; at most LOG_LINE_MAX characters, the rest are dropped.
+// ============================================================================
+void LogLine(LogWriter& out, const char* fmt, ...)
+{
+    std::size_t start = out.buf.size();
+    out.buf.resize(start + LOG_LINE_MAX);
+
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(out.buf.data() + start, LOG_LINE_MAX, fmt, args);
+    va_end(args);
+
+    if (len < 0) len = 0;
+    if (len >= (int)LOG_LINE_MAX) len = (int)LOG_LINE_MAX - 1;
+    out.buf.resize(start + len);
+    LogEndLine(out);
+}
+
+// ============================================================================
+//   The default sink: xSE's log, via _MESSAGE.
+// ----------------------------------------------------------------------------
+// IDebugLog formats every message into a fixed 8 KB buffer, so the text is
+// passed on in pieces of whole lines that fit in it (a single line that
+// doesn't is truncated, as it would have been anyway). _MESSAGE adds the
+// newline that ends each piece.
+// ============================================================================
+const std::size_t DEBUG_LOG_CHUNK = 8000;
+
+void WriteToDebugLog(const char* text, const std::size_t length)
+{
+    const char* end = text + length;
+    while (text < end)
+    {
+        // The last newline within the next DEBUG_LOG_CHUNK bytes, or failing
+        // that the end of the (over-long) line.
+        const char* stop = (end - text > (std::ptrdiff_t)DEBUG_LOG_CHUNK) ? text + DEBUG_LOG_CHUNK : end;
+        const char* nl = stop;
+        while (nl > text && nl[-1] != '\n') --nl;
+        if (nl == text) {
+            nl = (const char*)memchr(stop, '\n', end - stop);
+            nl = nl ? nl + 1 : end;
+        }
+
+        // Less the newline, which _MESSAGE supplies.
+        int len = (int)(nl - text);
+        if (nl[-1] == '\n') len--;
+        _MESSAGE("%.*s", len, text);
+        text = nl;
+    }
+}
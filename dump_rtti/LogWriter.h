@@ -0,0 +1,132 @@
+// ============================================================================
+// dump_rtti/LogWriter.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+
+// ============================================================================
+//                          Buffered log output.
+// ----------------------------------------------------------------------------
+// The dump is close to 100,000 lines. Building each one from std::strings and
+// sprintf, and then writing it with its own _MESSAGE (a formatted, flushed
+// write), made the output cost more than the analysis. A LogWriter instead
+// appends the text to one buffer, which is reserved up front and reused, and
+// hands it to its sink in large chunks of whole lines.
+//
+// The hex formatting is done here rather than with printf, so it doesn't
+// depend on the locale, and nothing allocates once the writer is open.
+//
+// A line is only complete once LogEndLine has been called. Text written to a
+// LogWriter appears in the log when the buffer fills, or on FlushLogWriter;
+// anything written to the log directly (e.g. with _MESSAGE) in the meantime
+// will come out first. So code that shares a LogWriter should use LogLine for
+// its odd message.
+// ============================================================================
+const std::size_t LOG_FLUSH_SIZE  = 0x40000;     // 256 KB
+const std::size_t LOG_LINE_MAX    = 1024;        // longest line LogLine can format
+
+// Receives whole lines: 'text' is 'length' bytes long and ends with '\n'.
+typedef void (*LogSinkFn)(const char* text, const std::size_t length);
+
+struct LogWriter
+{
+    std::vector<char> buf;             // text written since the last flush
+    std::size_t   flushSize;           // flush once a line ends past this; 0 = only on request
+    LogSinkFn     sink;
+};
+
+// public:
+void WriteToDebugLog(const char* text, const std::size_t length);
+
+void OpenLogWriter(LogWriter& out, const std::size_t flushSize = LOG_FLUSH_SIZE,
+                   LogSinkFn sink = WriteToDebugLog);
+
+void FlushLogWriter(LogWriter& out);
+
+void LogLine(LogWriter& out, const char* fmt, ...);
+
+inline void LogText(LogWriter& out, const char* text, const std::size_t length)
+{
+    out.buf.insert(out.buf.end(), text, text + length);
+}
+
+inline void LogText(LogWriter& out, const char* text)
+{
+    LogText(out, text, strlen(text));
+}
+
+inline void LogText(LogWriter& out, const std::string& text)
+{
+    LogText(out, text.data(), text.size());
+}
+
+inline void LogChar(LogWriter& out, const char c)
+{
+    out.buf.push_back(c);
+}
+
+// 'count' spaces.
+inline void LogPad(LogWriter& out, const std::size_t count)
+{
+    out.buf.insert(out.buf.end(), count, ' ');
+}
+
+// 'value' in upper case hex, zero-padded to at least 'width' digits (as
+// printf's "%0*llX").
+inline void LogHex(LogWriter& out, UInt64 value, const unsigned width)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    char tmp[16];
+    unsigned n = 0;
+    do {
+        tmp[15 - n++] = digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    if (width > n) out.buf.insert(out.buf.end(), width - n, '0');
+    LogText(out, tmp + 16 - n, n);
+}
+
+inline void LogEndLine(LogWriter& out)
+{
+    out.buf.push_back('\n');
+    if (out.flushSize && out.buf.size() >= out.flushSize) {
+        FlushLogWriter(out);
+    }
+}
+
+// Text that's already whole lines, e.g. from another LogWriter's buffer.
+inline void LogLines(LogWriter& out, const char* text, const std::size_t length)
+{
+    LogText(out, text, length);
+    if (out.flushSize && out.buf.size() >= out.flushSize) {
+        FlushLogWriter(out);
+    }
+}
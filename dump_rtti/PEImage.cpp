@@ -0,0 +1,574 @@
+// ============================================================================
+// dump_rtti/PEImage.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+#include "PEImage.h"
+#include "RTTI.h"
+
+static const IMAGE_SECTION_HEADER* FindSection(const IMAGE_NT_HEADERS* pNtHdr, const char* name);
+
+static bool HasRelocations(const UInt64 baseAddr);
+
+static bool SameNameNoCase(const char* a, const char* b);
+
+static void LoadImageFunctions(const UInt64 baseAddr, std::vector<ImageFunction>& functions);
+
+static UInt32 GetFunctionEntryRva(const UInt64 baseAddr, const UInt32 sizeOfImage, const RUNTIME_FUNCTION& func);
+
+const IMAGE_NT_HEADERS* GetNtHeaders(const UInt64 baseAddr)
+{
+    // ------------------------------------------------------------------------
+    // Return the NT headers of the image mapped at 'baseAddr', or NULL if it
+    // doesn't look like a PE32+ image.
+    // ------------------------------------------------------------------------
+    const IMAGE_DOS_HEADER* pDosHdr = reinterpret_cast<const IMAGE_DOS_HEADER*>(baseAddr);
+    if (pDosHdr->e_magic != IMAGE_DOS_SIGNATURE) return nullptr;
+
+    const IMAGE_NT_HEADERS* pNtHdr =
+        reinterpret_cast<const IMAGE_NT_HEADERS*>(baseAddr + (UInt64)pDosHdr->e_lfanew);
+    if (pNtHdr->Signature != IMAGE_NT_SIGNATURE) return nullptr;
+
+    return pNtHdr;
+}
+
+// ============================================================================
+//     Work out where the interesting parts of the image are.
+// ----------------------------------------------------------------------------
+// GetImageSections only reads the headers, and the exception table into the
+// function index. GetImageLayout also collects the pointer slots and locates
+// type_info's VFT and _purecall, which means scanning the image. Its scans
+// are also exposed a piece at a time (below), so that they can be spread
+// over many short steps; see RTTIAnalysis.h.
+//
+// Both return FALSE if the image isn't a PE32+ image or is missing one of the
+// sections we scan. GetImageLayout also returns FALSE if the image doesn't
+// appear to contain MSVC RTTI at all.
+// ============================================================================
+bool GetImageSections(const UInt64 baseAddr, ImageLayout& layout)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr || pNtHdr->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC) return false;
+
+    // N.B. 1.6.659 has two sections called ".text". The first one holds the
+    // game's code, and is the only one the original hardcoded offsets covered.
+    const IMAGE_SECTION_HEADER* pText = FindSection(pNtHdr, ".text");
+    const IMAGE_SECTION_HEADER* pRdata = FindSection(pNtHdr, ".rdata");
+    const IMAGE_SECTION_HEADER* pData = FindSection(pNtHdr, ".data");
+    if (!pText || !pRdata || !pData) return false;
+
+    layout.baseAddr = baseAddr;
+    layout.sizeOfImage = pNtHdr->OptionalHeader.SizeOfImage;
+    layout.timeDateStamp = pNtHdr->FileHeader.TimeDateStamp;
+
+    // Code pointers are valid anywhere in the section, but we only need to
+    // scan the initialised part of the data sections.
+    layout.text.begin = baseAddr + pText->VirtualAddress;
+    layout.text.end = layout.text.begin + pText->Misc.VirtualSize;
+    layout.rdata.begin = baseAddr + pRdata->VirtualAddress;
+    layout.rdata.end = layout.rdata.begin + (std::min)(pRdata->Misc.VirtualSize, pRdata->SizeOfRawData);
+    layout.data.begin = baseAddr + pData->VirtualAddress;
+    layout.data.end = layout.data.begin + (std::min)(pData->Misc.VirtualSize, pData->SizeOfRawData);
+
+    layout.typeInfoVtbl = 0;
+    layout.pureCall = 0;
+    layout.pointerSlots.clear();
+    LoadImageFunctions(baseAddr, layout.functions);
+    return true;
+}
+
+bool GetImageLayout(const UInt64 baseAddr, ImageLayout& layout)
+{
+    if (!GetImageSections(baseAddr, layout)) return false;
+
+    UInt32 next = 0;
+    while (!LoadPointerSlotChunk(baseAddr, layout.pointerSlots, next)) {}
+
+    layout.typeInfoVtbl = FindTypeInfoVtbl(layout, layout.data);
+    if (!layout.typeInfoVtbl) return false;
+
+    std::unordered_map<UInt64, UInt32> refs;
+    CountCodeRefs(layout, layout.rdata, refs);
+    layout.pureCall = FindPureCall(layout, refs);
+
+    return true;
+}
+
+// ============================================================================
+//   Collect the RVA of every DIR64 (i.e. 64-bit absolute address) slot
+//   listed in the base relocation table into 'slots', sorted ascending.
+// ----------------------------------------------------------------------------
+// Reads the table's blocks from offset 'next', about RELOC_CHUNK_SIZE bytes
+// of them, and advances 'next'. Start with 'slots' empty and 'next' 0, and
+// call until it returns TRUE (the whole table has been read). 'slots' stays
+// empty if the image has no relocations.
+// ============================================================================
+bool LoadPointerSlotChunk(const UInt64 baseAddr, std::vector<UInt32>& slots, UInt32& next)
+{
+    if (!HasRelocations(baseAddr)) return true;
+
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    const IMAGE_DATA_DIRECTORY& dir = pNtHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    if (next >= dir.Size) return true;
+
+    // The table is a sequence of blocks, one per 4 KB page, each followed by
+    // 16-bit entries: type:4, offset:12. Each entry is at most one slot.
+    if (next == 0) slots.reserve(dir.Size / sizeof(UInt16));
+    const UInt8* table = reinterpret_cast<const UInt8*>(baseAddr + dir.VirtualAddress);
+    const UInt8* end = table + dir.Size;
+    const UInt8* p = table + next;
+    const UInt8* chunkEnd = (dir.Size - next > RELOC_CHUNK_SIZE) ? p + RELOC_CHUNK_SIZE : end;
+    while (p < chunkEnd && (std::size_t)(end - p) >= sizeof(IMAGE_BASE_RELOCATION))
+    {
+        const IMAGE_BASE_RELOCATION* block = reinterpret_cast<const IMAGE_BASE_RELOCATION*>(p);
+        if (block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || block->SizeOfBlock > (std::size_t)(end - p)) {
+            p = end;
+            break;
+        }
+
+        const std::size_t first = slots.size();
+        const UInt16* entry = reinterpret_cast<const UInt16*>(block + 1);
+        const UInt16* entryEnd = reinterpret_cast<const UInt16*>(p + block->SizeOfBlock);
+        for (; entry < entryEnd; ++entry)
+        {
+            if ((*entry >> 12) == IMAGE_REL_BASED_DIR64) {
+                slots.push_back(block->VirtualAddress + (*entry & 0xFFF));
+            }
+        }
+
+        // Blocks are normally in page order, but the entries within a block
+        // needn't be. So sort each block's slots, and only merge them into
+        // the rest if the block is out of order.
+        std::sort(slots.begin() + first, slots.end());
+        if (first > 0 && first < slots.size() && slots[first] < slots[first - 1]) {
+            std::inplace_merge(slots.begin(), slots.begin() + first, slots.end());
+        }
+        p += block->SizeOfBlock;
+    }
+    next = (UInt32)(p - table);
+    return (std::size_t)(end - p) < sizeof(IMAGE_BASE_RELOCATION);
+}
+
+// ============================================================================
+//   Locate the RTTI Type Descriptor for class type_info, and return its
+//   pVFTable (i.e. the address of type_info's VFT), or 0 if not found.
+// ----------------------------------------------------------------------------
+// Only looks for a name that starts in 'range', which is .data or a chunk of
+// it. In Skyrim 1.6.659, the mangled name ".?AVtype_info@@" is at address
+// 0x41f50eb0, which means the type_info TypeDescriptor is 2 8-byte pointers
+// earlier, at 0x41f50ea0. Its pVFTable is 0x419752c0.
+// ============================================================================
+UInt64 FindTypeInfoVtbl(const ImageLayout& layout, const ImageRange& range)
+{
+    // TypeDescriptors are 8-byte aligned, so the name is too, and we can
+    // search for its first 8 bytes as a single 64-bit value. The name is
+    // exactly 16 bytes long (including the terminating null).
+    static const char s_typeInfo[16] = ".?AVtype_info@@";
+    UInt64 name[2];
+    memcpy(name, s_typeInfo, sizeof(name));
+
+    // The name is at least 0x10 bytes into .data, after the TypeDescriptor's
+    // other fields, and all of it must be in .data.
+    if (layout.data.end - layout.data.begin < 0x10 + sizeof(name)) return 0;
+    UInt64 lo = (std::max)(range.begin, layout.data.begin + 0x10);
+    lo = layout.data.begin + ((lo - layout.data.begin + 7) & ~(UInt64)7);
+    const UInt64 hi = (std::min)(range.end, layout.data.end - sizeof(name) + 1);
+    if (lo >= hi) return 0;
+    const UInt64* first = reinterpret_cast<const UInt64*>(lo);
+    const UInt64* last = first + (hi - lo + 7) / 8;
+
+    std::vector<const UInt64*> hits;
+    FindAll64(first, last, name, 1, hits);
+    for (const UInt64* p : hits)
+    {
+        if (p[1] != name[1]) continue;
+
+        // The TypeDescriptor's pVFTable (i.e. type_info's VFT) should be in
+        // .RDATA, and its first entry (the destructor) in .TEXT.
+        const TypeDescriptor* type = reinterpret_cast<const TypeDescriptor*>(p - 2);
+        if (!layout.rdata.Contains(type->pVFTable)) continue;
+        if (!layout.text.Contains(*reinterpret_cast<const UInt64*>(type->pVFTable))) continue;
+        return type->pVFTable;
+    }
+    return 0;
+}
+
+// ============================================================================
+//   Identify _purecall, the function MSVC puts in every pure virtual slot.
+// ----------------------------------------------------------------------------
+// _purecall has no distinctive name or byte signature we can rely on across
+// compiler versions. But it's the most common target of the function
+// pointers in .RDATA - which are almost all VFT entries - once we discount
+// the tiny leaf functions (e.g. "{ return false; }") that COMDAT folding
+// shares between thousands of classes. Unlike those, _purecall calls out to
+// the CRT's purecall handler, so it isn't a leaf function and must have
+// unwind info in .PDATA.
+//
+// CountCodeRefs counts the pointers to .TEXT in 'range' (.RDATA, or a chunk
+// of it) into 'refs', by the address they point to. FindPureCall then
+// returns the most common of those that has unwind info, or 0 if none has.
+// ============================================================================
+void CountCodeRefs(const ImageLayout& layout, const ImageRange& range, std::unordered_map<UInt64, UInt32>& refs)
+{
+    ForEachPointerSlot(layout, range, layout.text.begin, layout.text.end, [&](const UInt64* p) {
+        ++refs[*p];
+    });
+}
+
+UInt64 FindPureCall(const ImageLayout& layout, const std::unordered_map<UInt64, UInt32>& refs)
+{
+    // Ties go to the lowest address. Only a candidate that beats the best so
+    // far needs looking up in the function index.
+    UInt64 best = 0;
+    UInt32 bestCount = 0;
+    for (auto& r : refs)
+    {
+        if (r.second < bestCount || (r.second == bestCount && r.first > best)) continue;
+        const ImageFunction* func = FindImageFunction(layout, r.first);
+        if (func && layout.baseAddr + (UInt64)func->begin == r.first && func->entry == func->begin) {
+            best = r.first;
+            bestCount = r.second;
+        }
+    }
+    return best;
+}
+
+// ============================================================================
+//        Print useful summary info about the loaded executable.
+// ----------------------------------------------------------------------------
+// N.B. addresses are printed as 32-bit values, as they always have been.
+// ============================================================================
+void PrintModuleSummary(const char* fileName, const UInt64 baseAddr)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+
+    _MESSAGE("------------------------------ MODULE SUMMARY ----------------------------------");
+    if (fileName) {
+        _MESSAGE("File name: %s", fileName);
+    }
+    if (!pNtHdr) {
+        _MESSAGE("Not a PE image.");
+        _MESSAGE("--------------------------------------------------------------------------------");
+        return;
+    }
+    std::string format;
+    switch ((UInt16)pNtHdr->FileHeader.Machine) {
+    case IMAGE_FILE_MACHINE_I386:
+        format = "Intel 386 or later processors and compatible processors";
+        break;
+    case IMAGE_FILE_MACHINE_IA64:
+        format = "Intel Itanium processor family";
+        break;
+    case IMAGE_FILE_MACHINE_AMD64:
+        format = "x64";
+        break;
+    default:
+        format = "UNRECOGNISED";
+        break;
+    }
+    _MESSAGE("Format: %s (0x%04X)", format.c_str(), (UInt16)pNtHdr->FileHeader.Machine);
+    const time_t t1 = (time_t)pNtHdr->FileHeader.TimeDateStamp;
+    char buf[32];
+    if (!ctime_s(buf, sizeof(buf), &t1)) {
+        _MESSAGE("Build timestamp: %s", buf);
+    }
+    _MESSAGE("Base address: %#010x", (UInt32)baseAddr);
+
+    // Thanks Nawaz @
+    // https://stackoverflow.com/questions/4308996/finding-the-address-range-of-the-data-segment
+    _MESSAGE("Sections:");
+    const IMAGE_SECTION_HEADER* pSectionHdr = reinterpret_cast<const IMAGE_SECTION_HEADER*>(pNtHdr + 1);
+    std::string scnName;
+    for (int scn = 0; scn < pNtHdr->FileHeader.NumberOfSections; ++scn)
+    {
+        // N.B. pSectionHdr->Name is 8 bytes long. If all 8 bytes are used it won't be
+        // null-terminated. So we do this to avoids potential buffer overruns:
+        scnName.assign((const char*)pSectionHdr->Name, 8);
+        _MESSAGE("  %3d: %#010x ... %#010x %-10s (%u bytes)",
+                 scn,
+                 (UInt32)(baseAddr + (UInt64)pSectionHdr->VirtualAddress),
+                 (UInt32)(baseAddr + (UInt64)pSectionHdr->VirtualAddress + (UInt64)pSectionHdr->Misc.VirtualSize),
+                 scnName.c_str(),
+                 (UInt32)pSectionHdr->Misc.VirtualSize);
+        ++pSectionHdr;
+    }
+
+    _MESSAGE("Data directories:");
+    std::vector<std::string> dirNames
+    { "Export Table", "Import Table", "Resource Table", "Exception Table",
+      "Certificate Table", "Base Relocation Table", "Debug",
+      "Architecture", "Global Ptr", "TLS Table", "Load Config Table",
+      "Bound Import", "IAT", "Delay Import Descriptor",
+      "CLR Runtime Header" };
+    int k = 0;
+    for (UInt32 i = 0; i < pNtHdr->OptionalHeader.NumberOfRvaAndSizes && i < 16; ++i)
+    {
+        IMAGE_DATA_DIRECTORY pDataDir = pNtHdr->OptionalHeader.DataDirectory[i];
+        if ((UInt64)pDataDir.Size > 0) {
+            _MESSAGE("  %3d: %#010x ... %#010x %-25s (%u bytes)",
+                k++,
+                (UInt32)(baseAddr + (UInt64)pDataDir.VirtualAddress),
+                (UInt32)(baseAddr + (UInt64)pDataDir.VirtualAddress + (UInt64)pDataDir.Size),
+                dirNames.at(i).c_str(),
+                (UInt32)pDataDir.Size);
+        }
+    }
+    _MESSAGE("--------------------------------------------------------------------------------");
+}
+
+// ============================================================================
+//        Print the section bounds and addresses the scanner will use.
+// ============================================================================
+void PrintImageLayout(const ImageLayout& layout)
+{
+    _MESSAGE("--------------------------------- IMAGE LAYOUT ---------------------------------");
+    _MESSAGE("Scanned:");
+    _MESSAGE("  .text:   %#010x ... %#010x", (UInt32)layout.text.begin, (UInt32)layout.text.end);
+    _MESSAGE("  .rdata:  %#010x ... %#010x", (UInt32)layout.rdata.begin, (UInt32)layout.rdata.end);
+    _MESSAGE("  .data:   %#010x ... %#010x", (UInt32)layout.data.begin, (UInt32)layout.data.end);
+    if (!layout.pointerSlots.empty()) {
+        _MESSAGE("Pointer slots:        %u (from the base relocation table)",
+                 (UInt32)layout.pointerSlots.size());
+    }
+    else if (HasRelocations(layout.baseAddr)) {
+        _MESSAGE("Pointer slots:        not loaded (no scan needed).");
+    }
+    else {
+        _MESSAGE("Pointer slots:        no relocations; scanning every slot.");
+    }
+    if (!layout.functions.empty()) {
+        _MESSAGE("Functions:            %u (from the exception table)", (UInt32)layout.functions.size());
+    }
+    else {
+        _MESSAGE("Functions:            no exception table; function bounds unknown.");
+    }
+    _MESSAGE("type_info::`vftable': %#010x", (UInt32)layout.typeInfoVtbl);
+    if (layout.pureCall) {
+        _MESSAGE("_purecall:            %#010x", (UInt32)layout.pureCall);
+    }
+    else {
+        _MESSAGE("_purecall:            not found; pure virtuals won't be marked.");
+    }
+    _MESSAGE("--------------------------------------------------------------------------------");
+}
+
+// ============================================================================
+//   Return the import address table slot through which the image calls
+//   'funcName' in 'dllName', or NULL if it doesn't import it by name.
+// ----------------------------------------------------------------------------
+// Once the image has been loaded, the slot holds the function's address; all
+// of the image's calls to the function go through it.
+// ============================================================================
+UInt64* FindImportSlot(const UInt64 baseAddr, const char* dllName, const char* funcName)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr || pNtHdr->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_IMPORT) return nullptr;
+
+    const IMAGE_DATA_DIRECTORY& dir = pNtHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+    if (!dir.VirtualAddress) return nullptr;
+
+    const IMAGE_IMPORT_DESCRIPTOR* pImport =
+        reinterpret_cast<const IMAGE_IMPORT_DESCRIPTOR*>(baseAddr + dir.VirtualAddress);
+    for (; pImport->Name; ++pImport)
+    {
+        if (!SameNameNoCase(reinterpret_cast<const char*>(baseAddr + pImport->Name), dllName)) continue;
+
+        // N.B. without an import lookup table we'd have no names to go on.
+        if (!pImport->OriginalFirstThunk) continue;
+        const UInt64* pLookup = reinterpret_cast<const UInt64*>(baseAddr + pImport->OriginalFirstThunk);
+        UInt64* pSlot = reinterpret_cast<UInt64*>(baseAddr + pImport->FirstThunk);
+        for (; *pLookup; ++pLookup, ++pSlot)
+        {
+            if (*pLookup & IMAGE_ORDINAL_FLAG64) continue;
+            const IMAGE_IMPORT_BY_NAME* pName =
+                reinterpret_cast<const IMAGE_IMPORT_BY_NAME*>(baseAddr + (UInt32)*pLookup);
+            if (!strcmp(pName->Name, funcName)) return pSlot;
+        }
+    }
+    return nullptr;
+}
+
+// ============================================================================
+//                            The function index.
+// ----------------------------------------------------------------------------
+// Built from .pdata by GetImageSections. It only knows about the functions
+// that have unwind info, so an address it knows nothing about may still be a
+// (leaf) function. But an address inside one of its entries, other than at
+// the start of a function, can't be a function at all.
+// ============================================================================
+// ----------------------------------------------------------------------------
+// The entry whose code contains 'addr', or NULL if there isn't one.
+// ----------------------------------------------------------------------------
+const ImageFunction* FindImageFunction(const ImageLayout& layout, const UInt64 addr)
+{
+    if (addr < layout.baseAddr || addr - layout.baseAddr >= layout.sizeOfImage) return nullptr;
+    const UInt32 rva = (UInt32)(addr - layout.baseAddr);
+
+    auto it = std::upper_bound(layout.functions.begin(), layout.functions.end(), rva,
+                               [](const UInt32 r, const ImageFunction& f) { return r < f.begin; });
+    if (it == layout.functions.begin()) return nullptr;
+    --it;
+    return (rva < it->end) ? &*it : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// Could 'addr' be the entry point of a function, e.g. what a VFT slot points
+// to? It must be in .text, and if it's in an entry of the index, at the start
+// of a function (not of a chained fragment).
+// ----------------------------------------------------------------------------
+bool IsFunctionEntry(const ImageLayout& layout, const UInt64 addr)
+{
+    if (!layout.text.Contains(addr)) return false;
+    const ImageFunction* func = FindImageFunction(layout, addr);
+    return !func || (layout.baseAddr + (UInt64)func->begin == addr && func->entry == func->begin);
+}
+
+// ----------------------------------------------------------------------------
+// The address that the function at 'addr' can't extend past: the end of its
+// entry, or if it has none (it's a leaf function), the start of the next
+// function that has one, or failing that the end of .text.
+// ----------------------------------------------------------------------------
+UInt64 GetFunctionLimit(const ImageLayout& layout, const UInt64 addr)
+{
+    if (!layout.text.Contains(addr)) return addr;
+    const UInt32 rva = (UInt32)(addr - layout.baseAddr);
+
+    auto it = std::upper_bound(layout.functions.begin(), layout.functions.end(), rva,
+                               [](const UInt32 r, const ImageFunction& f) { return r < f.begin; });
+    if (it != layout.functions.begin() && rva < (it - 1)->end) {
+        return layout.baseAddr + (UInt64)(it - 1)->end;
+    }
+    if (it != layout.functions.end()) {
+        return (std::min)(layout.baseAddr + (UInt64)it->begin, layout.text.end);
+    }
+    return layout.text.end;
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static const IMAGE_SECTION_HEADER* FindSection(const IMAGE_NT_HEADERS* pNtHdr, const char* name)
+{
+    // ------------------------------------------------------------------------
+    // Return the header of the first section called 'name', or NULL.
+    // ------------------------------------------------------------------------
+    const IMAGE_SECTION_HEADER* pSectionHdr = reinterpret_cast<const IMAGE_SECTION_HEADER*>(pNtHdr + 1);
+    for (int scn = 0; scn < pNtHdr->FileHeader.NumberOfSections; ++scn, ++pSectionHdr)
+    {
+        // N.B. Name isn't null-terminated if all 8 bytes are used.
+        if (!strncmp((const char*)pSectionHdr->Name, name, IMAGE_SIZEOF_SHORT_NAME))
+            return pSectionHdr;
+    }
+    return nullptr;
+}
+
+static bool SameNameNoCase(const char* a, const char* b)
+{
+    // DLL names are case-insensitive (and ASCII).
+    for (; *a && *b; ++a, ++b) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) return false;
+    }
+    return *a == *b;
+}
+
+static bool HasRelocations(const UInt64 baseAddr)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr || pNtHdr->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_BASERELOC) return false;
+
+    const IMAGE_DATA_DIRECTORY& dir = pNtHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    return dir.VirtualAddress && dir.Size;
+}
+
+static void LoadImageFunctions(const UInt64 baseAddr, std::vector<ImageFunction>& functions)
+{
+    // ------------------------------------------------------------------------
+    // Build the function index from the exception table: one entry per
+    // RUNTIME_FUNCTION, sorted by start address, with the entry point of the
+    // function each belongs to. Leave 'functions' empty if there's no table.
+    // ------------------------------------------------------------------------
+    functions.clear();
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr || pNtHdr->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_EXCEPTION) return;
+
+    const IMAGE_DATA_DIRECTORY& dir = pNtHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+    const UInt32 sizeOfImage = pNtHdr->OptionalHeader.SizeOfImage;
+    if (!dir.VirtualAddress || dir.VirtualAddress >= sizeOfImage || dir.Size > sizeOfImage - dir.VirtualAddress) {
+        return;
+    }
+
+    const RUNTIME_FUNCTION* begin = reinterpret_cast<const RUNTIME_FUNCTION*>(baseAddr + dir.VirtualAddress);
+    const RUNTIME_FUNCTION* end = begin + dir.Size / sizeof(RUNTIME_FUNCTION);
+    functions.reserve(end - begin);
+    for (const RUNTIME_FUNCTION* f = begin; f < end; ++f)
+    {
+        if (f->BeginAddress >= f->EndAddress || f->EndAddress > sizeOfImage) continue;
+        functions.push_back({ f->BeginAddress, f->EndAddress, f->UnwindInfoAddress,
+                              GetFunctionEntryRva(baseAddr, sizeOfImage, *f) });
+    }
+
+    // The table should be sorted by BeginAddress already, but a lookup in
+    // an unsorted one would silently go wrong.
+    auto byBegin = [](const ImageFunction& a, const ImageFunction& b) { return a.begin < b.begin; };
+    if (!std::is_sorted(functions.begin(), functions.end(), byBegin)) {
+        std::sort(functions.begin(), functions.end(), byBegin);
+    }
+}
+
+static UInt32 GetFunctionEntryRva(const UInt64 baseAddr, const UInt32 sizeOfImage, const RUNTIME_FUNCTION& func)
+{
+    // ------------------------------------------------------------------------
+    // Follow a fragment's chain of RUNTIME_FUNCTIONs back to the function
+    // it's part of, and return that's BeginAddress. The chain is either in
+    // the UNWIND_INFO (kUnwindFlag_ChainInfo), or, if the UnwindInfoAddress
+    // is odd, the UnwindInfoAddress is that of the RUNTIME_FUNCTION itself.
+    // ------------------------------------------------------------------------
+    const UInt32 MAX_CHAIN = 32;
+    const RUNTIME_FUNCTION* f = &func;
+    for (UInt32 depth = 0; depth < MAX_CHAIN; ++depth)
+    {
+        UInt64 next;
+        const UInt32 unwind = f->UnwindInfoAddress;
+        if (unwind & 1) {
+            next = unwind & ~(UInt32)1;
+        }
+        else
+        {
+            if (unwind >= sizeOfImage || sizeOfImage - unwind < sizeof(ImageUnwindInfo)) break;
+            const ImageUnwindInfo* info = reinterpret_cast<const ImageUnwindInfo*>(baseAddr + unwind);
+            if (!((info->versionAndFlags >> 3) & kUnwindFlag_ChainInfo)) break;
+            next = (UInt64)unwind + sizeof(ImageUnwindInfo) + ((info->countOfCodes + 1) & ~1) * sizeof(UInt16);
+        }
+        if (next + sizeof(RUNTIME_FUNCTION) > sizeOfImage) break;
+        f = reinterpret_cast<const RUNTIME_FUNCTION*>(baseAddr + next);
+    }
+    return f->BeginAddress;
+}
@@ -0,0 +1,180 @@
+// ============================================================================
+// dump_rtti/PEImage.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "PointerScan.h"
+
+// ============================================================================
+//                  Helpers for walking a loaded PE32+ image.
+// ----------------------------------------------------------------------------
+// 'baseAddr' is always the address at which the image's headers are mapped,
+// i.e. the HMODULE in the game, or the reservation made by the offline driver.
+// See https://learn.microsoft.com/en-us/windows/win32/debug/pe-format
+// ============================================================================
+// A half-open range of absolute addresses, [begin, end).
+struct ImageRange
+{
+    UInt64        begin;
+    UInt64        end;
+
+    bool Contains(const UInt64 addr) const { return begin <= addr && addr < end; }
+
+    // TRUE if all 'size' bytes at 'addr' are in the range.
+    bool Contains(const UInt64 addr, const UInt64 size) const
+    {
+        return begin <= addr && addr <= end && size <= end - addr;
+    }
+};
+
+// One entry of the function index built from the exception table (.pdata).
+// Only functions that aren't leaf functions have one: a leaf function doesn't
+// touch the stack, so it needs no unwind info. A function the compiler has
+// split up (e.g. moving its cold paths out of line) has one entry per
+// fragment, each but the first chained to the function's.
+struct ImageFunction
+{
+    UInt32        begin;               // 00: RVA of the fragment's first byte
+    UInt32        end;                 // 04: RVA just past its last byte
+    UInt32        unwindInfo;          // 08: RVA of its UNWIND_INFO
+    UInt32        entry;               // 0C: RVA of the function's entry point; 'begin' unless it's a chained fragment
+};
+
+// The fixed part of an UNWIND_INFO (in .xdata). It's followed by CountOfCodes
+// 16-bit unwind codes, padded to an even number of them, and then, if its
+// flags include kUnwindFlag_ChainInfo, by the RUNTIME_FUNCTION of the
+// fragment it's chained to.
+// See https://learn.microsoft.com/en-us/cpp/build/exception-handling-x64
+struct ImageUnwindInfo
+{
+    UInt8         versionAndFlags;     // 00: Version:3, Flags:5
+    UInt8         sizeOfProlog;        // 01
+    UInt8         countOfCodes;        // 02
+    UInt8         frameRegister;       // 03: FrameRegister:4, FrameOffset:4
+};
+
+enum ImageUnwindFlags
+{
+    kUnwindFlag_ExceptionHandler = 0x01,
+    kUnwindFlag_TerminationHandler = 0x02,
+    kUnwindFlag_ChainInfo = 0x04,
+};
+
+// Everything the RTTI scanner needs to know about the image. These used to be
+// hardcoded offsets for Skyrim 1.6.659 (GOG); they're now read from the PE
+// headers, so the scanner works with any build of the game.
+//
+// N.B. 'rdata' and 'data' cover only the initialised part of each section
+// (min(VirtualSize, SizeOfRawData)). The rest is zero-fill, so it can't hold
+// RTTI, and for .data that's most of the section.
+struct ImageLayout
+{
+    UInt64        baseAddr;            // address at which the image is mapped
+    UInt32        sizeOfImage;         // from the optional header
+    UInt32        timeDateStamp;       // from the file header
+    ImageRange    text;                // .text: VFT entries must point in here
+    ImageRange    rdata;               // .rdata: COLs, class hierarchies and VFTs
+    ImageRange    data;                // .data: TypeDescriptors
+    UInt64        typeInfoVtbl;        // type_info::`vftable'
+    UInt64        pureCall;            // _purecall, or 0 if it couldn't be identified
+    std::vector<UInt32> pointerSlots;  // sorted RVAs of the DIR64 relocations (empty if none)
+    std::vector<ImageFunction> functions;  // from .pdata, sorted by 'begin' (empty if there's none)
+};
+
+// LoadPointerSlotChunk reads the base relocation table about this much at a
+// time (a block is a 4 KB page's relocations, so it's usually a few hundred
+// blocks).
+const UInt32 RELOC_CHUNK_SIZE     = 0x4000;      // 16 KB
+
+// public:
+const IMAGE_NT_HEADERS* GetNtHeaders(const UInt64 baseAddr);
+
+bool GetImageSections(const UInt64 baseAddr, ImageLayout& layout);
+
+bool GetImageLayout(const UInt64 baseAddr, ImageLayout& layout);
+
+bool LoadPointerSlotChunk(const UInt64 baseAddr, std::vector<UInt32>& slots, UInt32& next);
+
+UInt64 FindTypeInfoVtbl(const ImageLayout& layout, const ImageRange& range);
+
+void CountCodeRefs(const ImageLayout& layout, const ImageRange& range, std::unordered_map<UInt64, UInt32>& refs);
+
+UInt64 FindPureCall(const ImageLayout& layout, const std::unordered_map<UInt64, UInt32>& refs);
+
+void PrintModuleSummary(const char* fileName, const UInt64 baseAddr);
+
+void PrintImageLayout(const ImageLayout& layout);
+
+UInt64* FindImportSlot(const UInt64 baseAddr, const char* dllName, const char* funcName);
+
+const ImageFunction* FindImageFunction(const ImageLayout& layout, const UInt64 addr);
+
+bool IsFunctionEntry(const ImageLayout& layout, const UInt64 addr);
+
+UInt64 GetFunctionLimit(const ImageLayout& layout, const UInt64 addr);
+
+// ============================================================================
+//   Call fn(UInt64* slot) for each 8-byte aligned slot in 'range' that holds
+//   an absolute address in [lo, hi), in ascending address order.
+// ----------------------------------------------------------------------------
+// Every absolute address in a relocatable image - including each VFT's meta
+// field and each TypeDescriptor's pVFTable - has a DIR64 entry in the base
+// relocation table, so we only need to visit those slots. That's a small
+// fraction of the section, and none of the slots holding ordinary data that
+// just happens to look like an address. If the image has no relocations we
+// fall back to a vectorised scan of every slot.
+// ============================================================================
+template <typename Fn>
+void ForEachPointerSlot(const ImageLayout& layout, const ImageRange& range, const UInt64 lo, const UInt64 hi,
+                        Fn fn)
+{
+    if (layout.pointerSlots.empty()) {
+        std::vector<const UInt64*> hits;
+        FindInRange64(reinterpret_cast<const UInt64*>(range.begin),
+                      reinterpret_cast<const UInt64*>(range.begin + ((range.end - range.begin) & ~(UInt64)7)),
+                      lo, hi, hits);
+        for (const UInt64* p : hits) {
+            fn(const_cast<UInt64*>(p));
+        }
+        return;
+    }
+
+    const UInt32 begin = (UInt32)(range.begin - layout.baseAddr);
+    const UInt32 end = (UInt32)(range.end - layout.baseAddr);
+    auto it = std::lower_bound(layout.pointerSlots.begin(), layout.pointerSlots.end(), begin);
+    for (; it != layout.pointerSlots.end() && *it < end; ++it) {
+        if ((*it & 7) || end - *it < 8) continue;
+        UInt64* p = reinterpret_cast<UInt64*>(layout.baseAddr + *it);
+        if (lo <= *p && *p < hi) {
+            fn(p);
+        }
+    }
+}
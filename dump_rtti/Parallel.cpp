@@ -0,0 +1,154 @@
+// ============================================================================
+// dump_rtti/Parallel.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "Parallel.h"
+
+// ============================================================================
+//                            The worker pool.
+// ----------------------------------------------------------------------------
+// One job runs at a time. The thread that starts it posts it to the pool,
+// asking for up to numThreads - 1 helpers, works on it too, and then waits
+// for any helpers still working to finish. A helper that wakes after the job
+// has been closed to helpers just goes back to sleep.
+//
+// A ParallelFor started while another is running (from a task, or from
+// another thread) runs on the thread that started it, without the pool, so
+// it can never wait on itself.
+//
+// The pool is never destroyed: its threads are detached and sleep until the
+// process exits. (Joining them at exit would hang the plugin, whose static
+// destructors run while the loader lock is held.)
+// ============================================================================
+struct WorkerPool
+{
+    std::mutex    jobLock;             // held by the thread running a job
+    std::mutex    lock;                // guards everything below
+    std::condition_variable wake;      // a job wants helpers
+    std::condition_variable idle;      // the last helper has finished
+    unsigned      numWorkers;
+    unsigned      seats;               // helpers the job still wants
+    unsigned      busy;                // helpers working on the job
+    ParallelTaskFn task;
+    void*         ctx;
+    std::size_t   count;
+    std::atomic<std::size_t> next;     // the next item to hand out
+};
+
+static thread_local bool s_inParallelFor = false;    // a pool thread, or running a job
+
+static WorkerPool& GetWorkerPool()
+{
+    static WorkerPool* s_pool = new WorkerPool();
+    return *s_pool;
+}
+
+static void RunWorker(WorkerPool* pool)
+{
+    s_inParallelFor = true;
+    std::unique_lock<std::mutex> lock(pool->lock);
+    for (;;)
+    {
+        pool->wake.wait(lock, [&]() { return pool->seats > 0; });
+        pool->seats--;
+        pool->busy++;
+        const ParallelTaskFn task = pool->task;
+        void* ctx = pool->ctx;
+        const std::size_t count = pool->count;
+        lock.unlock();
+
+        for (std::size_t i = pool->next++; i < count; i = pool->next++) task(ctx, i);
+
+        lock.lock();
+        if (--pool->busy == 0) pool->idle.notify_all();
+    }
+}
+
+unsigned GetDefaultThreadCount()
+{
+    // N.B. hardware_concurrency() may return 0 if it can't tell.
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// ============================================================================
+//   Split 'range' into chunks of SCAN_CHUNK_SIZE bytes. All chunk boundaries
+//   except the range's own begin and end are page-aligned.
+// ============================================================================
+void SplitRange(const ImageRange& range, std::vector<ImageRange>& chunks)
+{
+    chunks.clear();
+    UInt64 begin = range.begin;
+    while (begin < range.end)
+    {
+        UInt64 end = (begin & ~(UInt64)0xFFF) + SCAN_CHUNK_SIZE;
+        if (end > range.end) end = range.end;
+        chunks.push_back({ begin, end });
+        begin = end;
+    }
+}
+
+// ============================================================================
+//   Call task(ctx, i) for each i in [0, count) on up to 'numThreads' threads
+//   (0 means one per core), including the calling thread. See ParallelFor.
+// ============================================================================
+void RunParallelTasks(const std::size_t count, unsigned numThreads, ParallelTaskFn task, void* ctx)
+{
+    if (numThreads == 0) numThreads = GetDefaultThreadCount();
+    if (numThreads > count) numThreads = (unsigned)count;
+
+    WorkerPool& pool = GetWorkerPool();
+    std::unique_lock<std::mutex> job(pool.jobLock, std::defer_lock);
+    if (numThreads <= 1 || s_inParallelFor || !job.try_lock()) {
+        for (std::size_t i = 0; i < count; ++i) task(ctx, i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.lock);
+        for (; pool.numWorkers < numThreads - 1; ++pool.numWorkers) {
+            std::thread(RunWorker, &pool).detach();
+        }
+        pool.task = task;
+        pool.ctx = ctx;
+        pool.count = count;
+        pool.next = 0;
+        pool.seats = numThreads - 1;
+    }
+    pool.wake.notify_all();
+
+    s_inParallelFor = true;
+    for (std::size_t i = pool.next++; i < count; i = pool.next++) task(ctx, i);
+    s_inParallelFor = false;
+
+    std::unique_lock<std::mutex> lock(pool.lock);
+    pool.seats = 0;
+    pool.idle.wait(lock, [&]() { return pool.busy == 0; });
+}
@@ -0,0 +1,68 @@
+// ============================================================================
+// dump_rtti/Parallel.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "PEImage.h"
+
+// ============================================================================
+//                        Parallel section scanning.
+// ----------------------------------------------------------------------------
+// The scanners split a section into page-aligned chunks and scan the chunks
+// on a handful of threads. Each chunk writes its results to its own buffer,
+// and the buffers are merged in chunk (i.e. address) order afterwards, so the
+// result is exactly what a single-threaded scan would have produced, whatever
+// the number of threads.
+//
+// The threads belong to a pool that's started by the first ParallelFor and
+// kept for the life of the process, so the scan passes, the decompiler and
+// each of PrintVirtuals' batches don't each pay for starting threads.
+// ============================================================================
+const UInt64 SCAN_CHUNK_SIZE      = 0x40000;     // 256 KB (64 pages)
+
+// Runs item 'i' of a job; 'ctx' is whatever the job was started with.
+typedef void (*ParallelTaskFn)(void* ctx, const std::size_t i);
+
+// public:
+unsigned GetDefaultThreadCount();
+
+void SplitRange(const ImageRange& range, std::vector<ImageRange>& chunks);
+
+void RunParallelTasks(const std::size_t count, unsigned numThreads, ParallelTaskFn task, void* ctx);
+
+// ----------------------------------------------------------------------------
+// Call fn(i) for each i in [0, count) on up to 'numThreads' threads (0 means
+// one per core), including the calling thread. Indices are handed out in
+// ascending order, but may complete in any order.
+// ----------------------------------------------------------------------------
+template <typename Fn>
+void ParallelFor(const std::size_t count, unsigned numThreads, Fn fn)
+{
+    RunParallelTasks(count, numThreads, [](void* ctx, const std::size_t i) { (*static_cast<Fn*>(ctx))(i); }, &fn);
+}
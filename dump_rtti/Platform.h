@@ -0,0 +1,313 @@
+// ============================================================================
+// dump_rtti/Platform.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+// ============================================================================
+//                          Platform support.
+// ----------------------------------------------------------------------------
+// The RTTI code is shared by two builds:
+//   1. the SKSE plugin (dump_rtti), which runs inside the game on Windows and
+//      gets its types and logging from xSE's "common" library; and
+//   2. the standalone offline analyser (dump_rtti_offline), which loads
+//      SkyrimSE.exe from disk and can be built on Linux. That build defines
+//      SKYRETK_OFFLINE and supplies its own _MESSAGE / _ERROR.
+// Everything that differs between those builds, or between Windows and other
+// platforms, lives here.
+// ============================================================================
+#include <cstddef>
+#include <cstring>
+
+#ifdef SKYRETK_OFFLINE
+#include <cstdint>
+
+typedef std::uint8_t      UInt8;
+typedef std::uint16_t     UInt16;
+typedef std::uint32_t     UInt32;
+typedef std::uint64_t     UInt64;
+typedef std::int8_t       SInt8;
+typedef std::int16_t      SInt16;
+typedef std::int32_t      SInt32;
+typedef std::int64_t      SInt64;
+
+// Implemented by the offline driver. Same semantics as xSE's IDebugLog
+// helpers: printf-style formatting, one line per call.
+void _MESSAGE(const char* fmt, ...);
+void _ERROR(const char* fmt, ...);
+#else
+#include "common/ITypes.h"
+#include "common/IDebugLog.h"
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// ----------------------------------------------------------------------------
+// The subset of <winnt.h> that we need to walk a PE32+ image.
+// See https://learn.microsoft.com/en-us/windows/win32/debug/pe-format
+// ----------------------------------------------------------------------------
+#define IMAGE_DOS_SIGNATURE                  0x5A4D      // MZ
+#define IMAGE_NT_SIGNATURE                   0x00004550  // PE00
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC        0x20B
+
+#define IMAGE_FILE_MACHINE_I386              0x014C
+#define IMAGE_FILE_MACHINE_IA64              0x0200
+#define IMAGE_FILE_MACHINE_AMD64             0x8664
+
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES     16
+#define IMAGE_SIZEOF_SHORT_NAME              8
+
+#define IMAGE_DIRECTORY_ENTRY_IMPORT         1
+#define IMAGE_DIRECTORY_ENTRY_EXCEPTION      3
+#define IMAGE_DIRECTORY_ENTRY_BASERELOC      5
+
+#define IMAGE_REL_BASED_ABSOLUTE             0
+#define IMAGE_REL_BASED_DIR64                10
+
+#define IMAGE_ORDINAL_FLAG64                 0x8000000000000000ULL
+
+#pragma pack(push, 4)
+struct IMAGE_DOS_HEADER
+{
+    UInt16        e_magic;
+    UInt16        e_cblp;
+    UInt16        e_cp;
+    UInt16        e_crlc;
+    UInt16        e_cparhdr;
+    UInt16        e_minalloc;
+    UInt16        e_maxalloc;
+    UInt16        e_ss;
+    UInt16        e_sp;
+    UInt16        e_csum;
+    UInt16        e_ip;
+    UInt16        e_cs;
+    UInt16        e_lfarlc;
+    UInt16        e_ovno;
+    UInt16        e_res[4];
+    UInt16        e_oemid;
+    UInt16        e_oeminfo;
+    UInt16        e_res2[10];
+    SInt32        e_lfanew;            // 3C: file offset of the IMAGE_NT_HEADERS
+};
+
+struct IMAGE_FILE_HEADER
+{
+    UInt16        Machine;
+    UInt16        NumberOfSections;
+    UInt32        TimeDateStamp;
+    UInt32        PointerToSymbolTable;
+    UInt32        NumberOfSymbols;
+    UInt16        SizeOfOptionalHeader;
+    UInt16        Characteristics;
+};
+
+struct IMAGE_DATA_DIRECTORY
+{
+    UInt32        VirtualAddress;
+    UInt32        Size;
+};
+
+struct IMAGE_OPTIONAL_HEADER64
+{
+    UInt16        Magic;
+    UInt8         MajorLinkerVersion;
+    UInt8         MinorLinkerVersion;
+    UInt32        SizeOfCode;
+    UInt32        SizeOfInitializedData;
+    UInt32        SizeOfUninitializedData;
+    UInt32        AddressOfEntryPoint;
+    UInt32        BaseOfCode;
+    UInt64        ImageBase;
+    UInt32        SectionAlignment;
+    UInt32        FileAlignment;
+    UInt16        MajorOperatingSystemVersion;
+    UInt16        MinorOperatingSystemVersion;
+    UInt16        MajorImageVersion;
+    UInt16        MinorImageVersion;
+    UInt16        MajorSubsystemVersion;
+    UInt16        MinorSubsystemVersion;
+    UInt32        Win32VersionValue;
+    UInt32        SizeOfImage;
+    UInt32        SizeOfHeaders;
+    UInt32        CheckSum;
+    UInt16        Subsystem;
+    UInt16        DllCharacteristics;
+    UInt64        SizeOfStackReserve;
+    UInt64        SizeOfStackCommit;
+    UInt64        SizeOfHeapReserve;
+    UInt64        SizeOfHeapCommit;
+    UInt32        LoaderFlags;
+    UInt32        NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+};
+
+struct IMAGE_NT_HEADERS64
+{
+    UInt32        Signature;
+    IMAGE_FILE_HEADER FileHeader;
+    IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+};
+typedef IMAGE_NT_HEADERS64 IMAGE_NT_HEADERS;
+
+struct IMAGE_SECTION_HEADER
+{
+    UInt8         Name[IMAGE_SIZEOF_SHORT_NAME];
+    union {
+        UInt32    PhysicalAddress;
+        UInt32    VirtualSize;
+    } Misc;
+    UInt32        VirtualAddress;
+    UInt32        SizeOfRawData;
+    UInt32        PointerToRawData;
+    UInt32        PointerToRelocations;
+    UInt32        PointerToLinenumbers;
+    UInt16        NumberOfRelocations;
+    UInt16        NumberOfLinenumbers;
+    UInt32        Characteristics;
+};
+
+struct IMAGE_BASE_RELOCATION
+{
+    UInt32        VirtualAddress;
+    UInt32        SizeOfBlock;
+    // followed by (SizeOfBlock - 8) / 2 16-bit entries: type:4, offset:12.
+};
+
+// One entry of the import directory per imported DLL, terminated by a zeroed
+// entry. Both thunk arrays are arrays of UInt64, terminated by 0: the import
+// lookup table (OriginalFirstThunk) holds the OFFSET of an IMAGE_IMPORT_BY_NAME
+// or an ordinal, and the loader replaces each entry of the import address
+// table (FirstThunk) with the address of the function.
+struct IMAGE_IMPORT_DESCRIPTOR
+{
+    union {
+        UInt32    Characteristics;
+        UInt32    OriginalFirstThunk;
+    };
+    UInt32        TimeDateStamp;
+    UInt32        ForwarderChain;
+    UInt32        Name;                // OFFSET to the DLL's name
+    UInt32        FirstThunk;
+};
+
+struct IMAGE_IMPORT_BY_NAME
+{
+    UInt16        Hint;
+    char          Name[1];             // null-terminated
+};
+
+// One entry of the .pdata (exception) directory. Entries are sorted by
+// BeginAddress and don't overlap.
+struct IMAGE_RUNTIME_FUNCTION_ENTRY
+{
+    UInt32        BeginAddress;
+    UInt32        EndAddress;
+    UInt32        UnwindInfoAddress;
+};
+typedef IMAGE_RUNTIME_FUNCTION_ENTRY RUNTIME_FUNCTION;
+#pragma pack(pop)
+
+// ----------------------------------------------------------------------------
+// MSVC CRT functions used by the shared code.
+// ----------------------------------------------------------------------------
+template <std::size_t N>
+inline int sprintf_s(char (&buf)[N], const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int ret = vsnprintf(buf, N, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+inline int ctime_s(char* buf, std::size_t size, const time_t* t)
+{
+    // ctime_r needs at least 26 bytes.
+    if (size < 26 || !ctime_r(t, buf)) return 1;
+    return 0;
+}
+#endif
+
+// ============================================================================
+//   Copy 'len' bytes from 'src' to 'dst' without faulting if 'src' turns out
+//   to be unreadable. Returns FALSE (leaving 'dst' unspecified) in that case.
+// ----------------------------------------------------------------------------
+// The RTTI code frequently follows pointers that are only *probably* valid
+// (e.g. treating an arbitrary 32-bit immediate as a VFT). Inside the game we
+// use structured exception handling; elsewhere we let the kernel do the read
+// for us via process_vm_readv, which fails with EFAULT rather than raising
+// SIGSEGV.
+// ============================================================================
+inline bool SafeRead(const void* src, void* dst, std::size_t len)
+{
+#ifdef _MSC_VER
+    __try
+    {
+        memcpy(dst, src, len);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return false;
+    }
+#elif defined(_WIN32)
+    SIZE_T read = 0;
+    return ReadProcessMemory(GetCurrentProcess(), src, dst, len, &read) && read == len;
+#else
+    struct iovec local = { dst, len };
+    struct iovec remote = { const_cast<void*>(src), len };
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t)len;
+#endif
+}
+
+// ============================================================================
+//   Seconds of CPU time (user and kernel) used by the calling thread so far.
+// ----------------------------------------------------------------------------
+// N.B. on Windows this only advances in scheduler ticks (typically 15.6 ms),
+// so it's only meaningful summed over many short intervals, or for long ones.
+// ============================================================================
+inline double GetThreadCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0.0;
+    }
+    UInt64 kernel = ((UInt64)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    UInt64 user = ((UInt64)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+    return (double)(kernel + user) * 1e-7;    // 100 ns units
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.0;
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
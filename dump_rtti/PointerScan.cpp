@@ -0,0 +1,368 @@
+// ============================================================================
+// dump_rtti/PointerScan.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <atomic>
+
+#include "PointerScan.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define SKYRETK_SIMD_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets us use any intrinsic anywhere. GCC and Clang need to be told which
+// functions may use which instruction set extensions.
+#if defined(SKYRETK_SIMD_X64) && !defined(_MSC_VER)
+#define TARGET_SSE42    __attribute__((target("sse4.2")))
+#define TARGET_AVX2     __attribute__((target("avx2")))
+#else
+#define TARGET_SSE42
+#define TARGET_AVX2
+#endif
+
+// The vector kernels test every element against every needle, so beyond a
+// handful of needles a scalar loop is just as fast.
+const std::size_t MAX_SIMD_NEEDLES = 8;
+
+static std::atomic<int> s_simdLevel(-1);     // -1: use GetSupportedSimdLevel()
+
+// ============================================================================
+//                          CPU feature detection.
+// ============================================================================
+static SimdLevel DetectSimdLevel()
+{
+#if !defined(SKYRETK_SIMD_X64)
+    return kSimd_Scalar;
+#elif defined(_MSC_VER)
+    // CPUID.1:ECX bit 20 = SSE4.2, bit 27 = OSXSAVE, bit 28 = AVX;
+    // CPUID.7.0:EBX bit 5 = AVX2. AVX2 also needs the OS to save the YMM
+    // registers on a context switch (XCR0 bits 1 and 2).
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse42 = (info[2] & (1 << 20)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+    return avx2 ? kSimd_AVX2 : (sse42 ? kSimd_SSE42 : kSimd_Scalar);
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return kSimd_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return kSimd_SSE42;
+    return kSimd_Scalar;
+#endif
+}
+
+SimdLevel GetSupportedSimdLevel()
+{
+    static const SimdLevel s_supported = DetectSimdLevel();
+    return s_supported;
+}
+
+SimdLevel GetSimdLevel()
+{
+    int level = s_simdLevel.load();
+    return (level < 0) ? GetSupportedSimdLevel() : (SimdLevel)level;
+}
+
+void SetSimdLevel(const SimdLevel level)
+{
+    // N.B. we never use an instruction set the CPU doesn't have.
+    s_simdLevel = (level < GetSupportedSimdLevel()) ? level : GetSupportedSimdLevel();
+}
+
+const char* GetSimdLevelName(const SimdLevel level)
+{
+    switch (level) {
+    case kSimd_AVX2:  return "AVX2";
+    case kSimd_SSE42: return "SSE4.2";
+    default:          return "scalar";
+    }
+}
+
+// ============================================================================
+//                            Scalar kernels.
+// ----------------------------------------------------------------------------
+// These also finish off whatever the vector kernels leave over at the end.
+// ============================================================================
+template <typename T>
+static void FindAll_Scalar(const T* p, const T* end, const T* needles, const std::size_t numNeedles,
+                           std::vector<const T*>& hits)
+{
+    for (; p < end; ++p)
+    {
+        for (std::size_t k = 0; k < numNeedles; ++k)
+        {
+            if (*p == needles[k]) {
+                hits.push_back(p);
+                break;
+            }
+        }
+    }
+}
+
+static void FindInRange64_Scalar(const UInt64* p, const UInt64* end, const UInt64 lo, const UInt64 hi,
+                                 std::vector<const UInt64*>& hits)
+{
+    for (; p < end; ++p)
+    {
+        if (lo <= *p && *p < hi) {
+            hits.push_back(p);
+        }
+    }
+}
+
+static void FindRamp32_Scalar(const UInt32* p, const UInt32* end, UInt32 expected, const UInt32 step,
+                              std::vector<const UInt32*>& hits)
+{
+    for (; p < end; ++p, expected += step)
+    {
+        if (*p == expected) {
+            hits.push_back(p);
+        }
+    }
+}
+
+#ifdef SKYRETK_SIMD_X64
+static inline unsigned LowestSetBit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Append p + i for each set bit i of 'mask', lowest first.
+template <typename T>
+static inline void PushHits(const T* p, unsigned mask, std::vector<const T*>& hits)
+{
+    while (mask) {
+        hits.push_back(p + LowestSetBit(mask));
+        mask &= mask - 1;
+    }
+}
+
+// ============================================================================
+//                          SSE4.2 kernels (16 bytes).
+// ----------------------------------------------------------------------------
+// Each returns a pointer to the first element it didn't examine.
+// ============================================================================
+TARGET_SSE42 static const UInt64* FindAll64_SSE42(const UInt64* p, const UInt64* end,
+                                                  const UInt64* needles, const std::size_t numNeedles,
+                                                  std::vector<const UInt64*>& hits)
+{
+    __m128i vn[MAX_SIMD_NEEDLES];
+    for (std::size_t k = 0; k < numNeedles; ++k) vn[k] = _mm_set1_epi64x((long long)needles[k]);
+
+    for (; end - p >= 2; p += 2)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i m = _mm_cmpeq_epi64(v, vn[0]);
+        for (std::size_t k = 1; k < numNeedles; ++k) m = _mm_or_si128(m, _mm_cmpeq_epi64(v, vn[k]));
+        PushHits(p, (unsigned)_mm_movemask_pd(_mm_castsi128_pd(m)), hits);
+    }
+    return p;
+}
+
+TARGET_SSE42 static const UInt64* FindInRange64_SSE42(const UInt64* p, const UInt64* end,
+                                                      const UInt64 lo, const UInt64 hi,
+                                                      std::vector<const UInt64*>& hits)
+{
+    // lo <= v < hi  <=>  (v - lo) < (hi - lo), unsigned. There's no unsigned
+    // 64-bit compare, so flip the sign bits and use the signed one.
+    const __m128i sign = _mm_set1_epi64x((long long)0x8000000000000000ull);
+    const __m128i vlo = _mm_set1_epi64x((long long)lo);
+    const __m128i vlimit = _mm_xor_si128(_mm_set1_epi64x((long long)(hi - lo)), sign);
+
+    for (; end - p >= 2; p += 2)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i x = _mm_xor_si128(_mm_sub_epi64(v, vlo), sign);
+        __m128i m = _mm_cmpgt_epi64(vlimit, x);
+        PushHits(p, (unsigned)_mm_movemask_pd(_mm_castsi128_pd(m)), hits);
+    }
+    return p;
+}
+
+TARGET_SSE42 static const UInt32* FindRamp32_SSE42(const UInt32* p, const UInt32* end,
+                                                   const UInt32 first, const UInt32 step,
+                                                   std::vector<const UInt32*>& hits)
+{
+    __m128i expected = _mm_setr_epi32((int)first, (int)(first + step),
+                                      (int)(first + 2 * step), (int)(first + 3 * step));
+    const __m128i inc = _mm_set1_epi32((int)(4 * step));
+
+    for (; end - p >= 4; p += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i m = _mm_cmpeq_epi32(v, expected);
+        PushHits(p, (unsigned)_mm_movemask_ps(_mm_castsi128_ps(m)), hits);
+        expected = _mm_add_epi32(expected, inc);
+    }
+    return p;
+}
+
+// ============================================================================
+//                           AVX2 kernels (32 bytes).
+// ----------------------------------------------------------------------------
+// These look at two vectors per iteration, and only extract hits when either
+// of them matched anything, which keeps the loop branch-predictable.
+// ============================================================================
+TARGET_AVX2 static const UInt64* FindAll64_AVX2(const UInt64* p, const UInt64* end,
+                                                const UInt64* needles, const std::size_t numNeedles,
+                                                std::vector<const UInt64*>& hits)
+{
+    __m256i vn[MAX_SIMD_NEEDLES];
+    for (std::size_t k = 0; k < numNeedles; ++k) vn[k] = _mm256_set1_epi64x((long long)needles[k]);
+
+    for (; end - p >= 8; p += 8)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 4));
+        __m256i m0 = _mm256_cmpeq_epi64(v0, vn[0]);
+        __m256i m1 = _mm256_cmpeq_epi64(v1, vn[0]);
+        for (std::size_t k = 1; k < numNeedles; ++k) {
+            m0 = _mm256_or_si256(m0, _mm256_cmpeq_epi64(v0, vn[k]));
+            m1 = _mm256_or_si256(m1, _mm256_cmpeq_epi64(v1, vn[k]));
+        }
+        __m256i any = _mm256_or_si256(m0, m1);
+        if (_mm256_testz_si256(any, any)) continue;
+        PushHits(p, (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m0)), hits);
+        PushHits(p + 4, (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m1)), hits);
+    }
+    return p;
+}
+
+TARGET_AVX2 static const UInt64* FindInRange64_AVX2(const UInt64* p, const UInt64* end,
+                                                    const UInt64 lo, const UInt64 hi,
+                                                    std::vector<const UInt64*>& hits)
+{
+    // See FindInRange64_SSE42.
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    const __m256i vlo = _mm256_set1_epi64x((long long)lo);
+    const __m256i vlimit = _mm256_xor_si256(_mm256_set1_epi64x((long long)(hi - lo)), sign);
+
+    for (; end - p >= 8; p += 8)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 4));
+        __m256i m0 = _mm256_cmpgt_epi64(vlimit, _mm256_xor_si256(_mm256_sub_epi64(v0, vlo), sign));
+        __m256i m1 = _mm256_cmpgt_epi64(vlimit, _mm256_xor_si256(_mm256_sub_epi64(v1, vlo), sign));
+        __m256i any = _mm256_or_si256(m0, m1);
+        if (_mm256_testz_si256(any, any)) continue;
+        PushHits(p, (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m0)), hits);
+        PushHits(p + 4, (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m1)), hits);
+    }
+    return p;
+}
+
+TARGET_AVX2 static const UInt32* FindRamp32_AVX2(const UInt32* p, const UInt32* end,
+                                                 const UInt32 first, const UInt32 step,
+                                                 std::vector<const UInt32*>& hits)
+{
+    __m256i expected0 = _mm256_add_epi32(_mm256_set1_epi32((int)first),
+                                         _mm256_mullo_epi32(_mm256_set1_epi32((int)step),
+                                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    __m256i expected1 = _mm256_add_epi32(expected0, _mm256_set1_epi32((int)(8 * step)));
+    const __m256i inc = _mm256_set1_epi32((int)(16 * step));
+
+    for (; end - p >= 16; p += 16)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 8));
+        __m256i m0 = _mm256_cmpeq_epi32(v0, expected0);
+        __m256i m1 = _mm256_cmpeq_epi32(v1, expected1);
+        expected0 = _mm256_add_epi32(expected0, inc);
+        expected1 = _mm256_add_epi32(expected1, inc);
+        __m256i any = _mm256_or_si256(m0, m1);
+        if (_mm256_testz_si256(any, any)) continue;
+        PushHits(p, (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(m0)), hits);
+        PushHits(p + 8, (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(m1)), hits);
+    }
+    return p;
+}
+#endif
+
+// ============================================================================
+//                               Dispatch.
+// ============================================================================
+void FindAll64(const UInt64* begin, const UInt64* end, const UInt64* needles, const std::size_t numNeedles,
+               std::vector<const UInt64*>& hits)
+{
+    const UInt64* p = begin;
+    if (numNeedles == 0) return;
+#ifdef SKYRETK_SIMD_X64
+    if (numNeedles <= MAX_SIMD_NEEDLES)
+    {
+        switch (GetSimdLevel()) {
+        case kSimd_AVX2:  p = FindAll64_AVX2(p, end, needles, numNeedles, hits); break;
+        case kSimd_SSE42: p = FindAll64_SSE42(p, end, needles, numNeedles, hits); break;
+        default: break;
+        }
+    }
+#endif
+    FindAll_Scalar(p, end, needles, numNeedles, hits);
+}
+
+void FindInRange64(const UInt64* begin, const UInt64* end, const UInt64 lo, const UInt64 hi,
+                   std::vector<const UInt64*>& hits)
+{
+    const UInt64* p = begin;
+    if (hi <= lo) return;
+#ifdef SKYRETK_SIMD_X64
+    switch (GetSimdLevel()) {
+    case kSimd_AVX2:  p = FindInRange64_AVX2(p, end, lo, hi, hits); break;
+    case kSimd_SSE42: p = FindInRange64_SSE42(p, end, lo, hi, hits); break;
+    default: break;
+    }
+#endif
+    FindInRange64_Scalar(p, end, lo, hi, hits);
+}
+
+void FindRamp32(const UInt32* begin, const UInt32* end, const UInt32 first, const UInt32 step,
+                std::vector<const UInt32*>& hits)
+{
+    const UInt32* p = begin;
+#ifdef SKYRETK_SIMD_X64
+    switch (GetSimdLevel()) {
+    case kSimd_AVX2:  p = FindRamp32_AVX2(p, end, first, step, hits); break;
+    case kSimd_SSE42: p = FindRamp32_SSE42(p, end, first, step, hits); break;
+    default: break;
+    }
+#endif
+    FindRamp32_Scalar(p, end, first + (UInt32)(p - begin) * step, step, hits);
+}
@@ -0,0 +1,73 @@
+// ============================================================================
+// dump_rtti/PointerScan.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <vector>
+
+#include "Platform.h"
+
+// ============================================================================
+//                     Vectorised "find value" kernels.
+// ----------------------------------------------------------------------------
+// The RTTI scans spend almost all their time comparing every element of a
+// multi-megabyte section against one or two values, which is limited by
+// memory bandwidth rather than by the comparisons. These kernels do the
+// comparisons 16 (SSE4.2) or 32 (AVX2) bytes at a time and only drop
+// back to scalar code for the hits and the tail.
+//
+// The instruction set is chosen at runtime from what the CPU supports; builds
+// for anything other than x86-64 only have the scalar versions. Every kernel
+// appends matches to 'hits' in ascending address order.
+// ============================================================================
+enum SimdLevel
+{
+    kSimd_Scalar = 0,
+    kSimd_SSE42,
+    kSimd_AVX2,
+};
+
+// public:
+SimdLevel GetSimdLevel();
+
+SimdLevel GetSupportedSimdLevel();
+
+void SetSimdLevel(const SimdLevel level);
+
+const char* GetSimdLevelName(const SimdLevel level);
+
+// Elements equal to any of the 'numNeedles' needles.
+void FindAll64(const UInt64* begin, const UInt64* end, const UInt64* needles, const std::size_t numNeedles,
+               std::vector<const UInt64*>& hits);
+
+// Elements in the half-open range [lo, hi).
+void FindInRange64(const UInt64* begin, const UInt64* end, const UInt64 lo, const UInt64 hi,
+                   std::vector<const UInt64*>& hits);
+
+// Elements equal to the arithmetic sequence first, first + step, ... i.e.
+// begin[i] == first + i * step. E.g. fields that hold their own RVA.
+void FindRamp32(const UInt32* begin, const UInt32* end, const UInt32 first, const UInt32 step,
+                std::vector<const UInt32*>& hits);
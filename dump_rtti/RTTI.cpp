@@ -25,293 +25,854 @@
 // 
 // (The MIT License)
 // ============================================================================
-#pragma comment(lib, "Dbghelp.lib")
-
-#include <dbghelp.h>
 #include <vector>
-#include <sstream>
-#include <shlobj.h>
-#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <typeinfo>
 
+#include "Parallel.h"
 #include "RTTI.h"
+#include "Undecorate.h"
+
+static void GetTypeName(const TypeDescriptor* type, const ImageLayout& layout, const RTTIDatabase* db,
+                        std::string& name);
+
+static void LogTypeName(LogWriter& out, const TypeDescriptor* type, const ImageLayout& layout,
+                        const RTTIDatabase* db, std::string& buf);
+
+static const TypeDescriptor* GetTypeDescriptor(const UInt64* vtbl, const ImageLayout& layout);
+
+static bool GetTypeHierarchyInfo(const UInt64* vtbl, const TypeDescriptor*& type, UInt32& offset,
+                                 const RTTIClassHierarchyDescriptor*& hierarchy, UInt32& numBaseClasses,
+                                 const ImageLayout& layout);
+
+static void SimpleFunctionDecompiler(const UInt64 funcAddr, std::string& retOut, std::string& paramsOut,
+                                     std::string& bodyOut, const ImageLayout& layout, const RTTIDatabase& db);
+
+static bool GetThisAdjustment(const UInt8* code, const X64Instruction& insn, SInt32& delta);
+
+static BytePatternSet CompileFuncIdioms(const FuncIdiom* idioms, const UInt32 numIdioms);
+
+static bool FormatFuncIdiom(const FuncIdiom& idiom, const SInt64* captures, const ImageLayout& layout,
+                            const RTTIDatabase& db, std::string& ret, std::string& body);
+
+static void MergeSortedFuncs(std::vector<UInt32>& funcs, const std::size_t sorted);
 
 // ============================================================================
-//   A. Scan for, and save, the addresses of all RTTI type descriptors and 
+//   A. Scan for, and save, the addresses of all RTTI type descriptors and
 //      their associated virtual function tables.
+// ----------------------------------------------------------------------------
+// Each section is walked exactly once. Every pass builds a hash index which
+// the next pass consults, and the indexes are then joined to produce the
+// RTTI database (see RTTIDatabase.h). (The original implementation rescanned all
+// of .RDATA for every TypeDescriptor, and then again for every COL; that's
+// tens of billions of loads for 1.6.659.)
+//
+// Each pass is split into page-aligned chunks which are scanned on
+// 'numThreads' threads (0 means one per core). Every chunk collects its
+// hits in its own buffer, and the buffers are merged in address order, so
+// the result doesn't depend on the number of threads.
+//
+// The passes are also exposed one chunk at a time (ScanVtblChunk and
+// MergeVtblChunk, then JoinVTables, then FinishRTTIDatabase's pieces), so
+// that the scan can be spread over many short steps; see RTTIAnalysis.h.
 // ============================================================================
-void LoadVTables(const UInt64 baseAddr, std::map<UInt64, VtblList>& vtblMap)
-{
-    UInt64 textStart = baseAddr + TEXT_SEG_BEGIN;
-    UInt64 textEnd = baseAddr + TEXT_SEG_END;
-
-    UInt64 rdataStart = baseAddr + RDATA_SEG_BEGIN;
-    UInt64 rdataEnd = baseAddr + RDATA_SEG_END;
-    UInt64 vtblTypeInfo = baseAddr + TYPE_INFO_VTBL;
-
-    UInt64 dataStart = baseAddr + DATA_SEG_BEGIN;
-    UInt64 dataEnd = baseAddr + DATA_SEG_END;
-
-    // 1. Given the address of type_info's vftable, we can locate all of the object 
-    //    TypeDescriptors by scanning .DATA for 64-bit memory addresses containing 
-    //    that address.
-    // 
-    //    E.g. 0x41E9F968 is the address of the TypeDescriptor for BaseFormComponent.
-    //    It has:
-    //      -> 00: pVFTable    == 0x419752C0
-    //      -> 08: spare       == 0
-    //      -> 10: name        == ".?AVBaseFormComponent@@" (null-terminated).
-    //
-    //    N.B. For this example, we assume the module base address is 0x40000000.
-    for (UInt64 i = dataStart; i < dataEnd; i += 8)
+void LoadVTables(const ImageLayout& layout, RTTIDatabase& db, const unsigned numThreads)
+{
+    VtblScan scan;
+    std::vector<ImageRange> chunks;
+    for (int pass = 0; pass < kVtblPass_Count; ++pass)
     {
-        UInt64* p = reinterpret_cast<UInt64*>(i);
-        if (*p == vtblTypeInfo) {
+        SplitRange(GetVtblPassRange(layout, (VtblScanPass)pass), chunks);
+        std::vector<VtblChunkHits> hits(chunks.size());
+        ParallelFor(chunks.size(), numThreads, [&](std::size_t c) {
+            ScanVtblChunk(layout, scan, (VtblScanPass)pass, chunks[c], hits[c]);
+        });
+        for (const VtblChunkHits& h : hits) {
+            MergeVtblChunk(scan, (VtblScanPass)pass, h);
+        }
+    }
+    JoinVTables(layout, scan, db);
+    FinishRTTIDatabase(layout, db);
+}
+
+// ----------------------------------------------------------------------------
+// The section that each pass walks.
+// ----------------------------------------------------------------------------
+const ImageRange& GetVtblPassRange(const ImageLayout& layout, const VtblScanPass pass)
+{
+    return (pass == kVtblPass_TypeDescriptors) ? layout.data : layout.rdata;
+}
+
+// ----------------------------------------------------------------------------
+// Run one pass over one chunk of its section, collecting the hits in 'hits'.
+// Only reads 'scan', so chunks of the same pass can be scanned concurrently.
+// ----------------------------------------------------------------------------
+void ScanVtblChunk(const ImageLayout& layout, const VtblScan& scan, const VtblScanPass pass,
+                   const ImageRange& chunk, VtblChunkHits& hits)
+{
+    UInt64 baseAddr = layout.baseAddr;
+
+    UInt64 textStart = layout.text.begin;
+    UInt64 textEnd = layout.text.end;
+
+    UInt64 rdataEnd = layout.rdata.end;
+    UInt64 vtblTypeInfo = layout.typeInfoVtbl;
+
+    switch (pass)
+    {
+    case kVtblPass_TypeDescriptors:
+        // 1. Given the address of type_info's vftable, we can locate all of the object
+        //    TypeDescriptors by scanning .DATA for 64-bit memory addresses containing
+        //    that address. Index them by their OFFSET from the module base.
+        //    (pVFTable is an absolute address, so only relocated slots need checking.)
+        //
+        //    E.g. 0x41E9F968 is the address of the TypeDescriptor for BaseFormComponent.
+        //    It has:
+        //      -> 00: pVFTable    == 0x419752C0
+        //      -> 08: spare       == 0
+        //      -> 10: name        == ".?AVBaseFormComponent@@" (null-terminated).
+        //
+        //    N.B. For this example, we assume the module base address is 0x40000000.
+        ForEachPointerSlot(layout, chunk, vtblTypeInfo, vtblTypeInfo + 1, [&](UInt64* p) {
             // We have probably found a TypeDescriptor.
-            // 
-            // 2. Now find the RTTICompleteObjectLocator structure for this TypeDescriptor. 
-            //    On x64 platforms, we scan .RDATA for all 32-bit memory addresses containing 
-            //    the OFFSET of that TypeDescriptor from the module base. We assume such
-            //    addresses are the "pTypeDescriptor" field of an RTTICompleteObjectLocator.
-            // 
-            //    E.g. 0x41975F90 is the address of the RTTICompleteObjectLocator for 
-            //    BaseFormComponent. It has:
-            //      -> 00: signature          == 1 (COL_SIG_REV1)
-            //      -> 04: offset             == 0
-            //      -> 08: cdOffset           == 0
-            //      -> 0C: pTypeDescriptor    == 0x01E9F968
-            //      -> 10: pClassDescriptor   == 0x01975FB8
-            //      -> 14: pObjectBase        == 0x01975F90
-            UInt32 pTypeDescriptor = i - baseAddr;
-            for (UInt64 j = rdataStart; j < rdataEnd; j += 4)
+            const UInt32 rva = (UInt32)((UInt64)p - baseAddr);
+            if (IsTypeDescriptor(layout, rva)) {
+                hits.typeDescriptors.push_back(rva);
+            }
+        });
+        break;
+
+    case kVtblPass_COLs:
+    {
+        // 2. Now find the RTTICompleteObjectLocator structures for those TypeDescriptors.
+        //    On x64 platforms, each COL's pSelf field contains the COL's own OFFSET from
+        //    the module base, so a COL validates itself: we sweep .RDATA once, at the
+        //    COLs' 4-byte alignment, for structures whose signature is COL_SIG_REV1 and
+        //    whose pSelf matches their own OFFSET. We keep those whose pTypeDescriptor
+        //    is one of the TypeDescriptors found above, indexed by their OFFSET.
+        //
+        //    E.g. 0x41975F90 is the address of the RTTICompleteObjectLocator for
+        //    BaseFormComponent. It has:
+        //      -> 00: signature          == 1 (COL_SIG_REV1)
+        //      -> 04: offset             == 0
+        //      -> 08: cdOffset           == 0
+        //      -> 0C: pTypeDescriptor    == 0x01E9F968
+        //      -> 10: pClassDescriptor   == 0x01975FB8
+        //      -> 14: pSelf              == 0x01975F90
+        //
+        //    The COLs for each TypeDescriptor are kept in ascending address order,
+        //    which is the order in which the original nested scan visited them.
+        //
+        //    The pSelf test is the vectorised part: for the COL candidates at j, j+4,
+        //    j+8, ... the pSelf fields (at +0x14) should hold j, j+4, j+8, ... minus
+        //    the module base.
+        const UInt64 first = chunk.begin;
+        if (first + sizeof(RTTICompleteObjectLocator) > rdataEnd) break;
+        const UInt64 last = (std::min)(chunk.end, rdataEnd - sizeof(RTTICompleteObjectLocator) + 1);
+
+        std::vector<const UInt32*> selfHits;
+        const UInt32* pSelfs = reinterpret_cast<const UInt32*>(first + offsetof(RTTICompleteObjectLocator, pSelf));
+        FindRamp32(pSelfs, pSelfs + (last - first + 3) / 4, (UInt32)(first - baseAddr), 4, selfHits);
+
+        for (const UInt32* pSelf : selfHits)
+        {
+            RTTICompleteObjectLocator* col = reinterpret_cast<RTTICompleteObjectLocator*>(
+                (UInt64)pSelf - offsetof(RTTICompleteObjectLocator, pSelf));
+            if (col->signature != COL_SIG_REV1) continue;
+            if (col->cdOffset != 0) continue;
+            if (scan.typeDescriptors.find(col->pTypeDescriptor) == scan.typeDescriptors.end()) continue;
+
+            hits.cols.push_back(col);
+        }
+        break;
+    }
+
+    case kVtblPass_MetaFields:
+        // 3. Now find the meta fields. Scan .RDATA once more for all 64-bit memory
+        //    addresses containing the address of any of the COLs found above.
+        //    We assume such addresses are 'meta' fields, appearing 0x8 bytes
+        //    before the start of the object's VFT. Again, only relocated slots
+        //    can hold an absolute address.
+        //
+        //    E.g. 0x41613320 is the meta field, followed by VFT for
+        //    BaseFormComponent. It has:
+        //      -> 00: meta                   == 0x41975F90
+        //      -> 08: first VFT entry        == 0x40101DB0
+        //      -> 10: second VFT entry, ...
+        ForEachPointerSlot(layout, chunk, layout.rdata.begin, layout.rdata.end, [&](UInt64* p) {
+            UInt32 colRva = (UInt32)(*p - baseAddr);
+            if (scan.vtblsByCol.find(colRva) == scan.vtblsByCol.end()) return;
+
+            // We have probably found the object's meta field. Increment our
+            // pointer by 8 bytes to address the object's VFT; check that the
+            // dereferenced first VFT entry is in the .TEXT (executable) segment
+            // - i.e. probably refers to a valid executable function - and,
+            // if so, remember it against its COL.
+            UInt64* vtbl = reinterpret_cast<UInt64*>(p + 1);
+            if (textStart <= *vtbl && *vtbl < textEnd) {
+                hits.vtbls.push_back(std::make_pair(colRva, vtbl));
+            }
+        });
+        break;
+
+    default:
+        break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Add one chunk's hits to the pass's index. Chunks must be merged in address
+// order.
+// ----------------------------------------------------------------------------
+void MergeVtblChunk(VtblScan& scan, const VtblScanPass pass, const VtblChunkHits& hits)
+{
+    switch (pass)
+    {
+    case kVtblPass_TypeDescriptors:
+        scan.typeDescriptors.insert(hits.typeDescriptors.begin(), hits.typeDescriptors.end());
+        break;
+
+    case kVtblPass_COLs:
+        for (RTTICompleteObjectLocator* col : hits.cols) {
+            scan.colsByType[col->pTypeDescriptor].push_back(col);
+            scan.vtblsByCol[col->pSelf];
+        }
+        break;
+
+    case kVtblPass_MetaFields:
+        for (auto& h : hits.vtbls) {
+            scan.vtblsByCol[h.first].push_back(h.second);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// 4. Join the indexes, in TypeDescriptor order, to build the database.
+//    The primary VFTs (offset 0) go first, most recently found first,
+//    followed by the other sub-objects' VFTs in the order found. The
+//    database still needs FinishRTTIDatabase.
+// ----------------------------------------------------------------------------
+void JoinVTables(const ImageLayout& layout, VtblScan& scan, RTTIDatabase& db)
+{
+    UInt64 baseAddr = layout.baseAddr;
+
+    std::vector<UInt32> typeRvas;
+    typeRvas.reserve(scan.colsByType.size());
+    for (auto& t : scan.colsByType) {
+        typeRvas.push_back(t.first);
+    }
+    std::sort(typeRvas.begin(), typeRvas.end());
+
+    ClearRTTIDatabase(db);
+    std::vector<std::pair<UInt32, UInt32>> primary, secondary;    // (vtbl, COL) OFFSETs
+    for (UInt32 td : typeRvas)
+    {
+        primary.clear();
+        secondary.clear();
+        for (RTTICompleteObjectLocator* col : scan.colsByType[td])
+        {
+            for (UInt64* vtbl : scan.vtblsByCol[col->pSelf])
             {
-                UInt32* p = reinterpret_cast<UInt32*>(j);
-                if (*p == pTypeDescriptor)
-                {
-                    // We have probably found the pClassDescriptor field of the object's
-                    // RTTICompleteObjectLocator. This field is at offset 0x0C of the COL, 
-                    // so decrement our pointer to address the complete COL.
-                    //
-                    // 3. Now find the meta fields. Scan .RDATA again for all 64-bit memory
-                    //    addresses containing the address of the RTTICompleteObjectLocator.
-                    //    We assume such addresses are 'meta' fields, appearing 0x8 bytes
-                    //    before the start of the object's VFT.
-                    //
-                    //    E.g. 0x41613320 is the meta field, followed by VFT for 
-                    //    BaseFormComponent. It has:
-                    //      -> 00: meta                   == 0x41975F90
-                    //      -> 08: first VFT entry        == 0x40101DB0
-                    //      -> 10: second VFT entry, ...
-                    RTTICompleteObjectLocator* col =
-                        reinterpret_cast<RTTICompleteObjectLocator*>(j - 0x0C);
-                    if (col->signature != COL_SIG_REV1) continue;
-                    if (col->cdOffset != 0) continue;
-
-                    UInt64 pCol = reinterpret_cast<UInt64>(col);
-                    for (UInt64 k = rdataStart; k < rdataEnd; k += 8)
-                    {
-                        UInt64* p = reinterpret_cast<UInt64*>(k);
-                        if (*p == pCol)
-                        {
-                            // We have probably found the object's meta field. Increment our 
-                            // pointer by 8 bytes to address the object's VFT; check that the 
-                            // dereferenced first VFT entry is in the .TEXT (executable) segment
-                            // - i.e. probably refers to a valid executable function - and, 
-                            // if so, push the address into our typeDescriptor => vtbl mapping.
-                            UInt64* vtbl = reinterpret_cast<UInt64*>(p + 1);
-                            if (textStart <= *vtbl && *vtbl < textEnd) {
-                                UInt64 addr = baseAddr + (UInt64)col->pTypeDescriptor;
-                                (col->offset == 0) ?
-                                    vtblMap[addr].push_front(vtbl) :
-                                    vtblMap[addr].push_back(vtbl);
-                            }
-                        }
-                    }
-                }
+                auto entry = std::make_pair((UInt32)((UInt64)vtbl - baseAddr), col->pSelf);
+                (col->offset == 0) ? primary.push_back(entry) : secondary.push_back(entry);
             }
         }
+        if (primary.empty() && secondary.empty()) continue;
+
+        AddRTTIType(db, td);
+        for (auto it = primary.rbegin(); it != primary.rend(); ++it) {
+            AddRTTIVtbl(db, it->first, it->second);
+        }
+        for (auto& entry : secondary) {
+            AddRTTIVtbl(db, entry.first, entry.second);
+        }
     }
 }
 
 // ============================================================================
 //   B. Pretty print classes, including functions and inheritance.
 //      Assumes step A above (scanning for VFTs) has already been done.
+// ----------------------------------------------------------------------------
+// Each class's text depends only on the image, so the classes are formatted
+// on 'numThreads' threads (0 means one per core). They're taken a batch at a
+// time: each block of PRINT_BLOCK_CLASSES classes in the batch is printed to
+// its own buffer, and the buffers are then copied to 'out' in database order,
+// so the log is exactly what a single thread would have written. Before that,
+// the functions the VFTs point to are all decompiled, once each (see
+// BuildFuncCache).
 // ============================================================================
-void PrintVirtuals(const UInt64 baseAddr, const std::map<UInt64, VtblList> vtblMap)
+void PrintVirtuals(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, RTTIProgressFn progress,
+                   const unsigned numThreads)
 {
-    UInt64 textStart = baseAddr + TEXT_SEG_BEGIN;
-    UInt64 textEnd = baseAddr + TEXT_SEG_END;
-    UInt64 pureCall = baseAddr + PURE_CALL_ADDR;
+    const UInt32 numTypes = (UInt32)db.types.size();
+    const UInt32 blocksPerBatch = PRINT_BATCH_CLASSES / PRINT_BLOCK_CLASSES;
 
-    for (auto& n : vtblMap)
+    RTTIFuncCache funcs;
+    BuildFuncCache(layout, db, funcs, numThreads);
+    ReportFuncCache(funcs);
+
+    // Kept from batch to batch, so their buffers are only grown a few times.
+    std::vector<LogWriter> blocks(blocksPerBatch);
+    std::vector<std::vector<std::size_t>> classEnds(blocksPerBatch);
+    for (LogWriter& block : blocks) {
+        OpenLogWriter(block, 0, nullptr);
+    }
+
+    for (UInt32 batch = 0; batch < numTypes; batch += PRINT_BATCH_CLASSES)
     {
-        // Output information for each RTTITypeDescriptor in vtblMap.
-        // Each of these entries corresponds to one class.
-        UInt64 type_addr = n.first;
-        const VtblList& vtblList = n.second;
-
-        _MESSAGE("/*==============================================================================");
-        DumpObjectClassHierarchy(vtblList.front(), false, baseAddr);
-        _MESSAGE("==============================================================================*/");
-
-        // Iterate over the VFTs for the current RTTITypeDescriptor (class):
-        for (auto vtbl : vtblList) {
-            bool bOverride = false;
-            bool bAdd = false;
-
-            // Attempt to look up the VFT of the current VFT's parent class (if any):
-            UInt64* vtparent = GetParentVtbl(vtbl, vtblMap, baseAddr);
-
-            // Now iterate over each entry in the current VFT.
-            // Stop when the entry no longer points at a valid executable function
-            // (does not contain an address in the .TEXT segment).
-            for (int i = 0; textStart <= vtbl[i] && vtbl[i] < textEnd; i++) {
-                if (vtparent)
-                {
-                    if (textStart <= vtparent[i] && vtparent[i] < textEnd)
-                    {
-                        // If this vtable entry points to the same function as one 
-                        // of the vtable entries in the parent, then it hasn't
-                        // overridden anything - and we don't show it.
-                        if (vtbl[i] == vtparent[i])
-                            continue;
-                    }
-                    else
-                    {
-                        // We've exhausted all the entries in the parent VFT.
-                        // Any further VFT entries in the child are additions.
-                        vtparent = nullptr;
-                    }
+        const UInt32 batchEnd = (numTypes - batch > PRINT_BATCH_CLASSES) ? batch + PRINT_BATCH_CLASSES : numTypes;
+        const UInt32 numBlocks = (batchEnd - batch + PRINT_BLOCK_CLASSES - 1) / PRINT_BLOCK_CLASSES;
+
+        ParallelFor(numBlocks, numThreads, [&](std::size_t b) {
+            const UInt32 first = batch + (UInt32)b * PRINT_BLOCK_CLASSES;
+            const UInt32 last = (batchEnd - first > PRINT_BLOCK_CLASSES) ? first + PRINT_BLOCK_CLASSES : batchEnd;
+            blocks[b].buf.clear();
+            classEnds[b].clear();
+            for (UInt32 t = first; t < last; ++t) {
+                PrintClass(blocks[b], layout, db, t, &funcs);
+                classEnds[b].push_back(blocks[b].buf.size());
+            }
+        });
+
+        // Stitch the blocks together, reporting progress class by class.
+        UInt32 t = batch;
+        for (UInt32 b = 0; b < numBlocks; ++b)
+        {
+            std::size_t start = 0;
+            for (std::size_t end : classEnds[b]) {
+                LogLines(out, blocks[b].buf.data() + start, end - start);
+                start = end;
+                if (progress) {
+                    progress(out, ++t, numTypes);
                 }
+            }
+        }
+    }
+    FlushLogWriter(out);
+}
+
+// ----------------------------------------------------------------------------
+// One class: its hierarchy, its VFTs, and a blank line.
+// ----------------------------------------------------------------------------
+void PrintClass(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 t,
+                const RTTIFuncCache* funcs)
+{
+    // Output information for each RTTITypeDescriptor in the database.
+    // Each of these entries corresponds to one class.
+    const RTTITypeEntry& type = db.types[t];
+    PrintClassHeader(out, layout, db, t);
+
+    // Iterate over the VFTs for the current RTTITypeDescriptor (class):
+    for (UInt32 v = type.firstVtbl; v < type.firstVtbl + type.numVtbls; ++v) {
+        PrintVtbl(out, layout, db, v, funcs);
+    }
+    LogEndLine(out);
+}
+
+// ----------------------------------------------------------------------------
+// The comment block that starts each class: its hierarchy.
+// ----------------------------------------------------------------------------
+void PrintClassHeader(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 t)
+{
+    LogText(out, "/*==============================================================================");
+    LogEndLine(out);
+    DumpObjectClassHierarchy(out, GetVtblAddress(db, GetPrimaryVtbl(db, t)), false, layout, &db);
+    LogText(out, "==============================================================================*/");
+    LogEndLine(out);
+}
+
+// ----------------------------------------------------------------------------
+// The functions in one of the class's VFTs that it adds or overrides. They're
+// looked up in 'funcs', if given, and decompiled otherwise.
+// ----------------------------------------------------------------------------
+void PrintVtbl(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 v,
+               const RTTIFuncCache* funcs)
+{
+    UInt64 pureCall = layout.pureCall;
+
+    const UInt64* vtbl = GetVtblAddress(db, v);
+    bool bOverride = false;
+    bool bAdd = false;
+
+    // Look up the VFT of the current VFT's parent class (if any):
+    UInt32 parent = GetParentVtbl(db, v);
+    const UInt64* vtparent = (parent != RTTI_NO_INDEX) ? GetVtblAddress(db, parent) : nullptr;
+
+    // Reused for every entry, so they only allocate for the first few.
+    std::string ret;
+    std::string params;
+    std::string body;
+
+    // Now iterate over each entry in the current VFT.
+    // Stop when the entry no longer points at a valid executable function
+    // (an address in the .TEXT segment that isn't inside a function the
+    // exception table knows of, other than at its start).
+    for (int i = 0; IsFunctionEntry(layout, vtbl[i]); i++) {
+        if (vtparent)
+        {
+            if (IsFunctionEntry(layout, vtparent[i]))
+            {
+                // If this vtable entry points to the same function as one 
+                // of the vtable entries in the parent, then it hasn't
+                // overridden anything - and we don't show it.
+                if (vtbl[i] == vtparent[i])
+                    continue;
+            }
+            else
+            {
+                // We've exhausted all the entries in the parent VFT.
+                // Any further VFT entries in the child are additions.
+                vtparent = nullptr;
+            }
+        }
 
-                char buf[64];
-                sprintf_s(buf, "Unk_%03X", i);
-                std::string name = buf;
+        ret.assign("????  ");
+        params.assign("????");
+        body.clear();
 
-                sprintf_s(buf, "%08IX", (UInt64)vtbl[i]);
-                std::string offset = buf;
+        // Where the slot ends up, once any thunks have been followed.
+        const UInt32 pSlot = (UInt32)(vtbl[i] - layout.baseAddr);
+        UInt64 funcAddr = vtbl[i];
+        SInt32 thisAdjust = 0;
+        const RTTIFuncEntry* func = nullptr;
+        if (funcs) {
+            const RTTIFuncThunk* thunk = FindFuncThunk(*funcs, pSlot);
+            if (thunk) {
+                funcAddr = layout.baseAddr + (UInt64)thunk->pFunc;
+                thisAdjust = thunk->thisAdjust;
+            }
+            func = FindFuncEntry(*funcs, (UInt32)(funcAddr - layout.baseAddr));
+        }
+        else {
+            funcAddr = layout.baseAddr + (UInt64)ResolveFuncThunk(layout, pSlot, thisAdjust);
+        }
 
-                std::string ret = "????  ";
-                std::string params = "????";
-                std::string body;
+        if (pureCall && (vtbl[i] == pureCall || funcAddr == pureCall)) {
+            body.assign("(pure)");
+        }
+        else if (func) {
+            const char* text = funcs->text.data() + func->text;
+            ret.assign(text, func->retLength);
+            params.assign(text + func->retLength, func->paramsLength);
+            body.assign(text + func->retLength + func->paramsLength, func->bodyLength);
+        }
+        else {
+            SimpleFunctionDecompiler(funcAddr, ret, params, body, layout, db);
+        }
+
+        if (vtparent && !bOverride) {
+            bOverride = true;
+            const TypeDescriptor* parentType = reinterpret_cast<const TypeDescriptor*>(
+                db.baseAddr + (UInt64)db.types[db.vtbls[parent].type].pTypeDescriptor);
+            std::string className;
+            LogText(out, "    // @override ");
+            LogTypeName(out, parentType, layout, &db, className);
+            LogText(out, " : (vtbl=");
+            LogHex(out, (UInt32)(UInt64)vtbl, 8);
+            LogChar(out, ')');
+            LogEndLine(out);
+        }
+        if (!vtparent && !bAdd) {
+            bAdd = true;
+            if (i > 0) {
+                LogText(out, "    // @add");
+                LogEndLine(out);
+            }
+        }
+
+        // "    virtual <ret> Unk_<i>(<params>)[ override];<pad>// <address>[ (this-<n>)][ (<size> bytes)][ <body>]"
+        int numPad = 40;
+        numPad -= (int)params.length();
+        LogText(out, "    virtual ");
+        LogText(out, ret);
+        LogText(out, " Unk_");
+        LogHex(out, i, 3);
+        LogChar(out, '(');
+        LogText(out, params);
+        LogChar(out, ')');
+        if (vtparent) {
+            numPad -= 9;
+            LogText(out, " override");
+        }
+        LogChar(out, ';');
+
+        if (numPad < 4) {
+            numPad = 4;
+        }
+        LogPad(out, numPad);
+
+        LogText(out, "// ");
+        LogHex(out, funcAddr, 8);
+        if (thisAdjust) {
+            LogText(out, (thisAdjust < 0) ? " (this-0x" : " (this+0x");
+            LogHex(out, (thisAdjust < 0) ? 0 - (UInt32)thisAdjust : (UInt32)thisAdjust, 0);
+            LogChar(out, ')');
+        }
+        const ImageFunction* image = FindImageFunction(layout, funcAddr);
+        if (image && layout.baseAddr + (UInt64)image->begin == funcAddr && funcAddr != pureCall) {
+            LogText(out, " (0x");
+            LogHex(out, image->end - image->begin, 0);
+            LogText(out, " bytes)");
+        }
+        if (!body.empty()) {
+            LogChar(out, ' ');
+            LogText(out, body);
+        }
+        LogEndLine(out);
+    }
+}
 
-                if (vtbl[i] == pureCall) {
-                    body = "(pure)";
+// ============================================================================
+//   Decompile every function that PrintVtbl will print into 'cache', on
+//   'numThreads' threads (0 means one per core), a chunk of FUNC_CHUNK_FUNCS
+//   at a time. The chunks are merged in order, so the cache is the same
+//   whatever the number of threads.
+// ============================================================================
+void BuildFuncCache(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache,
+                    const unsigned numThreads)
+{
+    CollectVirtualFuncs(layout, db, cache);
+
+    const UInt32 numFuncs = (UInt32)cache.funcs.size();
+    const UInt32 numChunks = (numFuncs + FUNC_CHUNK_FUNCS - 1) / FUNC_CHUNK_FUNCS;
+    std::vector<std::vector<char>> texts(numChunks);
+    ParallelFor(numChunks, numThreads, [&](std::size_t c) {
+        const UInt32 first = (UInt32)c * FUNC_CHUNK_FUNCS;
+        const UInt32 last = (numFuncs - first > FUNC_CHUNK_FUNCS) ? first + FUNC_CHUNK_FUNCS : numFuncs;
+        DecompileFuncChunk(layout, db, cache, first, last, texts[c]);
+    });
+    for (UInt32 c = 0; c < numChunks; ++c) {
+        const UInt32 first = c * FUNC_CHUNK_FUNCS;
+        const UInt32 last = (numFuncs - first > FUNC_CHUNK_FUNCS) ? first + FUNC_CHUNK_FUNCS : numFuncs;
+        MergeFuncChunk(cache, first, last, texts[c]);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Find the distinct functions that PrintVtbl will decompile - those in the
+// slots it prints, less _purecall, with any thunks followed - and count the
+// slots. Their entries in 'cache' are left empty until DecompileFuncChunk
+// fills them in; the thunks' entries say where they lead.
+//
+// It's also exposed a chunk at a time, so that it can be spread over many
+// short steps (see RTTIAnalysis.h): starting from an empty 'cache', call
+// CollectVtblFuncChunk for each chunk of VFTs, in order, then
+// ResolveThunkChunk for each chunk of the functions that collects, in order,
+// then FinishVirtualFuncs. Each chunk merges what it finds into a sorted
+// list, so no step has to sort the whole of it.
+// ----------------------------------------------------------------------------
+void CollectVirtualFuncs(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache)
+{
+    cache.funcs.clear();
+    cache.thunks.clear();
+    cache.text.clear();
+    cache.numSlots = 0;
+
+    std::vector<UInt32> funcs;
+    std::vector<UInt32> targets;
+    CollectVtblFuncChunk(layout, db, 0, (UInt32)db.vtbls.size(), cache, funcs);
+    ResolveThunkChunk(layout, funcs, 0, (UInt32)funcs.size(), cache, targets);
+    FinishVirtualFuncs(cache, targets);
+}
+
+// ----------------------------------------------------------------------------
+// Add the functions in the slots of VFTs [first, last) to 'funcs', which is
+// kept sorted and distinct, and count the slots in the cache's 'numSlots'.
+// ----------------------------------------------------------------------------
+void CollectVtblFuncChunk(const ImageLayout& layout, const RTTIDatabase& db, const UInt32 first,
+                          const UInt32 last, RTTIFuncCache& cache, std::vector<UInt32>& funcs)
+{
+    // The same walk as PrintVtbl's.
+    const std::size_t sorted = funcs.size();
+    for (UInt32 v = first; v < last; ++v)
+    {
+        const UInt64* vtbl = GetVtblAddress(db, v);
+        const UInt32 parent = GetParentVtbl(db, v);
+        const UInt64* vtparent = (parent != RTTI_NO_INDEX) ? GetVtblAddress(db, parent) : nullptr;
+        for (UInt32 i = 0; IsFunctionEntry(layout, vtbl[i]); ++i)
+        {
+            if (vtparent)
+            {
+                if (IsFunctionEntry(layout, vtparent[i])) {
+                    if (vtbl[i] == vtparent[i]) continue;
                 }
                 else {
-                    SimpleFunctionDecompiler(vtbl[i], ret, params, body, baseAddr);
+                    vtparent = nullptr;
                 }
+            }
+            if (layout.pureCall && vtbl[i] == layout.pureCall) continue;
+            funcs.push_back((UInt32)(vtbl[i] - layout.baseAddr));
+        }
+    }
+    cache.numSlots += (UInt32)(funcs.size() - sorted);
+    MergeSortedFuncs(funcs, sorted);
+}
 
-                if (vtparent && !bOverride) {
-                    bOverride = true;
-                    std::string className;
-                    GetObjectClassName(vtparent, baseAddr, className);
-                    _MESSAGE("    // @override %s : (vtbl=%08X)", className.c_str(), vtbl);
-                }
-                if (!vtparent && !bAdd) {
-                    bAdd = true;
-                    if (i > 0) {
-                        _MESSAGE("    // @add");
-                    }
-                }
+// ----------------------------------------------------------------------------
+// Follow any thunks among funcs[first, last) into the cache's 'thunks', and
+// add the functions they lead to (or the functions themselves) to 'targets',
+// which is kept sorted and distinct. Each thunk is followed once, and each
+// function it leads to is decompiled once, however many thunks lead to it.
+// ----------------------------------------------------------------------------
+void ResolveThunkChunk(const ImageLayout& layout, const std::vector<UInt32>& funcs, const UInt32 first,
+                       const UInt32 last, RTTIFuncCache& cache, std::vector<UInt32>& targets)
+{
+    const std::size_t sorted = targets.size();
+    for (UInt32 f = first; f < last; ++f)
+    {
+        const UInt32 pFunc = funcs[f];
+        SInt32 thisAdjust = 0;
+        const UInt32 target = ResolveFuncThunk(layout, pFunc, thisAdjust);
+        if (target != pFunc) {
+            cache.thunks.push_back({ pFunc, target, thisAdjust });
+            if (layout.pureCall && layout.baseAddr + (UInt64)target == layout.pureCall) continue;
+        }
+        targets.push_back(target);
+    }
+    MergeSortedFuncs(targets, sorted);
+}
 
-                int numPad = 40;
-                numPad -= params.length();
-                std::string str = "    virtual ";
-                str += ret + ' ' + name + '(' + params + ')';
-                if (vtparent) {
-                    numPad -= 9;
-                    str += " override";
-                }
-                str += ';';
+// ----------------------------------------------------------------------------
+// Make the cache's (empty) entries for the functions in 'targets'.
+// ----------------------------------------------------------------------------
+void FinishVirtualFuncs(RTTIFuncCache& cache, const std::vector<UInt32>& targets)
+{
+    cache.funcs.resize(targets.size());
+    for (std::size_t f = 0; f < targets.size(); ++f) {
+        cache.funcs[f] = { targets[f], 0, 0, 0, 0 };
+    }
+}
 
-                if (numPad < 4) {
-                    numPad = 4;
-                }
-                for (int i = numPad; i > 0; --i) {
-                    str += ' ';
-                }
-                
-                str += "// " + offset;
-                if (!body.empty()) {
-                    str += ' ' + body;
-                }
+// ----------------------------------------------------------------------------
+// Decompile functions [first, last) of 'cache', appending their text to
+// 'text'. Their entries' 'text' are offsets in 'text' until MergeFuncChunk.
+// Chunks can be decompiled concurrently.
+// ----------------------------------------------------------------------------
+void DecompileFuncChunk(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache,
+                        const UInt32 first, const UInt32 last, std::vector<char>& text)
+{
+    std::string ret;
+    std::string params;
+    std::string body;
+    text.clear();
+    for (UInt32 f = first; f < last; ++f)
+    {
+        RTTIFuncEntry& func = cache.funcs[f];
+        ret.assign("????  ");
+        params.assign("????");
+        body.clear();
+        SimpleFunctionDecompiler(layout.baseAddr + (UInt64)func.pFunc, ret, params, body, layout, db);
+
+        func.text = (UInt32)text.size();
+        func.retLength = (UInt16)ret.length();
+        func.paramsLength = (UInt16)params.length();
+        func.bodyLength = (UInt16)body.length();
+        text.insert(text.end(), ret.begin(), ret.end());
+        text.insert(text.end(), params.begin(), params.end());
+        text.insert(text.end(), body.begin(), body.end());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Append a chunk's text to the cache's. Chunks must be merged in order.
+// ----------------------------------------------------------------------------
+void MergeFuncChunk(RTTIFuncCache& cache, const UInt32 first, const UInt32 last, const std::vector<char>& text)
+{
+    const UInt32 base = (UInt32)cache.text.size();
+    for (UInt32 f = first; f < last; ++f) {
+        cache.funcs[f].text += base;
+    }
+    cache.text.insert(cache.text.end(), text.begin(), text.end());
+}
+
+// ----------------------------------------------------------------------------
+// The entry for the function at OFFSET 'pFunc', or NULL if there isn't one.
+// ----------------------------------------------------------------------------
+const RTTIFuncEntry* FindFuncEntry(const RTTIFuncCache& cache, const UInt32 pFunc)
+{
+    auto it = std::lower_bound(cache.funcs.begin(), cache.funcs.end(), pFunc,
+                               [](const RTTIFuncEntry& func, const UInt32 p) { return func.pFunc < p; });
+    return (it != cache.funcs.end() && it->pFunc == pFunc) ? &*it : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// The entry for the thunk at OFFSET 'pThunk', or NULL if it isn't one.
+// ----------------------------------------------------------------------------
+const RTTIFuncThunk* FindFuncThunk(const RTTIFuncCache& cache, const UInt32 pThunk)
+{
+    auto it = std::lower_bound(cache.thunks.begin(), cache.thunks.end(), pThunk,
+                               [](const RTTIFuncThunk& thunk, const UInt32 p) { return thunk.pThunk < p; });
+    return (it != cache.thunks.end() && it->pThunk == pThunk) ? &*it : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// Follow the thunks starting at OFFSET 'pFunc' to the function they lead to,
+// and return its OFFSET, with what they add to 'this' on the way in
+// 'thisAdjust'. A thunk is a direct "jmp", optionally after an adjustment
+// to 'this' (see GetThisAdjustment). A function that isn't a thunk is its
+// own target; so is one whose thunks loop, or go on for more than
+// FUNC_MAX_THUNKS. A jump to something that can't be a function (see
+// IsFunctionEntry) stops where it is.
+// ----------------------------------------------------------------------------
+UInt32 ResolveFuncThunk(const ImageLayout& layout, const UInt32 pFunc, SInt32& thisAdjust)
+{
+    UInt32 visited[FUNC_MAX_THUNKS];
+    UInt32 numVisited = 0;
+    UInt32 target = pFunc;
+    SInt32 adjust = 0;
+    X64Instruction insn;
+    for (;;)
+    {
+        const UInt8* code = (const UInt8*)(layout.baseAddr + (UInt64)target);
+        SInt32 delta = 0;
+        UInt32 size = DecodeX64Instruction(code, insn);
+        if (size && GetThisAdjustment(code, insn, delta)) {
+            const UInt32 jmpSize = DecodeX64Instruction(code + size, insn);
+            size = jmpSize ? size + jmpSize : 0;
+        }
+        if (!size || insn.flow != kX64Flow_Jump || (insn.immSize != 1 && insn.immSize != 4)) {
+            break;
+        }
+
+        // jmp rel8 | jmp rel32
+        const UInt8* imm = code + size - insn.length + insn.immOffset;
+        SInt32 rel;
+        if (insn.immSize == 1) {
+            rel = (SInt8)imm[0];
+        }
+        else {
+            std::memcpy(&rel, imm, sizeof(rel));
+        }
+        const UInt64 next = layout.baseAddr + (UInt64)target + size + (SInt64)rel;
+        if (!IsFunctionEntry(layout, next)) {
+            break;
+        }
 
-                _MESSAGE(str.c_str());
+        if (numVisited == FUNC_MAX_THUNKS) {
+            thisAdjust = 0;
+            return pFunc;
+        }
+        visited[numVisited++] = target;
+        target = (UInt32)(next - layout.baseAddr);
+        adjust += delta;
+        for (UInt32 v = 0; v < numVisited; ++v)
+        {
+            if (visited[v] == target) {
+                thisAdjust = 0;
+                return pFunc;
             }
         }
-        _MESSAGE("");
     }
+    thisAdjust = adjust;
+    return target;
+}
+
+// ----------------------------------------------------------------------------
+// How much decompiling the cache saved: each slot after the first that
+// points to a function is a hit.
+// ----------------------------------------------------------------------------
+void ReportFuncCache(const RTTIFuncCache& cache)
+{
+    const UInt32 numFuncs = (UInt32)cache.funcs.size();
+    const UInt32 hits = (cache.numSlots > numFuncs) ? cache.numSlots - numFuncs : 0;
+    _MESSAGE("RTTI funcs: decompiled %u functions for %u VFT slots (%u via thunks); %u hits (%.1f%%), %u KB.",
+             numFuncs, cache.numSlots, (UInt32)cache.thunks.size(), hits,
+             cache.numSlots ? 100.0 * hits / cache.numSlots : 0.0,
+             (UInt32)((cache.funcs.size() * sizeof(RTTIFuncEntry) + cache.thunks.size() * sizeof(RTTIFuncThunk) +
+                       cache.text.size()) / 1024));
 }
 
 // ============================================================================
 //              Dump the class hierarchy for a given object.
 // ----------------------------------------------------------------------------
 // vtbl should be a pointer to the object's virtual function table
-// (i.e. the address of the first entry in the VFT).
+// (i.e. the address of the first entry in the VFT). The names are taken
+// from 'db', if given; any that aren't in it are demangled.
 // ============================================================================
-void DumpObjectClassHierarchy(const UInt64* vtbl, const bool verbose, const UInt64 baseAddr)
+void DumpObjectClassHierarchy(LogWriter& out, const UInt64* vtbl, const bool verbose, const ImageLayout& layout,
+                              const RTTIDatabase* db)
 {
-    std::stringstream ss;
+    UInt64 baseAddr = layout.baseAddr;
     std::string name;
+    const TypeDescriptor* type;
     UInt32 offset;
-    RTTIClassHierarchyDescriptor* hierarchy;
-    if (!GetTypeHierarchyInfo(vtbl, name, offset, hierarchy, baseAddr)) {
-        _MESSAGE("<no rtti>");
+    const RTTIClassHierarchyDescriptor* hierarchy;
+    UInt32 nClasses;
+    if (!GetTypeHierarchyInfo(vtbl, type, offset, hierarchy, nClasses, layout)) {
+        LogText(out, "<no rtti>");
+        LogEndLine(out);
         return;
     }
 
-    //_MESSAGE("%s +%04X (_vtbl=%08X)", name, offset, *(UInt64*)objBase);
-    ss << name;
-    ss << " +" << std::hex << std::setfill('0') << std::uppercase << std::setw(4) << std::right << offset;
-    ss << " (_vtbl=" << std::setw(8) << (UInt64)vtbl << ')';
-    ss << std::endl;
-
-    std::vector<int> depth(hierarchy->numBaseClasses, 0);
+    // "<name> +<offset> (_vtbl=<vtbl>)"
+    LogTypeName(out, type, layout, db, name);
+    LogText(out, " +");
+    LogHex(out, offset, 4);
+    LogText(out, " (_vtbl=");
+    LogHex(out, (UInt64)vtbl, 8);
+    LogChar(out, ')');
+    LogEndLine(out);
 
     // Iterate over the array of base class pointers
-    UInt64 nClasses = hierarchy->numBaseClasses;
+    if (!nClasses) return;
     UInt64 pClassArray = baseAddr + (UInt64)hierarchy->pBaseClassArray;
-    for (UInt64 i = 0; i < nClasses; i++)
+
+    // depth[n] is the number of rows still to be printed beneath class n
+    // (including its own); each of those rows gets a "|   " for it. Small
+    // hierarchies (i.e. nearly all of them) don't need the heap.
+    int depthBuf[64];
+    std::vector<int> depthVec;
+    int* depth = depthBuf;
+    if (nClasses > 64) {
+        depthVec.resize(nClasses);
+        depth = depthVec.data();
+    }
+    memset(depth, 0, nClasses * sizeof(int));
+
+    for (UInt32 i = 0; i < nClasses; i++)
     {
-        auto index = i * 4;
-        UInt32 pBaseClass = *(UInt32*)(pClassArray + index);
+        UInt32 pBaseClass = ((UInt32*)pClassArray)[i];
         RTTIBaseClassDescriptor* baseClass =
             reinterpret_cast<RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pBaseClass);
 
-        // _MESSAGE("%04X: ", node->offset);
-        ss << std::setw(4) << baseClass->where.mdisp << ": ";
+        // "<mdisp>: "
+        LogHex(out, baseClass->where.mdisp, 4);
+        LogText(out, ": ");
 
         // indents
         depth[i] = baseClass->numContainedBases + 1;
-        for (std::size_t n = 0; n < depth.size(); n++) {
+        for (UInt32 n = 0; n < nClasses; n++) {
             if (depth[n] > 0) {
                 if (n > 0)
-                    ss << "|   ";
+                    LogText(out, "|   ");
                 depth[n]--;
             }
         }
 
-        TypeDescriptor* type =
-            reinterpret_cast<TypeDescriptor*>(baseAddr + (UInt64)baseClass->pTypeDescriptor);
-        GetUnmangledTypeName(type, baseAddr, name);
-        ss << name;
+        type = reinterpret_cast<const TypeDescriptor*>(baseAddr + (UInt64)baseClass->pTypeDescriptor);
+        LogTypeName(out, type, layout, db, name);
         if (verbose) {
-            // _MESSAGE(" ... %p", node->type->name(), node->type);
-            ss << " ... " << std::setw(8) << type;
+            LogText(out, " ... ");
+            LogHex(out, (UInt64)type, 16);
         }
-        ss << std::endl;
+        LogEndLine(out);
     }
-
-    std::string out = ss.str();
-    out.pop_back();        // remove the last new line character as _MESSAGE will add one
-    _MESSAGE("%s", out.c_str());
 }
 
 // ============================================================================
 //                      Internal helper functions.
 // ============================================================================
-static void UnmangleRTTITypeName(const char* mangled, std::string& unmangled)
+void UnmangleRTTITypeName(const char* mangled, std::string& unmangled)
 {
     // ------------------------------------------------------------------------
     // Attempt to convert a mangled RTTI type name into an unmangled one.
@@ -328,8 +889,12 @@ static void UnmangleRTTITypeName(const char* mangled, std::string& unmangled)
     }
 
     // Demangle and store the result.
+    // N.B. UndecorateName gives the same results as DbgHelp's
+    // UnDecorateSymbolName did (see Undecorate.h), but on any platform and
+    // without a lock. The buffer is the same size too, so the odd very long
+    // name is cut short just as before.
     char szUndName[1024];
-    if (UnDecorateSymbolName(tmp.c_str(), szUndName, sizeof(szUndName), UNDNAME_COMPLETE)) {
+    if (UndecorateName(tmp.c_str(), szUndName, sizeof(szUndName))) {
         // Success - return the unmangled name.
         std::string toRemove = " `RTTI Type Descriptor'";
         tmp.assign(szUndName);
@@ -346,357 +911,352 @@ static void UnmangleRTTITypeName(const char* mangled, std::string& unmangled)
         // "??_R0?AVQueuedMagicItem@?A0x3cefe057@@@8" should demangle to
         // "class `anonymous namespace'::QueuedMagicItem `RTTI Type Descriptor'",
         // according to undname.exe, but UnDecorateSymbolName can't handle it.
-        unmangled.assign(mangled);
+        // It hands back the name it was given instead, so the dump has always
+        // shown these in their "??_R0...@8" form; UndecorateName gives up on
+        // the same names, and we return the same thing.
+        unmangled.assign(tmp);
     }
 }
 
-static void GetUnmangledTypeName(const TypeDescriptor* type, const UInt64 baseAddr, 
-                                 std::string& unmangled)
+// ----------------------------------------------------------------------------
+// The demangled name of 'type'. This is the slow way, for names that aren't
+// in an RTTIDatabase.
+// ----------------------------------------------------------------------------
+void GetUnmangledTypeName(const TypeDescriptor* type, const ImageLayout& layout, std::string& unmangled)
 {
-    if (type->pVFTable == baseAddr + TYPE_INFO_VTBL) {
+    if (type->pVFTable == layout.typeInfoVtbl) {
         // I.e. a Skyrim type
+        if (!IsTypeDescriptor(layout, (UInt32)((UInt64)type - layout.baseAddr))) {
+            unmangled.assign("<bad TypeDescriptor>");
+            return;
+        }
         UnmangleRTTITypeName(type->name, unmangled);
     }
     else
     {
+#ifdef _MSC_VER
         std::type_info const* pThis = reinterpret_cast<std::type_info const*>(type);
         unmangled.assign(pThis->name());
+#else
+        // Only MSVC's std::type_info shares the TypeDescriptor layout.
+        unmangled.assign(type->name);
+#endif
     }
 }
 
-static const TypeDescriptor* GetTypeDescriptor(const UInt64* vtbl, const UInt64 baseAddr)
+// ----------------------------------------------------------------------------
+// Checks for the RTTI structures that are reached by following OFFSETs from
+// the ones the scan found, so that a corrupt image can't send us outside it.
+//
+// IsTypeDescriptor: is there room in .DATA for a TypeDescriptor at OFFSET
+// 'pTypeDescriptor', with its name NUL-terminated there too?
+//
+// GetClassHierarchy: the class hierarchy descriptor at OFFSET
+// 'pClassDescriptor', or NULL if it isn't in .RDATA. 'numBaseClasses' is
+// how many of its RTTIBaseClassArray's entries can be followed: at most as
+// many as fit in .RDATA, and up to the first whose RTTIBaseClassDescriptor
+// isn't in .RDATA or whose TypeDescriptor fails IsTypeDescriptor.
+// ----------------------------------------------------------------------------
+bool IsTypeDescriptor(const ImageLayout& layout, const UInt32 pTypeDescriptor)
 {
-    // ------------------------------------------------------------------------
-    // Return a pointer to the TypeDescriptor for the given VFT ('vtbl').
-    // ------------------------------------------------------------------------
-    const TypeDescriptor* type = nullptr;
-    __try
-    {
-        RTTICompleteObjectLocator* rtti = *(RTTICompleteObjectLocator**)(vtbl - 1);
-        type = reinterpret_cast<TypeDescriptor*>(baseAddr + (UInt64)rtti->pTypeDescriptor);
+    const UInt64 addr = layout.baseAddr + (UInt64)pTypeDescriptor;
+    if (!layout.data.Contains(addr, sizeof(TypeDescriptor))) return false;
+    const char* name = reinterpret_cast<const TypeDescriptor*>(addr)->name;
+    return memchr(name, '\0', layout.data.end - (UInt64)name) != nullptr;
+}
+
+const RTTIClassHierarchyDescriptor* GetClassHierarchy(const ImageLayout& layout, const UInt32 pClassDescriptor,
+                                                      UInt32& numBaseClasses)
+{
+    const UInt64 baseAddr = layout.baseAddr;
+    numBaseClasses = 0;
+    if (!pClassDescriptor ||
+        !layout.rdata.Contains(baseAddr + (UInt64)pClassDescriptor, sizeof(RTTIClassHierarchyDescriptor))) {
+        return nullptr;
     }
-    __except (EXCEPTION_EXECUTE_HANDLER)
+    const RTTIClassHierarchyDescriptor* hierarchy =
+        reinterpret_cast<const RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)pClassDescriptor);
+
+    const UInt64 array = baseAddr + (UInt64)hierarchy->pBaseClassArray;
+    if (!layout.rdata.Contains(array, 0)) return hierarchy;
+    const UInt32* pClassArray = reinterpret_cast<const UInt32*>(array);
+    const UInt32 count = (UInt32)(std::min)((UInt64)hierarchy->numBaseClasses, (layout.rdata.end - array) / 4);
+    for (; numBaseClasses < count; ++numBaseClasses)
     {
-        // return the default
+        const UInt64 baseClass = baseAddr + (UInt64)pClassArray[numBaseClasses];
+        if (!layout.rdata.Contains(baseClass, sizeof(RTTIBaseClassDescriptor)) ||
+            !IsTypeDescriptor(layout, reinterpret_cast<const RTTIBaseClassDescriptor*>(baseClass)->pTypeDescriptor)) {
+            break;
+        }
     }
-
-    return type;
+    return hierarchy;
 }
 
-static bool GetTypeHierarchyInfo(const UInt64* vtbl, std::string& name, UInt32& offset,
-                                 RTTIClassHierarchyDescriptor*& hierarchy, const UInt64 baseAddr)
+static void GetTypeName(const TypeDescriptor* type, const ImageLayout& layout, const RTTIDatabase* db,
+                        std::string& name)
 {
     // ------------------------------------------------------------------------
-    // Try to obtain type hierarchy info for the the given VFT ('vtbl').
-    // If successful, return TRUE and store demangled RTTI type name in 'name', 
-    // offset in 'offset' and the RTTIClassHierarchy pointer in 'hierarchy'.
-    // Return FALSE otherwise.
+    // The demangled name of 'type', from 'db' if it's there.
     // ------------------------------------------------------------------------
-    bool success = false;
-    const TypeDescriptor* type = nullptr;
-    __try
-    {
-        RTTICompleteObjectLocator* rtti = *(RTTICompleteObjectLocator**)(vtbl - 1);
-        type = reinterpret_cast<TypeDescriptor*>(baseAddr + (UInt64)rtti->pTypeDescriptor);
-
-        if (type->pVFTable == baseAddr + TYPE_INFO_VTBL) {
-            // I.e. a Skyrim type
-            GetUnmangledTypeName(type, baseAddr, name);
-            offset = rtti->offset;
-            hierarchy =
-                reinterpret_cast<RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)rtti->pClassDescriptor);
-            success = true;
-        }
+    UInt32 length;
+    const char* interned = db ? FindRTTIName(*db, (UInt32)((UInt64)type - layout.baseAddr), length) : nullptr;
+    if (interned) {
+        name.assign(interned, length);
     }
-    __except (EXCEPTION_EXECUTE_HANDLER)
-    {
-        // return the default
+    else {
+        GetUnmangledTypeName(type, layout, name);
     }
-
-    return success;
 }
 
-static void GetObjectClassName(const UInt64* vtbl, const UInt64 baseAddr, std::string& name)
+static void LogTypeName(LogWriter& out, const TypeDescriptor* type, const ImageLayout& layout,
+                        const RTTIDatabase* db, std::string& buf)
 {
     // ------------------------------------------------------------------------
-    // Try to get the demangled RTTI type name for the given VFT ('vtbl').
-    // Store result in 'name'.
+    // Write the demangled name of 'type' to 'out': straight from 'db' if it's
+    // there, otherwise by way of 'buf'.
     // ------------------------------------------------------------------------
-    const TypeDescriptor* type = GetTypeDescriptor(vtbl, baseAddr);
-    if (type) {
-        GetUnmangledTypeName(type, baseAddr, name);
+    UInt32 length;
+    const char* interned = db ? FindRTTIName(*db, (UInt32)((UInt64)type - layout.baseAddr), length) : nullptr;
+    if (interned) {
+        LogText(out, interned, length);
     }
     else {
-        name.assign("<no rtti>");
+        GetUnmangledTypeName(type, layout, buf);
+        LogText(out, buf);
     }
 }
 
-static UInt64* GetParentVtbl(const UInt64* vtbl, const std::map<UInt64, VtblList> vtblMap, 
-                             const UInt64 baseAddr)
+static const TypeDescriptor* GetTypeDescriptor(const UInt64* vtbl, const ImageLayout& layout)
 {
     // ------------------------------------------------------------------------
-    // Try to locate the parent VFT for the given VFT ('vtbl').
-    // Return a pointer to that if found, or NULL otherwise.
+    // Return a pointer to the TypeDescriptor for the given VFT ('vtbl').
     // ------------------------------------------------------------------------
-    // Decrement vtbl pointer by one to get the "meta" field, the pointer to the
-    // object's RTTICompleteObjectLocator structure.
-    RTTICompleteObjectLocator* col = *(RTTICompleteObjectLocator**)(vtbl - 1);
-
-    // Is the derived RTTICompleteObjectLocator valid?
-    // N.B. col->pClassDescriptor should not be null, even when the class has no parent.
-    if (col->pClassDescriptor)
-    {
-        RTTIClassHierarchyDescriptor* hierarchy =
-            reinterpret_cast<RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)col->pClassDescriptor);
-
-        // Iterate over the array of 32-bit base class pointer offsets.
-        // We skip the first entry because that is the BaseClassDescriptor for the current object.
-        UInt64 nClasses = hierarchy->numBaseClasses;
-        UInt64 pClassArray = baseAddr + (UInt64)hierarchy->pBaseClassArray;
-        for (UInt64 i = 1; i < nClasses; i++)
-        {
-            UInt64 index = i * 4;
-            UInt32 pBaseClass = *(UInt32*)(pClassArray + index);
-            RTTIBaseClassDescriptor* baseClass =
-                reinterpret_cast<RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pBaseClass);
-
-            if (baseClass->where.mdisp == col->offset)
-            {
-                // Attempt to locate this base class's TypeDescriptor in our
-                // Type=>VFT mapping. If found, then return the first VFT in the
-                // associated VFT list as the start of the VFT of the parent.
-                auto it = vtblMap.find(baseAddr + (UInt64)baseClass->pTypeDescriptor);
-                if (it != vtblMap.cend())
-                    return it->second.front();
-            }
-        }
+    // N.B. 'vtbl' may be garbage (e.g. an immediate operand that we're only
+    // guessing is a VFT), so every dereference goes through SafeRead.
+    RTTICompleteObjectLocator* pCol = nullptr;
+    RTTICompleteObjectLocator rtti;
+    if (!SafeRead(vtbl - 1, &pCol, sizeof(pCol)) ||
+        !SafeRead(pCol, &rtti, sizeof(rtti))) {
+        return nullptr;
     }
 
-    // Parent vtbl not found.
-    return nullptr;
+    // The TypeDescriptor is an OFFSET, so it must be in this image.
+    if (!IsTypeDescriptor(layout, rtti.pTypeDescriptor)) return nullptr;
+    return reinterpret_cast<TypeDescriptor*>(layout.baseAddr + (UInt64)rtti.pTypeDescriptor);
 }
 
-static void SimpleFunctionDecompiler(const UInt64 funcAddr, std::string& retOut, std::string& paramsOut,
-                                     std::string& bodyOut, const UInt64 baseAddr)
+static bool GetTypeHierarchyInfo(const UInt64* vtbl, const TypeDescriptor*& type, UInt32& offset,
+                                 const RTTIClassHierarchyDescriptor*& hierarchy, UInt32& numBaseClasses,
+                                 const ImageLayout& layout)
 {
     // ------------------------------------------------------------------------
-    // Attempt to decompile a simple two-instruction function of form:
-    //         <some instruction>
-    //         "retn" | "retn imm16"
+    // Try to obtain type hierarchy info for the the given VFT ('vtbl').
+    // If successful, return TRUE and store the RTTI TypeDescriptor in 'type', 
+    // offset in 'offset' and the RTTIClassHierarchy pointer in 'hierarchy'
+    // (NULL if it's corrupt), with the number of its base classes that can
+    // be followed in 'numBaseClasses' (see GetClassHierarchy).
+    // Return FALSE otherwise.
     // ------------------------------------------------------------------------
-    // See https://www.felixcloutier.com/x86/ret
-    //     https://learn.microsoft.com/en-us/windows-hardware/drivers/debugger/x64-architecture
-    UInt8* code = (UInt8*)funcAddr;
-    std::size_t size = 0;
-    std::string ret = "????  ";
-    std::string body;
+    RTTICompleteObjectLocator* pCol = nullptr;
+    RTTICompleteObjectLocator rtti;
+    if (!SafeRead(vtbl - 1, &pCol, sizeof(pCol)) ||
+        !SafeRead(pCol, &rtti, sizeof(rtti))) {
+        return false;
+    }
 
+    type = reinterpret_cast<TypeDescriptor*>(layout.baseAddr + (UInt64)rtti.pTypeDescriptor);
+    if (!IsTypeDescriptor(layout, rtti.pTypeDescriptor) || type->pVFTable != layout.typeInfoVtbl) {
+        return false;
+    }
+
+    // I.e. a Skyrim type
+    offset = rtti.offset;
+    hierarchy = GetClassHierarchy(layout, rtti.pClassDescriptor, numBaseClasses);
+    return true;
+}
+
+// ============================================================================
+//   The single instructions SimpleFunctionDecompiler recognises, as byte
+//   patterns (see BytePattern.h). They're compiled into one automaton that
+//   reads each function once, so more of them don't make it any slower.
+// ============================================================================
+static const FuncIdiom FUNC_IDIOMS[] = {
     // -----------------------------------------
-    // XOR ...
+    // XOR, OR ...
     // -----------------------------------------
-    if (code[0] == 0x32 && code[1] == 0xC0)
-    {
-        // xor al, al
-        ret = "bool  ";
-        body = "{ return false; }";
-        size = 2;
-    }
-    else if (code[0] == 0x33 && code[1] == 0xC0)
-    {
-        // xor eax, eax
-        ret = "UInt32";
-        body = "{ return 0; }";
-        size = 2;
-    }
-    else if (code[0] == 0x83 && code[1] == 0xC8 && code[2] == 0xFF)
-    {
-        // xor al, ???
-        ret = "Sint32";
-        body = "{ return -1; }";
-        size = 3;
-    }
+    { "32 C0",           kIdiom_Text,    "bool  ", "{ return false; }", nullptr },         // xor al, al
+    { "30 C0",           kIdiom_Text,    "bool  ", "{ return false; }", nullptr },         // xor al, al
+    { "33 C0",           kIdiom_Text,    "UInt32", "{ return 0; }", nullptr },             // xor eax, eax
+    { "31 C0",           kIdiom_Text,    "UInt32", "{ return 0; }", nullptr },             // xor eax, eax
+    { "48 33 C0",        kIdiom_Text,    "UInt64", "{ return 0; }", nullptr },             // xor rax, rax
+    { "48 31 C0",        kIdiom_Text,    "UInt64", "{ return 0; }", nullptr },             // xor rax, rax
+    { "83 C8 FF",        kIdiom_Text,    "Sint32", "{ return -1; }", nullptr },            // or eax, -1
+    { "48 83 C8 FF",     kIdiom_Text,    "SInt64", "{ return -1; }", nullptr },            // or rax, -1
     // -----------------------------------------
-    // XORPS ...
+    // XORPS, XORPD ...
     // -----------------------------------------
-    else if (code[0] == 0x0F && code[1] == 0x57 && code[2] == 0xC0)
-    {
-        // xorps xmm0, xmm0
-        ret = "float";
-        body = "{ return 0.0f; }";
-        size = 3;
-    }
+    { "0F 57 C0",        kIdiom_Text,    "float", "{ return 0.0f; }", nullptr },           // xorps xmm0, xmm0
+    { "66 0F 57 C0",     kIdiom_Text,    "double", "{ return 0.0; }", nullptr },           // xorpd xmm0, xmm0
     // -----------------------------------------
-    // MOV ...
+    // MOV ... (and MOVZX, MOVSS, MOVSD)
     // See https://www.felixcloutier.com/x86/mov
     // -----------------------------------------
-    else if (code[0] == 0xB0)
-    {
-        // mov al, imm
-        if (code[1] == 0x00)
-        {
-            ret = "bool  ";
-            body = "{ return false; }";
-        }
-        else if (code[1] == 0x01)
-        {
-            ret = "bool  ";
-            body = "{ return true; }";
-        }
-        else {
-            char buf[32];
-            sprintf_s(buf, "{ return 0x%02X; }", code[1]);
-            ret = "UInt8 ";
-            body = buf;
-        }
-        size = 2;
-    }
-    else if (code[0] == 0x8A)
-    {
-        // mov al, ???
-        if (code[1] == 0x41)
-        {
-            // mov al, [ecx+imm8]
-            char buf[48];
-            sprintf_s(buf, "{ return (UInt8)unk%X; }", (SInt8)code[2]);
-            ret = "UInt8 ";
-            body = buf;
-            size = 3;
-        }
-        else if (code[1] == 0x81)
-        {
-            // mov al, [ecx+imm32]
-            char buf[48];
-            sprintf_s(buf, "{ return (UInt8)unk%X; }", *(SInt32*)&code[2]);
-            ret = "UInt8 ";
-            body = buf;
-            size = 6;
-        }
-    }
-    else if (code[0] == 0x48 && code[1] == 0x8B)
-    {
-        // mov rax, ???
-        if (code[2] == 0xC1)
-        {
-            // mov rax, rcx
-            ret = "void *";
-            body = "{ return this; }";
-            size = 3;
-        }
-        else if (code[2] == 0x41)
-        {
-            // mov rax, [rcx+imm8]
-            char buf[48];
-            sprintf_s(buf, "{ return (UInt64)unk%X; }", (SInt8)code[3]);
-            ret = "UInt64";
-            body = buf;
-            size = 4;
-        }
-        else if (code[2] == 0x81)
-        {
-            // mov rax, [rcx+imm32]
-            char buf[48];
-            sprintf_s(buf, "{ return (UInt64)unk%X; }", *(SInt32*)&code[3]);
-            ret = "UInt64";
-            body = buf;
-            size = 7;
-        }
-    }
-    else if (code[0] == 0xB8)
-    {
-        // mov eax, imm32
-        UInt32* p = *(UInt32**)&code[1];
-        char buf[32];
-
-        const TypeDescriptor* type = GetTypeDescriptor((UInt64*)p, baseAddr);
-        if (type)
-        {
-            GetUnmangledTypeName(type, baseAddr, ret);
-            ret += " *";
-            body.reserve(ret.length() + 32);
-            body = "{ return (";
-            body += ret;
-            body += ')';
-            sprintf_s(buf, "0x%08X; }", (UInt32)p);
-            body += buf;
-        }
-        else
-        {
-            sprintf_s(buf, "{ return 0x%08X; }", (UInt32)p);
-            ret = "UInt32";
-            body = buf;
-        }
-        size = 5;
-    }
+    { "B0 00",           kIdiom_Text,    "bool  ", "{ return false; }", nullptr },         // mov al, 0
+    { "B0 01",           kIdiom_Text,    "bool  ", "{ return true; }", nullptr },          // mov al, 1
+    { "B0 u8",           kIdiom_Format,  "UInt8 ", "{ return 0x%02X; }", nullptr },        // mov al, imm8
+    { "B8 u32",          kIdiom_Pointer, "UInt32", "{ return 0x%08llX; }", nullptr },      // mov eax, imm32
+    { "8A 41 i8",        kIdiom_Format,  "UInt8 ", "{ return (UInt8)unk%X; }", nullptr },  // mov al, [rcx+disp8]
+    { "8A 81 i32",       kIdiom_Format,  "UInt8 ", "{ return (UInt8)unk%X; }", nullptr },  // mov al, [rcx+disp32]
+    { "0F B6 41 i8",     kIdiom_Format,  "UInt8 ", "{ return (UInt8)unk%X; }", nullptr },  // movzx eax, byte ptr [rcx+disp8]
+    { "0F B6 81 i32",    kIdiom_Format,  "UInt8 ", "{ return (UInt8)unk%X; }", nullptr },  // movzx eax, byte ptr [rcx+disp32]
+    { "0F B7 41 i8",     kIdiom_Format,  "UInt16", "{ return (UInt16)unk%X; }", nullptr }, // movzx eax, word ptr [rcx+disp8]
+    { "0F B7 81 i32",    kIdiom_Format,  "UInt16", "{ return (UInt16)unk%X; }", nullptr }, // movzx eax, word ptr [rcx+disp32]
+    { "8B 41 i8",        kIdiom_Format,  "UInt32", "{ return (UInt32)unk%X; }", nullptr }, // mov eax, [rcx+disp8]
+    { "8B 81 i32",       kIdiom_Format,  "UInt32", "{ return (UInt32)unk%X; }", nullptr }, // mov eax, [rcx+disp32]
+    { "48 8B C1",        kIdiom_Text,    "void *", "{ return this; }", nullptr },          // mov rax, rcx
+    { "48 8B 41 i8",     kIdiom_Format,  "UInt64", "{ return (UInt64)unk%X; }", nullptr }, // mov rax, [rcx+disp8]
+    { "48 8B 81 i32",    kIdiom_Format,  "UInt64", "{ return (UInt64)unk%X; }", nullptr }, // mov rax, [rcx+disp32]
+    { "F3 0F 10 41 i8",  kIdiom_Format,  "float", "{ return (float)unk%X; }", nullptr },   // movss xmm0, [rcx+disp8]
+    { "F3 0F 10 81 i32", kIdiom_Format,  "float", "{ return (float)unk%X; }", nullptr },   // movss xmm0, [rcx+disp32]
+    { "F2 0F 10 41 i8",  kIdiom_Format,  "double", "{ return (double)unk%X; }", nullptr }, // movsd xmm0, [rcx+disp8]
+    { "F2 0F 10 81 i32", kIdiom_Format,  "double", "{ return (double)unk%X; }", nullptr }, // movsd xmm0, [rcx+disp32]
+    { "F3 0F 10 05 r32", kIdiom_Float,   "float", "{ return %s; }", nullptr },             // movss xmm0, [rip+disp32]
+    { "F2 0F 10 05 r32", kIdiom_Double,  "double", "{ return %s; }", nullptr },            // movsd xmm0, [rip+disp32]
+    { "8B C2",           kIdiom_Text,    "UInt32", "{ return arg; }", "UInt32 arg" },      // mov eax, edx
+    { "48 8B C2",        kIdiom_Text,    "UInt64", "{ return arg; }", "UInt64 arg" },      // mov rax, rdx
+    // Setters.
+    { "88 51 i8",        kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt8 arg" },      // mov [rcx+disp8], dl
+    { "88 91 i32",       kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt8 arg" },      // mov [rcx+disp32], dl
+    { "89 51 i8",        kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt32 arg" },     // mov [rcx+disp8], edx
+    { "89 91 i32",       kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt32 arg" },     // mov [rcx+disp32], edx
+    { "48 89 51 i8",     kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt64 arg" },     // mov [rcx+disp8], rdx
+    { "48 89 91 i32",    kIdiom_Format,  "void  ", "{ unk%X = arg; }", "UInt64 arg" },     // mov [rcx+disp32], rdx
+    { "F3 0F 11 49 i8",  kIdiom_Format,  "void  ", "{ unk%X = arg; }", "float arg" },      // movss [rcx+disp8], xmm1
+    { "F3 0F 11 89 i32", kIdiom_Format,  "void  ", "{ unk%X = arg; }", "float arg" },      // movss [rcx+disp32], xmm1
+    { "C6 41 i8 u8",     kIdiom_Format,  "void  ", "{ unk%X = 0x%02X; }", nullptr },       // mov byte ptr [rcx+disp8], imm8
+    { "C6 81 i32 u8",    kIdiom_Format,  "void  ", "{ unk%X = 0x%02X; }", nullptr },       // mov byte ptr [rcx+disp32], imm8
+    { "C7 41 i8 u32",    kIdiom_Format,  "void  ", "{ unk%X = 0x%X; }", nullptr },         // mov dword ptr [rcx+disp8], imm32
+    { "C7 81 i32 u32",   kIdiom_Format,  "void  ", "{ unk%X = 0x%X; }", nullptr },         // mov dword ptr [rcx+disp32], imm32
     // -----------------------------------------
     // LEA r64,m
     // REX.W + 8D /r
     // See https://www.felixcloutier.com/x86/lea
     // N.B. reg == 000 for RAX
     // -----------------------------------------
-    else if (code[0] == 0x48 && code[1] == 0x8D)
+    { "48 8D 41 i8",     kIdiom_Format,  "void *", "{ return &unk%X; }", nullptr },        // lea rax, [rcx+disp8]
+    { "48 8D 81 i32",    kIdiom_Format,  "void *", "{ return &unk%X; }", nullptr },        // lea rax, [rcx+disp32]
+    { "48 8D 05 r32",    kIdiom_Pointer, "void *", "{ return (void *)0x%llX; }", nullptr }, // lea rax, [rip+disp32]
+};
+
+// ============================================================================
+//   The same, for functions of two or three instructions (before the "retn").
+// ============================================================================
+static const FuncIdiom FUNC_SEQUENCES[] = {
+    // -----------------------------------------
+    // CMP / TEST ..., then SETcc al
+    // See https://www.felixcloutier.com/x86/setcc
+    // -----------------------------------------
+    { "80 79 i8 u8 0F u8 C0",      kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp byte ptr [rcx+disp8], imm8
+    { "80 B9 i32 u8 0F u8 C0",     kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp byte ptr [rcx+disp32], imm8
+    { "83 79 i8 i8 0F u8 C0",      kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp dword ptr [rcx+disp8], imm8
+    { "83 B9 i32 i8 0F u8 C0",     kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp dword ptr [rcx+disp32], imm8
+    { "48 83 79 i8 i8 0F u8 C0",   kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp qword ptr [rcx+disp8], imm8
+    { "48 83 B9 i32 i8 0F u8 C0",  kIdiom_Compare, "bool  ", "{ return unk%X %s %d; }", nullptr }, // cmp qword ptr [rcx+disp32], imm8
+    { "F6 41 i8 u8 0F 95 C0",      kIdiom_Format,  "bool  ", "{ return (unk%X & 0x%02X) != 0; }", nullptr }, // test byte ptr [rcx+disp8], imm8; setne al
+    { "F6 41 i8 u8 0F 94 C0",      kIdiom_Format,  "bool  ", "{ return (unk%X & 0x%02X) == 0; }", nullptr }, // test byte ptr [rcx+disp8], imm8; sete al
+    { "F6 81 i32 u8 0F 95 C0",     kIdiom_Format,  "bool  ", "{ return (unk%X & 0x%02X) != 0; }", nullptr }, // test byte ptr [rcx+disp32], imm8; setne al
+    { "F6 81 i32 u8 0F 94 C0",     kIdiom_Format,  "bool  ", "{ return (unk%X & 0x%02X) == 0; }", nullptr }, // test byte ptr [rcx+disp32], imm8; sete al
+    // -----------------------------------------
+    // Masked and shifted fields (flags, bitfields).
+    // -----------------------------------------
+    { "0F B6 41 i8 24 u8",         kIdiom_Format,  "UInt8 ", "{ return unk%X & 0x%02X; }", nullptr }, // movzx eax, byte ptr [rcx+disp8]; and al, imm8
+    { "0F B6 81 i32 24 u8",        kIdiom_Format,  "UInt8 ", "{ return unk%X & 0x%02X; }", nullptr }, // movzx eax, byte ptr [rcx+disp32]; and al, imm8
+    { "8B 41 i8 83 E0 i8",         kIdiom_Format,  "UInt32", "{ return unk%X & 0x%X; }", nullptr }, // mov eax, [rcx+disp8]; and eax, imm8
+    { "8B 81 i32 83 E0 i8",        kIdiom_Format,  "UInt32", "{ return unk%X & 0x%X; }", nullptr }, // mov eax, [rcx+disp32]; and eax, imm8
+    { "8B 41 i8 25 u32",           kIdiom_Format,  "UInt32", "{ return unk%X & 0x%X; }", nullptr }, // mov eax, [rcx+disp8]; and eax, imm32
+    { "8B 81 i32 25 u32",          kIdiom_Format,  "UInt32", "{ return unk%X & 0x%X; }", nullptr }, // mov eax, [rcx+disp32]; and eax, imm32
+    { "0F B6 41 i8 C0 E8 u8 24 01",  kIdiom_Format, "UInt8 ", "{ return (unk%X >> %u) & 1; }", nullptr }, // movzx eax, byte ptr [rcx+disp8]; shr al, imm8; and al, 1
+    { "0F B6 81 i32 C0 E8 u8 24 01", kIdiom_Format, "UInt8 ", "{ return (unk%X >> %u) & 1; }", nullptr }, // movzx eax, byte ptr [rcx+disp32]; shr al, imm8; and al, 1
+    { "8B 41 i8 C1 E8 u8 83 E0 01",  kIdiom_Format, "UInt32", "{ return (unk%X >> %u) & 1; }", nullptr }, // mov eax, [rcx+disp8]; shr eax, imm8; and eax, 1
+    { "8B 81 i32 C1 E8 u8 83 E0 01", kIdiom_Format, "UInt32", "{ return (unk%X >> %u) & 1; }", nullptr }, // mov eax, [rcx+disp32]; shr eax, imm8; and eax, 1
+    // -----------------------------------------
+    // A field of a field.
+    // -----------------------------------------
+    { "48 8B 41 i8 48 8B 40 i8",   kIdiom_Format,  "UInt64", "{ return unk%X->unk%X; }", nullptr }, // mov rax, [rcx+disp8]; mov rax, [rax+disp8]
+    { "48 8B 41 i8 48 8B 80 i32",  kIdiom_Format,  "UInt64", "{ return unk%X->unk%X; }", nullptr }, // mov rax, [rcx+disp8]; mov rax, [rax+disp32]
+    { "48 8B 81 i32 48 8B 40 i8",  kIdiom_Format,  "UInt64", "{ return unk%X->unk%X; }", nullptr }, // mov rax, [rcx+disp32]; mov rax, [rax+disp8]
+    { "48 8B 81 i32 48 8B 80 i32", kIdiom_Format,  "UInt64", "{ return unk%X->unk%X; }", nullptr }, // mov rax, [rcx+disp32]; mov rax, [rax+disp32]
+};
+
+static void SimpleFunctionDecompiler(const UInt64 funcAddr, std::string& retOut, std::string& paramsOut,
+                                     std::string& bodyOut, const ImageLayout& layout, const RTTIDatabase& db)
+{
+    // ------------------------------------------------------------------------
+    // Attempt to decompile a simple function of form:
+    //         [<some instructions>]
+    //         "retn" | "retn imm16"
+    // where the instructions are one of FUNC_IDIOMS, one of FUNC_SEQUENCES,
+    // or missing. They're found by decoding as far as the "retn"; a function
+    // that jumps, calls or is longer than FUNC_MAX_INSTRUCTIONS before it
+    // isn't simple, and nor is one that would run past its end (as far as
+    // the function index knows; see GetFunctionLimit).
+    // ------------------------------------------------------------------------
+    // See https://www.felixcloutier.com/x86/ret
+    //     https://learn.microsoft.com/en-us/windows-hardware/drivers/debugger/x64-architecture
+    static const BytePatternSet idioms =
+        CompileFuncIdioms(FUNC_IDIOMS, sizeof(FUNC_IDIOMS) / sizeof(FUNC_IDIOMS[0]));
+    static const BytePatternSet sequences =
+        CompileFuncIdioms(FUNC_SEQUENCES, sizeof(FUNC_SEQUENCES) / sizeof(FUNC_SEQUENCES[0]));
+
+    const UInt8* code = (const UInt8*)funcAddr;
+    const std::size_t limit = (std::size_t)(GetFunctionLimit(layout, funcAddr) - funcAddr);
+    std::size_t size = 0;
+    UInt32 numInstructions = 0;
+    X64Instruction insn;
+    for (;;)
     {
-        // lea rax, ???
-        if (code[2] == 0x41)
-        {
-            // lea rax, [rcx+imm8]
-            char buf[32];
-            sprintf_s(buf, "{ return &unk%X; }", (SInt8)code[3]);
-            ret = "void *";
-            body = buf;
-            size = 4;
-        }
-        else if (code[2] == 0x81)
-        {
-            // lea rax, [rcx+imm32]
-            char buf[32];
-            sprintf_s(buf, "{ return &unk%X; }", *(SInt32*)&code[3]);
-            ret = "void *";
-            body = buf;
-            size = 7;
-        }
-        else if (code[3] == 0x05)
-        {
-            // lea rax, [rbx+imm32]
-            UInt32* p = *(UInt32**)&code[4];
-            char buf[32];
+        if (!DecodeX64Instruction(code + size, insn) || size + insn.length > limit) return;
+        if (insn.flow == kX64Flow_Return) break;
+        if (insn.flow != kX64Flow_Next || ++numInstructions > FUNC_MAX_INSTRUCTIONS) return;
+        size += insn.length;
+    }
 
-            const TypeDescriptor* type = GetTypeDescriptor((UInt64*)p, baseAddr);
-            if (type)
-            {
-                GetUnmangledTypeName(type, baseAddr, ret);
-                ret += " *";
-                body.reserve(ret.length() + 32);
-                body = "{ return (";
-                body += ret;
-                body += ')';
-                sprintf_s(buf, "0x%08X; }", (UInt32)p);
-                body += buf;
-            }
-            else
-            {
-                sprintf_s(buf, "{ return 0x%08X; }", (UInt32)p);
-                ret = "UInt32";
-                body = buf;
-            }
-            size = 7;
+    std::string ret = "????  ";
+    std::string body;
+    const char* idiomParams = nullptr;
+    if (numInstructions > 0)
+    {
+        // The idiom has to account for all of them.
+        const BytePatternSet& patterns = (numInstructions == 1) ? idioms : sequences;
+        SInt64 captures[BYTE_PATTERN_MAX_CAPTURES] = {};
+        const UInt32 match = MatchBytePatterns(patterns, code, captures);
+        if (match == BYTE_PATTERN_NONE || patterns.patterns[match].length != size) {
+            return;
+        }
+        const FuncIdiom& idiom = (numInstructions == 1) ? FUNC_IDIOMS[match] : FUNC_SEQUENCES[match];
+        if (!FormatFuncIdiom(idiom, captures, layout, db, ret, body)) {
+            return;
         }
+        idiomParams = idiom.params;
     }
 
     // Increment the code pointer by 'size' bytes, so
-    // we're ready to parse the next bytes.
+    // we're ready to parse the "retn". 'insn' is its decoding.
     code += size;
 
-    // Parse the second instruction.
     std::string params;
-    if (code[0] == 0xC3)
+    if (insn.opcode == 0xC3)
     {
-        // retn
+        // retn, with or without prefixes (e.g. "rep retn")
         params = "void";
     }
-    else if (code[0] == 0xC2)
+    else
     {
-        // retn imm16
-        UInt16 imm = *(UInt16*)&code[1];
+        // retn imm16. With a prefix, it's not one a compiler would emit.
+        if (insn.opcode != 0xC2 || insn.numPrefixes != 0 || insn.rex != 0 || insn.immSize != 2) {
+            return;
+        }
+        UInt16 imm = *(const UInt16*)(code + insn.immOffset);
         switch (imm)
         {
         case 0:
@@ -722,22 +1282,192 @@ static void SimpleFunctionDecompiler(const UInt64 funcAddr, std::string& retOut,
         }
         break;
         }
-
-    }
-    else
-    {
-        // second instruction isn't a retn, so give up and
-        // don't infer anything about the function.
-        return;
     }
 
-    if (size == 0)
+    if (numInstructions == 0)
     {
         ret = "void  ";
         body = "{ return; }";
     }
+    if (idiomParams) {
+        params = idiomParams;
+    }
 
     retOut = ret;
     paramsOut = params;
     bodyOut = body;
 }
+
+static bool GetThisAdjustment(const UInt8* code, const X64Instruction& insn, SInt32& delta)
+{
+    // ------------------------------------------------------------------------
+    // If the instruction at 'code' is how an adjustor thunk adjusts 'this'
+    // (rcx) - one of
+    //         "add rcx, imm8" | "add rcx, imm32"
+    //         "sub rcx, imm8" | "sub rcx, imm32"
+    //         "lea rcx, [rcx+disp8]" | "lea rcx, [rcx+disp32]"
+    // - return TRUE, with what it adds to 'this' in 'delta'.
+    // ------------------------------------------------------------------------
+    if (insn.rex != 0x48 || insn.numPrefixes != 0 || insn.map != kX64Map_Primary) {
+        return false;
+    }
+
+    const UInt8* operand;
+    UInt32 size;
+    if ((insn.opcode == 0x83 || insn.opcode == 0x81) && (insn.modrm == 0xC1 || insn.modrm == 0xE9)) {
+        operand = code + insn.immOffset;
+        size = insn.immSize;
+    }
+    else if (insn.opcode == 0x8D && (insn.modrm == 0x49 || insn.modrm == 0x89)) {
+        operand = code + insn.dispOffset;
+        size = insn.dispSize;
+    }
+    else {
+        return false;
+    }
+
+    SInt32 value;
+    if (size == 1) {
+        value = (SInt8)operand[0];
+    }
+    else {
+        std::memcpy(&value, operand, sizeof(value));
+    }
+    delta = (insn.modrm == 0xE9) ? 0 - value : value;
+    return true;
+}
+
+static BytePatternSet CompileFuncIdioms(const FuncIdiom* idioms, const UInt32 numIdioms)
+{
+    // ------------------------------------------------------------------------
+    // The automaton for a table of idioms. SimpleFunctionDecompiler compiles
+    // each table the first time it's called. (PrintVirtuals' threads may all
+    // get there at once, but the initialisation of a static local is
+    // thread-safe.)
+    // ------------------------------------------------------------------------
+    BytePatternSet set;
+    for (UInt32 i = 0; i < numIdioms; ++i) {
+        AddBytePattern(set, idioms[i].bytes);
+    }
+    FinishBytePatterns(set);
+    return set;
+}
+
+static bool FormatFuncIdiom(const FuncIdiom& idiom, const SInt64* captures, const ImageLayout& layout,
+                            const RTTIDatabase& db, std::string& ret, std::string& body)
+{
+    // ------------------------------------------------------------------------
+    // Set the return type and body of a function that starts with 'idiom',
+    // given the values of its captures. Return FALSE if that can't be done
+    // after all, e.g. because its constant can't be read.
+    // ------------------------------------------------------------------------
+    char buf[64];
+    ret = idiom.ret;
+    switch (idiom.action)
+    {
+    case kIdiom_Text:
+        body = idiom.body;
+        break;
+    case kIdiom_Format:
+        sprintf_s(buf, idiom.body, (UInt32)captures[0], (UInt32)captures[1], (UInt32)captures[2]);
+        body = buf;
+        break;
+    case kIdiom_Compare:
+    {
+        // Capture 2 is the SETcc's second byte, 90 + the condition code.
+        static const char* const CONDITIONS[16] = {
+            nullptr, nullptr, "<", ">=", "==", "!=", "<=", ">",    // o no b ae e ne be a
+            nullptr, nullptr, nullptr, nullptr, "<", ">=", "<=", ">",    // s ns p np l ge le g
+        };
+        const char* condition = ((captures[2] & 0xF0) == 0x90) ? CONDITIONS[captures[2] & 0x0F] : nullptr;
+        if (!condition) return false;
+        sprintf_s(buf, idiom.body, (UInt32)captures[0], condition, (int)captures[1]);
+        body = buf;
+    }
+    break;
+    case kIdiom_Pointer:
+    {
+        // If it's a VFT, we know what the function returns.
+        const TypeDescriptor* type = GetTypeDescriptor((const UInt64*)captures[0], layout);
+        if (type)
+        {
+            GetTypeName(type, layout, &db, ret);
+            ret += " *";
+            body.reserve(ret.length() + 32);
+            body = "{ return (";
+            body += ret;
+            body += ')';
+            sprintf_s(buf, "0x%08llX; }", (unsigned long long)captures[0]);
+            body += buf;
+        }
+        else
+        {
+            sprintf_s(buf, idiom.body, (unsigned long long)captures[0]);
+            body = buf;
+        }
+    }
+    break;
+    case kIdiom_Float:
+    case kIdiom_Double:
+    {
+        const bool isFloat = idiom.action == kIdiom_Float;
+        float f = 0.0f;
+        double value;
+        if (isFloat)
+        {
+            if (!SafeRead((const void*)captures[0], &f, sizeof(f))) return false;
+            value = f;
+        }
+        else if (!SafeRead((const void*)captures[0], &value, sizeof(value))) {
+            return false;
+        }
+
+        // The shortest text that reads back as the same value, and looks
+        // like a floating-point constant, e.g. "0.1" rather than "0.100000001",
+        // "2.0" rather than "2" and "2.0f" for a float. Infinities and NaNs
+        // have no literals; <cmath>'s macros will do instead.
+        std::string constant;
+        if (std::isinf(value)) {
+            constant = (value < 0) ? "-INFINITY" : "INFINITY";
+        }
+        else if (std::isnan(value)) {
+            constant = "NAN";
+        }
+        else
+        {
+            char text[40];
+            const int maxPrecision = isFloat ? 9 : 17;
+            for (int precision = isFloat ? 6 : 15; ; ++precision)
+            {
+                sprintf_s(text, "%.*g", precision, value);
+                const double back = std::strtod(text, nullptr);
+                if (precision == maxPrecision || (isFloat ? (float)back == f : back == value)) break;
+            }
+            constant = text;
+            if (constant.find_first_of(".eE") == std::string::npos) {
+                constant += ".0";
+            }
+            if (isFloat) {
+                constant += 'f';
+            }
+        }
+        sprintf_s(buf, idiom.body, constant.c_str());
+        body = buf;
+    }
+    break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+static void MergeSortedFuncs(std::vector<UInt32>& funcs, const std::size_t sorted)
+{
+    // ------------------------------------------------------------------------
+    // 'funcs' is sorted and distinct up to 'sorted', and has had some more
+    // OFFSETs appended. Sort those, and merge them into the rest.
+    // ------------------------------------------------------------------------
+    std::sort(funcs.begin() + sorted, funcs.end());
+    std::inplace_merge(funcs.begin(), funcs.begin() + sorted, funcs.end());
+    funcs.erase(std::unique(funcs.begin(), funcs.end()), funcs.end());
+}
@@ -27,30 +27,18 @@
 // ============================================================================
 #pragma once
 
-#include <list>
-#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
-#include "common/ITypes.h"
-
-// ============================================================================
-//                Section Offsets (from base module address)
-// ----------------------------------------------------------------------------
-// These are all correct for Skyrim 1.6.659 (GOG version).
-// Refer MODULE SUMMARY header in skyretk_dump_rtti.log.
-// ============================================================================
-// 0: .text (+rx)
-const UInt64 TEXT_SEG_BEGIN       = 0x00001000;  // start
-const UInt64 PURE_CALL_ADDR       = 0x01471648;
-const UInt64 TEXT_SEG_END         = 0x015fcb8c;  // end
-
-// 1: .rdata (+r)
-const UInt64 RDATA_SEG_BEGIN      = 0x015fd000;  // start
-const UInt64 TYPE_INFO_VTBL       = 0x019752c0;
-const UInt64 RDATA_SEG_END        = 0x01e3c276;  // end 
-
-// 2: .data (+rw)
-const UInt64 DATA_SEG_BEGIN       = 0x01e3d000;  // start
-const UInt64 DATA_SEG_END         = 0x0352baf0;  // end
+#include "BytePattern.h"
+#include "LogWriter.h"
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTIDatabase.h"
+#include "X64Length.h"
 
 // ============================================================================
 //                          RTTI structures.
@@ -92,6 +80,18 @@ struct RTTIBaseClassDescriptor
     UInt32        attributes;          // 14: flags, usually 0
 };
 
+// RTTIBaseClassDescriptor::attributes.
+enum RTTIBaseClassAttributes
+{
+    kBCD_NotVisible       = 0x01,      // a private or protected base
+    kBCD_Ambiguous        = 0x02,      // occurs more than once in the class
+    kBCD_PrivOrProtBase   = 0x04,
+    kBCD_PrivOrProtInCompObj = 0x08,
+    kBCD_VbOfContObj      = 0x10,      // a virtual base of the class it's contained in
+    kBCD_NonPolymorphic   = 0x20,
+    kBCD_HasPCHD          = 0x40,      // followed by the OFFSET to its own RTTIClassHierarchyDescriptor
+};
+
 // "Class Hierarchy Descriptor describes the inheritance hierarchy
 //  of the class. It is shared by all COLs for a class."
 //        - http://www.openrce.org/articles/full_view/23
@@ -120,31 +120,161 @@ struct RTTICompleteObjectLocator
     UInt32        pSelf;               // 14: contains the OFFSET to this RTTICompleteObjectLocator.
 };
 
-typedef std::list<UInt64*> VtblList;
+// The passes LoadVTables makes over the image, in order. See RTTI.cpp.
+enum VtblScanPass
+{
+    kVtblPass_TypeDescriptors,         // .data: TypeDescriptors
+    kVtblPass_COLs,                    // .rdata: their COLs
+    kVtblPass_MetaFields,              // .rdata: VFT meta fields referencing those COLs
+    kVtblPass_Count
+};
+
+// The indexes built by the passes; each pass consults the previous ones'.
+struct VtblScan
+{
+    std::unordered_set<UInt32> typeDescriptors;    // TypeDescriptor OFFSETs
+    std::unordered_map<UInt32, std::vector<RTTICompleteObjectLocator*>> colsByType;
+    std::unordered_map<UInt32, std::vector<UInt64*>> vtblsByCol;    // COL OFFSET => VFTs
+};
+
+// What one pass found in one chunk of its section.
+struct VtblChunkHits
+{
+    std::vector<UInt32> typeDescriptors;
+    std::vector<RTTICompleteObjectLocator*> cols;
+    std::vector<std::pair<UInt32, UInt64*>> vtbls;    // (COL OFFSET, VFT)
+};
+
+// PrintVirtuals formats this many classes at a time, in blocks of
+// PRINT_BLOCK_CLASSES (one block per task).
+const UInt32 PRINT_BATCH_CLASSES  = 1024;
+const UInt32 PRINT_BLOCK_CLASSES  = 16;
+
+// Called by PrintVirtuals after printing each class, with the number of
+// classes printed so far and the total. Anything it logs should go to 'out'.
+typedef void (*RTTIProgressFn)(LogWriter& out, const UInt32 done, const UInt32 total);
+
+// What SimpleFunctionDecompiler makes of a function whose instructions
+// before the "retn" match one of its idioms (FUNC_IDIOMS and FUNC_SEQUENCES
+// in RTTI.cpp). It decodes at most FUNC_MAX_INSTRUCTIONS of them.
+const UInt32 FUNC_MAX_INSTRUCTIONS = 4;
+
+// Many VFT slots don't point to the function itself, but to a thunk that
+// jumps to it: an incremental linking stub ("jmp rel32"), or an adjustor
+// thunk for a base class that isn't first in memory ("sub rcx, N" then
+// "jmp"). ResolveFuncThunk follows at most FUNC_MAX_THUNKS of them.
+const UInt32 FUNC_MAX_THUNKS      = 8;
+
+enum FuncIdiomAction
+{
+    kIdiom_Text,                       // the body is 'body'
+    kIdiom_Format,                     // 'body' is a format for the captures, as UInt32s
+    kIdiom_Compare,                    // CMP then SETcc: 'body' formats capture 0, the condition and capture 1
+    kIdiom_Pointer,                    // capture 0 is an address: "(<class> *)" if it's a VFT, else 'body' formats it as a UInt64
+    kIdiom_Float,                      // capture 0 is the address of a float, which 'body' formats as a string
+    kIdiom_Double,                     // ... of a double
+};
+
+struct FuncIdiom
+{
+    const char*   bytes;               // the instructions, as a byte pattern (see BytePattern.h)
+    UInt32        action;              // FuncIdiomAction
+    const char*   ret;
+    const char*   body;
+    const char*   params;              // or nullptr to infer them from the "retn"
+};
+
+// Many VFT slots point to the same function: a base class's implementation,
+// identical trivial functions folded together by the linker, _purecall. So
+// PrintVirtuals decompiles each function once, up front, and looks the
+// result up for every slot that points to it. The functions are decompiled
+// FUNC_CHUNK_FUNCS at a time, one chunk per task (or per incremental step).
+const UInt32 FUNC_CHUNK_FUNCS     = 256;
+
+struct RTTIFuncEntry
+{
+    UInt32        pFunc;               // 00: OFFSET to the function (never a thunk)
+    UInt32        text;                // 04: offset in 'text' of its return type, params and body, back to back
+    UInt16        retLength;           // 08
+    UInt16        paramsLength;        // 0A
+    UInt16        bodyLength;          // 0C
+};
+
+struct RTTIFuncThunk
+{
+    UInt32        pThunk;              // 00: OFFSET to the thunk, i.e. what the VFT slot holds
+    UInt32        pFunc;               // 04: OFFSET to the function it ends up at
+    SInt32        thisAdjust;          // 08: what it adds to 'this' on the way, if anything
+};
+
+struct RTTIFuncCache
+{
+    std::vector<RTTIFuncEntry> funcs;  // in ascending address order
+    std::vector<RTTIFuncThunk> thunks; // in ascending address order
+    std::vector<char> text;
+    UInt32        numSlots;            // the VFT slots PrintVtbl decompiles, i.e. lookups
+};
 
 // ============================================================================
 //                             Functions.
 // ============================================================================
 // public:
-void LoadVTables(const UInt64 baseAddr, std::map<UInt64, VtblList>& vtblMap);
+void LoadVTables(const ImageLayout& layout, RTTIDatabase& db, const unsigned numThreads = 0);
+
+const ImageRange& GetVtblPassRange(const ImageLayout& layout, const VtblScanPass pass);
+
+void ScanVtblChunk(const ImageLayout& layout, const VtblScan& scan, const VtblScanPass pass,
+                   const ImageRange& chunk, VtblChunkHits& hits);
+
+void MergeVtblChunk(VtblScan& scan, const VtblScanPass pass, const VtblChunkHits& hits);
+
+void JoinVTables(const ImageLayout& layout, VtblScan& scan, RTTIDatabase& db);
+
+void PrintVirtuals(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db,
+                   RTTIProgressFn progress = nullptr, const unsigned numThreads = 0);
+
+void PrintClass(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 t,
+                const RTTIFuncCache* funcs = nullptr);
+
+void PrintClassHeader(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 t);
+
+void PrintVtbl(LogWriter& out, const ImageLayout& layout, const RTTIDatabase& db, const UInt32 v,
+               const RTTIFuncCache* funcs = nullptr);
+
+void BuildFuncCache(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache,
+                    const unsigned numThreads = 0);
+
+void CollectVirtualFuncs(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache);
+
+void CollectVtblFuncChunk(const ImageLayout& layout, const RTTIDatabase& db, const UInt32 first,
+                          const UInt32 last, RTTIFuncCache& cache, std::vector<UInt32>& funcs);
+
+void ResolveThunkChunk(const ImageLayout& layout, const std::vector<UInt32>& funcs, const UInt32 first,
+                       const UInt32 last, RTTIFuncCache& cache, std::vector<UInt32>& targets);
+
+void FinishVirtualFuncs(RTTIFuncCache& cache, const std::vector<UInt32>& targets);
+
+void DecompileFuncChunk(const ImageLayout& layout, const RTTIDatabase& db, RTTIFuncCache& cache,
+                        const UInt32 first, const UInt32 last, std::vector<char>& text);
+
+void MergeFuncChunk(RTTIFuncCache& cache, const UInt32 first, const UInt32 last, const std::vector<char>& text);
 
-void PrintVirtuals(const UInt64 baseAddr, const std::map<UInt64, VtblList> vtblMap);
+const RTTIFuncEntry* FindFuncEntry(const RTTIFuncCache& cache, const UInt32 pFunc);
 
-void DumpObjectClassHierarchy(const UInt64* vtbl, const bool verbose, const UInt64 baseAddr);
+const RTTIFuncThunk* FindFuncThunk(const RTTIFuncCache& cache, const UInt32 pThunk);
 
-// private:
-static void UnmangleRTTITypeName(const char* mangled, std::string& unmangled);
+UInt32 ResolveFuncThunk(const ImageLayout& layout, const UInt32 pFunc, SInt32& thisAdjust);
 
-static void GetUnmangledTypeName(const TypeDescriptor* type, const UInt64 baseAddr, std::string& unmangled);
+void ReportFuncCache(const RTTIFuncCache& cache);
 
-static const TypeDescriptor* GetTypeDescriptor(const UInt64* vtbl, const UInt64 baseAddr);
+void DumpObjectClassHierarchy(LogWriter& out, const UInt64* vtbl, const bool verbose, const ImageLayout& layout,
+                              const RTTIDatabase* db = nullptr);
 
-static UInt64* GetParentVtbl(const UInt64* vtbl, const std::map<UInt64, VtblList> vtblMap, const UInt64 baseAddr);
+void GetUnmangledTypeName(const TypeDescriptor* type, const ImageLayout& layout, std::string& unmangled);
 
-static bool GetTypeHierarchyInfo(const UInt64* vtbl, std::string& name, UInt32& offset,
-                                 RTTIClassHierarchyDescriptor*& hierarchy, const UInt64 baseAddr);
+bool IsTypeDescriptor(const ImageLayout& layout, const UInt32 pTypeDescriptor);
 
-static void GetObjectClassName(const UInt64* vtbl, const UInt64 baseAddr, std::string& name);
+const RTTIClassHierarchyDescriptor* GetClassHierarchy(const ImageLayout& layout, const UInt32 pClassDescriptor,
+                                                      UInt32& numBaseClasses);
 
-static void SimpleFunctionDecompiler(const UInt64 funcAddr, std::string& retOut, std::string& paramsOut,
-                                     std::string& bodyOut, const UInt64 baseAddr);
+void UnmangleRTTITypeName(const char* mangled, std::string& unmangled);
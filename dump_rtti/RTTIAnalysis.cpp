@@ -0,0 +1,359 @@
+// ============================================================================
+// dump_rtti/RTTIAnalysis.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include "Parallel.h"
+#include "RTTIAnalysis.h"
+#include "RTTICache.h"
+
+static void DoAnalysisUnit(RTTIAnalysis& a);
+
+static void StartVtblPass(RTTIAnalysis& a, const VtblScanPass pass);
+
+static void StartPrinting(RTTIAnalysis& a);
+
+// ============================================================================
+//   Set up 'a' to analyse the image at 'baseAddr'. No work is done until the
+//   first call to StepRTTIAnalysis.
+// ============================================================================
+void StartRTTIAnalysis(RTTIAnalysis& a, const UInt64 baseAddr, const char* fileName, const char* cachePath,
+                       RTTIProgressFn progress, LogSinkFn sink)
+{
+    a.baseAddr = baseAddr;
+    a.fileName = fileName ? fileName : "";
+    a.cachePath = cachePath ? cachePath : "";
+    a.progress = progress;
+    OpenLogWriter(a.out, LOG_FLUSH_SIZE, sink);
+
+    a.stage = kAnalysis_Start;
+    a.fromCache = false;
+    ClearRTTIDatabase(a.db);
+    a.reloc = 0;
+    a.codeRefs.clear();
+    a.scan = VtblScan();
+    a.chunks.clear();
+    a.chunk = 0;
+    a.name = 0;
+    a.slotFuncs.clear();
+    a.targets.clear();
+    a.funcs = RTTIFuncCache();
+    a.func = 0;
+    a.type = 0;
+    a.vtbl = 0;
+
+    a.startTime = std::chrono::steady_clock::now();
+    a.wallTime = 0.0;
+    a.cpuTime = 0.0;
+    a.longestStep = 0.0;
+    a.numSteps = 0;
+}
+
+// ============================================================================
+//   Do about 'budget' microseconds of work (0 means no limit, i.e. finish the
+//   analysis). Returns TRUE if there's more to do.
+// ============================================================================
+bool StepRTTIAnalysis(RTTIAnalysis& a, const UInt32 budget)
+{
+    if (a.stage == kAnalysis_Done || a.stage == kAnalysis_Failed) return false;
+
+    const auto stepStart = std::chrono::steady_clock::now();
+    const auto deadline = stepStart + std::chrono::microseconds(budget);
+    const double cpuStart = GetThreadCpuTime();
+    do {
+        DoAnalysisUnit(a);
+    } while (a.stage != kAnalysis_Done && a.stage != kAnalysis_Failed &&
+             (budget == 0 || std::chrono::steady_clock::now() < deadline));
+
+    const auto stepEnd = std::chrono::steady_clock::now();
+    std::chrono::duration<double> step = stepEnd - stepStart;
+    a.cpuTime += GetThreadCpuTime() - cpuStart;
+    if (step.count() > a.longestStep) a.longestStep = step.count();
+    a.numSteps++;
+
+    if (a.stage == kAnalysis_Done || a.stage == kAnalysis_Failed) {
+        FlushLogWriter(a.out);
+        std::chrono::duration<double> wall = stepEnd - a.startTime;
+        a.wallTime = wall.count();
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static void DoAnalysisUnit(RTTIAnalysis& a)
+{
+    switch (a.stage)
+    {
+    case kAnalysis_Start:
+        // --------------------------------------------------------------------
+        // The headers, and the cache if there is one. Both are quick.
+        // --------------------------------------------------------------------
+        PrintModuleSummary(a.fileName.empty() ? nullptr : a.fileName.c_str(), a.baseAddr);
+        if (!GetImageSections(a.baseAddr, a.layout)) {
+            _ERROR("couldn't find the RTTI in the executable");
+            a.stage = kAnalysis_Failed;
+            return;
+        }
+        if (!a.cachePath.empty() && LoadRTTICache(a.cachePath.c_str(), a.layout, a.db)) {
+            _MESSAGE("RTTI cache: loaded %u classes from %s.", (UInt32)a.db.types.size(), a.cachePath.c_str());
+            a.fromCache = true;
+            a.stage = kAnalysis_Link;
+            return;
+        }
+        a.reloc = 0;
+        a.stage = kAnalysis_Relocs;
+        return;
+
+    case kAnalysis_Relocs:
+        // --------------------------------------------------------------------
+        // A chunk of the base relocation table. See GetImageLayout.
+        // --------------------------------------------------------------------
+        if (LoadPointerSlotChunk(a.baseAddr, a.layout.pointerSlots, a.reloc)) {
+            SplitRange(a.layout.data, a.chunks);
+            a.chunk = 0;
+            a.stage = kAnalysis_TypeInfo;
+        }
+        return;
+
+    case kAnalysis_TypeInfo:
+        // --------------------------------------------------------------------
+        // One chunk of .data, until type_info's TypeDescriptor turns up.
+        // --------------------------------------------------------------------
+        if (a.chunk < a.chunks.size()) {
+            a.layout.typeInfoVtbl = FindTypeInfoVtbl(a.layout, a.chunks[a.chunk]);
+            a.chunk++;
+        }
+        if (a.layout.typeInfoVtbl) {
+            a.codeRefs.clear();
+            SplitRange(a.layout.rdata, a.chunks);
+            a.chunk = 0;
+            a.stage = kAnalysis_PureCall;
+        }
+        else if (a.chunk == a.chunks.size()) {
+            _ERROR("couldn't find the RTTI in the executable");
+            a.stage = kAnalysis_Failed;
+        }
+        return;
+
+    case kAnalysis_PureCall:
+        // --------------------------------------------------------------------
+        // One chunk of .rdata's code pointers, then pick _purecall.
+        // --------------------------------------------------------------------
+        if (a.chunk < a.chunks.size()) {
+            CountCodeRefs(a.layout, a.chunks[a.chunk], a.codeRefs);
+            a.chunk++;
+        }
+        if (a.chunk == a.chunks.size()) {
+            a.layout.pureCall = FindPureCall(a.layout, a.codeRefs);
+            a.codeRefs = std::unordered_map<UInt64, UInt32>();
+            a.stage = kAnalysis_Scan;
+            StartVtblPass(a, kVtblPass_TypeDescriptors);
+        }
+        return;
+
+    case kAnalysis_Scan:
+    {
+        // --------------------------------------------------------------------
+        // One chunk of one pass.
+        // --------------------------------------------------------------------
+        if (a.chunk < a.chunks.size()) {
+            VtblChunkHits hits;
+            ScanVtblChunk(a.layout, a.scan, a.pass, a.chunks[a.chunk], hits);
+            MergeVtblChunk(a.scan, a.pass, hits);
+            a.chunk++;
+        }
+        if (a.chunk == a.chunks.size()) {
+            if (a.pass + 1 < kVtblPass_Count) {
+                StartVtblPass(a, (VtblScanPass)(a.pass + 1));
+            }
+            else {
+                a.stage = kAnalysis_Join;
+            }
+        }
+        return;
+    }
+
+    case kAnalysis_Join:
+        // --------------------------------------------------------------------
+        // Build the database. See FinishRTTIDatabase for the rest.
+        // --------------------------------------------------------------------
+        JoinVTables(a.layout, a.scan, a.db);
+        a.scan = VtblScan();
+        a.stage = kAnalysis_Link;
+        return;
+
+    case kAnalysis_Link:
+        // --------------------------------------------------------------------
+        // The database's cross-references, and its (as yet empty) names.
+        // --------------------------------------------------------------------
+        LinkRTTIDatabase(a.layout, a.db);
+        StartRTTINames(a.db);
+        a.name = 0;
+        a.stage = kAnalysis_Names;
+        return;
+
+    case kAnalysis_Names:
+    {
+        // --------------------------------------------------------------------
+        // One chunk of names.
+        // --------------------------------------------------------------------
+        const UInt32 numNames = (UInt32)a.db.names.size();
+        if (a.name < numNames) {
+            const UInt32 last = (numNames - a.name > NAME_CHUNK_NAMES) ? a.name + NAME_CHUNK_NAMES : numNames;
+            InternRTTINames(a.layout, a.db, a.name, last);
+            a.name = last;
+        }
+        if (a.name == numNames) {
+            if (a.fromCache) {
+                StartPrinting(a);
+            }
+            else {
+                a.stage = kAnalysis_Save;
+            }
+        }
+        return;
+    }
+
+    case kAnalysis_Save:
+        // --------------------------------------------------------------------
+        // Save the database for next time.
+        // --------------------------------------------------------------------
+        _MESSAGE("RTTI scan: found %u classes (%u VFTs, %u KB).", (UInt32)a.db.types.size(),
+                 (UInt32)a.db.vtbls.size(), (UInt32)(GetRTTIDatabaseSize(a.db) / 1024));
+        if (!a.cachePath.empty() && !SaveRTTICache(a.cachePath.c_str(), a.layout, a.db)) {
+            _MESSAGE("RTTI cache: couldn't write %s.", a.cachePath.c_str());
+        }
+        StartPrinting(a);
+        return;
+
+    case kAnalysis_Collect:
+    {
+        // --------------------------------------------------------------------
+        // One chunk of VFTs. See CollectVirtualFuncs.
+        // --------------------------------------------------------------------
+        const UInt32 numVtbls = (UInt32)a.db.vtbls.size();
+        if (a.vtbl < numVtbls) {
+            const UInt32 last = (numVtbls - a.vtbl > FUNC_CHUNK_VTBLS) ? a.vtbl + FUNC_CHUNK_VTBLS : numVtbls;
+            CollectVtblFuncChunk(a.layout, a.db, a.vtbl, last, a.funcs, a.slotFuncs);
+            a.vtbl = last;
+        }
+        if (a.vtbl == numVtbls) {
+            a.vtbl = 0;
+            a.func = 0;
+            a.stage = kAnalysis_Thunks;
+        }
+        return;
+    }
+
+    case kAnalysis_Thunks:
+    {
+        // --------------------------------------------------------------------
+        // One chunk of the functions those VFTs point to.
+        // --------------------------------------------------------------------
+        const UInt32 numFuncs = (UInt32)a.slotFuncs.size();
+        if (a.func < numFuncs) {
+            const UInt32 last = (numFuncs - a.func > FUNC_CHUNK_FUNCS) ? a.func + FUNC_CHUNK_FUNCS : numFuncs;
+            ResolveThunkChunk(a.layout, a.slotFuncs, a.func, last, a.funcs, a.targets);
+            a.func = last;
+        }
+        if (a.func == numFuncs) {
+            FinishVirtualFuncs(a.funcs, a.targets);
+            a.slotFuncs = std::vector<UInt32>();
+            a.targets = std::vector<UInt32>();
+            a.func = 0;
+            a.stage = kAnalysis_Decompile;
+        }
+        return;
+    }
+
+    case kAnalysis_Decompile:
+    {
+        // --------------------------------------------------------------------
+        // One chunk of functions. See BuildFuncCache.
+        // --------------------------------------------------------------------
+        const UInt32 numFuncs = (UInt32)a.funcs.funcs.size();
+        if (a.func < numFuncs) {
+            const UInt32 last = (numFuncs - a.func > FUNC_CHUNK_FUNCS) ? a.func + FUNC_CHUNK_FUNCS : numFuncs;
+            DecompileFuncChunk(a.layout, a.db, a.funcs, a.func, last, a.funcText);
+            MergeFuncChunk(a.funcs, a.func, last, a.funcText);
+            a.func = last;
+        }
+        if (a.func == numFuncs) {
+            ReportFuncCache(a.funcs);
+            a.funcText = std::vector<char>();
+            a.stage = kAnalysis_Print;
+        }
+        return;
+    }
+
+    case kAnalysis_Print:
+    {
+        // --------------------------------------------------------------------
+        // One class header, or one VFT. See PrintVirtuals.
+        // --------------------------------------------------------------------
+        const RTTITypeEntry& type = a.db.types[a.type];
+        if (a.vtbl == type.firstVtbl) {
+            PrintClassHeader(a.out, a.layout, a.db, a.type);
+        }
+        PrintVtbl(a.out, a.layout, a.db, a.vtbl, &a.funcs);
+        a.vtbl++;
+        if (a.vtbl == type.firstVtbl + type.numVtbls) {
+            LogEndLine(a.out);
+            a.type++;
+            if (a.progress) {
+                a.progress(a.out, a.type, (UInt32)a.db.types.size());
+            }
+            if (a.type == a.db.types.size()) {
+                a.stage = kAnalysis_Done;
+            }
+        }
+        return;
+    }
+
+    default:
+        return;
+    }
+}
+
+static void StartVtblPass(RTTIAnalysis& a, const VtblScanPass pass)
+{
+    a.pass = pass;
+    SplitRange(GetVtblPassRange(a.layout, pass), a.chunks);
+    a.chunk = 0;
+}
+
+static void StartPrinting(RTTIAnalysis& a)
+{
+    PrintImageLayout(a.layout);
+    a.funcs = RTTIFuncCache();
+    a.slotFuncs.clear();
+    a.targets.clear();
+    a.func = 0;
+    a.type = 0;
+    a.vtbl = 0;
+    a.stage = a.db.types.empty() ? kAnalysis_Done : kAnalysis_Collect;
+}
@@ -0,0 +1,123 @@
+// ============================================================================
+// dump_rtti/RTTIAnalysis.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LogWriter.h"
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTI.h"
+#include "RTTIDatabase.h"
+
+// ============================================================================
+//                 Incremental (frame-budgeted) RTTI analysis.
+// ----------------------------------------------------------------------------
+// The same work as LoadRTTI followed by PrintVirtuals, but as a state machine
+// that does at most about 'budget' microseconds of work per call to
+// StepRTTIAnalysis and then returns, picking up where it left off on the next
+// call. Driven once per frame from the game thread, that spreads the cost of
+// the dump over many frames without needing a thread of its own.
+//
+// The units of work are: reading the headers (and the cache, if any); about
+// RELOC_CHUNK_SIZE bytes of the base relocation table; one chunk
+// (SCAN_CHUNK_SIZE bytes) of the search for type_info, of the count of the
+// code pointers that finds _purecall, or of one of LoadVTables' passes; the
+// join; filling in the database's cross-references; demangling a chunk
+// (NAME_CHUNK_NAMES) of the names; saving the cache; walking a chunk
+// (FUNC_CHUNK_VTBLS) of the VFTs for the functions they point to, and
+// following the thunks among, and decompiling, a chunk (FUNC_CHUNK_FUNCS) of
+// those; and printing one class header or one VFT. A step always does at
+// least one unit, so it can overrun a very small budget.
+// ============================================================================
+const UInt32 NAME_CHUNK_NAMES     = 64;
+const UInt32 FUNC_CHUNK_VTBLS     = 64;
+
+enum RTTIAnalysisStage
+{
+    kAnalysis_Start,                   // read the headers, and the cache if any
+    kAnalysis_Relocs,                  // the pointer slots, a chunk at a time
+    kAnalysis_TypeInfo,                // find type_info's VFT, a chunk at a time
+    kAnalysis_PureCall,                // find _purecall, a chunk at a time
+    kAnalysis_Scan,                    // LoadVTables' passes, a chunk at a time
+    kAnalysis_Join,                    // build the database
+    kAnalysis_Link,                    // fill in its cross-references
+    kAnalysis_Names,                   // demangle the names, a chunk at a time
+    kAnalysis_Save,                    // save the cache
+    kAnalysis_Collect,                 // CollectVirtualFuncs' walk, a chunk at a time
+    kAnalysis_Thunks,                  // ... and its thunks, a chunk at a time
+    kAnalysis_Decompile,               // BuildFuncCache, a chunk at a time
+    kAnalysis_Print,                   // PrintVirtuals, a VFT at a time
+    kAnalysis_Done,
+    kAnalysis_Failed                   // the image doesn't appear to have RTTI
+};
+
+struct RTTIAnalysis
+{
+    // What to analyse.
+    UInt64        baseAddr;            // where the executable is mapped
+    std::string   fileName;            // its path, or empty if unknown
+    std::string   cachePath;           // the RTTI cache, or empty for none
+    RTTIProgressFn progress;           // as for PrintVirtuals, or NULL
+    LogWriter     out;                 // where the classes are printed
+
+    // Where we've got to.
+    RTTIAnalysisStage stage;
+    bool          fromCache;           // TRUE if the database came from the cache
+    ImageLayout   layout;
+    RTTIDatabase  db;
+    UInt32        reloc;               // kAnalysis_Relocs: offset of the next block
+    std::unordered_map<UInt64, UInt32> codeRefs;   // kAnalysis_PureCall: see CountCodeRefs
+    VtblScan      scan;
+    VtblScanPass  pass;                // kAnalysis_Scan: the current pass...
+    std::vector<ImageRange> chunks;    //     ... its section's chunks (or kAnalysis_TypeInfo's or _PureCall's)
+    std::size_t   chunk;               //     ... and the next one to scan
+    UInt32        name;                // kAnalysis_Names: the next name to demangle
+    std::vector<UInt32> slotFuncs;     // kAnalysis_Collect: the functions in the VFT slots
+    std::vector<UInt32> targets;       // kAnalysis_Thunks: the functions those lead to
+    RTTIFuncCache funcs;               // kAnalysis_Decompile: the functions...
+    UInt32        func;                //     ... and the next one to decompile (or whose thunk to follow)
+    std::vector<char> funcText;        //     ... and its chunk's text
+    UInt32        type;                // kAnalysis_Print: the next class...
+    UInt32        vtbl;                //     ... and the next of its VFTs (or kAnalysis_Collect's next VFT)
+
+    // Statistics.
+    std::chrono::steady_clock::time_point startTime;
+    double        wallTime;            // seconds from start to finish
+    double        cpuTime;             // seconds of CPU time spent in steps
+    double        longestStep;         // seconds
+    UInt32        numSteps;
+};
+
+// public:
+void StartRTTIAnalysis(RTTIAnalysis& a, const UInt64 baseAddr, const char* fileName, const char* cachePath,
+                       RTTIProgressFn progress = nullptr, LogSinkFn sink = WriteToDebugLog);
+
+bool StepRTTIAnalysis(RTTIAnalysis& a, const UInt32 budget);
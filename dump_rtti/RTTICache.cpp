@@ -0,0 +1,255 @@
+// ============================================================================
+// dump_rtti/RTTICache.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+#include "RTTICache.h"
+
+static UInt64 GetChecksum(const void* data, const std::size_t len, UInt64 hash = 0xCBF29CE484222325ULL);
+
+static UInt64 GetSectionChecksum(const UInt64 baseAddr);
+
+// ============================================================================
+//   Load the RTTI found by a previous run from 'path'.
+// ----------------------------------------------------------------------------
+// 'layout' must already describe the image's sections (see GetImageSections).
+// On success, fills in its typeInfoVtbl and pureCall, fills 'db' exactly as
+// JoinVTables would have (so it still needs FinishRTTIDatabase), and returns
+// TRUE. Otherwise logs why the cache couldn't be used and returns FALSE,
+// leaving 'db' empty.
+// ============================================================================
+bool LoadRTTICache(const char* path, ImageLayout& layout, RTTIDatabase& db)
+{
+    ClearRTTIDatabase(db);
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        _MESSAGE("RTTI cache: %s not found; scanning.", path);
+        return false;
+    }
+
+    // ----------------------------------------------------------------------
+    // 1. Is it a cache for this image?
+    // ----------------------------------------------------------------------
+    RTTICacheHeader hdr;
+    if (!file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+        memcmp(hdr.magic, RTTI_CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != RTTI_CACHE_VERSION) {
+        _MESSAGE("RTTI cache: %s isn't a version %u cache; rescanning.", path, RTTI_CACHE_VERSION);
+        return false;
+    }
+    if (hdr.timeDateStamp != layout.timeDateStamp || hdr.sizeOfImage != layout.sizeOfImage ||
+        hdr.sectionChecksum != GetSectionChecksum(layout.baseAddr)) {
+        _MESSAGE("RTTI cache: %s is for a different executable; rescanning.", path);
+        return false;
+    }
+
+    // ----------------------------------------------------------------------
+    // 2. Read the payload in one go and check that it's complete and intact.
+    // ----------------------------------------------------------------------
+    const std::size_t payloadSize =
+        (std::size_t)hdr.numTypes * sizeof(RTTICacheType) + (std::size_t)hdr.numVtbls * sizeof(RTTICacheVtbl);
+    std::vector<char> payload(payloadSize + 1);
+    file.read(payload.data(), payload.size());
+    if ((std::size_t)file.gcount() != payloadSize ||
+        GetChecksum(payload.data(), payloadSize) != hdr.payloadChecksum) {
+        _MESSAGE("RTTI cache: %s is truncated or corrupt; rescanning.", path);
+        return false;
+    }
+    const RTTICacheType* types = reinterpret_cast<const RTTICacheType*>(payload.data());
+    const RTTICacheVtbl* vtbls = reinterpret_cast<const RTTICacheVtbl*>(types + hdr.numTypes);
+
+    // ----------------------------------------------------------------------
+    // 3. Check each entry against the image, i.e. repeat the tests that
+    //    LoadVTables made when it found them, and rebuild the database.
+    // ----------------------------------------------------------------------
+    const UInt64 baseAddr = layout.baseAddr;
+    const UInt64 typeInfoVtbl = baseAddr + hdr.typeInfoVtbl;
+    const UInt64 pureCall = hdr.pureCall ? baseAddr + hdr.pureCall : 0;
+    bool valid = layout.rdata.Contains(typeInfoVtbl) && (!pureCall || layout.text.Contains(pureCall));
+
+    const RTTICacheVtbl* v = vtbls;
+    const RTTICacheVtbl* vEnd = vtbls + hdr.numVtbls;
+    for (UInt32 t = 0; valid && t < hdr.numTypes; ++t)
+    {
+        const UInt64 td = baseAddr + types[t].pTypeDescriptor;
+        if (!IsTypeDescriptor(layout, types[t].pTypeDescriptor) ||
+            reinterpret_cast<const TypeDescriptor*>(td)->pVFTable != typeInfoVtbl ||
+            types[t].numVtbls == 0 || (std::size_t)(vEnd - v) < types[t].numVtbls ||
+            (t > 0 && types[t].pTypeDescriptor <= types[t - 1].pTypeDescriptor)) {
+            valid = false;
+            break;
+        }
+
+        AddRTTIType(db, types[t].pTypeDescriptor);
+        for (UInt32 n = 0; n < types[t].numVtbls; ++n, ++v)
+        {
+            const UInt64 vtbl = baseAddr + v->pVtbl;
+            const UInt64 col = baseAddr + v->pCompleteObjectLocator;
+            if ((vtbl & 7) || !layout.rdata.Contains(vtbl - 8) || !layout.rdata.Contains(vtbl) ||
+                (col & 3) || !layout.rdata.Contains(col) ||
+                layout.rdata.end - col < sizeof(RTTICompleteObjectLocator)) {
+                valid = false;
+                break;
+            }
+
+            const UInt64* pVtbl = reinterpret_cast<const UInt64*>(vtbl);
+            const RTTICompleteObjectLocator* pCol = reinterpret_cast<const RTTICompleteObjectLocator*>(col);
+            if (pVtbl[-1] != col || pCol->signature != COL_SIG_REV1 ||
+                pCol->pSelf != v->pCompleteObjectLocator ||
+                pCol->pTypeDescriptor != types[t].pTypeDescriptor ||
+                !layout.text.Contains(pVtbl[0])) {
+                valid = false;
+                break;
+            }
+            AddRTTIVtbl(db, v->pVtbl, v->pCompleteObjectLocator);
+        }
+    }
+    if (!valid || v != vEnd) {
+        _MESSAGE("RTTI cache: %s doesn't match the executable in memory; rescanning.", path);
+        ClearRTTIDatabase(db);
+        return false;
+    }
+
+    layout.typeInfoVtbl = typeInfoVtbl;
+    layout.pureCall = pureCall;
+    return true;
+}
+
+// ============================================================================
+//   Save the result of a scan to 'path', for LoadRTTICache.
+// ============================================================================
+bool SaveRTTICache(const char* path, const ImageLayout& layout, const RTTIDatabase& db)
+{
+    const UInt64 baseAddr = layout.baseAddr;
+
+    std::vector<RTTICacheType> types;
+    std::vector<RTTICacheVtbl> vtbls;
+    types.reserve(db.types.size());
+    vtbls.reserve(db.vtbls.size());
+    for (const RTTITypeEntry& t : db.types) {
+        types.push_back({ t.pTypeDescriptor, t.numVtbls });
+    }
+    for (const RTTIVtblEntry& v : db.vtbls) {
+        vtbls.push_back({ v.pVtbl, db.cols[v.col].pSelf });
+    }
+
+    RTTICacheHeader hdr;
+    memcpy(hdr.magic, RTTI_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = RTTI_CACHE_VERSION;
+    hdr.timeDateStamp = layout.timeDateStamp;
+    hdr.sizeOfImage = layout.sizeOfImage;
+    hdr.typeInfoVtbl = (UInt32)(layout.typeInfoVtbl - baseAddr);
+    hdr.pureCall = layout.pureCall ? (UInt32)(layout.pureCall - baseAddr) : 0;
+    hdr.numTypes = (UInt32)types.size();
+    hdr.numVtbls = (UInt32)vtbls.size();
+    hdr.sectionChecksum = GetSectionChecksum(baseAddr);
+    hdr.payloadChecksum = GetChecksum(vtbls.data(), vtbls.size() * sizeof(RTTICacheVtbl),
+                                      GetChecksum(types.data(), types.size() * sizeof(RTTICacheType)));
+
+    // N.B. a partially written file fails the payload checksum, so there's
+    // no need to write to a temporary file and rename it.
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    file.write(reinterpret_cast<const char*>(types.data()), types.size() * sizeof(RTTICacheType));
+    file.write(reinterpret_cast<const char*>(vtbls.data()), vtbls.size() * sizeof(RTTICacheVtbl));
+    file.close();
+    return !file.fail();
+}
+
+// ============================================================================
+//   Find the image's RTTI: from the cache at 'cachePath' if it's valid, or
+//   else by scanning the image, in which case the cache is (re)written.
+// ----------------------------------------------------------------------------
+// Pass a null 'cachePath' to always scan and not write a cache. Returns FALSE
+// if the image doesn't look like it has any RTTI; 'layout' and 'db' are then
+// unspecified.
+// ============================================================================
+bool LoadRTTI(const UInt64 baseAddr, const char* cachePath, ImageLayout& layout, RTTIDatabase& db,
+              const unsigned numThreads)
+{
+    ClearRTTIDatabase(db);
+    if (cachePath) {
+        auto start = std::chrono::steady_clock::now();
+        if (!GetImageSections(baseAddr, layout)) return false;
+        if (LoadRTTICache(cachePath, layout, db)) {
+            FinishRTTIDatabase(layout, db);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            _MESSAGE("RTTI cache: loaded %u classes from %s in %.2f ms.",
+                     (UInt32)db.types.size(), cachePath, ms.count());
+            return true;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!GetImageLayout(baseAddr, layout)) return false;
+    LoadVTables(layout, db, numThreads);
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    _MESSAGE("RTTI scan: found %u classes (%u VFTs, %u KB) in %.2f ms.", (UInt32)db.types.size(),
+             (UInt32)db.vtbls.size(), (UInt32)(GetRTTIDatabaseSize(db) / 1024), ms.count());
+
+    if (cachePath && !SaveRTTICache(cachePath, layout, db)) {
+        _MESSAGE("RTTI cache: couldn't write %s.", cachePath);
+    }
+    return true;
+}
+
+// ============================================================================
+//   64-bit FNV-1a hash of 'len' bytes at 'data', continuing from 'hash'.
+// ============================================================================
+static UInt64 GetChecksum(const void* data, const std::size_t len, UInt64 hash)
+{
+    const UInt8* p = static_cast<const UInt8*>(data);
+    for (std::size_t i = 0; i < len; ++i)
+    {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// ============================================================================
+//   Checksum of the parts of the headers that describe the image's layout.
+// ----------------------------------------------------------------------------
+// The file header, the data directories and the section table. Not the whole
+// optional header, because the loader rewrites its ImageBase when it rebases
+// the image, and not the sections' contents, which are relocated too.
+// ============================================================================
+static UInt64 GetSectionChecksum(const UInt64 baseAddr)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr) return 0;
+    UInt64 hash = GetChecksum(&pNtHdr->FileHeader, sizeof(pNtHdr->FileHeader));
+
+    UInt32 numDirs = pNtHdr->OptionalHeader.NumberOfRvaAndSizes;
+    if (numDirs > IMAGE_NUMBEROF_DIRECTORY_ENTRIES) numDirs = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+    hash = GetChecksum(pNtHdr->OptionalHeader.DataDirectory, numDirs * sizeof(IMAGE_DATA_DIRECTORY), hash);
+
+    const IMAGE_SECTION_HEADER* pSectionHdr = reinterpret_cast<const IMAGE_SECTION_HEADER*>(
+        reinterpret_cast<const UInt8*>(&pNtHdr->OptionalHeader) + pNtHdr->FileHeader.SizeOfOptionalHeader);
+    return GetChecksum(pSectionHdr, pNtHdr->FileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER), hash);
+}
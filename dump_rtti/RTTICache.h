@@ -0,0 +1,92 @@
+// ============================================================================
+// dump_rtti/RTTICache.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTI.h"
+#include "RTTIDatabase.h"
+
+// ============================================================================
+//                        Persistent RTTI cache.
+// ----------------------------------------------------------------------------
+// Scanning the image for RTTI is by far the slowest part of the dump, and its
+// result only changes when the executable does. So after a scan we save what
+// it found - each TypeDescriptor's OFFSET and, for each of its VFTs, the OFFSET
+// of the VFT and of its COL (from which the class hierarchy is reached) - to a
+// small binary file next to the log, and on the next run load that instead.
+//
+// The cache is keyed by the image's TimeDateStamp, SizeOfImage and a checksum
+// of its section table and data directories. All OFFSETs are relative to the
+// base address, so the cache survives ASLR. Every entry is also checked
+// against the image on load (the TypeDescriptor's pVFTable, the VFT's meta
+// field, the COL's pSelf and pTypeDescriptor, and the first VFT entry), so a
+// stale or corrupt cache is never used; we just rescan and overwrite it.
+//
+// File layout (little-endian):
+//     RTTICacheHeader
+//     RTTICacheType[numTypes]     in ascending TypeDescriptor order
+//     RTTICacheVtbl[numVtbls]     each type's VFTs, in RTTIDatabase order
+// ============================================================================
+const char RTTI_CACHE_MAGIC[8]    = { 'S', 'K', 'Y', 'R', 'T', 'T', 'I', '\0' };
+const UInt32 RTTI_CACHE_VERSION   = 1;
+
+#pragma pack(push, 4)
+struct RTTICacheHeader
+{
+    char          magic[8];            // 00: RTTI_CACHE_MAGIC
+    UInt32        version;             // 08: RTTI_CACHE_VERSION
+    UInt32        timeDateStamp;       // 0C: from the file header
+    UInt32        sizeOfImage;         // 10: from the optional header
+    UInt32        typeInfoVtbl;        // 14: OFFSET to type_info::`vftable'
+    UInt32        pureCall;            // 18: OFFSET to _purecall, or 0 if not found
+    UInt32        numTypes;            // 1C: number of RTTICacheType records
+    UInt32        numVtbls;            // 20: number of RTTICacheVtbl records
+    UInt64        sectionChecksum;     // 24: see GetSectionChecksum
+    UInt64        payloadChecksum;     // 2C: FNV-1a of everything after the header
+};
+
+struct RTTICacheType
+{
+    UInt32        pTypeDescriptor;     // 00: OFFSET to the TypeDescriptor
+    UInt32        numVtbls;            // 04: number of its RTTICacheVtbl records
+};
+
+struct RTTICacheVtbl
+{
+    UInt32        pVtbl;               // 00: OFFSET to the VFT
+    UInt32        pCompleteObjectLocator; // 04: OFFSET to the VFT's COL
+};
+#pragma pack(pop)
+
+// public:
+bool LoadRTTICache(const char* path, ImageLayout& layout, RTTIDatabase& db);
+
+bool SaveRTTICache(const char* path, const ImageLayout& layout, const RTTIDatabase& db);
+
+bool LoadRTTI(const UInt64 baseAddr, const char* cachePath, ImageLayout& layout, RTTIDatabase& db,
+              const unsigned numThreads = 0);
@@ -0,0 +1,352 @@
+// ============================================================================
+// dump_rtti/RTTICast.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cstring>
+
+#include "RTTI.h"
+#include "RTTICast.h"
+
+static UInt32 HashCastKey(const UInt64 key);
+
+static UInt32 GetCastTableSize(const std::size_t numEntries);
+
+static const RTTICastVtbl* FindCastVtbl(const RTTICastTable& table, const void* obj, const UInt8*& complete);
+
+static void* FindCastInstance(const RTTICastTable& table, const void* obj, const UInt8* complete,
+                              const UInt32 classId);
+
+static const RTTICastBase* FindCastBase(const RTTICastTable& table, const UInt32 classId, const UInt32 baseId);
+
+// ============================================================================
+//   Work out each VFT's class and each class's bases, for the casts. 'table'
+//   refers to 'db', which must outlive it.
+// ============================================================================
+void BuildRTTICastTable(const ImageLayout& layout, const RTTIDatabase& db, RTTICastTable& table)
+{
+    const UInt64 baseAddr = layout.baseAddr;
+    table.db = &db;
+    table.baseAddr = baseAddr;
+    table.sizeOfImage = layout.sizeOfImage;
+
+    // 1. Every VFT, with the class and the offset of the sub-object its COL
+    //    says it's for.
+    table.vtbls.assign(GetCastTableSize(db.vtbls.size()), RTTICastVtbl{ 0, RTTI_NO_INDEX, 0, 0 });
+    const UInt32 vtblMask = (UInt32)table.vtbls.size() - 1;
+    for (const RTTIVtblEntry& v : db.vtbls)
+    {
+        const RTTIColEntry& col = db.cols[v.col];
+        const RTTICompleteObjectLocator* pCol =
+            reinterpret_cast<const RTTICompleteObjectLocator*>(baseAddr + (UInt64)col.pSelf);
+        UInt32 i = HashCastKey(v.pVtbl) & vtblMask;
+        while (table.vtbls[i].pVtbl) {
+            i = (i + 1) & vtblMask;
+        }
+        table.vtbls[i] = { v.pVtbl, GetRTTIClassId(table, db.types[v.type].pTypeDescriptor), col.offset,
+                           pCol->cdOffset };
+    }
+
+    // 2. Every class's bases, from the class hierarchy of its primary VFT's
+    //    COL, as FinishRTTIDatabase reads them, but with the whole PMD and
+    //    the attributes, which the database doesn't keep. Entry 0 of the
+    //    RTTIBaseClassArray is the class itself.
+    table.bases.assign(GetCastTableSize(db.bases.size()), RTTICastBase{ RTTI_NO_INDEX, RTTI_NO_INDEX, 0, -1, 0, 0 });
+    const UInt32 baseMask = (UInt32)table.bases.size() - 1;
+    for (const RTTITypeEntry& type : db.types)
+    {
+        const RTTIColEntry& col = db.cols[db.vtbls[type.firstVtbl].col];
+        if (!col.pClassDescriptor) continue;
+
+        const UInt32 classId = GetRTTIClassId(table, type.pTypeDescriptor);
+        const RTTIClassHierarchyDescriptor* hierarchy =
+            reinterpret_cast<const RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)col.pClassDescriptor);
+        const UInt32* pClassArray = reinterpret_cast<const UInt32*>(baseAddr + (UInt64)hierarchy->pBaseClassArray);
+        for (UInt32 b = 1; b < col.numBaseClasses; ++b)
+        {
+            const RTTIBaseClassDescriptor* baseClass =
+                reinterpret_cast<const RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pClassArray[b]);
+            const UInt32 baseId = GetRTTIClassId(table, baseClass->pTypeDescriptor);
+            const PMD& where = baseClass->where;
+
+            UInt32 i = HashCastKey(((UInt64)classId << 32) | baseId) & baseMask;
+            while (table.bases[i].classId != RTTI_NO_INDEX &&
+                   (table.bases[i].classId != classId || table.bases[i].baseId != baseId)) {
+                i = (i + 1) & baseMask;
+            }
+            RTTICastBase& entry = table.bases[i];
+            if (entry.classId != RTTI_NO_INDEX)
+            {
+                // The base is in the array again. A virtual base is listed
+                // once per path to it, but it's the same sub-object; a
+                // non-virtual one is a second copy of it.
+                if (entry.mdisp != where.mdisp || entry.pdisp != (SInt32)where.pdisp || entry.vdisp != where.vdisp) {
+                    entry.flags |= kRTTICast_Ambiguous;
+                }
+                continue;
+            }
+            entry = { classId, baseId, where.mdisp, (SInt32)where.pdisp, where.vdisp, 0 };
+            if (baseClass->attributes & kBCD_NotVisible) entry.flags |= kRTTICast_NotVisible;
+            if (baseClass->attributes & kBCD_Ambiguous) entry.flags |= kRTTICast_Ambiguous;
+            if (entry.pdisp >= 0) entry.flags |= kRTTICast_Virtual;
+        }
+    }
+}
+
+// ============================================================================
+//   The ID of the class called 'name', e.g. "Actor" or "class Actor", or
+//   RTTI_NO_INDEX if there's no such class. This compares every name, so
+//   look up the classes you need once and keep their IDs.
+// ============================================================================
+UInt32 FindRTTIClassId(const RTTICastTable& table, const char* name)
+{
+    static const char* const KEYWORDS[] = { "class ", "struct ", "union ", "enum " };
+
+    const RTTIDatabase& db = *table.db;
+    const UInt32 length = (UInt32)strlen(name);
+    for (UInt32 id = 0; id < (UInt32)db.names.size(); ++id)
+    {
+        const RTTINameEntry& entry = db.names[id];
+        const char* text = db.nameText.data() + entry.name;
+        if (entry.length == length && !memcmp(text, name, length)) return id;
+        for (const char* keyword : KEYWORDS)
+        {
+            const UInt32 keywordLength = (UInt32)strlen(keyword);
+            if (entry.length == keywordLength + length && !memcmp(text, keyword, keywordLength) &&
+                !memcmp(text + keywordLength, name, length)) {
+                return id;
+            }
+        }
+    }
+    return RTTI_NO_INDEX;
+}
+
+// ============================================================================
+//   The ID of the class whose TypeDescriptor is at OFFSET 'pTypeDescriptor',
+//   or RTTI_NO_INDEX.
+// ============================================================================
+UInt32 GetRTTIClassId(const RTTICastTable& table, const UInt32 pTypeDescriptor)
+{
+    const std::vector<RTTINameEntry>& names = table.db->names;
+    auto it = std::lower_bound(names.begin(), names.end(), pTypeDescriptor,
+                               [](const RTTINameEntry& n, UInt32 rva) { return n.pTypeDescriptor < rva; });
+    if (it == names.end() || it->pTypeDescriptor != pTypeDescriptor) return RTTI_NO_INDEX;
+    return (UInt32)(it - names.begin());
+}
+
+// ============================================================================
+//   The ID of the class of the complete object that 'obj' (a pointer to an
+//   object with a VFT, or to one of its sub-objects that has one) is part of,
+//   or RTTI_NO_INDEX if its VFT isn't one of the image's.
+// ============================================================================
+UInt32 GetRTTIObjectClassId(const RTTICastTable& table, const void* obj)
+{
+    const UInt8* complete;
+    const RTTICastVtbl* vtbl = FindCastVtbl(table, obj, complete);
+    return vtbl ? vtbl->classId : RTTI_NO_INDEX;
+}
+
+// ============================================================================
+//   TRUE if class 'classId' is, or is derived from, class 'baseId'.
+// ============================================================================
+bool IsRTTIBaseOf(const RTTICastTable& table, const UInt32 baseId, const UInt32 classId)
+{
+    if (baseId == RTTI_NO_INDEX) return false;
+    return classId == baseId || FindCastBase(table, classId, baseId) != nullptr;
+}
+
+// ============================================================================
+//   TRUE if 'obj' is part of an object of class 'classId', or of a class
+//   derived from it, however it's derived.
+// ============================================================================
+bool RTTIIsA(const RTTICastTable& table, const void* obj, const UInt32 classId)
+{
+    const UInt8* complete;
+    const RTTICastVtbl* vtbl = FindCastVtbl(table, obj, complete);
+    return vtbl && IsRTTIBaseOf(table, classId, vtbl->classId);
+}
+
+// ============================================================================
+//   dynamic_cast<classId*>(obj): the class 'classId' sub-object of the
+//   complete object 'obj' is part of, or NULL if it doesn't have exactly one
+//   that's public. Like dynamic_cast, it casts down, up and across. If the
+//   complete object has more than one, the one that contains 'obj', or else
+//   the only one within 'obj', will do (see FindCastInstance).
+// ----------------------------------------------------------------------------
+// N.B. like __RTDynamicCast, this trusts 'obj' to point to an object, and a
+// virtual base's offset is read from the object's vbtable.
+// ============================================================================
+void* RTTICast(const RTTICastTable& table, const void* obj, const UInt32 classId)
+{
+    const UInt8* complete;
+    const RTTICastVtbl* vtbl = FindCastVtbl(table, obj, complete);
+    if (!vtbl) return nullptr;
+    if (vtbl->classId == classId) return const_cast<UInt8*>(complete);
+
+    const RTTICastBase* base = FindCastBase(table, vtbl->classId, classId);
+    if (!base) return nullptr;
+    if (base->flags & kRTTICast_Ambiguous) return FindCastInstance(table, obj, complete, classId);
+    if (base->flags & kRTTICast_NotVisible) return nullptr;
+
+    SInt64 offset = base->mdisp;
+    if (base->pdisp >= 0) {
+        const UInt8* vbtable = *reinterpret_cast<const UInt8* const*>(complete + base->pdisp);
+        offset += base->pdisp + *reinterpret_cast<const SInt32*>(vbtable + base->vdisp);
+    }
+    return const_cast<UInt8*>(complete + offset);
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static UInt32 HashCastKey(const UInt64 key)
+{
+    // ------------------------------------------------------------------------
+    // Fibonacci hashing: the high bits of the product depend on every bit of
+    // the key, and VFT OFFSETs differ mostly in their middle bits.
+    // ------------------------------------------------------------------------
+    return (UInt32)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static UInt32 GetCastTableSize(const std::size_t numEntries)
+{
+    // ------------------------------------------------------------------------
+    // The smallest power of two that's at least twice 'numEntries', so that
+    // a hash table of that size is at most half full, and a probe always
+    // reaches an empty slot.
+    // ------------------------------------------------------------------------
+    UInt32 size = 16;
+    while (size < numEntries * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static const RTTICastVtbl* FindCastVtbl(const RTTICastTable& table, const void* obj, const UInt8*& complete)
+{
+    // ------------------------------------------------------------------------
+    // Look up the VFT that 'obj' points to, and set 'complete' to the
+    // complete object, as __RTDynamicCast's FindCompleteObject does.
+    // Return NULL if 'obj' is NULL or its VFT isn't in the table.
+    // ------------------------------------------------------------------------
+    if (!obj) return nullptr;
+    const UInt64 pVtbl = *reinterpret_cast<const UInt64*>(obj) - table.baseAddr;
+    if (pVtbl >= table.sizeOfImage || !pVtbl) return nullptr;
+
+    const UInt32 mask = (UInt32)table.vtbls.size() - 1;
+    for (UInt32 i = HashCastKey(pVtbl) & mask; ; i = (i + 1) & mask)
+    {
+        const RTTICastVtbl& vtbl = table.vtbls[i];
+        if (vtbl.pVtbl == (UInt32)pVtbl)
+        {
+            complete = static_cast<const UInt8*>(obj) - vtbl.offset;
+            if (vtbl.cdOffset) {
+                complete -= *reinterpret_cast<const SInt32*>(static_cast<const UInt8*>(obj) - vtbl.cdOffset);
+            }
+            return &vtbl;
+        }
+        if (!vtbl.pVtbl) return nullptr;
+    }
+}
+
+static void* FindCastInstance(const RTTICastTable& table, const void* obj, const UInt8* complete,
+                              const UInt32 classId)
+{
+    // ------------------------------------------------------------------------
+    // RTTICast's slow path, for a class that's a base of the complete
+    // object's class more than once. As __RTDynamicCast does, walk the class's
+    // RTTIBaseClassArray for the instance of 'classId' that contains the
+    // sub-object 'obj' points to (a cast down, or across within it), or
+    // failing that, the only instance within that sub-object (a cast up). The
+    // sub-object is taken to be the largest one at 'obj', i.e. the first in
+    // the array. Return NULL if there's no such instance or it isn't public.
+    //
+    // Only bases on a non-virtual path from the complete class are compared,
+    // as a virtual base's offset is in the object's vbtable; a cast from or
+    // to an instance inside a virtual base fails.
+    // ------------------------------------------------------------------------
+    // The hierarchy is the one the database checked (see RTTIColEntry).
+    const UInt64 baseAddr = table.baseAddr;
+    const UInt64 pCol = (*reinterpret_cast<const UInt64* const*>(obj))[-1];
+    const UInt32 c = FindRTTICol(*table.db, (UInt32)(pCol - baseAddr));
+    if (c == RTTI_NO_INDEX || !table.db->cols[c].pClassDescriptor) return nullptr;
+    const RTTIColEntry& col = table.db->cols[c];
+    const RTTIClassHierarchyDescriptor* hierarchy =
+        reinterpret_cast<const RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)col.pClassDescriptor);
+    const UInt32* pClassArray = reinterpret_cast<const UInt32*>(baseAddr + (UInt64)hierarchy->pBaseClassArray);
+    const UInt32 numBases = col.numBaseClasses;
+    const UInt32 pTarget = table.db->names[classId].pTypeDescriptor;
+    const UInt64 srcOffset = (UInt64)(static_cast<const UInt8*>(obj) - complete);
+
+    UInt32 source = RTTI_NO_INDEX;
+    UInt32 sourceEnd = 0;                               // index of its last base
+    const RTTIBaseClassDescriptor* within = nullptr;    // an instance within the source
+    bool ambiguous = false;
+    for (UInt32 b = 0; b < numBases; ++b)
+    {
+        const RTTIBaseClassDescriptor* baseClass =
+            reinterpret_cast<const RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pClassArray[b]);
+        if ((SInt32)baseClass->where.pdisp >= 0) continue;
+        if (source == RTTI_NO_INDEX && baseClass->where.mdisp == srcOffset) {
+            source = b;
+            sourceEnd = b + baseClass->numContainedBases;
+        }
+        if (baseClass->pTypeDescriptor != pTarget) continue;
+
+        // An instance's own bases follow it in the array.
+        const UInt32 end = (std::min)(b + baseClass->numContainedBases, numBases - 1);
+        for (UInt32 c = b; c <= end; ++c)
+        {
+            const RTTIBaseClassDescriptor* contained =
+                reinterpret_cast<const RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pClassArray[c]);
+            if ((SInt32)contained->where.pdisp < 0 && contained->where.mdisp == srcOffset) {
+                if (baseClass->attributes & kBCD_NotVisible) return nullptr;
+                return const_cast<UInt8*>(complete + baseClass->where.mdisp);
+            }
+        }
+        if (source != RTTI_NO_INDEX && b > source && b <= sourceEnd)
+        {
+            if (within && within->where.mdisp != baseClass->where.mdisp) ambiguous = true;
+            within = baseClass;
+        }
+    }
+    if (!within || ambiguous || (within->attributes & kBCD_NotVisible)) return nullptr;
+    return const_cast<UInt8*>(complete + within->where.mdisp);
+}
+
+static const RTTICastBase* FindCastBase(const RTTICastTable& table, const UInt32 classId, const UInt32 baseId)
+{
+    // ------------------------------------------------------------------------
+    // Look up base class 'baseId' of class 'classId', or return NULL if it
+    // isn't one.
+    // ------------------------------------------------------------------------
+    const UInt32 mask = (UInt32)table.bases.size() - 1;
+    for (UInt32 i = HashCastKey(((UInt64)classId << 32) | baseId) & mask; ; i = (i + 1) & mask)
+    {
+        const RTTICastBase& base = table.bases[i];
+        if (base.classId == classId && base.baseId == baseId) return &base;
+        if (base.classId == RTTI_NO_INDEX) return nullptr;
+    }
+}
@@ -0,0 +1,128 @@
+// ============================================================================
+// dump_rtti/RTTICast.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <vector>
+
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTIDatabase.h"
+
+// ============================================================================
+//                 Constant-time is-a and dynamic_cast.
+// ----------------------------------------------------------------------------
+// The game's dynamic_cast (__RTDynamicCast) finds the object's COL, then
+// walks its class's RTTIBaseClassArray comparing TypeDescriptor names with
+// strcmp until it finds the one it's casting to, on every cast. Everything it
+// works out only depends on the two classes, so BuildRTTICastTable works it
+// all out once, from the same class hierarchies the dump prints:
+//
+//   class IDs  one dense ID per TypeDescriptor in the database, i.e. its
+//              index in 'db.names', whether or not the class has VFTs.
+//   vtbls      every VFT, with the class of the complete object it belongs to
+//              and the sub-object's offset in it (from its COL), so an
+//              object's class is one hash lookup on its VFT pointer away.
+//   bases      every (class, base class) pair, with where the base is in the
+//              class (its PMD) and whether dynamic_cast may cast to it.
+//
+// Both are open-addressed hash tables at most half full, so a lookup is one
+// or two probes. (The hierarchy isn't a tree - a class can have any number
+// of bases, some of them virtual - so ancestor intervals from a walk of the
+// tree don't work, and a bitset of every pair would take N^2 bits for N
+// classes: tens of megabytes for the game. The pairs are what the base class
+// arrays already list, a few per class.)
+//
+// A class that's a base more than once (inherited non-virtually along two
+// paths) is the exception: which copy a cast means depends on the sub-object
+// it's cast from, so for those RTTICast walks the class's base class array,
+// as __RTDynamicCast does.
+//
+// RTTIIsA, RTTICast and the other lookups only read the table: they take no
+// locks, don't allocate and can be called on any number of threads at once,
+// for as long as the table and the database it was built from are left
+// alone. Another plugin can build its own table from LoadRTTI's database
+// (with the RTTI cache, that takes milliseconds), look up the IDs of the
+// classes it's interested in once, and then use RTTIIsA and RTTICast on any
+// object that has a VFT:
+//
+//     const UInt32 actorId = FindRTTIClassId(table, "Actor");
+//     ...
+//     Actor* actor = static_cast<Actor*>(RTTICast(table, form, actorId));
+// ============================================================================
+enum RTTICastFlags
+{
+    kRTTICast_Ambiguous   = 0x0001,    // the base occurs more than once in the class: which one depends on the sub-object
+    kRTTICast_NotVisible  = 0x0002,    // a private or protected base: dynamic_cast fails
+    kRTTICast_Virtual     = 0x0004,    // a virtual base: its offset is in the object's vbtable
+};
+
+// A VFT, and what a pointer to it says about the object.
+struct RTTICastVtbl
+{
+    UInt32        pVtbl;               // 00: OFFSET to the VFT; 0 for an empty slot
+    UInt32        classId;             // 04: class of the complete object
+    UInt32        offset;              // 08: from the complete object to the sub-object that points to the VFT
+    UInt32        cdOffset;            // 0C: from its COL; non-zero only while a virtual base is being constructed
+};
+
+// A base class of a class.
+struct RTTICastBase
+{
+    UInt32        classId;             // 00: the derived class; RTTI_NO_INDEX for an empty slot
+    UInt32        baseId;              // 04: the base class
+    UInt32        mdisp;               // 08: its PMD (see RTTI.h)
+    SInt32        pdisp;               // 0C: -1 unless it's a virtual base
+    UInt32        vdisp;               // 10
+    UInt32        flags;               // 14: RTTICastFlags
+};
+
+struct RTTICastTable
+{
+    const RTTIDatabase* db;
+    UInt64        baseAddr;
+    UInt32        sizeOfImage;
+    std::vector<RTTICastVtbl> vtbls;   // a power of two in size
+    std::vector<RTTICastBase> bases;   // likewise
+};
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+void BuildRTTICastTable(const ImageLayout& layout, const RTTIDatabase& db, RTTICastTable& table);
+
+UInt32 FindRTTIClassId(const RTTICastTable& table, const char* name);
+
+UInt32 GetRTTIClassId(const RTTICastTable& table, const UInt32 pTypeDescriptor);
+
+UInt32 GetRTTIObjectClassId(const RTTICastTable& table, const void* obj);
+
+bool IsRTTIBaseOf(const RTTICastTable& table, const UInt32 baseId, const UInt32 classId);
+
+bool RTTIIsA(const RTTICastTable& table, const void* obj, const UInt32 classId);
+
+void* RTTICast(const RTTICastTable& table, const void* obj, const UInt32 classId);
@@ -0,0 +1,319 @@
+// ============================================================================
+// dump_rtti/RTTIDatabase.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "RTTI.h"
+#include "RTTIDatabase.h"
+
+static void LinkParentVtbls(RTTIDatabase& db);
+
+template <typename T>
+static bool SameEntries(const std::vector<T>& a, const std::vector<T>& b);
+
+// ============================================================================
+//   Building the database.
+// ----------------------------------------------------------------------------
+// Call ClearRTTIDatabase, then AddRTTIType for each class in ascending
+// TypeDescriptor order, each followed by AddRTTIVtbl for each of its VFTs
+// (primary VFT first). FinishRTTIDatabase then reads the COLs and class
+// hierarchies from the image and fills in the cross-references, including
+// each VFT's parent, and demangles the names.
+//
+// FinishRTTIDatabase is LinkRTTIDatabase, which does all but the names, then
+// StartRTTINames and InternRTTINames, which can demangle the names a chunk
+// at a time; see RTTIAnalysis.h.
+// ============================================================================
+void ClearRTTIDatabase(RTTIDatabase& db)
+{
+    db.baseAddr = 0;
+    db.types.clear();
+    db.vtbls.clear();
+    db.cols.clear();
+    db.bases.clear();
+    db.vtblsByAddr.clear();
+    db.names.clear();
+    db.nameText.clear();
+}
+
+void AddRTTIType(RTTIDatabase& db, const UInt32 pTypeDescriptor)
+{
+    db.types.push_back({ pTypeDescriptor, (UInt32)db.vtbls.size(), 0, 0, 0 });
+}
+
+void AddRTTIVtbl(RTTIDatabase& db, const UInt32 pVtbl, const UInt32 pCol)
+{
+    // N.B. until FinishRTTIDatabase, 'col' holds the COL's OFFSET, not its index.
+    db.vtbls.push_back({ pVtbl, pCol, (UInt32)db.types.size() - 1, RTTI_NO_INDEX });
+    db.types.back().numVtbls++;
+}
+
+void FinishRTTIDatabase(const ImageLayout& layout, RTTIDatabase& db)
+{
+    LinkRTTIDatabase(layout, db);
+    InternRTTINames(layout, db, 0, StartRTTINames(db));
+}
+
+void LinkRTTIDatabase(const ImageLayout& layout, RTTIDatabase& db)
+{
+    const UInt64 baseAddr = layout.baseAddr;
+    db.baseAddr = baseAddr;
+
+    // 1. One entry per distinct COL, in address order. A COL belongs to the
+    //    class of the VFTs that reference it.
+    db.cols.clear();
+    db.cols.reserve(db.vtbls.size());
+    for (const RTTIVtblEntry& v : db.vtbls) {
+        db.cols.push_back({ v.col, 0, 0, v.type, 0 });
+    }
+    std::sort(db.cols.begin(), db.cols.end(),
+              [](const RTTIColEntry& a, const RTTIColEntry& b) { return a.pSelf < b.pSelf; });
+    db.cols.erase(std::unique(db.cols.begin(), db.cols.end(),
+                              [](const RTTIColEntry& a, const RTTIColEntry& b) { return a.pSelf == b.pSelf; }),
+                  db.cols.end());
+    UInt32 numCorrupt = 0;
+    for (RTTIColEntry& c : db.cols)
+    {
+        const RTTICompleteObjectLocator* col =
+            reinterpret_cast<const RTTICompleteObjectLocator*>(baseAddr + (UInt64)c.pSelf);
+        c.offset = col->offset;
+        c.pClassDescriptor = 0;
+        c.numBaseClasses = 0;
+        if (!col->pClassDescriptor) continue;
+
+        // The scan checked the COL, but not what it points to.
+        const RTTIClassHierarchyDescriptor* hierarchy =
+            GetClassHierarchy(layout, col->pClassDescriptor, c.numBaseClasses);
+        if (hierarchy) {
+            c.pClassDescriptor = col->pClassDescriptor;
+        }
+        if (!hierarchy || c.numBaseClasses < hierarchy->numBaseClasses) {
+            numCorrupt++;
+        }
+    }
+    if (numCorrupt) {
+        _MESSAGE("RTTI: %u class hierarchies point outside the image; ignored their bad entries.", numCorrupt);
+    }
+    for (RTTIVtblEntry& v : db.vtbls) {
+        v.col = FindRTTICol(db, v.col);
+    }
+
+    // 2. Each class's base classes, from the class hierarchy of its primary
+    //    VFT's COL. Entry 0 of the RTTIBaseClassArray is the class itself.
+    db.bases.clear();
+    for (UInt32 t = 0; t < (UInt32)db.types.size(); ++t)
+    {
+        RTTITypeEntry& type = db.types[t];
+        type.firstBase = (UInt32)db.bases.size();
+        type.numBases = 0;
+
+        const RTTIColEntry& col = db.cols[db.vtbls[type.firstVtbl].col];
+        if (!col.pClassDescriptor) continue;
+
+        const RTTIClassHierarchyDescriptor* hierarchy =
+            reinterpret_cast<const RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)col.pClassDescriptor);
+        const UInt32* pClassArray = reinterpret_cast<const UInt32*>(baseAddr + (UInt64)hierarchy->pBaseClassArray);
+        for (UInt32 i = 1; i < col.numBaseClasses; ++i)
+        {
+            const RTTIBaseClassDescriptor* baseClass =
+                reinterpret_cast<const RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pClassArray[i]);
+            db.bases.push_back({ baseClass->pTypeDescriptor, baseClass->where.mdisp, baseClass->numContainedBases,
+                                 FindRTTIType(db, baseClass->pTypeDescriptor) });
+            type.numBases++;
+        }
+    }
+
+    // 3. Each VFT's parent.
+    LinkParentVtbls(db);
+
+    // 4. The VFTs by address.
+    db.vtblsByAddr.resize(db.vtbls.size());
+    for (UInt32 v = 0; v < (UInt32)db.vtbls.size(); ++v) {
+        db.vtblsByAddr[v] = v;
+    }
+    std::sort(db.vtblsByAddr.begin(), db.vtblsByAddr.end(),
+              [&](UInt32 a, UInt32 b) { return db.vtbls[a].pVtbl < db.vtbls[b].pVtbl; });
+}
+
+// ----------------------------------------------------------------------------
+// 5. The names: one entry for each distinct TypeDescriptor in 'types' and
+//    'bases', demangled once into 'names' and 'nameText'. StartRTTINames
+//    makes the entries, with empty names, and returns how many there are;
+//    InternRTTINames then demangles entries [first, last), in order.
+// ----------------------------------------------------------------------------
+UInt32 StartRTTINames(RTTIDatabase& db)
+{
+    std::vector<UInt32> keys;
+    keys.reserve(db.types.size() + db.bases.size());
+    for (const RTTITypeEntry& t : db.types) {
+        keys.push_back(t.pTypeDescriptor);
+    }
+    for (const RTTIBaseEntry& b : db.bases) {
+        keys.push_back(b.pTypeDescriptor);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    db.names.clear();
+    db.names.reserve(keys.size());
+    for (UInt32 key : keys) {
+        db.names.push_back({ key, 0, 0 });
+    }
+
+    // Most names are well under 64 characters.
+    db.nameText.clear();
+    db.nameText.reserve(keys.size() * 64);
+    return (UInt32)db.names.size();
+}
+
+void InternRTTINames(const ImageLayout& layout, RTTIDatabase& db, const UInt32 first, const UInt32 last)
+{
+    std::string name;
+    for (UInt32 n = first; n < last; ++n)
+    {
+        RTTINameEntry& entry = db.names[n];
+        const TypeDescriptor* type =
+            reinterpret_cast<const TypeDescriptor*>(db.baseAddr + (UInt64)entry.pTypeDescriptor);
+        GetUnmangledTypeName(type, layout, name);
+        entry.name = (UInt32)db.nameText.size();
+        entry.length = (UInt32)name.size();
+        db.nameText.insert(db.nameText.end(), name.begin(), name.end());
+        db.nameText.push_back('\0');
+    }
+}
+
+// ============================================================================
+//   Lookups. Each returns an index into the relevant array, or RTTI_NO_INDEX.
+// ============================================================================
+UInt32 FindRTTIType(const RTTIDatabase& db, const UInt32 pTypeDescriptor)
+{
+    auto it = std::lower_bound(db.types.begin(), db.types.end(), pTypeDescriptor,
+                               [](const RTTITypeEntry& t, UInt32 rva) { return t.pTypeDescriptor < rva; });
+    if (it == db.types.end() || it->pTypeDescriptor != pTypeDescriptor) return RTTI_NO_INDEX;
+    return (UInt32)(it - db.types.begin());
+}
+
+UInt32 FindRTTIVtbl(const RTTIDatabase& db, const UInt32 pVtbl)
+{
+    auto it = std::lower_bound(db.vtblsByAddr.begin(), db.vtblsByAddr.end(), pVtbl,
+                               [&](UInt32 v, UInt32 rva) { return db.vtbls[v].pVtbl < rva; });
+    if (it == db.vtblsByAddr.end() || db.vtbls[*it].pVtbl != pVtbl) return RTTI_NO_INDEX;
+    return *it;
+}
+
+UInt32 FindRTTICol(const RTTIDatabase& db, const UInt32 pSelf)
+{
+    auto it = std::lower_bound(db.cols.begin(), db.cols.end(), pSelf,
+                               [](const RTTIColEntry& c, UInt32 rva) { return c.pSelf < rva; });
+    if (it == db.cols.end() || it->pSelf != pSelf) return RTTI_NO_INDEX;
+    return (UInt32)(it - db.cols.begin());
+}
+
+// ============================================================================
+//   The demangled name of the TypeDescriptor at 'pTypeDescriptor', and its
+//   'length', or NULL if it isn't one of the database's.
+// ============================================================================
+const char* FindRTTIName(const RTTIDatabase& db, const UInt32 pTypeDescriptor, UInt32& length)
+{
+    auto it = std::lower_bound(db.names.begin(), db.names.end(), pTypeDescriptor,
+                               [](const RTTINameEntry& n, UInt32 rva) { return n.pTypeDescriptor < rva; });
+    if (it == db.names.end() || it->pTypeDescriptor != pTypeDescriptor) return nullptr;
+    length = it->length;
+    return db.nameText.data() + it->name;
+}
+
+// ============================================================================
+//   Return the parent VFT of 'vtbl', which must be the address of one of the
+//   database's VFTs, or NULL if it doesn't have one.
+// ============================================================================
+UInt64* GetParentVtbl(const RTTIDatabase& db, const UInt64* vtbl)
+{
+    UInt32 v = FindRTTIVtbl(db, (UInt32)((UInt64)vtbl - db.baseAddr));
+    if (v == RTTI_NO_INDEX || db.vtbls[v].parent == RTTI_NO_INDEX) return nullptr;
+    return GetVtblAddress(db, db.vtbls[v].parent);
+}
+
+// ============================================================================
+//   Number of bytes of memory used by the database's arrays.
+// ============================================================================
+std::size_t GetRTTIDatabaseSize(const RTTIDatabase& db)
+{
+    return db.types.capacity() * sizeof(RTTITypeEntry) +
+           db.vtbls.capacity() * sizeof(RTTIVtblEntry) +
+           db.cols.capacity() * sizeof(RTTIColEntry) +
+           db.bases.capacity() * sizeof(RTTIBaseEntry) +
+           db.vtblsByAddr.capacity() * sizeof(UInt32) +
+           db.names.capacity() * sizeof(RTTINameEntry) +
+           db.nameText.capacity();
+}
+
+// ============================================================================
+//   Link each VFT to the VFT of its parent class.
+// ----------------------------------------------------------------------------
+// A VFT's parent is the primary VFT of the first base class (other than the
+// class itself) that sits at the same offset (mdisp) as the VFT's sub-object
+// and that has VFTs of its own. The child's entries override or extend the
+// parent's, entry for entry. Done once here, this makes everything that
+// compares a class with its parents linear in the number of VFTs.
+// ============================================================================
+static void LinkParentVtbls(RTTIDatabase& db)
+{
+    for (RTTIVtblEntry& v : db.vtbls)
+    {
+        v.parent = RTTI_NO_INDEX;
+        const RTTIColEntry& col = db.cols[v.col];
+        const RTTITypeEntry& type = db.types[v.type];
+        for (UInt32 b = type.firstBase; b < type.firstBase + type.numBases; ++b)
+        {
+            const RTTIBaseEntry& base = db.bases[b];
+            if (base.mdisp == col.offset && base.type != RTTI_NO_INDEX) {
+                v.parent = GetPrimaryVtbl(db, base.type);
+                break;
+            }
+        }
+    }
+}
+
+// ============================================================================
+//   TRUE if both databases describe the same classes and VFTs.
+// ----------------------------------------------------------------------------
+// The entries are plain arrays of UInt32s, so they can be compared bytewise.
+// The names follow from the rest, so they aren't compared.
+// ============================================================================
+template <typename T>
+static bool SameEntries(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || !memcmp(a.data(), b.data(), a.size() * sizeof(T)));
+}
+
+bool operator==(const RTTIDatabase& a, const RTTIDatabase& b)
+{
+    return a.baseAddr == b.baseAddr &&
+           SameEntries(a.types, b.types) && SameEntries(a.vtbls, b.vtbls) &&
+           SameEntries(a.cols, b.cols) && SameEntries(a.bases, b.bases);
+}
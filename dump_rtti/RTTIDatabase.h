@@ -0,0 +1,162 @@
+// ============================================================================
+// dump_rtti/RTTIDatabase.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <vector>
+
+#include "PEImage.h"
+#include "Platform.h"
+
+// ============================================================================
+//                          RTTI database.
+// ----------------------------------------------------------------------------
+// Everything LoadVTables finds, in a handful of flat arrays. All addresses are
+// stored as OFFSETs (RVAs) from the module base, and all cross-references as
+// 32-bit indexes into the other arrays, so the whole thing is compact and can
+// be walked without chasing pointers.
+//
+//   types    one per class with at least one VFT, in ascending TypeDescriptor
+//            order. Each owns a contiguous range of 'vtbls' and of 'bases'.
+//   vtbls    grouped by type. Within a type the primary VFT (offset 0) comes
+//            first, followed by the VFTs of the other sub-objects. Each links
+//            to its parent VFT, if any (see FinishRTTIDatabase).
+//   cols     one per COL referenced by a VFT, in ascending address order.
+//            A corrupt class hierarchy is dropped, and a corrupt base class
+//            array cut short at its first bad entry.
+//   bases    each type's base classes, i.e. its RTTIBaseClassArray less its
+//            own entry, in array order.
+//   names    the demangled name of every TypeDescriptor in 'types' and
+//            'bases', in ascending TypeDescriptor order. The text of them
+//            all is kept back to back in 'nameText'.
+//
+// Demangling is much the most expensive thing the dump does per name, and the
+// same few thousand names turn up again and again: every class's hierarchy
+// lists all of its bases, and every VFT names its parent. So each name is
+// demangled once, in FinishRTTIDatabase, and looked up by TypeDescriptor
+// OFFSET from then on.
+// ============================================================================
+const UInt32 RTTI_NO_INDEX        = 0xFFFFFFFF;
+
+struct RTTITypeEntry
+{
+    UInt32        pTypeDescriptor;     // 00: OFFSET to the TypeDescriptor
+    UInt32        firstVtbl;           // 04: index of its first entry in 'vtbls'
+    UInt32        numVtbls;            // 08: number of entries in 'vtbls' (at least 1)
+    UInt32        firstBase;           // 0C: index of its first entry in 'bases'
+    UInt32        numBases;            // 10: number of entries in 'bases'
+};
+
+struct RTTIVtblEntry
+{
+    UInt32        pVtbl;               // 00: OFFSET to the VFT (i.e. its first entry)
+    UInt32        col;                 // 04: index of its COL in 'cols'
+    UInt32        type;                // 08: index of its class in 'types'
+    UInt32        parent;              // 0C: index of its parent VFT, or RTTI_NO_INDEX
+};
+
+struct RTTIColEntry
+{
+    UInt32        pSelf;               // 00: OFFSET to the RTTICompleteObjectLocator
+    UInt32        offset;              // 04: offset from the complete object to this sub-object
+    UInt32        pClassDescriptor;    // 08: OFFSET to the RTTIClassHierarchyDescriptor, or 0 if it's corrupt
+    UInt32        type;                // 0C: index of its class in 'types'
+    UInt32        numBaseClasses;      // 10: entries of its RTTIBaseClassArray that can be followed (see GetClassHierarchy)
+};
+
+struct RTTIBaseEntry
+{
+    UInt32        pTypeDescriptor;     // 00: OFFSET to the base class's TypeDescriptor
+    UInt32        mdisp;               // 04: offset of the base class within the class
+    UInt32        numContainedBases;   // 08: number of bases the base class itself has
+    UInt32        type;                // 0C: index of the base class in 'types', or RTTI_NO_INDEX
+};
+
+struct RTTINameEntry
+{
+    UInt32        pTypeDescriptor;     // 00: OFFSET to the TypeDescriptor
+    UInt32        name;                // 04: offset of its name in 'nameText'
+    UInt32        length;              // 08: length of the name (which is also NUL-terminated)
+};
+
+struct RTTIDatabase
+{
+    UInt64        baseAddr;            // address at which the image is mapped
+    std::vector<RTTITypeEntry> types;
+    std::vector<RTTIVtblEntry> vtbls;
+    std::vector<RTTIColEntry>  cols;
+    std::vector<RTTIBaseEntry> bases;
+    std::vector<UInt32>        vtblsByAddr; // indexes into 'vtbls', in ascending VFT order
+    std::vector<RTTINameEntry> names;
+    std::vector<char>          nameText;
+};
+
+// public:
+void ClearRTTIDatabase(RTTIDatabase& db);
+
+void AddRTTIType(RTTIDatabase& db, const UInt32 pTypeDescriptor);
+
+void AddRTTIVtbl(RTTIDatabase& db, const UInt32 pVtbl, const UInt32 pCol);
+
+void FinishRTTIDatabase(const ImageLayout& layout, RTTIDatabase& db);
+
+void LinkRTTIDatabase(const ImageLayout& layout, RTTIDatabase& db);
+
+UInt32 StartRTTINames(RTTIDatabase& db);
+
+void InternRTTINames(const ImageLayout& layout, RTTIDatabase& db, const UInt32 first, const UInt32 last);
+
+UInt32 FindRTTIType(const RTTIDatabase& db, const UInt32 pTypeDescriptor);
+
+UInt32 FindRTTIVtbl(const RTTIDatabase& db, const UInt32 pVtbl);
+
+UInt32 FindRTTICol(const RTTIDatabase& db, const UInt32 pSelf);
+
+const char* FindRTTIName(const RTTIDatabase& db, const UInt32 pTypeDescriptor, UInt32& length);
+
+UInt64* GetParentVtbl(const RTTIDatabase& db, const UInt64* vtbl);
+
+std::size_t GetRTTIDatabaseSize(const RTTIDatabase& db);
+
+bool operator==(const RTTIDatabase& a, const RTTIDatabase& b);
+
+// Absolute address of vtbls[v].
+inline UInt64* GetVtblAddress(const RTTIDatabase& db, const UInt32 v)
+{
+    return reinterpret_cast<UInt64*>(db.baseAddr + db.vtbls[v].pVtbl);
+}
+
+// Index into 'vtbls' of the primary VFT of types[t].
+inline UInt32 GetPrimaryVtbl(const RTTIDatabase& db, const UInt32 t)
+{
+    return db.types[t].firstVtbl;
+}
+
+// Index into 'vtbls' of the parent of vtbls[v], or RTTI_NO_INDEX.
+inline UInt32 GetParentVtbl(const RTTIDatabase& db, const UInt32 v)
+{
+    return db.vtbls[v].parent;
+}
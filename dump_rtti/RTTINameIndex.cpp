@@ -0,0 +1,403 @@
+// ============================================================================
+// dump_rtti/RTTINameIndex.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "RTTINameIndex.h"
+
+static void ParseRTTIName(RTTINameIndex& index, const UInt32 n, const char* text, const UInt32 length,
+                          const bool isArg);
+
+static bool SplitPlainName(const char* text, const UInt32 length, UInt32& name, UInt32& nameEnd,
+                           std::vector<std::pair<UInt32, UInt32>>& args);
+
+static bool IsInteger(const char* text, const UInt32 length, SInt64& value);
+
+static void CanonicalName(const char* text, const UInt32 length, std::string& canonical);
+
+static UInt32 InternAtom(RTTINameIndex& index, const std::string& text);
+
+static UInt32 FindAtom(const RTTINameIndex& index, const std::string& text);
+
+static void FindPostings(const RTTINameIndex& index, const UInt32 templ, const UInt32 arg, const UInt32 atom,
+                         std::vector<UInt32>& names);
+
+// ============================================================================
+//   Parse the names in 'db' and index them. 'index' refers to 'db', which
+//   must outlive it.
+// ============================================================================
+void BuildRTTINameIndex(const RTTIDatabase& db, RTTINameIndex& index)
+{
+    index.db = &db;
+    index.nodes.clear();
+    index.atoms.clear();
+    index.atomIds.clear();
+    index.postings.clear();
+    InternAtom(index, std::string());
+
+    // The names come first, so that nodes[n] is names[n]; their arguments
+    // are added after them as they're parsed.
+    const UInt32 numNames = (UInt32)db.names.size();
+    index.nodes.resize(numNames);
+    for (UInt32 n = 0; n < numNames; ++n) {
+        ParseRTTIName(index, n, db.nameText.data() + db.names[n].name, db.names[n].length, false);
+    }
+
+    // Each instantiation is posted under its template's full name and, if
+    // that's scoped, its own name. Likewise each argument that's a class (or
+    // struct, ...), so "StaticFunctionTag" finds "BSScript::StaticFunctionTag".
+    // A plain class name is posted like an instantiation with no arguments.
+    std::string shortName;
+    for (UInt32 n = 0; n < numNames; ++n)
+    {
+        const RTTINameNode& node = index.nodes[n];
+        if (node.kind == kRTTIName_Other) continue;
+
+        const char* text = GetRTTINodeText(index, node);
+        UInt32 templ = node.templ;
+        if (templ == RTTI_NO_INDEX) {
+            CanonicalName(text + node.scope, node.nameEnd - node.scope, shortName);
+            templ = InternAtom(index, shortName);
+        }
+        CanonicalName(text + node.name, node.nameEnd - node.name, shortName);
+        UInt32 templs[2] = { templ, InternAtom(index, shortName) };
+        for (UInt32 t = 0; t < 2; ++t)
+        {
+            if (t == 1 && templs[1] == templs[0]) break;
+            index.postings.push_back({ templs[t], RTTI_NO_INDEX, 0, n });
+            for (UInt32 a = 0; a < node.numArgs; ++a)
+            {
+                const RTTINameNode& arg = index.nodes[node.firstArg + a];
+                index.postings.push_back({ templs[t], a, arg.atom, n });
+                if (arg.kind == kRTTIName_Integer || arg.kind == kRTTIName_Other || arg.name == arg.scope) continue;
+
+                const char* argText = GetRTTINodeText(index, arg);
+                CanonicalName(argText + arg.name, arg.length - arg.name, shortName);
+                index.postings.push_back({ templs[t], a, InternAtom(index, shortName), n });
+            }
+        }
+    }
+    std::sort(index.postings.begin(), index.postings.end(),
+              [](const RTTINamePosting& a, const RTTINamePosting& b) {
+                  if (a.templ != b.templ) return a.templ < b.templ;
+                  if (a.arg != b.arg) return a.arg < b.arg;
+                  if (a.atom != b.atom) return a.atom < b.atom;
+                  return a.name < b.name;
+              });
+}
+
+// ============================================================================
+//   Set 'names' to the indexes (into the database's 'names') of the names
+//   that match 'pattern', in ascending order. Return FALSE if the pattern
+//   isn't a name or of the form "template<arg,...>" (see RTTINameIndex.h).
+// ============================================================================
+bool FindRTTINames(const RTTINameIndex& index, const char* pattern, std::vector<UInt32>& names)
+{
+    names.clear();
+
+    // The pattern is parsed like a name, after being put in the same form
+    // as the atoms.
+    std::string canonical;
+    CanonicalName(pattern, (UInt32)strlen(pattern), canonical);
+    std::size_t first = canonical.find_first_not_of(' ');
+    std::size_t last = canonical.find_last_not_of(' ');
+    if (first == std::string::npos) return false;
+    canonical = canonical.substr(first, last - first + 1);
+
+    UInt32 name, nameEnd;
+    std::vector<std::pair<UInt32, UInt32>> args;
+    if (!SplitPlainName(canonical.c_str(), (UInt32)canonical.length(), name, nameEnd, args)) return false;
+
+    UInt32 templ = FindAtom(index, canonical.substr(0, nameEnd));
+    if (templ == RTTI_NO_INDEX) return true;
+    FindPostings(index, templ, RTTI_NO_INDEX, 0, names);
+
+    std::vector<UInt32> hits;
+    std::vector<UInt32> both;
+    for (UInt32 a = 0; a < (UInt32)args.size() && !names.empty(); ++a)
+    {
+        std::string arg = canonical.substr(args[a].first, args[a].second - args[a].first);
+        if (arg == "*") continue;
+
+        UInt32 atom = FindAtom(index, arg);
+        if (atom == RTTI_NO_INDEX) {
+            names.clear();
+            break;
+        }
+        hits.clear();
+        FindPostings(index, templ, a, atom, hits);
+        both.clear();
+        std::set_intersection(names.begin(), names.end(), hits.begin(), hits.end(), std::back_inserter(both));
+        names.swap(both);
+    }
+    return true;
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static void ParseRTTIName(RTTINameIndex& index, const UInt32 n, const char* text, const UInt32 length,
+                          const bool isArg)
+{
+    // ------------------------------------------------------------------------
+    // Parse the name or template argument 'text' into nodes[n], and its
+    // arguments (if any) into new nodes.
+    // ------------------------------------------------------------------------
+    static const struct { const char* keyword; UInt32 length; RTTINameKind kind; } KEYWORDS[] = {
+        { "class ",  6, kRTTIName_Class },
+        { "struct ", 7, kRTTIName_Struct },
+        { "union ",  6, kRTTIName_Union },
+        { "enum ",   5, kRTTIName_Enum },
+    };
+
+    RTTINameNode node;
+    memset(&node, 0, sizeof(node));
+    node.text = (UInt32)(text - index.db->nameText.data());
+    node.length = length;
+    node.kind = kRTTIName_Other;
+    node.templ = RTTI_NO_INDEX;
+
+    std::string canonical;
+    CanonicalName(text, length, canonical);
+    node.atom = InternAtom(index, canonical);
+
+    // An integer...
+    if (isArg && IsInteger(text, length, node.value)) {
+        node.kind = kRTTIName_Integer;
+        index.nodes[n] = node;
+        return;
+    }
+
+    // ... or a class, struct, union or enum, i.e. the keyword and a name with
+    // nothing after it (" const", " * __ptr64" and so on make it some other
+    // type) ...
+    UInt32 start = 0;
+    for (const auto& k : KEYWORDS) {
+        if (length > k.length && !memcmp(text, k.keyword, k.length)) {
+            node.kind = k.kind;
+            start = k.length;
+            break;
+        }
+    }
+    UInt32 name, nameEnd;
+    std::vector<std::pair<UInt32, UInt32>> args;
+    if (node.kind == kRTTIName_Other || length > 0xFFFF ||
+        !SplitPlainName(text + start, length - start, name, nameEnd, args)) {
+        // ... or anything else.
+        node.kind = kRTTIName_Other;
+        index.nodes[n] = node;
+        return;
+    }
+    node.scope = (UInt16)start;
+    node.name = (UInt16)(start + name);
+    node.nameEnd = (UInt16)(start + nameEnd);
+    if (args.empty()) {
+        index.nodes[n] = node;
+        return;
+    }
+
+    CanonicalName(text + start, nameEnd, canonical);
+    node.templ = InternAtom(index, canonical);
+    node.numArgs = (UInt16)args.size();
+    node.firstArg = (UInt32)index.nodes.size();
+    index.nodes[n] = node;
+
+    // N.B. parsing the arguments adds nodes, so 'node' is a copy.
+    index.nodes.resize(index.nodes.size() + args.size());
+    for (UInt32 a = 0; a < node.numArgs; ++a) {
+        ParseRTTIName(index, node.firstArg + a, text + start + args[a].first, args[a].second - args[a].first, true);
+    }
+}
+
+static bool SplitPlainName(const char* text, const UInt32 length, UInt32& name, UInt32& nameEnd,
+                           std::vector<std::pair<UInt32, UInt32>>& args)
+{
+    // ------------------------------------------------------------------------
+    // If 'text' is a (possibly scoped, possibly template) name, e.g.
+    // "BSScript::NativeFunction2<struct BSScript::StaticFunctionTag,void>",
+    // return TRUE with the offsets of its own name ("NativeFunction2") and of
+    // the end of that, and the extents of its template arguments in 'args'.
+    // Return FALSE for anything else.
+    // ------------------------------------------------------------------------
+    // Brackets of all kinds nest: <...>, (...) and `...' (a function, in the
+    // scope of a local class). Commas and "::" only count outside them.
+    int depth = 0;
+    UInt32 open = 0;                   // of the last part's '<', or 0
+    UInt32 close = 0;                  // ... and of its '>'
+    UInt32 argStart = 0;
+    name = 0;
+    args.clear();
+    for (UInt32 i = 0; i < length; ++i)
+    {
+        switch (text[i])
+        {
+        case '<':
+            if (depth == 0) {
+                if (open || i == name) return false;
+                open = i;
+                argStart = i + 1;
+            }
+            depth++;
+            break;
+
+        case '>':
+            if (--depth < 0) return false;
+            if (depth == 0) {
+                UInt32 argEnd = i;
+                while (argEnd > argStart && text[argEnd - 1] == ' ') argEnd--;
+                args.push_back({ argStart, argEnd });
+                close = i;
+            }
+            break;
+
+        case ',':
+            if (depth == 1 && open && !close) {
+                args.push_back({ argStart, i });
+                argStart = i + 1;
+            }
+            break;
+
+        case '(': case '`':
+            depth++;
+            break;
+
+        case ')': case '\'':
+            if (--depth < 0) return false;
+            break;
+
+        case ':':
+            if (depth == 0) {
+                // The scope so far, e.g. "BSTArray<int>::"; it's the last
+                // part that matters.
+                if (i + 1 >= length || text[i + 1] != ':' || (open && close != i - 1)) return false;
+                open = close = 0;
+                args.clear();
+                name = i + 2;
+                i++;
+            }
+            break;
+
+        case ' ':
+            if (depth == 0) return false;
+            break;
+
+        default:
+            if (depth == 0 && close) return false;
+            break;
+        }
+    }
+    if (depth != 0 || name >= length || (open && close != length - 1)) return false;
+    nameEnd = open ? open : length;
+    return true;
+}
+
+static bool IsInteger(const char* text, const UInt32 length, SInt64& value)
+{
+    UInt32 i = (length && text[0] == '-') ? 1 : 0;
+    if (i == length || length > 20) return false;
+    UInt64 n = 0;
+    for (UInt32 j = i; j < length; ++j) {
+        if (text[j] < '0' || text[j] > '9') return false;
+        n = n * 10 + (UInt64)(text[j] - '0');
+    }
+    value = i ? -(SInt64)n : (SInt64)n;
+    return true;
+}
+
+static void CanonicalName(const char* text, const UInt32 length, std::string& canonical)
+{
+    // ------------------------------------------------------------------------
+    // 'text' without the keywords at the start of it and of its arguments,
+    // without " __ptr64", and with "> >" written as ">>".
+    // ------------------------------------------------------------------------
+    static const char* const KEYWORDS[] = { "class ", "struct ", "union ", "enum " };
+    static const char PTR64[] = " __ptr64";
+
+    canonical.clear();
+    canonical.reserve(length);
+    UInt32 i = 0;
+    while (i < length)
+    {
+        char prev = canonical.empty() ? '\0' : canonical.back();
+        if (prev == '\0' || prev == '<' || prev == ',' || prev == '(') {
+            bool keyword = false;
+            for (const char* k : KEYWORDS) {
+                UInt32 len = (UInt32)strlen(k);
+                if (length - i > len && !memcmp(text + i, k, len)) {
+                    i += len;
+                    keyword = true;
+                    break;
+                }
+            }
+            if (keyword) continue;
+        }
+        if (length - i >= sizeof(PTR64) - 1 && !memcmp(text + i, PTR64, sizeof(PTR64) - 1)) {
+            i += sizeof(PTR64) - 1;
+            continue;
+        }
+        if (text[i] == ' ' && prev == '>' && i + 1 < length && text[i + 1] == '>') {
+            i++;
+            continue;
+        }
+        canonical.push_back(text[i++]);
+    }
+}
+
+static UInt32 InternAtom(RTTINameIndex& index, const std::string& text)
+{
+    auto it = index.atomIds.find(text);
+    if (it != index.atomIds.end()) return it->second;
+    UInt32 atom = (UInt32)index.atoms.size();
+    index.atoms.push_back(text);
+    index.atomIds.emplace(text, atom);
+    return atom;
+}
+
+static UInt32 FindAtom(const RTTINameIndex& index, const std::string& text)
+{
+    auto it = index.atomIds.find(text);
+    return (it != index.atomIds.end()) ? it->second : RTTI_NO_INDEX;
+}
+
+static void FindPostings(const RTTINameIndex& index, const UInt32 templ, const UInt32 arg, const UInt32 atom,
+                         std::vector<UInt32>& names)
+{
+    // ------------------------------------------------------------------------
+    // Append the names posted under (templ, arg, atom), in ascending order.
+    // ------------------------------------------------------------------------
+    const RTTINamePosting key = { templ, arg, atom, 0 };
+    auto it = std::lower_bound(index.postings.begin(), index.postings.end(), key,
+                               [](const RTTINamePosting& a, const RTTINamePosting& b) {
+                                   if (a.templ != b.templ) return a.templ < b.templ;
+                                   if (a.arg != b.arg) return a.arg < b.arg;
+                                   return a.atom < b.atom;
+                               });
+    for (; it != index.postings.end() && it->templ == templ && it->arg == arg && it->atom == atom; ++it) {
+        names.push_back(it->name);
+    }
+}
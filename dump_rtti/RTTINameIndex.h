@@ -0,0 +1,126 @@
+// ============================================================================
+// dump_rtti/RTTINameIndex.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Platform.h"
+#include "RTTIDatabase.h"
+
+// ============================================================================
+//                     Parsed names, and an index of them.
+// ----------------------------------------------------------------------------
+// Most of the interesting classes are template instantiations, e.g.
+//     class ConcreteObjectFormFactory<class AlchemyItem,46,17,2>
+//     class BSScript::NativeFunction2<struct BSScript::StaticFunctionTag,void,
+//                                     class BSFixedString const & __ptr64,float>
+// BuildRTTINameIndex parses each of the database's names into a node: its
+// kind (class, struct, ...), its scope, its own name and its template
+// arguments. Each argument is a node too - an integer, a class (parsed in
+// turn) or any other type - so the nodes form a tree per name, all kept in
+// one flat array. The text stays in the database's 'nameText'; nodes only
+// refer to it.
+//
+// Every distinct template name and argument is interned as an "atom", in a
+// canonical form: without the class / struct / union / enum keywords and
+// without __ptr64 (so "Actor" is the atom of "class Actor", and
+// "BSFixedString const &" that of "class BSFixedString const & __ptr64").
+// The index proper is one sorted array of postings, (template, argument
+// number, argument) => name, plus (template) => name for each instantiation
+// and (class) => name for each plain class name, so a query is a binary
+// search per constraint and an intersection of sorted lists. FindRTTINames
+// takes a pattern like
+//     NativeFunction2<*,*,*,float>
+//     BSScript::NativeFunction2<StaticFunctionTag>
+//     ConcreteObjectFormFactory<*,46>
+//     DNameNode
+// where '*' matches anything, and trailing arguments may be left out (so a
+// plain name finds the class and every instantiation of a template of that
+// name). The template, and any argument that's a class, may be given with or
+// without its scope.
+//
+// Only the names themselves are indexed, not the templates that appear in
+// their arguments; each of those that has RTTI is a name in its own right.
+// ============================================================================
+enum RTTINameKind
+{
+    kRTTIName_Class,
+    kRTTIName_Struct,
+    kRTTIName_Union,
+    kRTTIName_Enum,
+    kRTTIName_Integer,                 // a template argument
+    kRTTIName_Other,                   // e.g. "float" or "class Actor * __ptr64"; not parsed further
+};
+
+struct RTTINameNode
+{
+    UInt32        text;                // 00: offset of its text in the database's 'nameText'
+    UInt32        length;              // 04: length of its text
+    UInt16        scope;               // 08: offset within the text of its scope ("BSScript::..."), i.e. after the keyword
+    UInt16        name;                // 0A: offset within the text of its own name
+    UInt16        nameEnd;             // 0C: offset within the text of the end of its name (its '<', if any)
+    UInt16        numArgs;             // 0E: number of template arguments
+    UInt32        firstArg;            // 10: index of its first template argument in 'nodes'
+    UInt32        kind;                // 14: RTTINameKind
+    UInt32        templ;               // 18: atom of its template ("BSScript::NativeFunction2"), or RTTI_NO_INDEX
+    UInt32        atom;                // 1C: atom of its whole text
+    SInt64        value;               // 20: its value, if it's an integer
+};
+
+struct RTTINamePosting
+{
+    UInt32        templ;               // 00: atom of the template (or plain class name), with or without its scope
+    UInt32        arg;                 // 04: argument number, or RTTI_NO_INDEX for the template itself
+    UInt32        atom;                // 08: atom of the argument (0 for the template itself)
+    UInt32        name;                // 0C: index of the instantiation in 'names' (and 'nodes')
+};
+
+struct RTTINameIndex
+{
+    const RTTIDatabase* db;
+    std::vector<RTTINameNode> nodes;   // one per name in db->names, in the same order, then the arguments
+    std::vector<std::string> atoms;
+    std::unordered_map<std::string, UInt32> atomIds;
+    std::vector<RTTINamePosting> postings;    // sorted
+};
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+void BuildRTTINameIndex(const RTTIDatabase& db, RTTINameIndex& index);
+
+bool FindRTTINames(const RTTINameIndex& index, const char* pattern, std::vector<UInt32>& names);
+
+// The text of a node.
+inline const char* GetRTTINodeText(const RTTINameIndex& index, const RTTINameNode& node)
+{
+    return index.db->nameText.data() + node.text;
+}
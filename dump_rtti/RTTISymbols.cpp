@@ -0,0 +1,357 @@
+// ============================================================================
+// dump_rtti/RTTISymbols.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cstring>
+
+#include "RTTI.h"
+#include "RTTISymbols.h"
+
+static UInt32 GetSymbolRefRank(const RTTISymbolRef& ref);
+
+static void AppendSymbolText(char* buf, const UInt32 size, UInt32& length, const char* text, UInt32 textLength);
+
+static void AppendSymbolHex(char* buf, const UInt32 size, UInt32& length, UInt64 value, const UInt32 width);
+
+static void AppendClassName(const RTTISymbols& symbols, char* buf, const UInt32 size, UInt32& length,
+                            const UInt32 type);
+
+// ============================================================================
+//   Work out the ranges of the image that can be named, and the VFT slots
+//   that point to each function. 'symbols' refers to 'db', which must
+//   outlive it.
+// ============================================================================
+void BuildRTTISymbols(const ImageLayout& layout, const RTTIDatabase& db, RTTISymbols& symbols)
+{
+    symbols.db = &db;
+    symbols.baseAddr = layout.baseAddr;
+    symbols.sizeOfImage = layout.sizeOfImage;
+    symbols.begins.clear();
+    symbols.ranges.clear();
+    symbols.refs.clear();
+
+    std::vector<std::pair<UInt32, RTTISymbolRange>> ranges;
+
+    // 1. Every slot of every VFT - inherited or not, unlike PrintVtbl - and
+    //    the function it leads to. A slot that points to a thunk refers to
+    //    both the thunk and the function.
+    std::vector<std::pair<UInt32, RTTISymbolRef>> funcRefs;
+    for (UInt32 v = 0; v < (UInt32)db.vtbls.size(); ++v)
+    {
+        const UInt64* vtbl = GetVtblAddress(db, v);
+        const UInt32 parent = GetParentVtbl(db, v);
+        const UInt64* vtparent = (parent != RTTI_NO_INDEX) ? GetVtblAddress(db, parent) : nullptr;
+        UInt32 i = 0;
+        for (; i <= 0xFFFF && IsFunctionEntry(layout, vtbl[i]); ++i)
+        {
+            if (vtparent && !IsFunctionEntry(layout, vtparent[i])) {
+                vtparent = nullptr;
+            }
+            const UInt16 flags = (vtparent && vtparent[i] == vtbl[i]) ? kRTTISymbolRef_Inherited : 0;
+            const UInt32 pFunc = (UInt32)(vtbl[i] - layout.baseAddr);
+            funcRefs.push_back(std::make_pair(pFunc, RTTISymbolRef{ v, (UInt16)i, flags }));
+
+            SInt32 thisAdjust;
+            const UInt32 target = ResolveFuncThunk(layout, pFunc, thisAdjust);
+            if (target != pFunc) {
+                funcRefs.push_back(std::make_pair(target, RTTISymbolRef{ v, (UInt16)i,
+                                                                         (UInt16)(flags | kRTTISymbolRef_Thunk) }));
+            }
+        }
+
+        // From the meta field to the last slot.
+        const UInt32 pVtbl = db.vtbls[v].pVtbl;
+        ranges.push_back(std::make_pair(pVtbl - 8, RTTISymbolRange{ pVtbl + i * 8, kRTTISymbol_Vtbl, 0, v, 0, 0 }));
+    }
+    std::sort(funcRefs.begin(), funcRefs.end(),
+              [](const std::pair<UInt32, RTTISymbolRef>& a, const std::pair<UInt32, RTTISymbolRef>& b) {
+                  if (a.first != b.first) return a.first < b.first;
+                  const UInt32 rankA = GetSymbolRefRank(a.second);
+                  const UInt32 rankB = GetSymbolRefRank(b.second);
+                  if (rankA != rankB) return rankA < rankB;
+                  if (a.second.vtbl != b.second.vtbl) return a.second.vtbl < b.second.vtbl;
+                  return a.second.slot < b.second.slot;
+              });
+
+    // 2. The functions in .pdata, and those the VFTs lead to that aren't in
+    //    it. Those run, as far as we know, up to the next function.
+    for (const ImageFunction& func : layout.functions)
+    {
+        const UInt16 flags = (func.entry != func.begin) ? kRTTISymbol_Fragment : 0;
+        ranges.push_back(std::make_pair(func.begin,
+                                        RTTISymbolRange{ func.end, kRTTISymbol_Function, flags, 0, 0, func.entry }));
+    }
+    std::vector<UInt32> leaves;
+    for (const auto& funcRef : funcRefs)
+    {
+        if ((leaves.empty() || leaves.back() != funcRef.first) &&
+            !FindImageFunction(layout, layout.baseAddr + (UInt64)funcRef.first)) {
+            leaves.push_back(funcRef.first);
+        }
+    }
+    for (std::size_t f = 0; f < leaves.size(); ++f)
+    {
+        UInt32 end = (UInt32)(GetFunctionLimit(layout, layout.baseAddr + (UInt64)leaves[f]) - layout.baseAddr);
+        if (f + 1 < leaves.size() && leaves[f + 1] < end) {
+            end = leaves[f + 1];
+        }
+        ranges.push_back(std::make_pair(leaves[f], RTTISymbolRange{ end, kRTTISymbol_Function,
+                                                                    kRTTISymbol_SizeGuessed, 0, 0, leaves[f] }));
+    }
+
+    // 3. The COLs and TypeDescriptors.
+    for (UInt32 c = 0; c < (UInt32)db.cols.size(); ++c)
+    {
+        const UInt32 pSelf = db.cols[c].pSelf;
+        ranges.push_back(std::make_pair(pSelf, RTTISymbolRange{ pSelf + (UInt32)sizeof(RTTICompleteObjectLocator),
+                                                                kRTTISymbol_Col, 0, c, 0, 0 }));
+    }
+    for (UInt32 t = 0; t < (UInt32)db.types.size(); ++t)
+    {
+        const UInt32 pType = db.types[t].pTypeDescriptor;
+        const TypeDescriptor* type = reinterpret_cast<const TypeDescriptor*>(layout.baseAddr + (UInt64)pType);
+        const UInt32 size = (UInt32)(type->name - reinterpret_cast<const char*>(type) + strlen(type->name) + 1);
+        ranges.push_back(std::make_pair(pType, RTTISymbolRange{ pType + size, kRTTISymbol_TypeDescriptor,
+                                                                0, t, 0, 0 }));
+    }
+
+    // 4. Sort the ranges, and give each function its refs. Ranges shouldn't
+    //    overlap; if any do, the first one wins.
+    std::sort(ranges.begin(), ranges.end(),
+              [](const std::pair<UInt32, RTTISymbolRange>& a, const std::pair<UInt32, RTTISymbolRange>& b) {
+                  return a.first < b.first;
+              });
+    symbols.begins.reserve(ranges.size());
+    symbols.ranges.reserve(ranges.size());
+    for (auto& range : ranges)
+    {
+        if (range.second.end <= range.first) continue;
+        if (!symbols.ranges.empty() && range.first < symbols.ranges.back().end) continue;
+        symbols.begins.push_back(range.first);
+        symbols.ranges.push_back(range.second);
+    }
+    symbols.refs.reserve(funcRefs.size());
+    for (const auto& funcRef : funcRefs) {
+        symbols.refs.push_back(funcRef.second);
+    }
+    for (RTTISymbolRange& range : symbols.ranges)
+    {
+        if (range.kind != kRTTISymbol_Function) continue;
+        auto lo = std::lower_bound(funcRefs.begin(), funcRefs.end(), range.entry,
+                                   [](const std::pair<UInt32, RTTISymbolRef>& r, const UInt32 p) {
+                                       return r.first < p;
+                                   });
+        auto hi = lo;
+        while (hi != funcRefs.end() && hi->first == range.entry) ++hi;
+        range.index = (UInt32)(lo - funcRefs.begin());
+        range.numRefs = (UInt32)(hi - lo);
+    }
+}
+
+// ============================================================================
+//   Find what 'addr' is in. Return FALSE, with symbol.kind kRTTISymbol_None,
+//   if it isn't in anything we know about. Doesn't lock or allocate.
+// ============================================================================
+bool LookupRTTISymbol(const RTTISymbols& symbols, const UInt64 addr, RTTISymbol& symbol)
+{
+    symbol.kind = kRTTISymbol_None;
+    symbol.flags = 0;
+    symbol.begin = 0;
+    symbol.end = 0;
+    symbol.offset = 0;
+    symbol.index = RTTI_NO_INDEX;
+    symbol.slot = RTTI_NO_INDEX;
+    symbol.refs = nullptr;
+    symbol.numRefs = 0;
+    if (addr < symbols.baseAddr || addr - symbols.baseAddr >= symbols.sizeOfImage) return false;
+    const UInt32 rva = (UInt32)(addr - symbols.baseAddr);
+
+    // The last range that starts at or before 'rva'.
+    const UInt32* begins = symbols.begins.data();
+    const UInt32* it = std::upper_bound(begins, begins + symbols.begins.size(), rva);
+    if (it == begins) return false;
+    const std::size_t r = (it - begins) - 1;
+    const RTTISymbolRange& range = symbols.ranges[r];
+    if (rva >= range.end) return false;
+
+    symbol.kind = range.kind;
+    symbol.flags = range.flags;
+    symbol.begin = symbols.baseAddr + (UInt64)begins[r];
+    symbol.end = symbols.baseAddr + (UInt64)range.end;
+    symbol.offset = rva - begins[r];
+    symbol.index = range.index;
+    if (range.kind == kRTTISymbol_Vtbl && symbol.offset >= 8) {
+        symbol.slot = (UInt32)(symbol.offset - 8) / 8;
+    }
+    if (range.kind == kRTTISymbol_Function && range.numRefs) {
+        symbol.refs = symbols.refs.data() + range.index;
+        symbol.numRefs = range.numRefs;
+    }
+    return true;
+}
+
+// ============================================================================
+//   Write a symbol's name into 'buf', e.g.
+//       Actor::Unk_01A + 0x34                 a function, by its first ref
+//       sub_140123450 + 0x34                  a function no VFT refers to
+//       Actor::`vftable' + 0x18
+//       Actor::`RTTI Complete Object Locator' + 0x4
+//       Actor `RTTI Type Descriptor' + 0x10
+//   truncated if need be, and NUL-terminated. Return its length. Doesn't
+//   lock or allocate.
+// ============================================================================
+UInt32 FormatRTTISymbol(const RTTISymbols& symbols, const RTTISymbol& symbol, char* buf, const UInt32 size)
+{
+    const RTTIDatabase& db = *symbols.db;
+    UInt32 length = 0;
+    if (size) buf[0] = '\0';
+
+    UInt64 offset = symbol.offset;
+    switch (symbol.kind)
+    {
+    case kRTTISymbol_Function:
+        if (symbol.numRefs) {
+            length = FormatRTTISymbolRef(symbols, symbol.refs[0], buf, size);
+        }
+        else {
+            AppendSymbolText(buf, size, length, "sub_", 4);
+            AppendSymbolHex(buf, size, length, symbol.begin, 8);
+        }
+        if (symbol.flags & kRTTISymbol_Fragment) {
+            AppendSymbolText(buf, size, length, " (fragment)", 11);
+        }
+        break;
+    case kRTTISymbol_Vtbl:
+        AppendClassName(symbols, buf, size, length, db.vtbls[symbol.index].type);
+        AppendSymbolText(buf, size, length, "::`vftable'", 11);
+        if (symbol.slot == RTTI_NO_INDEX) {
+            // The meta field, just before the VFT proper.
+            AppendSymbolText(buf, size, length, " - 0x", 5);
+            AppendSymbolHex(buf, size, length, 8 - offset, 0);
+            return length;
+        }
+        offset -= 8;
+        break;
+    case kRTTISymbol_Col:
+        AppendClassName(symbols, buf, size, length, db.cols[symbol.index].type);
+        AppendSymbolText(buf, size, length, "::`RTTI Complete Object Locator'", 32);
+        break;
+    case kRTTISymbol_TypeDescriptor:
+        AppendClassName(symbols, buf, size, length, symbol.index);
+        AppendSymbolText(buf, size, length, " `RTTI Type Descriptor'", 23);
+        break;
+    default:
+        AppendSymbolText(buf, size, length, "(unknown)", 9);
+        return length;
+    }
+    if (offset) {
+        AppendSymbolText(buf, size, length, " + 0x", 5);
+        AppendSymbolHex(buf, size, length, offset, 0);
+    }
+    return length;
+}
+
+// ============================================================================
+//   Write the name of the slot 'ref', e.g. "Actor::Unk_01A", into 'buf', as
+//   FormatRTTISymbol does.
+// ============================================================================
+UInt32 FormatRTTISymbolRef(const RTTISymbols& symbols, const RTTISymbolRef& ref, char* buf, const UInt32 size)
+{
+    UInt32 length = 0;
+    if (size) buf[0] = '\0';
+    AppendClassName(symbols, buf, size, length, symbols.db->vtbls[ref.vtbl].type);
+    AppendSymbolText(buf, size, length, "::Unk_", 6);
+    AppendSymbolHex(buf, size, length, ref.slot, 3);
+    return length;
+}
+
+static UInt32 GetSymbolRefRank(const RTTISymbolRef& ref)
+{
+    // ------------------------------------------------------------------------
+    // The order of a function's refs: the slots that introduce or override
+    // it before those that inherit it, and direct ones before thunks.
+    // ------------------------------------------------------------------------
+    return ((ref.flags & kRTTISymbolRef_Inherited) ? 2 : 0) + ((ref.flags & kRTTISymbolRef_Thunk) ? 1 : 0);
+}
+
+static void AppendSymbolText(char* buf, const UInt32 size, UInt32& length, const char* text, UInt32 textLength)
+{
+    // ------------------------------------------------------------------------
+    // Append as much of 'text' as fits, leaving room for the NUL.
+    // ------------------------------------------------------------------------
+    if (length + 1 >= size) return;
+    if (textLength > size - 1 - length) textLength = size - 1 - length;
+    memcpy(buf + length, text, textLength);
+    length += textLength;
+    buf[length] = '\0';
+}
+
+static void AppendSymbolHex(char* buf, const UInt32 size, UInt32& length, UInt64 value, const UInt32 width)
+{
+    // ------------------------------------------------------------------------
+    // Append 'value' in upper case hex, with at least 'width' digits.
+    // ------------------------------------------------------------------------
+    static const char digits[] = "0123456789ABCDEF";
+    char tmp[16];
+    UInt32 n = 0;
+    do {
+        tmp[15 - n++] = digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    while (n < width && n < 16) {
+        tmp[15 - n++] = '0';
+    }
+    AppendSymbolText(buf, size, length, tmp + 16 - n, n);
+}
+
+static void AppendClassName(const RTTISymbols& symbols, char* buf, const UInt32 size, UInt32& length,
+                            const UInt32 type)
+{
+    // ------------------------------------------------------------------------
+    // Append the name of db.types[type], without its class / struct / union
+    // keyword.
+    // ------------------------------------------------------------------------
+    static const char* const KEYWORDS[] = { "class ", "struct ", "union ", "enum " };
+
+    const UInt32 pTypeDescriptor = symbols.db->types[type].pTypeDescriptor;
+    UInt32 nameLength = 0;
+    const char* name = FindRTTIName(*symbols.db, pTypeDescriptor, nameLength);
+    if (!name) {
+        AppendSymbolText(buf, size, length, "type_", 5);
+        AppendSymbolHex(buf, size, length, symbols.baseAddr + (UInt64)pTypeDescriptor, 8);
+        return;
+    }
+    for (const char* keyword : KEYWORDS)
+    {
+        const UInt32 keywordLength = (UInt32)strlen(keyword);
+        if (nameLength > keywordLength && !strncmp(name, keyword, keywordLength)) {
+            name += keywordLength;
+            nameLength -= keywordLength;
+            break;
+        }
+    }
+    AppendSymbolText(buf, size, length, name, nameLength);
+}
@@ -0,0 +1,137 @@
+// ============================================================================
+// dump_rtti/RTTISymbols.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTIDatabase.h"
+
+// ============================================================================
+//                          Address symbolizer.
+// ----------------------------------------------------------------------------
+// Turns any address in the image into something a person can read, e.g.
+//     Actor::Unk_01A + 0x34
+//     PlayerCharacter::`vftable' + 0x18
+// for a crash handler. BuildRTTISymbols works out, once, every range of the
+// image it can name:
+//
+//   functions  every function in the exception table (.pdata), and every
+//              function a VFT slot points to, with or without a thunk in
+//              between. Functions without unwind info (leaf functions) are
+//              assumed to run up to the next function that's known.
+//   VFTs       from their meta field (the COL pointer) to their last slot.
+//   COLs and TypeDescriptors.
+//
+// Each function also gets the list of (VFT, slot)s that point to it, so a
+// crash in a base class's implementation can be reported against every class
+// that uses it.
+//
+// The ranges don't overlap, so they're kept in one array sorted by start
+// address, with the starts in an array of their own so that a lookup's
+// binary search touches as few cache lines as possible. LookupRTTISymbol and
+// FormatRTTISymbol only read those arrays and the database: they take no
+// locks, don't allocate and don't throw, so they're safe to call from an
+// exception filter, on any number of threads at once, for as long as the
+// symbols and the database they were built from are left alone.
+// ============================================================================
+enum RTTISymbolKind
+{
+    kRTTISymbol_None,                  // not in anything we know about
+    kRTTISymbol_Function,
+    kRTTISymbol_Vtbl,
+    kRTTISymbol_Col,
+    kRTTISymbol_TypeDescriptor,
+};
+
+enum RTTISymbolFlags
+{
+    kRTTISymbol_SizeGuessed = 0x0001,  // a function without unwind info: it may end sooner
+    kRTTISymbol_Fragment    = 0x0002,  // a chained fragment of a function (e.g. its cold paths)
+};
+
+enum RTTISymbolRefFlags
+{
+    kRTTISymbolRef_Inherited = 0x0001, // the parent VFT's slot points to the same function
+    kRTTISymbolRef_Thunk     = 0x0002, // the slot points to a thunk that leads to the function
+};
+
+struct RTTISymbolRange
+{
+    UInt32        end;                 // 00: OFFSET just past it
+    UInt16        kind;                // 04: RTTISymbolKind
+    UInt16        flags;               // 06: RTTISymbolFlags
+    UInt32        index;               // 08: index of the VFT, COL or type in the database; for a function, of its first ref
+    UInt32        numRefs;             // 0C: for a function, the number of (VFT, slot)s that point to it
+    UInt32        entry;               // 10: for a function, OFFSET to its entry point
+};
+
+// A VFT slot that points to a function.
+struct RTTISymbolRef
+{
+    UInt32        vtbl;                // 00: index of the VFT in the database
+    UInt16        slot;                // 04
+    UInt16        flags;               // 06: RTTISymbolRefFlags
+};
+
+struct RTTISymbols
+{
+    const RTTIDatabase* db;
+    UInt64        baseAddr;
+    UInt32        sizeOfImage;
+    std::vector<UInt32> begins;        // OFFSET to the start of each range, ascending
+    std::vector<RTTISymbolRange> ranges;   // in the same order
+    std::vector<RTTISymbolRef> refs;   // grouped by function; those that aren't inherited first
+};
+
+// What LookupRTTISymbol found.
+struct RTTISymbol
+{
+    UInt32        kind;                // RTTISymbolKind
+    UInt32        flags;               // RTTISymbolFlags
+    UInt64        begin;               // the start of the range
+    UInt64        end;                 // and its end
+    UInt64        offset;              // of the address within it
+    UInt32        index;               // as RTTISymbolRange::index; for a VFT, the database's index of it
+    UInt32        slot;                // for a VFT, the slot the address is in, or RTTI_NO_INDEX for its meta field
+    const RTTISymbolRef* refs;         // for a function, the (VFT, slot)s that point to it
+    UInt32        numRefs;
+};
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+void BuildRTTISymbols(const ImageLayout& layout, const RTTIDatabase& db, RTTISymbols& symbols);
+
+bool LookupRTTISymbol(const RTTISymbols& symbols, const UInt64 addr, RTTISymbol& symbol);
+
+UInt32 FormatRTTISymbol(const RTTISymbols& symbols, const RTTISymbol& symbol, char* buf, const UInt32 size);
+
+UInt32 FormatRTTISymbolRef(const RTTISymbols& symbols, const RTTISymbolRef& ref, char* buf, const UInt32 size);
@@ -0,0 +1,519 @@
+// ============================================================================
+// dump_rtti/StackWalk.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "StackWalk.h"
+
+static bool ReadStack(const StackMemory& stack, const UInt64 addr, UInt64& value);
+
+static const ImageUnwindInfo* GetUnwindInfo(const ImageLayout& layout, const UInt32 rva);
+
+static const RUNTIME_FUNCTION* GetChainedFunction(const ImageLayout& layout, const ImageUnwindInfo* info);
+
+static bool IsInEpilog(const ImageLayout& layout, const ImageFunction& func, const UInt8* pc);
+
+static bool UnwindEpilog(const UInt8* pc, StackContext& context, const StackMemory& stack);
+
+static UInt32 GetUnwindCodeSlots(const UInt8* code);
+
+// ============================================================================
+//   Unwind one frame: on return, 'context' is the caller's, as it was just
+//   after the call returned (or, through a machine frame, as it was when the
+//   interrupt or exception came in). 'flags' says how (StackFrameFlags).
+// ----------------------------------------------------------------------------
+// Returns FALSE if 'context.rip' isn't in the image, if its unwind info is
+// damaged, or if the frame goes outside 'stack'; 'context' is then
+// unspecified. Only the nonvolatile registers are restored: the others are
+// left as they were, which is as much as any unwinder can do.
+// ============================================================================
+bool UnwindStackFrame(const ImageLayout& layout, const UInt64 moduleBase, StackContext& context,
+                      const StackMemory& stack, UInt32& flags)
+{
+    flags = 0;
+    if (context.rip - moduleBase >= layout.sizeOfImage) return false;
+    const UInt64 addr = layout.baseAddr + (context.rip - moduleBase);
+    UInt64& rsp = context.regs[kReg_Rsp];
+
+    // ------------------------------------------------------------------------
+    // 1. A function with no entry in .pdata is a leaf function, so its
+    //    return address is on the top of the stack.
+    // ------------------------------------------------------------------------
+    const ImageFunction* func = FindImageFunction(layout, addr);
+    if (!func)
+    {
+        flags |= kStackFrame_Leaf;
+        if (!ReadStack(stack, rsp, context.rip)) return false;
+        rsp += 8;
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    // 2. Find the unwind info. A fragment whose UnwindInfoAddress is odd has
+    //    no prolog of its own: it's unwound with the RUNTIME_FUNCTION that
+    //    UnwindInfoAddress points to, as if it were part of that function's
+    //    body.
+    // ------------------------------------------------------------------------
+    UInt32 unwindRva = func->unwindInfo;
+    bool hasProlog = true;
+    for (UInt32 depth = 0; unwindRva & 1; ++depth)
+    {
+        const UInt32 rva = unwindRva & ~(UInt32)1;
+        if (depth == STACK_MAX_CHAIN || rva >= layout.sizeOfImage ||
+            layout.sizeOfImage - rva < sizeof(RUNTIME_FUNCTION)) {
+            return false;
+        }
+        unwindRva = reinterpret_cast<const RUNTIME_FUNCTION*>(layout.baseAddr + rva)->UnwindInfoAddress;
+        hasProlog = false;
+    }
+    const ImageUnwindInfo* info = GetUnwindInfo(layout, unwindRva);
+    if (!info) return false;
+
+    // ------------------------------------------------------------------------
+    // 3. In the prolog, only the codes for the instructions that have run
+    //    are undone. In an epilog, none of them describe the stack any more,
+    //    so we carry out the rest of the epilog instead.
+    // ------------------------------------------------------------------------
+    const UInt32 offset = (UInt32)(addr - layout.baseAddr) - func->begin;
+    UInt32 prologOffset = 0xFFFFFFFF;
+    if (hasProlog && offset < info->sizeOfProlog) {
+        prologOffset = offset;
+    }
+    else if (IsInEpilog(layout, *func, reinterpret_cast<const UInt8*>(addr)))
+    {
+        flags |= kStackFrame_Epilog;
+        return UnwindEpilog(reinterpret_cast<const UInt8*>(addr), context, stack);
+    }
+
+    // ------------------------------------------------------------------------
+    // 4. The establisher frame, which SET_FPREG restores rsp to and the SAVE_
+    //    codes are relative to: the frame register less its offset, once the
+    //    prolog has set it, or else rsp. The codes that set it may be in the
+    //    info of the function this fragment is chained to.
+    // ------------------------------------------------------------------------
+    UInt64 frame = rsp;
+    const ImageUnwindInfo* chain = info;
+    for (UInt32 depth = 0, codeLimit = prologOffset; chain; ++depth, codeLimit = 0xFFFFFFFF)
+    {
+        const UInt8* codes = reinterpret_cast<const UInt8*>(chain + 1);
+        bool found = false;
+        for (UInt32 i = 0; i < chain->countOfCodes; i += GetUnwindCodeSlots(codes + i * 2))
+        {
+            const UInt8* code = codes + i * 2;
+            if ((code[1] & 0x0F) == kUnwindOp_SetFpReg && code[0] <= codeLimit && (chain->frameRegister & 0x0F)) {
+                frame = context.regs[chain->frameRegister & 0x0F] - (UInt64)(chain->frameRegister >> 4) * 16;
+                found = true;
+                break;
+            }
+        }
+        if (found || depth == STACK_MAX_CHAIN || !((chain->versionAndFlags >> 3) & kUnwindFlag_ChainInfo)) break;
+        const RUNTIME_FUNCTION* chained = GetChainedFunction(layout, chain);
+        chain = chained ? GetUnwindInfo(layout, chained->UnwindInfoAddress) : nullptr;
+    }
+
+    // ------------------------------------------------------------------------
+    // 5. Undo the prolog, code by code (they're in the reverse order of the
+    //    instructions they describe), then the prologs of the functions it's
+    //    chained to, all of whose codes apply.
+    // ------------------------------------------------------------------------
+    for (UInt32 depth = 0; ; ++depth)
+    {
+        const UInt8* codes = reinterpret_cast<const UInt8*>(info + 1);
+        for (UInt32 i = 0, slots; i < info->countOfCodes; i += slots)
+        {
+            const UInt8* code = codes + i * 2;
+            slots = GetUnwindCodeSlots(code);
+            if (i + slots > info->countOfCodes) return false;
+            if (prologOffset < code[0]) continue;    // hasn't run yet
+
+            const UInt32 opInfo = code[1] >> 4;
+            UInt64 value;
+            switch (code[1] & 0x0F)
+            {
+            case kUnwindOp_PushNonVol:
+                if (!ReadStack(stack, rsp, value)) return false;
+                context.regs[opInfo] = value;
+                rsp += 8;
+                break;
+            case kUnwindOp_AllocLarge:
+                if (opInfo) {
+                    rsp += *reinterpret_cast<const UInt32*>(code + 2);
+                }
+                else {
+                    rsp += (UInt64)*reinterpret_cast<const UInt16*>(code + 2) * 8;
+                }
+                break;
+            case kUnwindOp_AllocSmall:
+                rsp += (opInfo + 1) * 8;
+                break;
+            case kUnwindOp_SetFpReg:
+                rsp = frame;
+                break;
+            case kUnwindOp_SaveNonVol:
+                if (!ReadStack(stack, frame + (UInt64)*reinterpret_cast<const UInt16*>(code + 2) * 8, value)) {
+                    return false;
+                }
+                context.regs[opInfo] = value;
+                break;
+            case kUnwindOp_SaveNonVolFar:
+                if (!ReadStack(stack, frame + *reinterpret_cast<const UInt32*>(code + 2), value)) return false;
+                context.regs[opInfo] = value;
+                break;
+            case kUnwindOp_PushMachFrame:
+                // The CPU pushed SS, RSP, EFLAGS, CS and RIP, and, if OpInfo
+                // is 1, an error code below them.
+                if (opInfo) rsp += 8;
+                if (!ReadStack(stack, rsp, context.rip) || !ReadStack(stack, rsp + 24, value)) return false;
+                rsp = value;
+                flags |= kStackFrame_MachFrame;
+                return true;
+            default:
+                // The XMM registers aren't tracked, and version 2's epilog
+                // codes only describe what we work out in IsInEpilog.
+                break;
+            }
+        }
+
+        if (!((info->versionAndFlags >> 3) & kUnwindFlag_ChainInfo)) break;
+        if (depth == STACK_MAX_CHAIN) return false;
+        const RUNTIME_FUNCTION* chained = GetChainedFunction(layout, info);
+        if (!chained || !(info = GetUnwindInfo(layout, chained->UnwindInfoAddress))) return false;
+        prologOffset = 0xFFFFFFFF;
+    }
+
+    // ------------------------------------------------------------------------
+    // 6. What's left is the return address.
+    // ------------------------------------------------------------------------
+    if (!ReadStack(stack, rsp, context.rip)) return false;
+    rsp += 8;
+    return true;
+}
+
+// ============================================================================
+//   Walk the stack from 'context', filling in up to 'maxFrames' frames, the
+//   innermost first. Returns how many were filled in.
+// ----------------------------------------------------------------------------
+// The last frame has kStackFrame_External if the walk left the image, or
+// kStackFrame_Truncated if it couldn't go any further; otherwise the walk
+// reached the end of the stack (a rip of 0) or 'maxFrames'.
+// ============================================================================
+UInt32 WalkStack(const ImageLayout& layout, const UInt64 moduleBase, const StackContext& context,
+                 const StackMemory& stack, StackFrame* frames, const UInt32 maxFrames)
+{
+    StackContext ctx = context;
+    UInt32 numFrames = 0;
+    UInt32 nextFlags = 0;
+    while (numFrames < maxFrames && ctx.rip)
+    {
+        StackFrame& frame = frames[numFrames++];
+        frame.rip = ctx.rip;
+        frame.rsp = ctx.regs[kReg_Rsp];
+        frame.flags = nextFlags;
+        if (ctx.rip - moduleBase >= layout.sizeOfImage) {
+            frame.flags |= kStackFrame_External;
+            break;
+        }
+
+        UInt32 flags;
+        const bool ok = UnwindStackFrame(layout, moduleBase, ctx, stack, flags);
+        frame.flags |= flags;
+        // The stack only ever unwinds upwards: a frame that doesn't would
+        // have us going round in circles.
+        if (!ok || ctx.regs[kReg_Rsp] <= frame.rsp) {
+            frame.flags |= kStackFrame_Truncated;
+            break;
+        }
+        // After a call, rip is the return address; after an interrupt or
+        // exception, it's the instruction it came in at.
+        nextFlags = (flags & kStackFrame_MachFrame) ? 0 : kStackFrame_Return;
+    }
+    return numFrames;
+}
+
+// ============================================================================
+//   Write a frame, e.g.
+//       #02 00007FF6A1C3D2E1 Actor::Unk_01A + 0x34
+//   into 'buf', truncated if need be, and NUL-terminated, and return its
+//   length. Doesn't lock or allocate.
+// ============================================================================
+UInt32 FormatStackFrame(const RTTISymbols& symbols, const UInt64 moduleBase, const StackFrame& frame,
+                        const UInt32 number, char* buf, const UInt32 size)
+{
+    if (!size) return 0;
+    const int prefix = snprintf(buf, size, "#%02u %016llX ", number, (unsigned long long)frame.rip);
+    UInt32 length = (prefix < 0) ? 0 : (std::min)((UInt32)prefix, size - 1);
+
+    const char* note = (frame.flags & kStackFrame_Truncated) ? " (can't unwind any further)" :
+                       (frame.flags & kStackFrame_MachFrame) ? " (interrupted)" :
+                       (frame.flags & kStackFrame_Epilog)    ? " (in its epilog)" :
+                       (frame.flags & kStackFrame_Leaf)      ? " (no unwind info)" : "";
+    if (frame.flags & kStackFrame_External) {
+        note = "(outside the image)";
+    }
+    else
+    {
+        // A return address is just past the call, which may be the last
+        // instruction of its function (e.g. a call to a function that
+        // doesn't return), so it's the call we look up.
+        const UInt64 back = (frame.flags & kStackFrame_Return) ? 1 : 0;
+        RTTISymbol symbol;
+        if (LookupRTTISymbol(symbols, symbols.baseAddr + (frame.rip - back - moduleBase), symbol)) {
+            symbol.offset += back;
+        }
+        length += FormatRTTISymbol(symbols, symbol, buf + length, size - length);
+    }
+
+    const int n = snprintf(buf + length, size - length, "%s", note);
+    return (n < 0) ? length : (std::min)(length + (UInt32)n, size - 1);
+}
+
+// ============================================================================
+//   Save a thread's registers and stack to 'path', for LoadStackSnapshot.
+// ============================================================================
+bool SaveStackSnapshot(const char* path, const ImageLayout& layout, const StackContext& context,
+                       const StackMemory& stack)
+{
+    StackSnapshotHeader hdr;
+    memcpy(hdr.magic, STACK_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = STACK_SNAPSHOT_VERSION;
+    hdr.timeDateStamp = layout.timeDateStamp;
+    hdr.sizeOfImage = layout.sizeOfImage;
+    hdr.moduleBase = layout.baseAddr;
+    hdr.stackBase = stack.base;
+    hdr.stackSize = stack.size;
+    hdr.context = context;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    file.write(reinterpret_cast<const char*>(stack.data), stack.size);
+    file.close();
+    return !file.fail();
+}
+
+// ============================================================================
+//   Load a snapshot written by SaveStackSnapshot. It's up to the caller to
+//   check that it's for the image it has loaded (timeDateStamp and
+//   sizeOfImage).
+// ============================================================================
+bool LoadStackSnapshot(const char* path, StackSnapshot& snapshot)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    const UInt64 fileSize = (UInt64)file.tellg();
+    file.seekg(0);
+
+    StackSnapshotHeader hdr;
+    if (!file.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+        memcmp(hdr.magic, STACK_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != STACK_SNAPSHOT_VERSION || hdr.stackSize != fileSize - sizeof(hdr)) {
+        return false;
+    }
+
+    snapshot.timeDateStamp = hdr.timeDateStamp;
+    snapshot.sizeOfImage = hdr.sizeOfImage;
+    snapshot.moduleBase = hdr.moduleBase;
+    snapshot.context = hdr.context;
+    snapshot.stackBase = hdr.stackBase;
+    snapshot.stack.resize((std::size_t)hdr.stackSize);
+    return !!file.read(reinterpret_cast<char*>(snapshot.stack.data()), snapshot.stack.size());
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static bool ReadStack(const StackMemory& stack, const UInt64 addr, UInt64& value)
+{
+    // ------------------------------------------------------------------------
+    // Read the qword at 'addr' in the thread's stack, if we have it.
+    // ------------------------------------------------------------------------
+    if (addr < stack.base || stack.size < 8 || addr - stack.base > stack.size - 8) return false;
+    memcpy(&value, stack.data + (addr - stack.base), 8);
+    return true;
+}
+
+static const ImageUnwindInfo* GetUnwindInfo(const ImageLayout& layout, const UInt32 rva)
+{
+    // ------------------------------------------------------------------------
+    // Return the UNWIND_INFO at 'rva', or NULL if it's not a version 1 or 2
+    // UNWIND_INFO that (with its codes and chained RUNTIME_FUNCTION, if any)
+    // fits in the image.
+    // ------------------------------------------------------------------------
+    if ((rva & 3) || rva >= layout.sizeOfImage || layout.sizeOfImage - rva < sizeof(ImageUnwindInfo)) {
+        return nullptr;
+    }
+    const ImageUnwindInfo* info = reinterpret_cast<const ImageUnwindInfo*>(layout.baseAddr + rva);
+    const UInt32 version = info->versionAndFlags & 7;
+    if (version != 1 && version != 2) return nullptr;
+
+    UInt64 size = sizeof(ImageUnwindInfo) + ((info->countOfCodes + 1) & ~1) * sizeof(UInt16);
+    if ((info->versionAndFlags >> 3) & kUnwindFlag_ChainInfo) size += sizeof(RUNTIME_FUNCTION);
+    return (layout.sizeOfImage - rva >= size) ? info : nullptr;
+}
+
+static const RUNTIME_FUNCTION* GetChainedFunction(const ImageLayout& layout, const ImageUnwindInfo* info)
+{
+    // ------------------------------------------------------------------------
+    // The RUNTIME_FUNCTION a kUnwindFlag_ChainInfo UNWIND_INFO is chained to,
+    // which follows its codes (GetUnwindInfo has checked that it's there).
+    // ------------------------------------------------------------------------
+    const UInt64 addr = reinterpret_cast<UInt64>(info + 1) + ((info->countOfCodes + 1) & ~1) * sizeof(UInt16);
+    const RUNTIME_FUNCTION* func = reinterpret_cast<const RUNTIME_FUNCTION*>(addr);
+    return (func->BeginAddress < func->EndAddress && func->EndAddress <= layout.sizeOfImage) ? func : nullptr;
+}
+
+static bool IsInEpilog(const ImageLayout& layout, const ImageFunction& func, const UInt8* pc)
+{
+    // ------------------------------------------------------------------------
+    // Is 'pc' in an epilog of the function? An x64 epilog is always
+    //     add rsp, imm8|imm32   or   lea rsp, [reg+disp8|disp32]   (optional)
+    //     pop reg               (any number)
+    //     ret | rep ret | jmp out of the function | jmp [rip+disp32]
+    // and 'pc' may be at any of those instructions. We don't read past the
+    // end of the fragment, except into the next fragment of the same function
+    // (MSVC sometimes makes the ret a fragment of its own).
+    // ------------------------------------------------------------------------
+    const UInt8* end = reinterpret_cast<const UInt8*>(layout.baseAddr + func.end);
+    if (end - pc >= 4 && (pc[0] & 0xF8) == 0x48)
+    {
+        if (pc[1] == 0x81 && pc[0] == 0x48 && pc[2] == 0xC4 && end - pc >= 7) pc += 7;
+        else if (pc[1] == 0x83 && pc[0] == 0x48 && pc[2] == 0xC4) pc += 4;
+        else if (pc[1] == 0x8D && !(pc[0] & 0x06) && ((pc[2] >> 3) & 7) == kReg_Rsp && (pc[2] & 7) != 4)
+        {
+            // lea rsp, [reg+disp]: no SIB, and REX.R and REX.X clear.
+            if ((pc[2] >> 6) == 1) pc += 4;
+            else if ((pc[2] >> 6) == 2 && end - pc >= 7) pc += 7;
+            else return false;
+        }
+    }
+
+    for (;;)
+    {
+        if (pc == end)
+        {
+            const ImageFunction* next = FindImageFunction(layout, reinterpret_cast<UInt64>(end));
+            if (!next || next->entry != func.entry) return false;
+            end = reinterpret_cast<const UInt8*>(layout.baseAddr + next->end);
+        }
+        if ((*pc & 0xF0) == 0x40 && ++pc == end) return false;    // REX
+        switch (*pc)
+        {
+        case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+            ++pc;
+            continue;
+        case 0xC2: case 0xC3:
+            return true;
+        case 0xF3:
+            return end - pc >= 2 && pc[1] == 0xC3;
+        case 0xE9: case 0xEB:
+        {
+            // A tail call: it must leave the function, not just jump to
+            // another part of it (e.g. a cold path in another fragment).
+            const UInt32 length = (*pc == 0xE9) ? 5 : 2;
+            if ((UInt32)(end - pc) < length) return false;
+            const SInt64 rel = (*pc == 0xE9) ? *reinterpret_cast<const SInt32*>(pc + 1) : (SInt8)pc[1];
+            const ImageFunction* target = FindImageFunction(layout, (UInt64)(pc + length) + rel);
+            return !target || target->entry != func.entry;
+        }
+        case 0xFF:
+            return end - pc >= 6 && pc[1] == 0x25;
+        default:
+            return false;
+        }
+    }
+}
+
+static bool UnwindEpilog(const UInt8* pc, StackContext& context, const StackMemory& stack)
+{
+    // ------------------------------------------------------------------------
+    // Carry out the rest of the epilog at 'pc' (which IsInEpilog has
+    // checked), as far as the return. A tail call returns to our caller too.
+    // ------------------------------------------------------------------------
+    UInt64& rsp = context.regs[kReg_Rsp];
+    if ((pc[0] & 0xF8) == 0x48)
+    {
+        if (pc[1] == 0x81 && pc[2] == 0xC4) {
+            rsp += *reinterpret_cast<const SInt32*>(pc + 3);
+            pc += 7;
+        }
+        else if (pc[1] == 0x83 && pc[2] == 0xC4) {
+            rsp += (SInt8)pc[3];
+            pc += 4;
+        }
+        else if (pc[1] == 0x8D)
+        {
+            const UInt64 base = context.regs[(pc[2] & 7) | ((pc[0] & 1) << 3)];
+            if ((pc[2] >> 6) == 1) {
+                rsp = base + (SInt8)pc[3];
+                pc += 4;
+            }
+            else {
+                rsp = base + *reinterpret_cast<const SInt32*>(pc + 3);
+                pc += 7;
+            }
+        }
+    }
+
+    for (;;)
+    {
+        UInt32 rex = 0;
+        if ((*pc & 0xF0) == 0x40) rex = *pc++ & 0x0F;
+        if ((*pc & 0xF8) != 0x58) break;
+        UInt64 value;
+        if (!ReadStack(stack, rsp, value)) return false;
+        context.regs[(*pc & 7) | ((rex & 1) << 3)] = value;
+        rsp += 8;
+        ++pc;
+    }
+
+    if (!ReadStack(stack, rsp, context.rip)) return false;
+    rsp += 8;
+    return true;
+}
+
+static UInt32 GetUnwindCodeSlots(const UInt8* code)
+{
+    // ------------------------------------------------------------------------
+    // How many 16-bit slots the unwind code at 'code' takes up, with its
+    // operands.
+    // ------------------------------------------------------------------------
+    switch (code[1] & 0x0F)
+    {
+    case kUnwindOp_AllocLarge:
+        return (code[1] >> 4) ? 3 : 2;
+    case kUnwindOp_SaveNonVol:
+    case kUnwindOp_Epilog:
+    case kUnwindOp_SaveXmm128:
+        return 2;
+    case kUnwindOp_SaveNonVolFar:
+    case kUnwindOp_SpareCode:
+    case kUnwindOp_SaveXmm128Far:
+        return 3;
+    default:
+        return 1;
+    }
+}
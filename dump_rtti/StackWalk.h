@@ -0,0 +1,200 @@
+// ============================================================================
+// dump_rtti/StackWalk.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <vector>
+
+#include "PEImage.h"
+#include "Platform.h"
+#include "RTTISymbols.h"
+
+// ============================================================================
+//                  Stack walker driven by the unwind info.
+// ----------------------------------------------------------------------------
+// Walks a thread's stack the way RtlVirtualUnwind does, straight from the
+// image's exception table (.pdata) and UNWIND_INFO codes, instead of with
+// DbgHelp's StackWalk64, which has to load symbols first and takes seconds
+// over a crash dump. Each frame is then named with the symbolizer (see
+// RTTISymbols.h), so a crash in a virtual function reads e.g.
+//     #02 00007FF6A1C3D2E1 Actor::Unk_01A + 0x34
+//
+// It needs nothing from the thread but its registers (a StackContext) and a
+// copy of, or pointer to, its stack (a StackMemory), so a crash handler can
+// save those with SaveStackSnapshot and the stack can be walked again later,
+// offline and on any OS, against the same executable. 'moduleBase' is where
+// the image was loaded in the thread's process; 'layout' may have it mapped
+// somewhere else.
+//
+// For each frame, the function's UNWIND_INFO is found in the index built
+// from .pdata (see FindImageFunction):
+//
+//   no entry    a leaf function: it hasn't touched the stack, so the return
+//               address is at [rsp].
+//   in an epilog (the instructions after the last one that restores a
+//               register, up to the ret or tail jump) the unwind codes no
+//               longer describe the stack, so the rest of the epilog is
+//               emulated instead. Epilogs have a fixed form: an optional
+//               add rsp / lea rsp, pops, then ret or jmp.
+//   otherwise   the unwind codes are undone in order, skipping those for the
+//               part of the prolog that hasn't run yet, then those of any
+//               function the entry is chained to, and the return address is
+//               popped. A machine frame (an interrupt or exception) holds
+//               the rip and rsp to go back to instead.
+//
+// The walk stops at a rip of 0, at a frame outside the image (we have no
+// unwind info for other modules), if a read falls outside the stack, or if
+// the stack pointer doesn't go up. None of it allocates or takes a lock.
+// ============================================================================
+const char STACK_SNAPSHOT_MAGIC[8]  = { 'S', 'K', 'Y', 'S', 'T', 'A', 'C', 'K' };
+const UInt32 STACK_SNAPSHOT_VERSION = 1;
+const UInt32 STACK_MAX_CHAIN        = 32;   // as GetFunctionEntryRva
+
+// The integer registers, in the order the unwind codes number them.
+enum StackRegister
+{
+    kReg_Rax, kReg_Rcx, kReg_Rdx, kReg_Rbx, kReg_Rsp, kReg_Rbp, kReg_Rsi, kReg_Rdi,
+    kReg_R8,  kReg_R9,  kReg_R10, kReg_R11, kReg_R12, kReg_R13, kReg_R14, kReg_R15,
+};
+
+// UNWIND_CODE operations: the low nibble of a code's second byte. The high
+// nibble is its OpInfo, and the first byte its CodeOffset.
+enum StackUnwindOp
+{
+    kUnwindOp_PushNonVol     = 0,
+    kUnwindOp_AllocLarge     = 1,
+    kUnwindOp_AllocSmall     = 2,
+    kUnwindOp_SetFpReg       = 3,
+    kUnwindOp_SaveNonVol     = 4,
+    kUnwindOp_SaveNonVolFar  = 5,
+    kUnwindOp_Epilog         = 6,     // version 2 only; was SAVE_XMM
+    kUnwindOp_SpareCode      = 7,     // was SAVE_XMM_FAR
+    kUnwindOp_SaveXmm128     = 8,
+    kUnwindOp_SaveXmm128Far  = 9,
+    kUnwindOp_PushMachFrame  = 10,
+};
+
+enum StackFrameFlags
+{
+    kStackFrame_Return       = 0x0001, // 'rip' is a return address, so the call is just before it
+    kStackFrame_Leaf         = 0x0002, // no unwind info: unwound as a leaf function
+    kStackFrame_Epilog       = 0x0004, // was in an epilog: unwound by emulating it
+    kStackFrame_MachFrame    = 0x0008, // unwound through a machine frame (an interrupt or exception)
+    kStackFrame_External     = 0x0010, // outside the image: the walk stops here
+    kStackFrame_Truncated    = 0x0020, // couldn't be unwound: the walk stops here
+};
+
+// A thread's registers. Only rip, rsp and the nonvolatile registers matter
+// for the first frame, but the unwind codes can name any of them.
+struct StackContext
+{
+    UInt64        rip;
+    UInt64        regs[16];            // StackRegister order
+};
+
+// The thread's stack, or as much of it as was saved: 'size' bytes at 'data',
+// which were at 'base' in the thread's process.
+struct StackMemory
+{
+    UInt64        base;
+    UInt64        size;
+    const UInt8*  data;
+};
+
+struct StackFrame
+{
+    UInt64        rip;                 // in the thread's process
+    UInt64        rsp;                 // on entry to the frame, i.e. just below its return address
+    UInt32        flags;               // StackFrameFlags
+};
+
+// What SaveStackSnapshot writes, followed by 'stackSize' bytes of stack.
+#pragma pack(push, 4)
+struct StackSnapshotHeader
+{
+    char          magic[8];            // 00: STACK_SNAPSHOT_MAGIC
+    UInt32        version;             // 08: STACK_SNAPSHOT_VERSION
+    UInt32        timeDateStamp;       // 0C: of the image, from its file header
+    UInt32        sizeOfImage;         // 10: from its optional header
+    UInt64        moduleBase;          // 14: where it was loaded
+    UInt64        stackBase;           // 1C: StackMemory::base
+    UInt64        stackSize;           // 24: StackMemory::size
+    StackContext  context;             // 2C
+};
+#pragma pack(pop)
+
+struct StackSnapshot
+{
+    UInt32        timeDateStamp;
+    UInt32        sizeOfImage;
+    UInt64        moduleBase;
+    StackContext  context;
+    UInt64        stackBase;
+    std::vector<UInt8> stack;
+};
+
+#ifndef SKYRETK_OFFLINE
+// The registers of a CONTEXT, e.g. an exception filter's
+// EXCEPTION_POINTERS::ContextRecord.
+inline void GetStackContext(const CONTEXT& ctx, StackContext& context)
+{
+    context.rip = ctx.Rip;
+    context.regs[kReg_Rax] = ctx.Rax;
+    context.regs[kReg_Rcx] = ctx.Rcx;
+    context.regs[kReg_Rdx] = ctx.Rdx;
+    context.regs[kReg_Rbx] = ctx.Rbx;
+    context.regs[kReg_Rsp] = ctx.Rsp;
+    context.regs[kReg_Rbp] = ctx.Rbp;
+    context.regs[kReg_Rsi] = ctx.Rsi;
+    context.regs[kReg_Rdi] = ctx.Rdi;
+    context.regs[kReg_R8]  = ctx.R8;
+    context.regs[kReg_R9]  = ctx.R9;
+    context.regs[kReg_R10] = ctx.R10;
+    context.regs[kReg_R11] = ctx.R11;
+    context.regs[kReg_R12] = ctx.R12;
+    context.regs[kReg_R13] = ctx.R13;
+    context.regs[kReg_R14] = ctx.R14;
+    context.regs[kReg_R15] = ctx.R15;
+}
+#endif
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+bool UnwindStackFrame(const ImageLayout& layout, const UInt64 moduleBase, StackContext& context,
+                      const StackMemory& stack, UInt32& flags);
+
+UInt32 WalkStack(const ImageLayout& layout, const UInt64 moduleBase, const StackContext& context,
+                 const StackMemory& stack, StackFrame* frames, const UInt32 maxFrames);
+
+UInt32 FormatStackFrame(const RTTISymbols& symbols, const UInt64 moduleBase, const StackFrame& frame,
+                        const UInt32 number, char* buf, const UInt32 size);
+
+bool SaveStackSnapshot(const char* path, const ImageLayout& layout, const StackContext& context,
+                       const StackMemory& stack);
+
+bool LoadStackSnapshot(const char* path, StackSnapshot& snapshot);
@@ -0,0 +1,669 @@
+// ============================================================================
+// dump_rtti/Undecorate.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <cstring>
+
+#include "Undecorate.h"
+
+static UndText Lit(const char* s);
+
+static UndText Join(Undecorator& u, std::initializer_list<UndText> parts);
+
+static UndText Append(Undecorator& u, const UndText head, std::initializer_list<UndText> parts);
+
+static bool Fail(Undecorator& u);
+
+static bool Consume(Undecorator& u, const char* prefix);
+
+static bool IsDigit(const char c);
+
+static bool ParseNumber(Undecorator& u, SInt64& value);
+
+static UndText FormatNumber(Undecorator& u, const SInt64 value);
+
+static UndText ParseSimpleName(Undecorator& u, const bool memorize);
+
+static void Memorize(Undecorator& u, const UndText name);
+
+static UndText ParseBackrefName(Undecorator& u);
+
+static UndText ParseTemplateName(Undecorator& u, const bool memorize);
+
+static UndText ParseTemplateArgs(Undecorator& u);
+
+static UndText ParseQualifiedName(Undecorator& u, const bool isSymbol);
+
+static UndText ParseLocalScope(Undecorator& u);
+
+static UndText ParseFunctionSymbol(Undecorator& u);
+
+static UndText ParseType(Undecorator& u, const bool isResult);
+
+static UndText ParsePointer(Undecorator& u, const char* op, const char* cv);
+
+static UndText ParseCv(Undecorator& u);
+
+static UndText ParseThisQualifiers(Undecorator& u);
+
+static UndText ParseCallingConvention(Undecorator& u);
+
+static bool ParseFunction(Undecorator& u, UndText& cc, UndText& ret, UndText& params);
+
+static UndText ParseParams(Undecorator& u);
+
+static const UndText NO_TEXT = { "", 0 };
+
+// ============================================================================
+//   Undecorate 'symbol' (e.g. "??_R0?AVActor@@@8") into 'out', which holds
+//   'outSize' characters including the terminating NUL. Returns the length of
+//   the result, or 0 if the name couldn't be undecorated.
+// ----------------------------------------------------------------------------
+// As with DbgHelp, a result that's too long is silently truncated.
+// ============================================================================
+std::size_t UndecorateName(const char* symbol, char* out, const std::size_t outSize)
+{
+    if (!outSize) return 0;
+    out[0] = '\0';
+
+    Undecorator u;
+    u.p = symbol;
+    u.ok = true;
+    u.depth = 0;
+    u.backrefs.numNames = 0;
+    u.backrefs.numParams = 0;
+    u.used = 0;
+
+    // Only TypeDescriptors ("??_R0" <type> "@8") for now.
+    UndText name = NO_TEXT;
+    if (Consume(u, "??_R0")) {
+        UndText type = ParseType(u, true);
+        if (Consume(u, "@8") && *u.p == '\0') {
+            name = Join(u, { type, Lit(" `RTTI Type Descriptor'") });
+        }
+        else {
+            Fail(u);
+        }
+    }
+    else {
+        Fail(u);
+    }
+    if (!u.ok) return 0;
+
+    std::size_t len = (name.length < outSize - 1) ? name.length : outSize - 1;
+    memcpy(out, name.s, len);
+    out[len] = '\0';
+    return len;
+}
+
+// ============================================================================
+//                      Internal helper functions.
+// ============================================================================
+static UndText Lit(const char* s)
+{
+    return { s, (UInt32)strlen(s) };
+}
+
+// ----------------------------------------------------------------------------
+// The concatenation of 'parts', in the arena.
+// ----------------------------------------------------------------------------
+static UndText Join(Undecorator& u, std::initializer_list<UndText> parts)
+{
+    std::size_t total = 0;
+    for (const UndText& t : parts) total += t.length;
+    if (!u.ok || total > sizeof(u.arena) - u.used) {
+        Fail(u);
+        return NO_TEXT;
+    }
+
+    char* start = u.arena + u.used;
+    char* dst = start;
+    for (const UndText& t : parts) {
+        memcpy(dst, t.s, t.length);
+        dst += t.length;
+    }
+    u.used += total;
+    return { start, (UInt32)total };
+}
+
+// ----------------------------------------------------------------------------
+// 'head' followed by 'parts'. If 'head' is the last thing in the arena, it's
+// extended where it is rather than copied, so lists can grow in linear time.
+// ----------------------------------------------------------------------------
+static UndText Append(Undecorator& u, const UndText head, std::initializer_list<UndText> parts)
+{
+    if (head.s + head.length != u.arena + u.used) {
+        UndText copy = Join(u, { head });
+        if (!u.ok) return NO_TEXT;
+        return Append(u, copy, parts);
+    }
+    UndText tail = Join(u, parts);
+    if (!u.ok) return NO_TEXT;
+    return { head.s, head.length + tail.length };
+}
+
+static bool Fail(Undecorator& u)
+{
+    // Point at an empty string, so nothing reads any further.
+    u.ok = false;
+    u.p = "";
+    return false;
+}
+
+static bool Consume(Undecorator& u, const char* prefix)
+{
+    std::size_t n = 0;
+    while (prefix[n]) {
+        if (u.p[n] != prefix[n]) return false;
+        n++;
+    }
+    u.p += n;
+    return true;
+}
+
+static bool IsDigit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// ----------------------------------------------------------------------------
+// A number: "0".."9" for 1..10, otherwise hex with the digits 'A'..'P' and a
+// terminating '@'. A leading '?' makes it negative.
+// ----------------------------------------------------------------------------
+static bool ParseNumber(Undecorator& u, SInt64& value)
+{
+    bool negative = Consume(u, "?");
+    UInt64 n = 0;
+    if (IsDigit(*u.p)) {
+        n = (UInt64)(*u.p++ - '0') + 1;
+    }
+    else {
+        const char* start = u.p;
+        while (*u.p >= 'A' && *u.p <= 'P') {
+            n = (n << 4) | (UInt64)(*u.p++ - 'A');
+        }
+        if (u.p == start || u.p - start > 16 || !Consume(u, "@")) return Fail(u);
+    }
+    value = negative ? -(SInt64)n : (SInt64)n;
+    return true;
+}
+
+static UndText FormatNumber(Undecorator& u, const SInt64 value)
+{
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    UInt64 n = (value < 0) ? 0 - (UInt64)value : (UInt64)value;
+    do {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    if (value < 0) *--p = '-';
+    return Join(u, { { p, (UInt32)(end - p) } });
+}
+
+// ----------------------------------------------------------------------------
+// Names, and references back to them.
+// ----------------------------------------------------------------------------
+static UndText ParseSimpleName(Undecorator& u, const bool memorize)
+{
+    const char* start = u.p;
+    while (*u.p && *u.p != '@') u.p++;
+
+    // DbgHelp can't undecorate lambdas ("<lambda_...>"), so neither do we.
+    if (*u.p != '@' || u.p == start || *start == '<') {
+        Fail(u);
+        return NO_TEXT;
+    }
+    UndText name = { start, (UInt32)(u.p - start) };
+    u.p++;
+    if (memorize) Memorize(u, name);
+    return name;
+}
+
+static void Memorize(Undecorator& u, const UndText name)
+{
+    UndBackrefs& b = u.backrefs;
+    for (UInt32 i = 0; i < b.numNames; ++i) {
+        if (b.names[i].length == name.length && !memcmp(b.names[i].s, name.s, name.length)) return;
+    }
+    if (b.numNames < UNDECORATE_MAX_BACKREFS) {
+        b.names[b.numNames++] = name;
+    }
+}
+
+static UndText ParseBackrefName(Undecorator& u)
+{
+    UInt32 i = (UInt32)(*u.p++ - '0');
+    if (i >= u.backrefs.numNames) {
+        Fail(u);
+        return NO_TEXT;
+    }
+    return u.backrefs.names[i];
+}
+
+// ----------------------------------------------------------------------------
+// "?$" <name> <args> "@". The arguments have their own back references. The
+// whole "name<args>" can then be referred back to, unless it's the name of
+// a function.
+// ----------------------------------------------------------------------------
+static UndText ParseTemplateName(Undecorator& u, const bool memorize)
+{
+    UndBackrefs outer = u.backrefs;
+    u.backrefs.numNames = 0;
+    u.backrefs.numParams = 0;
+
+    UndText name = ParseSimpleName(u, true);
+    UndText args = ParseTemplateArgs(u);
+    u.backrefs = outer;
+    if (!u.ok) return NO_TEXT;
+
+    // "> >", never ">>".
+    bool space = args.length && args.s[args.length - 1] == '>';
+    UndText result = Join(u, { name, Lit("<"), args, Lit(space ? " >" : ">") });
+    if (memorize && u.ok) Memorize(u, result);
+    return result;
+}
+
+static UndText ParseTemplateArgs(Undecorator& u)
+{
+    UndText args = NO_TEXT;
+    bool first = true;
+    while (u.ok && !Consume(u, "@"))
+    {
+        UndText arg;
+        if (Consume(u, "$0")) {
+            // An integer.
+            SInt64 value;
+            if (!ParseNumber(u, value)) return NO_TEXT;
+            arg = FormatNumber(u, value);
+        }
+        else {
+            // A type. N.B. these don't go in the table of parameter types.
+            arg = ParseType(u, false);
+        }
+        args = first ? arg : Append(u, args, { Lit(","), arg });
+        first = false;
+    }
+    return args;
+}
+
+// ----------------------------------------------------------------------------
+// A qualified name, innermost part first, e.g. "Location@BSResource@@" for
+// BSResource::Location. Any part may be a template or a back reference, and
+// a scope may also be a function (for a class local to it).
+// ----------------------------------------------------------------------------
+static UndText ParseQualifiedName(Undecorator& u, const bool isSymbol)
+{
+    if (++u.depth > UNDECORATE_MAX_DEPTH) {
+        Fail(u);
+        return NO_TEXT;
+    }
+
+    UndText pieces[UNDECORATE_MAX_PIECES];
+    UInt32 n = 0;
+
+    // The name itself...
+    if (IsDigit(*u.p)) {
+        pieces[n++] = ParseBackrefName(u);
+    }
+    else if (Consume(u, "?$")) {
+        pieces[n++] = ParseTemplateName(u, !isSymbol);
+    }
+    else if (*u.p == '?') {
+        // Operators, constructors and other special names.
+        Fail(u);
+    }
+    else {
+        pieces[n++] = ParseSimpleName(u, true);
+    }
+
+    // ... and its scopes.
+    while (u.ok && !Consume(u, "@"))
+    {
+        if (n == UNDECORATE_MAX_PIECES) {
+            Fail(u);
+        }
+        else if (IsDigit(*u.p)) {
+            pieces[n++] = ParseBackrefName(u);
+        }
+        else if (Consume(u, "?$")) {
+            pieces[n++] = ParseTemplateName(u, true);
+        }
+        else if (*u.p == '?' && u.p[1] == 'A') {
+            // An anonymous namespace ("?A0x1234abcd@"). DbgHelp can't do these.
+            Fail(u);
+        }
+        else if (*u.p == '?') {
+            pieces[n++] = ParseLocalScope(u);
+        }
+        else {
+            pieces[n++] = ParseSimpleName(u, true);
+        }
+    }
+    u.depth--;
+    if (!u.ok) return NO_TEXT;
+
+    UndText name = pieces[n - 1];
+    for (UInt32 i = n - 1; i-- > 0; ) {
+        name = Append(u, name, { Lit("::"), pieces[i] });
+    }
+    return name;
+}
+
+// ----------------------------------------------------------------------------
+// "?" <number> "?" <function symbol>, for something declared inside a
+// function: "`<function>'::`<number>'".
+// ----------------------------------------------------------------------------
+static UndText ParseLocalScope(Undecorator& u)
+{
+    u.p++;
+    SInt64 number;
+    if (!ParseNumber(u, number) || number < 0 || !Consume(u, "?")) {
+        Fail(u);
+        return NO_TEXT;
+    }
+    UndText function = ParseFunctionSymbol(u);
+    UndText scope = FormatNumber(u, number);
+    return Join(u, { Lit("`"), function, Lit("'::`"), scope, Lit("'") });
+}
+
+// ----------------------------------------------------------------------------
+// A function's symbol, e.g. "?Func@Class@@UEAAXH@Z". DbgHelp leaves the
+// return type out when the function is a scope, so we do too.
+// ----------------------------------------------------------------------------
+static UndText ParseFunctionSymbol(Undecorator& u)
+{
+    if (!Consume(u, "?")) {
+        Fail(u);
+        return NO_TEXT;
+    }
+    UndText name = ParseQualifiedName(u, true);
+
+    const char* access;
+    bool hasThis = true;
+    switch (*u.p)
+    {
+    case 'A': case 'B': access = "private: "; break;
+    case 'C': case 'D': access = "private: static "; hasThis = false; break;
+    case 'E': case 'F': access = "private: virtual "; break;
+    case 'I': case 'J': access = "protected: "; break;
+    case 'K': case 'L': access = "protected: static "; hasThis = false; break;
+    case 'M': case 'N': access = "protected: virtual "; break;
+    case 'Q': case 'R': access = "public: "; break;
+    case 'S': case 'T': access = "public: static "; hasThis = false; break;
+    case 'U': case 'V': access = "public: virtual "; break;
+    case 'Y': case 'Z': access = ""; hasThis = false; break;
+    default:
+        // Data, thunks, vftables and so on.
+        Fail(u);
+        return NO_TEXT;
+    }
+    u.p++;
+
+    UndText thisQuals = hasThis ? ParseThisQualifiers(u) : NO_TEXT;
+    UndText cc, ret, params;
+    if (!ParseFunction(u, cc, ret, params)) return NO_TEXT;
+    return Join(u, { Lit(access), cc, Lit(" "), name, Lit("("), params, Lit(")"), thisQuals });
+}
+
+// ----------------------------------------------------------------------------
+// Types. 'isResult' allows the "?" <cv> prefix of return types (and of
+// the TypeDescriptor's own type).
+// ----------------------------------------------------------------------------
+static UndText ParseType(Undecorator& u, const bool isResult)
+{
+    if (++u.depth > UNDECORATE_MAX_DEPTH) {
+        Fail(u);
+        return NO_TEXT;
+    }
+
+    UndText type = NO_TEXT;
+    if (isResult && Consume(u, "?")) {
+        UndText cv = ParseCv(u);
+        type = ParseType(u, false);
+        if (cv.length) type = Join(u, { type, Lit(" "), cv });
+        u.depth--;
+        return type;
+    }
+
+    const char c = *u.p;
+    if (c) u.p++;
+    switch (c)
+    {
+    case 'X': type = Lit("void"); break;
+    case 'C': type = Lit("signed char"); break;
+    case 'D': type = Lit("char"); break;
+    case 'E': type = Lit("unsigned char"); break;
+    case 'F': type = Lit("short"); break;
+    case 'G': type = Lit("unsigned short"); break;
+    case 'H': type = Lit("int"); break;
+    case 'I': type = Lit("unsigned int"); break;
+    case 'J': type = Lit("long"); break;
+    case 'K': type = Lit("unsigned long"); break;
+    case 'M': type = Lit("float"); break;
+    case 'N': type = Lit("double"); break;
+    case 'O': type = Lit("long double"); break;
+    case '_':
+        switch (*u.p)
+        {
+        case 'N': type = Lit("bool"); break;
+        case 'J': type = Lit("__int64"); break;
+        case 'K': type = Lit("unsigned __int64"); break;
+        case 'S': type = Lit("char16_t"); break;
+        case 'U': type = Lit("char32_t"); break;
+        case 'W': type = Lit("wchar_t"); break;
+        default: Fail(u); break;
+        }
+        if (u.ok) u.p++;
+        break;
+
+    // Classes, structs, unions and enums.
+    case 'T': type = Join(u, { Lit("union "), ParseQualifiedName(u, false) }); break;
+    case 'U': type = Join(u, { Lit("struct "), ParseQualifiedName(u, false) }); break;
+    case 'V': type = Join(u, { Lit("class "), ParseQualifiedName(u, false) }); break;
+    case 'W':
+        // Only int-sized enums; DbgHelp spells the others oddly.
+        if (!Consume(u, "4")) {
+            Fail(u);
+            break;
+        }
+        type = Join(u, { Lit("enum "), ParseQualifiedName(u, false) });
+        break;
+
+    // Pointers and references. The letter also says how the pointer itself
+    // is qualified.
+    case 'P': type = ParsePointer(u, "*", ""); break;
+    case 'Q': type = ParsePointer(u, "*", "const"); break;
+    case 'R': type = ParsePointer(u, "*", "volatile"); break;
+    case 'S': type = ParsePointer(u, "*", "const volatile"); break;
+    case 'A': type = ParsePointer(u, "&", ""); break;
+    case 'B': type = ParsePointer(u, "&", "volatile"); break;
+
+    case '$':
+        if (Consume(u, "$Q")) {
+            type = ParsePointer(u, "&&", "");
+        }
+        else if (Consume(u, "$R")) {
+            type = ParsePointer(u, "&&", "volatile");
+        }
+        else if (Consume(u, "$A6")) {
+            // A function type (not a pointer to one), e.g. in std::function<>.
+            UndText cc, ret, params;
+            if (ParseFunction(u, cc, ret, params)) {
+                type = Join(u, { ret, Lit(" "), cc, Lit("("), params, Lit(")") });
+            }
+        }
+        else if (Consume(u, "$C")) {
+            // A cv-qualified type, as a template argument.
+            UndText cv = ParseCv(u);
+            type = ParseType(u, false);
+            if (cv.length) type = Join(u, { type, Lit(" "), cv });
+        }
+        else {
+            // Including "$$T" (std::nullptr_t) and "$1" (a pointer to an
+            // object), neither of which DbgHelp can undecorate.
+            Fail(u);
+        }
+        break;
+
+    default:
+        Fail(u);
+        break;
+    }
+    u.depth--;
+    return u.ok ? type : NO_TEXT;
+}
+
+// ----------------------------------------------------------------------------
+// What follows the pointer or reference letter: the pointee's qualifiers and
+// type, or a function. 'op' is "*", "&" or "&&" and 'cv' qualifies the
+// pointer itself.
+// ----------------------------------------------------------------------------
+static UndText ParsePointer(Undecorator& u, const char* op, const char* cv)
+{
+    UndText cc, ret, params;
+    if (Consume(u, "6")) {
+        // Pointer to function: "ret (__cdecl*)(params)".
+        if (!ParseFunction(u, cc, ret, params)) return NO_TEXT;
+        return Join(u, { ret, Lit(" ("), cc, Lit(op), Lit(")("), params, Lit(")") });
+    }
+    if (Consume(u, "8")) {
+        // Pointer to member function: "ret (__cdecl Class::*)(params)const __ptr64".
+        UndText cls = ParseQualifiedName(u, false);
+        UndText thisQuals = ParseThisQualifiers(u);
+        if (!ParseFunction(u, cc, ret, params)) return NO_TEXT;
+        return Join(u, { ret, Lit(" ("), cc, Lit(" "), cls, Lit("::"), Lit(op), Lit(")("), params, Lit(")"),
+                         thisQuals });
+    }
+
+    bool ptr64 = false;
+    while (Consume(u, "E")) ptr64 = true;
+    if (*u.p == 'F' || *u.p == 'I') {
+        // __unaligned and __restrict.
+        Fail(u);
+        return NO_TEXT;
+    }
+    UndText pointeeCv = ParseCv(u);
+    UndText pointee = ParseType(u, false);
+    return Join(u, { pointee, Lit(pointeeCv.length ? " " : ""), pointeeCv, Lit(" "), Lit(op),
+                     Lit(ptr64 ? " __ptr64" : ""), Lit(*cv ? " " : ""), Lit(cv) });
+}
+
+static UndText ParseCv(Undecorator& u)
+{
+    switch (*u.p)
+    {
+    case 'A': u.p++; return NO_TEXT;
+    case 'B': u.p++; return Lit("const");
+    case 'C': u.p++; return Lit("volatile");
+    case 'D': u.p++; return Lit("const volatile");
+    default:
+        Fail(u);
+        return NO_TEXT;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// The qualifiers of a member function's 'this', which DbgHelp writes as
+// ")const __ptr64" or ") __ptr64".
+// ----------------------------------------------------------------------------
+static UndText ParseThisQualifiers(Undecorator& u)
+{
+    bool ptr64 = false;
+    while (Consume(u, "E")) ptr64 = true;
+    UndText cv = ParseCv(u);
+    return Join(u, { cv, Lit(ptr64 ? " __ptr64" : "") });
+}
+
+static UndText ParseCallingConvention(Undecorator& u)
+{
+    switch (*u.p)
+    {
+    case 'A': case 'B': u.p++; return Lit("__cdecl");
+    case 'C': case 'D': u.p++; return Lit("__pascal");
+    case 'E': case 'F': u.p++; return Lit("__thiscall");
+    case 'G': case 'H': u.p++; return Lit("__stdcall");
+    case 'I': case 'J': u.p++; return Lit("__fastcall");
+    case 'Q': u.p++; return Lit("__vectorcall");
+    default:
+        Fail(u);
+        return NO_TEXT;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// <calling convention> <return type> <parameters> <throw spec>.
+// ----------------------------------------------------------------------------
+static bool ParseFunction(Undecorator& u, UndText& cc, UndText& ret, UndText& params)
+{
+    cc = ParseCallingConvention(u);
+    ret = Consume(u, "@") ? NO_TEXT : ParseType(u, true);
+    params = ParseParams(u);
+    if (!Consume(u, "Z")) return Fail(u);
+    return u.ok;
+}
+
+// ----------------------------------------------------------------------------
+// "X" (no parameters), or a list of types ending with "@", or with "Z" if it
+// ends with "...". Each parameter type that takes more than one character
+// to write can be referred back to by a later parameter.
+// ----------------------------------------------------------------------------
+static UndText ParseParams(Undecorator& u)
+{
+    if (Consume(u, "X")) return Lit("void");
+
+    UndText list = NO_TEXT;
+    bool first = true;
+    while (u.ok)
+    {
+        UndText param;
+        if (Consume(u, "@")) {
+            break;
+        }
+        else if (Consume(u, "Z")) {
+            list = first ? Lit("...") : Append(u, list, { Lit(","), Lit("...") });
+            break;
+        }
+        else if (IsDigit(*u.p)) {
+            UInt32 i = (UInt32)(*u.p++ - '0');
+            if (i >= u.backrefs.numParams) {
+                Fail(u);
+                break;
+            }
+            param = u.backrefs.params[i];
+        }
+        else {
+            const char* start = u.p;
+            param = ParseType(u, false);
+            if (u.p - start > 1 && u.backrefs.numParams < UNDECORATE_MAX_BACKREFS) {
+                u.backrefs.params[u.backrefs.numParams++] = param;
+            }
+        }
+        list = first ? param : Append(u, list, { Lit(","), param });
+        first = false;
+    }
+    return list;
+}
@@ -0,0 +1,89 @@
+// ============================================================================
+// dump_rtti/Undecorate.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+
+#include "Platform.h"
+
+// ============================================================================
+//                      MSVC name undecoration.
+// ----------------------------------------------------------------------------
+// Turns the mangled names of RTTI TypeDescriptors, e.g.
+//     ??_R0?AV?$BSTArray@PEAVActor@@VBSTArrayHeapAllocator@@@@@8
+// into what DbgHelp's UnDecorateSymbolName(UNDNAME_COMPLETE) makes of them:
+//     class BSTArray<class Actor * __ptr64,class BSTArrayHeapAllocator> `RTTI Type Descriptor'
+//
+// DbgHelp is Windows only, single-threaded, and allocates for every name, so
+// we have our own. It covers the part of the MSVC grammar that type names
+// use: nested names, templates (types, integers, function types and member
+// function pointers as arguments), the builtin types, pointers, references,
+// cv-qualifiers, __ptr64, and classes local to a function. The output
+// matches DbgHelp's, spacing and all - e.g. "> >", "(__cdecl*)(void)" and
+// ")const __ptr64". So do its failures: names that DbgHelp can't undecorate
+// (anonymous namespaces, lambdas, pointers to objects and nullptr_t as
+// template arguments) are rejected here too, and the caller falls back to
+// the mangled name as before.
+//
+// An Undecorator holds all the working state, including an arena for the
+// text, so undecoration is reentrant and doesn't touch the heap.
+// ============================================================================
+const std::size_t UNDECORATE_ARENA_SIZE = 0x10000;     // 64 KB
+const UInt32 UNDECORATE_MAX_BACKREFS  = 10;
+const UInt32 UNDECORATE_MAX_DEPTH     = 64;            // of nested types and names
+const UInt32 UNDECORATE_MAX_PIECES    = 32;            // of one qualified name
+
+// Some text, usually in the arena.
+struct UndText
+{
+    const char*   s;
+    UInt32        length;
+};
+
+// The names and function parameter types that later parts of a name can
+// refer back to with a digit. Each template argument list has its own.
+struct UndBackrefs
+{
+    UndText       names[UNDECORATE_MAX_BACKREFS];
+    UInt32        numNames;
+    UndText       params[UNDECORATE_MAX_BACKREFS];
+    UInt32        numParams;
+};
+
+struct Undecorator
+{
+    const char*   p;                   // the next character of the mangled name
+    bool          ok;                  // FALSE once anything is wrong
+    UInt32        depth;
+    UndBackrefs   backrefs;
+    std::size_t   used;                // bytes of 'arena' used
+    char          arena[UNDECORATE_ARENA_SIZE];
+};
+
+// public:
+std::size_t UndecorateName(const char* symbol, char* out, const std::size_t outSize);
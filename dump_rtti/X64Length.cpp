@@ -0,0 +1,281 @@
+// ============================================================================
+// dump_rtti/X64Length.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#include <cstring>
+
+#include "X64Length.h"
+
+static UInt8 GetX64Flow(const X64Instruction& insn);
+
+// ============================================================================
+//                            Opcode tables.
+// ----------------------------------------------------------------------------
+// See the Intel SDM, volume 2, appendix A ("Opcode Map"), and
+// https://wiki.osdev.org/X86-64_Instruction_Encoding
+//
+// Prefixes, the escapes (0F, 0F 38, 0F 3A) and VEX / EVEX are dealt with
+// before these are consulted, so their entries don't matter.
+// ============================================================================
+enum : UInt8
+{
+    NN = 0,                            // nothing follows the opcode
+    MR = kX64_ModRM,
+    I1 = kX64_Imm8,
+    I2 = kX64_Imm16,
+    IZ = kX64_ImmZ,
+    IV = kX64_ImmV,
+    I4 = kX64_Imm32,
+    MO = kX64_Moffs,
+    MI = kX64_ModRM | kX64_Imm8,
+    MZ = kX64_ModRM | kX64_ImmZ,
+    EN = kX64_Imm16 | kX64_Imm8,       // ENTER
+    XX = kX64_Invalid,
+};
+
+static const UInt8 X64_OPCODES_PRIMARY[256] = {
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        MR, MR, MR, MR, I1, IZ, XX, XX, MR, MR, MR, MR, I1, IZ, XX, NN,    // 00
+        MR, MR, MR, MR, I1, IZ, XX, XX, MR, MR, MR, MR, I1, IZ, XX, XX,    // 10
+        MR, MR, MR, MR, I1, IZ, NN, XX, MR, MR, MR, MR, I1, IZ, NN, XX,    // 20
+        MR, MR, MR, MR, I1, IZ, NN, XX, MR, MR, MR, MR, I1, IZ, NN, XX,    // 30
+        NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN,    // 40 (REX)
+        NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, NN,    // 50
+        XX, XX, NN, MR, NN, NN, NN, NN, IZ, MZ, I1, MI, NN, NN, NN, NN,    // 60
+        I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1, I1,    // 70
+        MI, MZ, XX, MI, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 80
+        NN, NN, NN, NN, NN, NN, NN, NN, NN, NN, XX, NN, NN, NN, NN, NN,    // 90
+        MO, MO, MO, MO, NN, NN, NN, NN, I1, IZ, NN, NN, NN, NN, NN, NN,    // A0
+        I1, I1, I1, I1, I1, I1, I1, I1, IV, IV, IV, IV, IV, IV, IV, IV,    // B0
+        MI, MI, I2, NN, NN, NN, MI, MZ, EN, NN, I2, NN, NN, I1, XX, NN,    // C0
+        MR, MR, MR, MR, XX, XX, XX, NN, MR, MR, MR, MR, MR, MR, MR, MR,    // D0
+        I1, I1, I1, I1, I1, I1, I1, I1, I4, I4, XX, I1, NN, NN, NN, NN,    // E0
+        NN, NN, NN, NN, NN, NN, MR, MR, NN, NN, NN, NN, NN, NN, MR, MR,    // F0
+};
+
+static const UInt8 X64_OPCODES_0F[256] = {
+    //  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+        MR, MR, MR, MR, XX, NN, NN, NN, NN, NN, XX, NN, XX, MR, NN, MI,    // 00
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 10
+        MR, MR, MR, MR, XX, XX, XX, XX, MR, MR, MR, MR, MR, MR, MR, MR,    // 20
+        NN, NN, NN, NN, NN, NN, XX, NN, NN, XX, NN, XX, XX, XX, XX, XX,    // 30
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 40
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 50
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 60
+        MI, MI, MI, MI, MR, MR, MR, NN, MR, MR, XX, XX, MR, MR, MR, MR,    // 70
+        I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4, I4,    // 80
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // 90
+        NN, NN, NN, MR, MI, MR, XX, XX, NN, NN, NN, MR, MI, MR, MR, MR,    // A0
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MI, MR, MR, MR, MR, MR,    // B0
+        MR, MR, MI, MR, MI, MI, MI, MR, NN, NN, NN, NN, NN, NN, NN, NN,    // C0
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // D0
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // E0
+        MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR, MR,    // F0
+};
+
+// ============================================================================
+//   Decode the instruction at 'code' into 'insn'. Return its length, or 0
+//   if it isn't a valid 64-bit mode instruction (in which case insn.length
+//   is 0 too). Reads no further than the end of the instruction, and never
+//   more than X64_MAX_LENGTH bytes.
+// ============================================================================
+UInt32 DecodeX64Instruction(const UInt8* code, X64Instruction& insn)
+{
+    std::memset(&insn, 0, sizeof(insn));
+    const UInt8* p = code;
+    const UInt8* end = code + X64_MAX_LENGTH;
+    bool opSize16 = false;
+    bool addrSize32 = false;
+
+    // ------------------------------------------------------------------------
+    // Prefixes. A REX prefix only counts if it's the last one.
+    // ------------------------------------------------------------------------
+    for (;; ++p)
+    {
+        if (p == end) return 0;
+        const UInt8 b = *p;
+        if ((b & 0xF0) == 0x40) {
+            insn.rex = b;
+            continue;
+        }
+        if (b == 0x66) opSize16 = true;
+        else if (b == 0x67) addrSize32 = true;
+        else if (b != 0xF0 && b != 0xF2 && b != 0xF3 && b != 0x2E && b != 0x36 && b != 0x3E &&
+                 b != 0x26 && b != 0x64 && b != 0x65) {
+            break;
+        }
+        insn.rex = 0;
+        insn.numPrefixes++;
+    }
+
+    // ------------------------------------------------------------------------
+    // The opcode, in whichever map.
+    // ------------------------------------------------------------------------
+    UInt8 flags;
+    UInt8 b = *p++;
+    if (b == 0x0F)
+    {
+        if (p == end) return 0;
+        b = *p++;
+        if (b == 0x38 || b == 0x3A)
+        {
+            if (p == end) return 0;
+            insn.map = (b == 0x38) ? kX64Map_0F38 : kX64Map_0F3A;
+            flags = (b == 0x38) ? MR : MI;
+            b = *p++;
+        }
+        else
+        {
+            insn.map = kX64Map_0F;
+            flags = X64_OPCODES_0F[b];
+        }
+    }
+    else if (b == 0xC4 || b == 0xC5 || b == 0x62)
+    {
+        // VEX (C5 is the two-byte form, C4 the three-byte one) or EVEX. The
+        // map is in the prefix; a REX prefix before it is invalid.
+        if (insn.rex) return 0;
+        const UInt32 prefixSize = (b == 0xC5) ? 1 : (b == 0xC4) ? 2 : 3;
+        if (end - p < (std::ptrdiff_t)prefixSize + 1) return 0;
+        const UInt32 map = (b == 0xC5) ? 1 : (b == 0xC4) ? (p[0] & 0x1F) : (p[0] & 0x07);
+        const bool evex = (b == 0x62);
+        p += prefixSize;
+        b = *p++;
+        switch (map)
+        {
+        case 1:
+            insn.map = kX64Map_0F;
+            flags = X64_OPCODES_0F[b];
+            if (flags & (kX64_Imm32 | kX64_Invalid)) return 0;
+            break;
+        case 2:
+            insn.map = kX64Map_0F38;
+            flags = MR;
+            break;
+        case 3:
+            insn.map = kX64Map_0F3A;
+            flags = MI;
+            break;
+        case 5:
+        case 6:
+            if (!evex) return 0;
+            insn.map = kX64Map_Other;
+            flags = MR;
+            break;
+        default:
+            return 0;
+        }
+        if (evex) flags |= kX64_ModRM;
+    }
+    else
+    {
+        insn.map = kX64Map_Primary;
+        flags = X64_OPCODES_PRIMARY[b];
+    }
+    if (flags & kX64_Invalid) return 0;
+    insn.opcode = b;
+
+    // ------------------------------------------------------------------------
+    // ModRM, SIB and displacement. There's no 16-bit addressing in 64-bit
+    // mode, so the address size doesn't change any of this.
+    // ------------------------------------------------------------------------
+    if (flags & kX64_ModRM)
+    {
+        if (p == end) return 0;
+        insn.modrm = *p++;
+        const UInt8 mod = insn.modrm >> 6;
+        const UInt8 rm = insn.modrm & 7;
+        if (mod != 3)
+        {
+            if (rm == 4)
+            {
+                // SIB; a base of RBP / R13 with mod 0 means disp32, no base.
+                if (p == end) return 0;
+                const UInt8 sib = *p++;
+                if (mod == 0 && (sib & 7) == 5) insn.dispSize = 4;
+            }
+            else if (mod == 0 && rm == 5) {
+                insn.dispSize = 4;     // [rip+disp32]
+            }
+            if (mod == 1) insn.dispSize = 1;
+            else if (mod == 2) insn.dispSize = 4;
+        }
+
+        // TEST r/m, imm is group 3's /0 (and /1); the rest of it has no immediate.
+        if (insn.map == kX64Map_Primary && (b == 0xF6 || b == 0xF7) && ((insn.modrm >> 3) & 7) < 2) {
+            flags |= (b == 0xF6) ? kX64_Imm8 : kX64_ImmZ;
+        }
+    }
+    insn.dispOffset = (UInt8)(p - code);
+    p += insn.dispSize;
+
+    // ------------------------------------------------------------------------
+    // Immediate.
+    // ------------------------------------------------------------------------
+    const bool rexW = (insn.rex & 0x08) != 0;
+    UInt32 immSize = 0;
+    if (flags & kX64_Imm8) immSize += 1;
+    if (flags & kX64_Imm16) immSize += 2;
+    if (flags & kX64_ImmZ) immSize += (opSize16 && !rexW) ? 2 : 4;
+    if (flags & kX64_ImmV) immSize += rexW ? 8 : opSize16 ? 2 : 4;
+    if (flags & kX64_Imm32) immSize += 4;
+    if (flags & kX64_Moffs) immSize += addrSize32 ? 4 : 8;
+    insn.immOffset = (UInt8)(p - code);
+    insn.immSize = (UInt8)immSize;
+    p += immSize;
+
+    if (p > end) return 0;
+    insn.flags = flags;
+    insn.length = (UInt8)(p - code);
+    insn.flow = GetX64Flow(insn);
+    return insn.length;
+}
+
+static UInt8 GetX64Flow(const X64Instruction& insn)
+{
+    // ------------------------------------------------------------------------
+    // What a decoded instruction does to the flow of control.
+    // ------------------------------------------------------------------------
+    const UInt8 op = insn.opcode;
+    const UInt8 reg = (insn.modrm >> 3) & 7;
+    if (insn.map == kX64Map_Primary)
+    {
+        if (op == 0xC3 || op == 0xC2) return kX64Flow_Return;
+        if (op == 0xE9 || op == 0xEB) return kX64Flow_Jump;
+        if (op == 0xE8) return kX64Flow_Call;
+        if ((op & 0xF0) == 0x70 || (op >= 0xE0 && op <= 0xE3)) return kX64Flow_Branch;
+        if (op == 0xFF && (reg == 2 || reg == 3)) return kX64Flow_Call;
+        if (op == 0xFF && (reg == 4 || reg == 5)) return kX64Flow_Jump;
+        if (op == 0xCC || op == 0xCD || op == 0xF1 || op == 0xF4 || op == 0xCA || op == 0xCB || op == 0xCF) {
+            return kX64Flow_Stop;
+        }
+    }
+    else if (insn.map == kX64Map_0F)
+    {
+        if ((op & 0xF0) == 0x80) return kX64Flow_Branch;
+        if (op == 0x0B || op == 0xB9 || op == 0xFF) return kX64Flow_Stop;
+    }
+    return kX64Flow_Next;
+}
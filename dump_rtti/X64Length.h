@@ -0,0 +1,106 @@
+// ============================================================================
+// dump_rtti/X64Length.h
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+#pragma once
+
+#include "Platform.h"
+
+// ============================================================================
+//                    x86-64 instruction length decoder.
+// ----------------------------------------------------------------------------
+// Works out where an instruction ends, and what sort of control flow it is,
+// without disassembling it: the legacy and REX prefixes, VEX and EVEX, the
+// one-byte, 0F, 0F 38 and 0F 3A opcode maps, ModRM, SIB, displacements and
+// immediates. What's needed for each opcode is looked up in a table of flags,
+// so the decoder is a handful of table lookups and branches per instruction,
+// and doesn't allocate.
+//
+// The tables are for 64-bit mode: opcodes that are invalid there (e.g. PUSH ES,
+// DAA, the BCD and far forms) fail to decode, and C4, C5 and 62 are always VEX
+// or EVEX. 3DNow! is decoded (0F 0F has a ModRM and an imm8), AMD's XOP isn't.
+// ============================================================================
+const UInt32 X64_MAX_LENGTH       = 15;
+
+// What an opcode is followed by.
+enum X64OpcodeFlags
+{
+    kX64_ModRM    = 0x01,
+    kX64_Imm8     = 0x02,
+    kX64_Imm16    = 0x04,
+    kX64_ImmZ     = 0x08,              // 16 or 32 bits, by operand size
+    kX64_ImmV     = 0x10,              // 16, 32 or 64 bits, by operand size (MOV r, imm)
+    kX64_Imm32    = 0x20,              // rel32, whatever the operand size
+    kX64_Moffs    = 0x40,              // 32 or 64 bits, by address size (MOV rAX, moffs)
+    kX64_Invalid  = 0x80,
+};
+
+enum X64OpcodeMap
+{
+    kX64Map_Primary,                   // one-byte opcodes
+    kX64Map_0F,
+    kX64Map_0F38,
+    kX64Map_0F3A,
+    kX64Map_Other,                     // EVEX maps 5 and 6
+};
+
+enum X64Flow
+{
+    kX64Flow_Next,                     // carries on with the next instruction
+    kX64Flow_Return,                   // RET, RET imm16
+    kX64Flow_Jump,                     // JMP rel8/rel32, or indirect
+    kX64Flow_Branch,                   // Jcc, LOOP, JRCXZ
+    kX64Flow_Call,                     // CALL rel32, or indirect
+    kX64Flow_Stop,                     // INT3, UD2, HLT, IRET, ... i.e. doesn't carry on
+};
+
+struct X64Instruction
+{
+    UInt8         length;              // 00: in bytes; 0 if it couldn't be decoded
+    UInt8         numPrefixes;         // 01: legacy prefixes
+    UInt8         rex;                 // 02: the REX prefix, or 0
+    UInt8         map;                 // 03: X64OpcodeMap
+    UInt8         opcode;              // 04
+    UInt8         modrm;               // 05: if 'flags' has kX64_ModRM
+    UInt8         flags;               // 06: X64OpcodeFlags
+    UInt8         flow;                // 07: X64Flow
+    UInt8         dispOffset;          // 08: offset of the displacement, if any
+    UInt8         dispSize;            // 09: 0, 1 or 4
+    UInt8         immOffset;           // 0A: offset of the immediate (or rel, or moffs), if any
+    UInt8         immSize;             // 0B: 0, 1, 2, 3 (ENTER), 4 or 8
+};
+
+// ============================================================================
+//                             Functions.
+// ============================================================================
+// public:
+UInt32 DecodeX64Instruction(const UInt8* code, X64Instruction& insn);
+
+// Just the length.
+inline UInt32 GetX64InstructionLength(const UInt8* code)
+{
+    X64Instruction insn;
+    return DecodeX64Instruction(code, insn);
+}
@@ -25,22 +25,220 @@
 // 
 // (The MIT License)
 // ============================================================================
-#pragma comment(lib, "Dbghelp.lib")
-
-#include <dbghelp.h>
 #include <shlobj.h>
-#include <time.h>
-#include <vector>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include "common/IDebugLog.h"
 #include "skse64_common/skse_version.h"
 #include "skse64/PluginAPI.h"
 
+#include "LogWriter.h"
+#include "PEImage.h"
 #include "RTTI.h"
+#include "RTTIAnalysis.h"
+#include "RTTICache.h"
+#include "StackWalk.h"
 
 IDebugLog		         gLog;
 PluginHandle	         g_pluginHandle = kPluginHandle_Invalid;
 SKSEMessagingInterface*  g_msgInterface = NULL;
+SKSETaskInterface*       g_taskInterface = NULL;
+std::string              g_cachePath;            // empty if the Documents folder couldn't be found
+
+// ============================================================================
+//                    Dumping on a background thread.
+// ----------------------------------------------------------------------------
+// The dump runs to several MB and takes a while, so rather than freezing the
+// game at the main menu we hand it to a worker thread when the game's data
+// has loaded. Everything it reads is part of the executable's image, which
+// doesn't change, so all it needs from the game thread is the image's base
+// address and file name.
+//
+// If the game quits before the dump is complete, the worker would be killed
+// part way through, leaving a truncated log. So, unless bWaitOnExit=0 in the
+// plugin's INI file, we redirect the game's calls to ExitProcess, and make
+// them wait until the dump is done.
+//
+// Alternatively, with bIncremental=1, the dump runs on the game thread a slice
+// at a time (see RTTIAnalysis.h): each slice is an SKSE task doing at most
+// iStepBudgetMicroseconds of work, so the frame rate barely notices.
+// ============================================================================
+const char* INI_PATH = "Data\\SKSE\\Plugins\\skyretk_dump_rtti.ini";
+
+struct DumpRequest
+{
+    UInt64        baseAddr;            // where the executable is mapped
+    std::string   fileName;            // its path, or empty if unknown
+    std::string   cachePath;           // the RTTI cache, or empty for none
+};
+
+typedef void (WINAPI* ExitProcessFn)(UINT exitCode);
+
+HANDLE                   g_dumpDone = NULL;      // set when the worker has finished
+ExitProcessFn            g_exitProcess = nullptr; // the real ExitProcess, if we've redirected it
+UInt32                   g_lastDecile = 0;       // progress last reported, in tenths
+
+static void ReportProgress(LogWriter& out, const UInt32 done, const UInt32 total)
+{
+    // One line for each 10% of the classes.
+    UInt32 decile = (UInt32)((UInt64)done * 10 / total);
+    if (decile != g_lastDecile) {
+        g_lastDecile = decile;
+        LogLine(out, "// RTTI dump: %u%% (%u of %u classes)", decile * 10, done, total);
+    }
+}
+
+// N.B. the CPU time is only this thread's. The scan, the decompiling and the
+// formatting mostly run on ParallelFor's helper threads, and the process's
+// CPU time would count the game's own threads as well.
+static void DumpRTTI(const DumpRequest req)
+{
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = GetThreadCpuTime();
+    PrintModuleSummary(req.fileName.empty() ? nullptr : req.fileName.c_str(), req.baseAddr);
+
+    // Load the VFTs from the cache, or locate them, then print the class structures:
+    ImageLayout layout;
+    RTTIDatabase db;
+    if (LoadRTTI(req.baseAddr, req.cachePath.empty() ? nullptr : req.cachePath.c_str(), layout, db)) {
+        PrintImageLayout(layout);
+        LogWriter out;
+        OpenLogWriter(out);
+        PrintVirtuals(out, layout, db, ReportProgress);
+
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+        _MESSAGE("RTTI dump: finished; %u classes in %.2f s wall time, %.2f s of this thread's CPU time.",
+                 (UInt32)db.types.size(), secs.count(), GetThreadCpuTime() - cpuStart);
+    }
+    else {
+        _ERROR("couldn't find the RTTI in the executable");
+    }
+    SetEvent(g_dumpDone);
+}
+
+// ----------------------------------------------------------------------------
+// Incremental mode. A task queued from the game thread's message loop does one
+// step of the analysis. The timer only queues a task if the last one has run:
+// SKSE runs tasks that are queued while it's running tasks in the same frame,
+// so a task that re-queued itself would never let the frame finish.
+// ----------------------------------------------------------------------------
+bool                     g_incremental = false;  // dumping a step at a time?
+UInt32                   g_stepBudget = 2000;    // microseconds of work per step
+RTTIAnalysis             g_analysis;
+std::mutex               g_analysisLock;         // held while stepping g_analysis
+UINT_PTR                 g_stepTimer = 0;
+bool                     g_stepQueued = false;   // an AnalysisTask is waiting to run
+
+// Called with g_analysisLock held once StepRTTIAnalysis has returned FALSE.
+static void EndAnalysisSteps()
+{
+    KillTimer(NULL, g_stepTimer);
+    g_stepTimer = 0;
+    if (g_analysis.stage == kAnalysis_Done) {
+        _MESSAGE("RTTI dump: finished; %u classes in %.2f s wall time, %.2f s CPU time "
+                 "(%u steps; longest %.2f ms).", (UInt32)g_analysis.db.types.size(),
+                 g_analysis.wallTime, g_analysis.cpuTime, g_analysis.numSteps,
+                 g_analysis.longestStep * 1000.0);
+    }
+}
+
+class AnalysisTask : public TaskDelegate
+{
+public:
+    virtual void Run()
+    {
+        g_stepQueued = false;
+        std::lock_guard<std::mutex> lock(g_analysisLock);
+        if (g_stepTimer && !StepRTTIAnalysis(g_analysis, g_stepBudget)) {
+            EndAnalysisSteps();
+        }
+    }
+    virtual void Dispose() {}          // static, so nothing to free
+};
+
+AnalysisTask             g_analysisTask;
+
+static void CALLBACK QueueAnalysisStep(HWND, UINT, UINT_PTR, DWORD)
+{
+    if (!g_stepQueued) {
+        g_stepQueued = true;
+        g_taskInterface->AddTask(&g_analysisTask);
+    }
+}
+
+static void WINAPI ExitProcessHook(UINT exitCode)
+{
+    if (g_incremental) {
+        // The steps run on the game thread, which is probably the one that's
+        // quitting, so waiting for them would never end. Finish here instead.
+        std::lock_guard<std::mutex> lock(g_analysisLock);
+        if (g_stepTimer) {
+            while (StepRTTIAnalysis(g_analysis, 0)) {}
+            EndAnalysisSteps();
+        }
+    }
+    else {
+        // N.B. no logging here: the worker may be writing to the log.
+        WaitForSingleObject(g_dumpDone, INFINITE);
+    }
+    g_exitProcess(exitCode);
+}
+
+static void HookExitProcess(const UInt64 baseAddr)
+{
+    UInt64* pSlot = FindImportSlot(baseAddr, "kernel32.dll", "ExitProcess");
+    DWORD oldProtect;
+    if (!pSlot || !VirtualProtect(pSlot, sizeof(*pSlot), PAGE_READWRITE, &oldProtect)) {
+        _MESSAGE("RTTI dump: couldn't hook ExitProcess; quitting before the dump finishes will truncate it.");
+        return;
+    }
+    g_exitProcess = reinterpret_cast<ExitProcessFn>(*pSlot);
+    *pSlot = reinterpret_cast<UInt64>(&ExitProcessHook);
+    VirtualProtect(pSlot, sizeof(*pSlot), oldProtect, &oldProtect);
+}
+
+// ----------------------------------------------------------------------------
+// Crash snapshots. Unless bStackSnapshot=0, an unhandled exception saves the
+// faulting thread's registers and stack next to the log, and then goes on to
+// whichever filter was there before us. The stack can then be walked with
+// dump_rtti_offline --stack (see StackWalk.h). Everything the filter needs is
+// worked out when it's installed.
+// ----------------------------------------------------------------------------
+ImageLayout                  g_crashLayout;      // only the image's base, size and time stamp
+std::string                  g_snapshotPath;
+LPTOP_LEVEL_EXCEPTION_FILTER g_prevFilter = nullptr;
+
+static LONG WINAPI SaveCrashSnapshot(EXCEPTION_POINTERS* info)
+{
+    StackContext context;
+    GetStackContext(*info->ContextRecord, context);
+
+    // The stack from rsp up to its base, as the thread's TIB gives it.
+    const UInt64 rsp = context.regs[kReg_Rsp];
+    const UInt64 stackBase = reinterpret_cast<UInt64>(reinterpret_cast<const NT_TIB*>(NtCurrentTeb())->StackBase);
+    if (rsp < stackBase) {
+        const StackMemory stack = { rsp, stackBase - rsp, reinterpret_cast<const UInt8*>(rsp) };
+        if (SaveStackSnapshot(g_snapshotPath.c_str(), g_crashLayout, context, stack)) {
+            _MESSAGE("RTTI dump: crashed at %016llX; saved the stack to %s.",
+                     (unsigned long long)context.rip, g_snapshotPath.c_str());
+        }
+    }
+    return g_prevFilter ? g_prevFilter(info) : EXCEPTION_CONTINUE_SEARCH;
+}
+
+static void InstallCrashFilter(const UInt64 baseAddr, const std::string& path)
+{
+    const IMAGE_NT_HEADERS* pNtHdr = GetNtHeaders(baseAddr);
+    if (!pNtHdr) return;
+    g_crashLayout.baseAddr = baseAddr;
+    g_crashLayout.sizeOfImage = pNtHdr->OptionalHeader.SizeOfImage;
+    g_crashLayout.timeDateStamp = pNtHdr->FileHeader.TimeDateStamp;
+    g_snapshotPath = path;
+    g_prevFilter = SetUnhandledExceptionFilter(SaveCrashSnapshot);
+}
 
 extern "C" {
     void HandleSKSEMessage(SKSEMessagingInterface::Message* msg) {
@@ -49,100 +247,44 @@ extern "C" {
         char modFileName[MAX_PATH];
         HMODULE hModule = GetModuleHandle(NULL);
         DWORD ret = GetModuleFileNameA(hModule, modFileName, MAX_PATH);
-        UInt64 baseAddr = reinterpret_cast<UInt64>(hModule);
-        IMAGE_NT_HEADERS* pNtHdr = ImageNtHeader(hModule);
-
-        // ----------------------------------------------------------------------
-        //        Print useful summary info about the loaded executable.
-        // See https://learn.microsoft.com/en-us/windows/win32/debug/pe-format
-        // ----------------------------------------------------------------------
-        _MESSAGE("------------------------------ MODULE SUMMARY ----------------------------------");
-        if (ret) {
-            _MESSAGE("File name: %s", modFileName);
-        }
-        std::string format;
-        switch ((UInt16)pNtHdr->FileHeader.Machine) {
-        case IMAGE_FILE_MACHINE_I386:
-            format = "Intel 386 or later processors and compatible processors";
-            break;
-        case IMAGE_FILE_MACHINE_IA64:
-            format = "Intel Itanium processor family";
-            break;
-        case IMAGE_FILE_MACHINE_AMD64:
-            format = "x64";
-            break;
-        default:
-            format = "UNRECOGNISED";
-            break;
+
+        DumpRequest req;
+        req.baseAddr = reinterpret_cast<UInt64>(hModule);
+        req.fileName = ret ? modFileName : "";
+        req.cachePath = g_cachePath;
+
+        g_incremental = GetPrivateProfileIntA("General", "bIncremental", 0, INI_PATH) != 0;
+        if (g_incremental) {
+            g_stepBudget = GetPrivateProfileIntA("General", "iStepBudgetMicroseconds", g_stepBudget, INI_PATH);
+            if (g_taskInterface) {
+                StartRTTIAnalysis(g_analysis, req.baseAddr, ret ? modFileName : nullptr,
+                                  g_cachePath.empty() ? nullptr : g_cachePath.c_str(), ReportProgress);
+                g_stepTimer = SetTimer(NULL, 0, USER_TIMER_MINIMUM, QueueAnalysisStep);
+            }
+            if (g_stepTimer) {
+                if (GetPrivateProfileIntA("General", "bWaitOnExit", 1, INI_PATH)) {
+                    HookExitProcess(req.baseAddr);
+                }
+                _MESSAGE("RTTI dump: started on the game thread, in steps of %u us.", g_stepBudget);
+                return;
+            }
+            _MESSAGE("RTTI dump: couldn't schedule the steps; dumping on a background thread.");
+            g_incremental = false;
         }
-        _MESSAGE("Format: %s (0x%04X)", format.c_str(), (UInt16)pNtHdr->FileHeader.Machine);
-        const time_t t1 = (time_t)pNtHdr->FileHeader.TimeDateStamp;
-        char buf[32];
-        if (!ctime_s(buf, sizeof(buf), &t1)) {
-            _MESSAGE("Build timestamp: %s", buf);
+
+        g_dumpDone = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!g_dumpDone) {
+            // Can't tell when the worker's done, so do it the old way.
+            _MESSAGE("RTTI dump: couldn't create an event; dumping on the game thread.");
+            DumpRTTI(req);
+            return;
         }
-        _MESSAGE("Base address: %#010x", baseAddr);
-
-        // Thanks Nawaz @
-        // https://stackoverflow.com/questions/4308996/finding-the-address-range-of-the-data-segment
-        _MESSAGE("Sections:");
-        IMAGE_SECTION_HEADER* pSectionHdr = (IMAGE_SECTION_HEADER*)(pNtHdr + 1);
-        std::string scnName;
-        for (int scn = 0; scn < pNtHdr->FileHeader.NumberOfSections; ++scn)
-        {
-            // N.B. pSectionHdr->Name is 8 bytes long. If all 8 bytes are used it won't be 
-            // null-terminated. So we do this to avoids potential buffer overruns:
-            scnName.assign((const char*)pSectionHdr->Name, 8);
-            _MESSAGE("  %3d: %#010x ... %#010x %-10s (%u bytes)",
-                     scn,
-                     baseAddr + (UInt64)pSectionHdr->VirtualAddress,
-                     baseAddr + (UInt64)pSectionHdr->VirtualAddress + (UInt64)pSectionHdr->Misc.VirtualSize,
-                     scnName.c_str(),
-                     (UInt32)pSectionHdr->Misc.VirtualSize);
-            ++pSectionHdr;
+        if (GetPrivateProfileIntA("General", "bWaitOnExit", 1, INI_PATH)) {
+            HookExitProcess(req.baseAddr);
         }
 
-        _MESSAGE("Data directories:");
-        std::vector<std::string> dirNames
-        { "Export Table", "Import Table", "Resource Table", "Exception Table", 
-          "Certificate Table", "Base Relocation Table", "Debug",
-          "Architecture", "Global Ptr", "TLS Table", "Load Config Table",
-          "Bound Import", "IAT", "Delay Import Descriptor",
-          "CLR Runtime Header" };
-        int k = 0;
-        for (int i = 0; i < pNtHdr->OptionalHeader.NumberOfRvaAndSizes && i < 16; ++i) 
-        {
-            IMAGE_DATA_DIRECTORY pDataDir = pNtHdr->OptionalHeader.DataDirectory[i];
-            if ((UInt64)pDataDir.Size > 0) {
-                _MESSAGE("  %3d: %#010x ... %#010x %-25s (%u bytes)",
-                    k++,
-                    baseAddr + (UInt64)pDataDir.VirtualAddress,
-                    baseAddr + (UInt64)pDataDir.VirtualAddress + (UInt64)pDataDir.Size,
-                    dirNames.at(i).c_str(),
-                    (UInt32)pDataDir.Size);
-            }
-        }
-        _MESSAGE("--------------------------------------------------------------------------------");
-
-        // 1. Locate the RTTI Type Descriptor for class type_info.
-        //    In Skyrim 1.6.659, it should find the string at address 0x41f50eb0,
-        //    which means the type_info TypeDescriptor is 2 8-byte pointers earlier,
-        //    at 0x41f50ea0.
-        // const char* s_typeInfo = ".?AVtype_info@@";
-        // const size_t len_typeInfo = strlen(s_typeInfo);
-
-        // 2. Once the type_info TypeDescriptor is found, we can dereference its
-        //    pVFTable member to locate the type_info VFT. In Skyrim 1.6.659, that's at
-        //    address 0x419752c0.
-
-        // For now we've simply hard-coded the address of the type_info VFT as the
-        // constant TYPE_INFO_VTBL. But in future, we could make this code more
-        // general by dynamically looking up that address as per the steps 1 & 2 above.
-
-        // ... Locate the VFTs, then print the class structures:
-        std::map<UInt64, VtblList> vtblMap;	// TypeDescriptor address, list of vtbl addresses
-        LoadVTables(baseAddr, vtblMap);
-        PrintVirtuals(baseAddr, vtblMap);
+        _MESSAGE("RTTI dump: started on a background thread.");
+        std::thread(DumpRTTI, req).detach();
     }
 
     __declspec(dllexport) SKSEPluginVersionData SKSEPlugin_Version = {
@@ -154,9 +296,11 @@ extern "C" {
         "nox sidereum (2022); himika (2017)",
         "",
 
-        0,  // not version independent (extended field)
-        0,  // not version independent
-        { RUNTIME_VERSION_1_6_659_GOG, 0 },
+        // Everything we need is located at runtime from the PE headers,
+        // and we don't use any of the game's structures.
+        SKSEPluginVersionData::kVersionIndependentEx_NoStructUse,
+        SKSEPluginVersionData::kVersionIndependent_Signatures,
+        { 0 },
 
         0  // works with any version of the script extender.
     };
@@ -166,11 +310,31 @@ extern "C" {
         // We're going to be generating a lot of text, so adjust the log & print
         // levels to ensure that all messages go to the log but only warnings or errors
         // go to the terminal.
-        gLog.OpenRelative(CSIDL_MYDOCUMENTS,
-            "\\My Games\\Skyrim Special Edition GOG\\SKSE\\skyretk_dump_rtti.log");
+        // Each edition of the game has its own "My Games" folder. The RTTI
+        // cache goes in the same folder as the log.
+        const char* skseFolder;
+        switch (GET_EXE_VERSION_SUB(skse->runtimeVersion)) {
+        case RUNTIME_TYPE_GOG:
+            skseFolder = "\\My Games\\Skyrim Special Edition GOG\\SKSE\\";
+            break;
+        case RUNTIME_TYPE_EPIC:
+            skseFolder = "\\My Games\\Skyrim Special Edition EPIC\\SKSE\\";
+            break;
+        default:
+            skseFolder = "\\My Games\\Skyrim Special Edition\\SKSE\\";
+            break;
+        }
+        gLog.OpenRelative(CSIDL_MYDOCUMENTS, (std::string(skseFolder) + "skyretk_dump_rtti.log").c_str());
         gLog.SetPrintLevel(IDebugLog::kLevel_Warning);
         gLog.SetLogLevel(IDebugLog::kLevel_DebugMessage);
 
+        char docsPath[MAX_PATH];
+        std::string snapshotPath;
+        if (SUCCEEDED(SHGetFolderPathA(NULL, CSIDL_MYDOCUMENTS, NULL, SHGFP_TYPE_CURRENT, docsPath))) {
+            g_cachePath = std::string(docsPath) + skseFolder + "skyretk_dump_rtti.cache";
+            snapshotPath = std::string(docsPath) + skseFolder + "skyretk_dump_rtti.stack";
+        }
+
         if (skse->isEditor) {
             _MESSAGE("loaded in editor, marking as incompatible");
             return false;
@@ -178,9 +342,13 @@ extern "C" {
 
         _MESSAGE("====================== SkyRETK dump_rtti: SKSEPlugin_Load ======================");
         _MESSAGE("Nox Sidereum's update of Himika's code at https://github.com/himika/libSkyrim.");
-        _MESSAGE("Currently only works for GOG Skyrim 1.6.659 because the offsets are hardcoded.");
+        _MESSAGE("Section bounds and RTTI addresses are read from the executable's PE headers.");
         _MESSAGE("================================================================================");
 
+        if (!snapshotPath.empty() && GetPrivateProfileIntA("General", "bStackSnapshot", 1, INI_PATH)) {
+            InstallCrashFilter(reinterpret_cast<UInt64>(GetModuleHandle(NULL)), snapshotPath);
+        }
+
         // Register for the "DataLoaded" SKSE callback.
         g_pluginHandle = skse->GetPluginHandle();
         g_msgInterface =
@@ -197,6 +365,10 @@ extern "C" {
         }
         g_msgInterface->RegisterListener(g_pluginHandle, "SKSE", HandleSKSEMessage);
 
+        // Only needed for bIncremental=1. Without it we dump on a thread.
+        g_taskInterface =
+            (SKSETaskInterface*)skse->QueryInterface(kInterface_Task);
+
         return true;
     }
 }
@@ -0,0 +1,1201 @@
+// ============================================================================
+// dump_rtti_offline/main.cpp
+// Part of the Skyrim64 Reverse Engineering Toolkit (SkyRETK)
+// 
+// Copyright (c) 2022 Nox Sidereum
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the “Software”), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is furnished
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+// 
+// (The MIT License)
+// ============================================================================
+// ----------------------------------------------------------------------------
+// Standalone driver for the dump_rtti pipeline.
+//
+// Maps SkyrimSE.exe from disk the way the Windows loader would (headers and
+// sections at their RVAs, preferably at the image's preferred base address)
+// and then runs exactly the same LoadVTables / PrintVirtuals code as the SKSE
+// plugin. No game, no SKSE, and it builds on Linux. See the Makefile.
+//
+// Usage: dump_rtti_offline [options] <path to SkyrimSE.exe> [output log]
+//
+// Options:
+//   --threads N     scan with N threads (default: one per core)
+//   --simd ISA      use at most the given instruction set for the scan
+//                   kernels: scalar, sse4.2 or avx2 (default: the best the
+//                   CPU supports)
+//   --bench-scan    time the scan kernels at each instruction set, and
+//                   LoadVTables at 1, 2, 4, ... threads, up to N or one
+//                   per core, then exit without dumping
+//   --bench-decode  time the instruction length decoder over .text, and
+//                   the decompiler over the virtual functions, then exit
+//                   without dumping
+//   --bench-cast    time RTTICast (see RTTICast.h) against a dynamic_cast
+//                   that compares names as the game's does, on a mock
+//                   object of every class, then exit without dumping
+//   --cache FILE    load the RTTI from FILE if it's a valid cache for this
+//                   executable, else scan and save it there (default: the
+//                   output log's name with a .cache extension)
+//   --no-cache      always scan, and don't write a cache
+//   --incremental U run the analysis as the plugin's incremental mode does,
+//                   in steps of about U microseconds, on one thread, and
+//                   report the wall and CPU time taken
+//   --find PATTERN  list the classes that match PATTERN, e.g.
+//                   "NativeFunction2<*,*,*,float>", instead of dumping them
+//                   (see RTTINameIndex.h); may be given more than once
+//   --addr ADDRESS  say what the (hex) address is in, e.g. "Actor::Unk_01A
+//                   + 0x34", instead of dumping (see RTTISymbols.h); may be
+//                   given more than once
+//   --stack FILE    walk the stack saved in FILE by SaveStackSnapshot (see
+//                   StackWalk.h), naming each frame, instead of dumping
+// ----------------------------------------------------------------------------
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Parallel.h"
+#include "PEImage.h"
+#include "PointerScan.h"
+#include "RTTI.h"
+#include "RTTICast.h"
+#include "LogWriter.h"
+#include "RTTIAnalysis.h"
+#include "RTTICache.h"
+#include "RTTINameIndex.h"
+#include "RTTISymbols.h"
+#include "StackWalk.h"
+#include "X64Length.h"
+
+static FILE* g_logFile = stdout;
+
+// ============================================================================
+//   Logging. Same contract as xSE's _MESSAGE / _ERROR: one line per call.
+// ============================================================================
+void _MESSAGE(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(g_logFile, fmt, args);
+    va_end(args);
+    fputc('\n', g_logFile);
+}
+
+void _ERROR(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+// The dump itself goes straight to the file, in LogWriter-sized chunks.
+static void WriteLogFile(const char* text, const std::size_t length)
+{
+    fwrite(text, 1, length, g_logFile);
+}
+
+// Closes the log file, if main opened one, however main returns.
+struct LogFileCloser
+{
+    ~LogFileCloser()
+    {
+        if (g_logFile != stdout) fclose(g_logFile);
+        g_logFile = stdout;
+    }
+};
+
+// ============================================================================
+//                     Memory-mapping the executable.
+// ============================================================================
+struct MappedFile
+{
+    const UInt8*  data = nullptr;
+    UInt64        size = 0;
+#ifdef _WIN32
+    HANDLE        hFile = INVALID_HANDLE_VALUE;
+    HANDLE        hMapping = NULL;
+#endif
+};
+
+static bool MapFile(const char* path, MappedFile& file)
+{
+#ifdef _WIN32
+    file.hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file.hFile == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file.hFile, &size)) return false;
+    file.hMapping = CreateFileMappingA(file.hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!file.hMapping) return false;
+    file.data = (const UInt8*)MapViewOfFile(file.hMapping, FILE_MAP_READ, 0, 0, 0);
+    file.size = (UInt64)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return false;
+    file.data = (const UInt8*)p;
+    file.size = (UInt64)st.st_size;
+#endif
+    return file.data != nullptr;
+}
+
+static void UnmapFile(MappedFile& file)
+{
+#ifdef _WIN32
+    if (file.data) UnmapViewOfFile(file.data);
+    if (file.hMapping) CloseHandle(file.hMapping);
+    if (file.hFile != INVALID_HANDLE_VALUE) CloseHandle(file.hFile);
+#else
+    if (file.data) munmap(const_cast<UInt8*>(file.data), (size_t)file.size);
+#endif
+    file.data = nullptr;
+}
+
+// ============================================================================
+//   Reserve 'size' bytes of zeroed, writable memory, ideally at 'preferred'.
+// ============================================================================
+static UInt8* ReserveImage(const UInt64 preferred, const UInt64 size)
+{
+#ifdef _WIN32
+    void* p = VirtualAlloc((void*)preferred, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!p) {
+        p = VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    return (UInt8*)p;
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void* p = mmap((void*)preferred, (size_t)size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED || (UInt64)p != preferred) {
+        // Older kernels treat the address as a hint (or ignore the flag);
+        // either way, take whatever we were given.
+        if (p != MAP_FAILED) munmap(p, (size_t)size);
+        p = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return nullptr;
+    }
+    return (UInt8*)p;
+#endif
+}
+
+static void ReleaseImage(UInt8* image, const UInt64 size)
+{
+#ifdef _WIN32
+    VirtualFree(image, 0, MEM_RELEASE);
+#else
+    munmap(image, (size_t)size);
+#endif
+}
+
+// ============================================================================
+//   Apply the base relocations, for when we couldn't map at ImageBase.
+// ----------------------------------------------------------------------------
+// The RTTI code compares absolute pointers found in the image (COL "meta"
+// fields, VFT entries, TypeDescriptor::pVFTable) against addresses computed
+// from the base address, so they must agree, exactly as after the Windows
+// loader has rebased the image.
+//
+// The table comes from the file, so it's checked against 'imageSize' before
+// anything is written. Returns FALSE if there's no table, or if it's
+// malformed (in which case some slots may already have been relocated).
+// ============================================================================
+static bool ApplyRelocations(UInt8* image, const UInt64 imageSize, const IMAGE_NT_HEADERS* pNtHdr,
+                             const SInt64 delta)
+{
+    if (pNtHdr->OptionalHeader.NumberOfRvaAndSizes <= IMAGE_DIRECTORY_ENTRY_BASERELOC) return false;
+    const IMAGE_DATA_DIRECTORY& dir =
+        pNtHdr->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    if (!dir.VirtualAddress || !dir.Size) {
+        // No relocations - the image can only be loaded at its preferred base.
+        return false;
+    }
+    if ((UInt64)dir.VirtualAddress + dir.Size > imageSize) {
+        _ERROR("the base relocation table lies outside the image");
+        return false;
+    }
+
+    const UInt8* p = image + dir.VirtualAddress;
+    const UInt8* end = p + dir.Size;
+    while (p + sizeof(IMAGE_BASE_RELOCATION) <= end)
+    {
+        const IMAGE_BASE_RELOCATION* block = reinterpret_cast<const IMAGE_BASE_RELOCATION*>(p);
+        if (block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION)) break;
+        if (block->SizeOfBlock > (UInt64)(end - p)) {
+            _ERROR("a base relocation block runs past the end of the table");
+            return false;
+        }
+
+        const UInt16* entry = reinterpret_cast<const UInt16*>(block + 1);
+        const UInt16* entryEnd = reinterpret_cast<const UInt16*>(p + block->SizeOfBlock);
+        for (; entry < entryEnd; ++entry)
+        {
+            UInt32 type = *entry >> 12;
+            UInt32 offset = *entry & 0xFFF;
+            if (type == IMAGE_REL_BASED_DIR64) {
+                if ((UInt64)block->VirtualAddress + offset + sizeof(UInt64) > imageSize) {
+                    _ERROR("a base relocation at %#x lies outside the image", block->VirtualAddress + offset);
+                    return false;
+                }
+                *reinterpret_cast<UInt64*>(image + block->VirtualAddress + offset) += delta;
+            }
+        }
+        p += block->SizeOfBlock;
+    }
+    return true;
+}
+
+// ============================================================================
+//   Lay out the file's headers and sections as the Windows loader would.
+//   Return the base address, or 0 on failure.
+// ----------------------------------------------------------------------------
+// Every range read from the headers is checked against the file and the
+// image before it's used, so a truncated or malformed file fails to load
+// rather than reading or writing out of bounds.
+// ============================================================================
+static UInt64 LoadImage(const MappedFile& file)
+{
+    if (file.size < sizeof(IMAGE_DOS_HEADER)) return 0;
+    const IMAGE_DOS_HEADER* pDosHdr = reinterpret_cast<const IMAGE_DOS_HEADER*>(file.data);
+    if (pDosHdr->e_magic != IMAGE_DOS_SIGNATURE ||
+        (UInt64)pDosHdr->e_lfanew + sizeof(IMAGE_NT_HEADERS) > file.size) {
+        _ERROR("not a PE file");
+        return 0;
+    }
+    const IMAGE_NT_HEADERS* pNtHdr =
+        reinterpret_cast<const IMAGE_NT_HEADERS*>(file.data + pDosHdr->e_lfanew);
+    if (pNtHdr->Signature != IMAGE_NT_SIGNATURE ||
+        pNtHdr->FileHeader.Machine != IMAGE_FILE_MACHINE_AMD64 ||
+        pNtHdr->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        _ERROR("not an x64 PE32+ image");
+        return 0;
+    }
+
+    // The headers, up to the end of the section table, must be in the file,
+    // and in the part of it that's copied into the image.
+    const UInt64 imageBase = pNtHdr->OptionalHeader.ImageBase;
+    const UInt64 imageSize = pNtHdr->OptionalHeader.SizeOfImage;
+    UInt64 headerSize = pNtHdr->OptionalHeader.SizeOfHeaders;
+    if (headerSize > file.size) headerSize = file.size;
+    if (headerSize > imageSize) headerSize = imageSize;
+    const UInt64 sectionTableEnd = (UInt64)pDosHdr->e_lfanew + offsetof(IMAGE_NT_HEADERS, OptionalHeader) +
+                                   pNtHdr->FileHeader.SizeOfOptionalHeader +
+                                   (UInt64)pNtHdr->FileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER);
+    if (sectionTableEnd > headerSize) {
+        _ERROR("the section table lies outside the file's headers");
+        return 0;
+    }
+
+    UInt8* image = ReserveImage(imageBase, imageSize);
+    if (!image) {
+        _ERROR("couldn't reserve %llu bytes for the image", (unsigned long long)imageSize);
+        return 0;
+    }
+
+    // Headers...
+    memcpy(image, file.data, (size_t)headerSize);
+
+    // ... and sections. Anything beyond a section's raw data (e.g. .bss-style
+    // uninitialised data at the end of .data) stays zero-filled.
+    const IMAGE_SECTION_HEADER* pSectionHdr = reinterpret_cast<const IMAGE_SECTION_HEADER*>(
+        reinterpret_cast<const UInt8*>(&pNtHdr->OptionalHeader) + pNtHdr->FileHeader.SizeOfOptionalHeader);
+    for (int scn = 0; scn < pNtHdr->FileHeader.NumberOfSections; ++scn, ++pSectionHdr)
+    {
+        UInt64 rawSize = pSectionHdr->SizeOfRawData;
+        if (pSectionHdr->Misc.VirtualSize && pSectionHdr->Misc.VirtualSize < rawSize) {
+            rawSize = pSectionHdr->Misc.VirtualSize;
+        }
+        if ((UInt64)pSectionHdr->PointerToRawData + rawSize > file.size ||
+            (UInt64)pSectionHdr->VirtualAddress + rawSize > imageSize) {
+            _ERROR("section %d lies outside the file or image", scn);
+            ReleaseImage(image, imageSize);
+            return 0;
+        }
+        memcpy(image + pSectionHdr->VirtualAddress, file.data + pSectionHdr->PointerToRawData,
+               (size_t)rawSize);
+    }
+
+    if ((UInt64)image != imageBase) {
+        const IMAGE_NT_HEADERS* pMappedNtHdr = GetNtHeaders((UInt64)image);
+        if (!ApplyRelocations(image, imageSize, pMappedNtHdr, (SInt64)((UInt64)image - imageBase))) {
+            _ERROR("couldn't map the image at %#llx and couldn't relocate it",
+                   (unsigned long long)imageBase);
+            ReleaseImage(image, imageSize);
+            return 0;
+        }
+    }
+
+    return (UInt64)image;
+}
+
+// ============================================================================
+//   Time LoadVTables with 1, 2, 4, ... threads, up to 'maxThreads', and check
+//   that every thread count produces the same result.
+// ============================================================================
+static void BenchmarkScan(const ImageLayout& layout, const unsigned maxThreads)
+{
+    const int REPEATS = 5;
+
+    // 1. The raw kernels, over the whole of .rdata / .data on one thread.
+    //    These are the brute-force scans, i.e. what we'd do without relocations.
+    _MESSAGE("--------------------------------- KERNEL BENCHMARK -----------------------------");
+    _MESSAGE("kernel          ISA         time (ms)      GB/s   hits");
+    const SimdLevel selected = GetSimdLevel();
+    for (int level = kSimd_Scalar; level <= GetSupportedSimdLevel(); ++level)
+    {
+        SetSimdLevel((SimdLevel)level);
+        for (int kernel = 0; kernel < 2; ++kernel)
+        {
+            const ImageRange& range = kernel ? layout.data : layout.rdata;
+            std::size_t numHits = 0;
+            double best = 0.0;
+            for (int r = 0; r < REPEATS; ++r)
+            {
+                auto start = std::chrono::steady_clock::now();
+                if (kernel) {
+                    std::vector<const UInt64*> hits;
+                    FindInRange64(reinterpret_cast<const UInt64*>(range.begin),
+                                  reinterpret_cast<const UInt64*>(range.end & ~(UInt64)7),
+                                  layout.rdata.begin, layout.rdata.end, hits);
+                    numHits = hits.size();
+                }
+                else {
+                    // The COL sweep: pSelf (+0x14) holds the COL's own OFFSET.
+                    std::vector<const UInt32*> hits;
+                    FindRamp32(reinterpret_cast<const UInt32*>(range.begin + 0x14),
+                               reinterpret_cast<const UInt32*>(range.end & ~(UInt64)3),
+                               (UInt32)(range.begin - layout.baseAddr), 4, hits);
+                    numHits = hits.size();
+                }
+                std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+                if (r == 0 || ms.count() < best) best = ms.count();
+            }
+            _MESSAGE("%-15s %-8s %12.2f %9.2f %6u",
+                     kernel ? "FindInRange64" : "FindRamp32", GetSimdLevelName((SimdLevel)level),
+                     best, (double)(range.end - range.begin) / (best * 1e6), (UInt32)numHits);
+        }
+    }
+    SetSimdLevel(selected);
+    _MESSAGE("--------------------------------------------------------------------------------");
+
+    // 2. The complete LoadVTables, at each thread count.
+    RTTIDatabase reference;
+    LoadVTables(layout, reference, 1);
+
+    _MESSAGE("--------------------------------- SCAN BENCHMARK -------------------------------");
+    _MESSAGE("%u classes; best of %d runs; %u core(s) reported; %s kernels.",
+             (UInt32)reference.types.size(), REPEATS, GetDefaultThreadCount(), GetSimdLevelName(GetSimdLevel()));
+    _MESSAGE("threads     time (ms)   speedup");
+
+    double baseline = 0.0;
+    for (unsigned n = 1; ; n = (n * 2 < maxThreads) ? n * 2 : maxThreads)
+    {
+        double best = 0.0;
+        bool same = true;
+        for (int r = 0; r < REPEATS; ++r)
+        {
+            RTTIDatabase db;
+            auto start = std::chrono::steady_clock::now();
+            LoadVTables(layout, db, n);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+            if (r == 0 || ms.count() < best) best = ms.count();
+            same = same && (db == reference);
+        }
+        if (n == 1) baseline = best;
+        _MESSAGE("%7u %13.2f %8.2fx%s", n, best, baseline / best, same ? "" : "   RESULT DIFFERS!");
+        if (n >= maxThreads) break;
+    }
+    _MESSAGE("--------------------------------------------------------------------------------");
+}
+
+// ============================================================================
+//   Time the instruction length decoder, and SimpleFunctionDecompiler, which
+//   uses it, on one thread.
+// ============================================================================
+static void BenchmarkDecode(const ImageLayout& layout, const RTTIDatabase& db)
+{
+    const int REPEATS = 5;
+
+    _MESSAGE("-------------------------------- DECODE BENCHMARK ------------------------------");
+    _MESSAGE("Best of %d runs, on one thread.", REPEATS);
+    _MESSAGE("what                      count     time (ms)   ns each");
+
+    // 1. A linear sweep of .text, stepping over a byte at a time wherever
+    //    there's something that doesn't decode (data, padding).
+    const UInt8* begin = reinterpret_cast<const UInt8*>(layout.text.begin);
+    const UInt8* end = reinterpret_cast<const UInt8*>(layout.text.end) - X64_MAX_LENGTH;
+    UInt32 numInstructions = 0;
+    UInt32 numInvalid = 0;
+    double best = 0.0;
+    for (int r = 0; r < REPEATS; ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        numInstructions = 0;
+        numInvalid = 0;
+        X64Instruction insn;
+        for (const UInt8* p = begin; p < end; )
+        {
+            const UInt32 length = DecodeX64Instruction(p, insn);
+            if (length) {
+                p += length;
+                numInstructions++;
+            }
+            else {
+                p++;
+                numInvalid++;
+            }
+        }
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        if (r == 0 || ms.count() < best) best = ms.count();
+    }
+    _MESSAGE("%-20s %10u %13.2f %9.2f", ".text sweep", numInstructions, best,
+             numInstructions ? best * 1e6 / numInstructions : 0.0);
+    _MESSAGE("    %.1f MB/s; %u byte(s) didn't decode.", (double)(end - begin) / (best * 1e3), numInvalid);
+
+    // 2. The decompiler, on every function the VFTs point to.
+    RTTIFuncCache funcs;
+    for (int r = 0; r < REPEATS; ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        BuildFuncCache(layout, db, funcs, 1);
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+        if (r == 0 || ms.count() < best) best = ms.count();
+    }
+    UInt32 numKnown = 0;
+    for (const RTTIFuncEntry& func : funcs.funcs) {
+        if (strncmp(funcs.text.data() + func.text, "????", 4) != 0) numKnown++;
+    }
+    const UInt32 numFuncs = (UInt32)funcs.funcs.size();
+    _MESSAGE("%-20s %10u %13.2f %9.2f", "virtual functions", numFuncs, best,
+             numFuncs ? best * 1e6 / numFuncs : 0.0);
+    _MESSAGE("    %u of them (%.1f%%) decompiled.", numKnown, numFuncs ? 100.0 * numKnown / numFuncs : 0.0);
+    _MESSAGE("--------------------------------------------------------------------------------");
+}
+
+// ============================================================================
+//   What __RTDynamicCast does: find the complete object from the COL, then
+//   compare the name of each class in its base class array with 'target's.
+//   A base that's in the array twice, at different offsets, is ambiguous
+//   whether or not its attributes say so. Then the instance that contains
+//   the sub-object at 'obj' is the one, or else the only one within it.
+// ============================================================================
+static void* NameCompareCast(const RTTIDatabase& db, const void* obj, const TypeDescriptor* target)
+{
+    // Only the part of the class hierarchy that the database checked (see
+    // RTTIColEntry) is followed.
+    const UInt64 baseAddr = db.baseAddr;
+    const RTTICompleteObjectLocator* col =
+        reinterpret_cast<const RTTICompleteObjectLocator*>((*reinterpret_cast<const UInt64* const*>(obj))[-1]);
+    const UInt32 colIndex = FindRTTICol(db, (UInt32)((UInt64)col - baseAddr));
+    if (colIndex == RTTI_NO_INDEX || !db.cols[colIndex].pClassDescriptor) return nullptr;
+    const UInt8* complete = static_cast<const UInt8*>(obj) - col->offset;
+    const RTTIClassHierarchyDescriptor* hierarchy =
+        reinterpret_cast<const RTTIClassHierarchyDescriptor*>(baseAddr + (UInt64)col->pClassDescriptor);
+    const UInt32* pClassArray = reinterpret_cast<const UInt32*>(baseAddr + (UInt64)hierarchy->pBaseClassArray);
+    const UInt32 numBases = db.cols[colIndex].numBaseClasses;
+    auto getBase = [&](const UInt32 b) {
+        return reinterpret_cast<const RTTIBaseClassDescriptor*>(baseAddr + (UInt64)pClassArray[b]);
+    };
+    auto isTarget = [&](const RTTIBaseClassDescriptor* baseClass) {
+        return !strcmp(reinterpret_cast<const TypeDescriptor*>(baseAddr + baseClass->pTypeDescriptor)->name,
+                       target->name);
+    };
+    auto isAt = [&](const RTTIBaseClassDescriptor* baseClass, const UInt32 offset) {
+        return (SInt32)baseClass->where.pdisp < 0 && baseClass->where.mdisp == offset;
+    };
+
+    const RTTIBaseClassDescriptor* found = nullptr;
+    bool ambiguous = false;
+    for (UInt32 b = 0; b < numBases; ++b)
+    {
+        const RTTIBaseClassDescriptor* baseClass = getBase(b);
+        if (!isTarget(baseClass)) continue;
+        if (found) {
+            if (memcmp(&found->where, &baseClass->where, sizeof(PMD)) != 0) ambiguous = true;
+            continue;
+        }
+        found = baseClass;
+    }
+    if (!found) return nullptr;
+    if (!ambiguous && !(found->attributes & kBCD_Ambiguous)) {
+        return (found->attributes & kBCD_NotVisible) ? nullptr : const_cast<UInt8*>(complete + found->where.mdisp);
+    }
+
+    // The sub-object at 'obj', then the instance that contains it ...
+    UInt32 source = 0;
+    while (source < numBases && !isAt(getBase(source), col->offset)) source++;
+    for (UInt32 b = 0; b < numBases; ++b)
+    {
+        const RTTIBaseClassDescriptor* baseClass = getBase(b);
+        if ((SInt32)baseClass->where.pdisp >= 0 || !isTarget(baseClass)) continue;
+        for (UInt32 c = b; c <= b + baseClass->numContainedBases && c < numBases; ++c)
+        {
+            if (isAt(getBase(c), col->offset)) {
+                if (baseClass->attributes & kBCD_NotVisible) return nullptr;
+                return const_cast<UInt8*>(complete + baseClass->where.mdisp);
+            }
+        }
+    }
+    if (source == numBases) return nullptr;
+
+    // ... or the only one within it.
+    found = nullptr;
+    for (UInt32 b = source + 1; b <= source + getBase(source)->numContainedBases && b < numBases; ++b)
+    {
+        const RTTIBaseClassDescriptor* baseClass = getBase(b);
+        if ((SInt32)baseClass->where.pdisp >= 0 || !isTarget(baseClass)) continue;
+        if (found && found->where.mdisp != baseClass->where.mdisp) return nullptr;
+        found = baseClass;
+    }
+    if (!found || (found->attributes & kBCD_NotVisible)) return nullptr;
+    return const_cast<UInt8*>(complete + found->where.mdisp);
+}
+
+// ============================================================================
+//   Time RTTICast against NameCompareCast, and check that they agree, on a
+//   mock object of every class (zeroes, with its VFT pointers in place) cast
+//   to itself, to each of its bases and to a couple of unrelated classes,
+//   from each of its sub-objects that has a VFT.
+// ============================================================================
+static void BenchmarkCast(const ImageLayout& layout, const RTTIDatabase& db)
+{
+    const int REPEATS = 5;
+    const UInt32 PADDING = 64;         // room for a cdOffset before the object
+
+    _MESSAGE("--------------------------------- CAST BENCHMARK -------------------------------");
+    auto start = std::chrono::steady_clock::now();
+    RTTICastTable table;
+    BuildRTTICastTable(layout, db, table);
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    _MESSAGE("Cast table: %u classes, %u VFT slots, %u base slots (%.1f KB), in %.2f ms.",
+             (UInt32)db.names.size(), (UInt32)table.vtbls.size(), (UInt32)table.bases.size(),
+             (table.vtbls.size() * sizeof(RTTICastVtbl) + table.bases.size() * sizeof(RTTICastBase)) / 1024.0,
+             ms.count());
+
+    // The mock objects, and the casts. Virtual bases are left out, as the
+    // mocks have no vbtables.
+    std::vector<std::vector<UInt64>> objects(db.types.size());
+    std::vector<std::pair<const void*, UInt32>> casts;
+    for (UInt32 t = 0; t < (UInt32)db.types.size(); ++t)
+    {
+        const RTTITypeEntry& type = db.types[t];
+        UInt32 size = 8;
+        for (UInt32 v = type.firstVtbl; v < type.firstVtbl + type.numVtbls; ++v) {
+            size = (std::max)(size, db.cols[db.vtbls[v].col].offset + 8);
+        }
+        std::vector<UInt64>& object = objects[t];
+        object.assign((PADDING + size + 7) / 8, 0);
+        UInt8* complete = reinterpret_cast<UInt8*>(object.data()) + PADDING;
+        for (UInt32 v = type.firstVtbl; v < type.firstVtbl + type.numVtbls; ++v) {
+            *reinterpret_cast<UInt64*>(complete + db.cols[db.vtbls[v].col].offset) = (UInt64)GetVtblAddress(db, v);
+        }
+
+        const UInt32 classId = GetRTTIClassId(table, type.pTypeDescriptor);
+        std::vector<UInt32> targets = { classId, (classId + 1) % (UInt32)db.names.size(),
+                                        (classId * 7 + 3) % (UInt32)db.names.size() };
+        const RTTIColEntry& col = db.cols[db.vtbls[type.firstVtbl].col];
+        if (col.pClassDescriptor)
+        {
+            const RTTIClassHierarchyDescriptor* hierarchy =
+                reinterpret_cast<const RTTIClassHierarchyDescriptor*>(db.baseAddr + (UInt64)col.pClassDescriptor);
+            const UInt32* pClassArray =
+                reinterpret_cast<const UInt32*>(db.baseAddr + (UInt64)hierarchy->pBaseClassArray);
+            for (UInt32 b = 1; b < col.numBaseClasses; ++b)
+            {
+                const RTTIBaseClassDescriptor* baseClass =
+                    reinterpret_cast<const RTTIBaseClassDescriptor*>(db.baseAddr + (UInt64)pClassArray[b]);
+                if ((SInt32)baseClass->where.pdisp < 0) {
+                    targets.push_back(GetRTTIClassId(table, baseClass->pTypeDescriptor));
+                }
+            }
+        }
+        for (UInt32 v = type.firstVtbl; v < type.firstVtbl + type.numVtbls; ++v)
+        {
+            const void* obj = complete + db.cols[db.vtbls[v].col].offset;
+            for (const UInt32 target : targets) {
+                casts.push_back({ obj, target });
+            }
+        }
+    }
+
+    std::vector<const TypeDescriptor*> descriptors(db.names.size());
+    for (UInt32 n = 0; n < (UInt32)db.names.size(); ++n) {
+        descriptors[n] = reinterpret_cast<const TypeDescriptor*>(db.baseAddr + db.names[n].pTypeDescriptor);
+    }
+
+    UInt32 numMismatches = 0;
+    UInt32 numCast = 0;
+    for (const std::pair<const void*, UInt32>& c : casts)
+    {
+        void* fast = RTTICast(table, c.first, c.second);
+        numCast += fast != nullptr;
+        if (fast != NameCompareCast(db, c.first, descriptors[c.second])) numMismatches++;
+    }
+
+    _MESSAGE("Best of %d runs, on one thread.", REPEATS);
+    _MESSAGE("what                      count     time (ms)   ns each");
+    double best[2] = { 0.0, 0.0 };
+    UInt64 sink = 0;
+    for (int r = 0; r < REPEATS; ++r)
+    {
+        start = std::chrono::steady_clock::now();
+        for (const std::pair<const void*, UInt32>& c : casts) {
+            sink += (UInt64)RTTICast(table, c.first, c.second);
+        }
+        ms = std::chrono::steady_clock::now() - start;
+        if (r == 0 || ms.count() < best[0]) best[0] = ms.count();
+
+        start = std::chrono::steady_clock::now();
+        for (const std::pair<const void*, UInt32>& c : casts) {
+            sink += (UInt64)NameCompareCast(db, c.first, descriptors[c.second]);
+        }
+        ms = std::chrono::steady_clock::now() - start;
+        if (r == 0 || ms.count() < best[1]) best[1] = ms.count();
+    }
+    const UInt32 numCasts = (UInt32)casts.size();
+    _MESSAGE("%-20s %10u %13.2f %9.2f", "RTTICast", numCasts, best[0], numCasts ? best[0] * 1e6 / numCasts : 0.0);
+    _MESSAGE("%-20s %10u %13.2f %9.2f", "name compares", numCasts, best[1], numCasts ? best[1] * 1e6 / numCasts : 0.0);
+    _MESSAGE("    %u cast(s) succeeded; %u mismatch(es) (checksum %llX).", numCast, numMismatches,
+             (unsigned long long)(sink & 0xFFFF));
+    _MESSAGE("--------------------------------------------------------------------------------");
+}
+
+// ============================================================================
+//   Index the database's names, and list the ones that match each pattern.
+// ============================================================================
+static void FindNames(const RTTIDatabase& db, const std::vector<const char*>& patterns)
+{
+    auto start = std::chrono::steady_clock::now();
+    RTTINameIndex index;
+    BuildRTTINameIndex(db, index);
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    _MESSAGE("RTTI names: indexed %u names (%u nodes, %u atoms, %u postings) in %.2f ms.",
+             (UInt32)db.names.size(), (UInt32)index.nodes.size(), (UInt32)index.atoms.size(),
+             (UInt32)index.postings.size(), ms.count());
+
+    std::vector<UInt32> names;
+    for (const char* pattern : patterns)
+    {
+        start = std::chrono::steady_clock::now();
+        bool ok = FindRTTINames(index, pattern, names);
+        std::chrono::duration<double, std::micro> us = std::chrono::steady_clock::now() - start;
+        if (!ok) {
+            _MESSAGE("RTTI find: \"%s\" isn't a name or template<arg,...> pattern.", pattern);
+            continue;
+        }
+        _MESSAGE("RTTI find: \"%s\": %u match(es) in %.1f us.", pattern, (UInt32)names.size(), us.count());
+        for (UInt32 n : names) {
+            _MESSAGE("    %08X %s", db.names[n].pTypeDescriptor, GetRTTINodeText(index, index.nodes[n]));
+        }
+    }
+}
+
+// ============================================================================
+//   Build the symbolizer, and look up each address with it.
+// ============================================================================
+static void SymbolizeAddresses(const ImageLayout& layout, const RTTIDatabase& db, const std::vector<UInt64>& addrs)
+{
+    const UInt32 MAX_REFS_SHOWN = 8;
+
+    auto start = std::chrono::steady_clock::now();
+    RTTISymbols symbols;
+    BuildRTTISymbols(layout, db, symbols);
+    std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+    _MESSAGE("RTTI symbols: %u ranges, %u VFT slot refs, in %.2f ms.", (UInt32)symbols.ranges.size(),
+             (UInt32)symbols.refs.size(), ms.count());
+
+    // How long a lookup takes: the start of every range, then one byte in.
+    RTTISymbol symbol;
+    char name[256];
+    UInt32 numFound = 0;
+    start = std::chrono::steady_clock::now();
+    for (const UInt32 begin : symbols.begins) {
+        numFound += LookupRTTISymbol(symbols, layout.baseAddr + begin + 1, symbol);
+    }
+    std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+    _MESSAGE("RTTI symbols: %u lookups (%u found), %.1f ns each.", (UInt32)symbols.begins.size(), numFound,
+             symbols.begins.empty() ? 0.0 : ns.count() / symbols.begins.size());
+
+    for (const UInt64 addr : addrs)
+    {
+        LookupRTTISymbol(symbols, addr, symbol);
+        FormatRTTISymbol(symbols, symbol, name, sizeof(name));
+        _MESSAGE("    %08llX %s", (unsigned long long)addr, name);
+        if (symbol.kind == kRTTISymbol_None) continue;
+
+        _MESSAGE("             %08llX ... %08llX%s", (unsigned long long)symbol.begin, (unsigned long long)symbol.end,
+                 (symbol.flags & kRTTISymbol_SizeGuessed) ? " (no unwind info; its end is a guess)" : "");
+        for (UInt32 r = 1; r < symbol.numRefs && r <= MAX_REFS_SHOWN; ++r)
+        {
+            FormatRTTISymbolRef(symbols, symbol.refs[r], name, sizeof(name));
+            _MESSAGE("             also %s%s%s", name,
+                     (symbol.refs[r].flags & kRTTISymbolRef_Inherited) ? " (inherited)" : "",
+                     (symbol.refs[r].flags & kRTTISymbolRef_Thunk) ? " (via a thunk)" : "");
+        }
+        if (symbol.numRefs > MAX_REFS_SHOWN + 1) {
+            _MESSAGE("             and %u more", symbol.numRefs - MAX_REFS_SHOWN - 1);
+        }
+    }
+}
+
+// ============================================================================
+//   Walk the stack in a snapshot, and name each of its frames.
+// ============================================================================
+static bool WalkStackSnapshot(const ImageLayout& layout, const RTTIDatabase& db, const char* path)
+{
+    const UInt32 MAX_FRAMES = 256;
+
+    StackSnapshot snapshot;
+    if (!LoadStackSnapshot(path, snapshot)) {
+        _ERROR("%s isn't a version %u stack snapshot", path, STACK_SNAPSHOT_VERSION);
+        return false;
+    }
+    if (snapshot.timeDateStamp != layout.timeDateStamp || snapshot.sizeOfImage != layout.sizeOfImage) {
+        _ERROR("%s is a snapshot of a different executable", path);
+        return false;
+    }
+
+    RTTISymbols symbols;
+    BuildRTTISymbols(layout, db, symbols);
+
+    const StackMemory stack = { snapshot.stackBase, (UInt64)snapshot.stack.size(), snapshot.stack.data() };
+    StackFrame frames[MAX_FRAMES];
+    auto start = std::chrono::steady_clock::now();
+    const UInt32 numFrames = WalkStack(layout, snapshot.moduleBase, snapshot.context, stack, frames, MAX_FRAMES);
+    std::chrono::duration<double, std::micro> us = std::chrono::steady_clock::now() - start;
+    _MESSAGE("Stack walk: %u frame(s) in %.1f us (module at %016llX, %llu bytes of stack at %016llX).", numFrames,
+             us.count(), (unsigned long long)snapshot.moduleBase, (unsigned long long)stack.size,
+             (unsigned long long)stack.base);
+
+    char line[512];
+    for (UInt32 f = 0; f < numFrames; ++f)
+    {
+        FormatStackFrame(symbols, snapshot.moduleBase, frames[f], f, line, sizeof(line));
+        _MESSAGE("    %s", line);
+    }
+    return true;
+}
+
+// ============================================================================
+//   Known-answer checks that need no executable: the demangling of names
+//   from a real dump, which has to stay exactly as it was, queries of a name
+//   index built from a few of them, and unwinding the frames of a function
+//   copied from an MSVC build. Return FALSE if any of them fails.
+// ============================================================================
+static bool SelfTest()
+{
+    // Each name is one of the classes in skyretk_dump_rtti.log, as DbgHelp
+    // printed it there.
+    static const struct { const char* mangled; const char* unmangled; } UNMANGLED[] = {
+        { ".?AVActor@@", "class Actor" },
+        { ".?AU?$BSTEventSink@UTESHitEvent@@@@", "struct BSTEventSink<struct TESHitEvent>" },
+        // Nested templates: "> >".
+        { ".?AV?$NiTArray@HV?$NiTMallocInterface@H@@@@", "class NiTArray<int,class NiTMallocInterface<int> >" },
+        // Integers: $0 followed by a digit (1 to 10), or hex digits A-P and
+        // '@', with '?' for negative.
+        { ".?AV?$FixedPool@$0CIAAA@$02@_impl@bnet@@", "class bnet::_impl::FixedPool<163840,3>" },
+        // Function pointers.
+        { ".?AV?$NiTStringPointerMap@P6APEAVNiObject@@XZ@@",
+          "class NiTStringPointerMap<class NiObject * __ptr64 (__cdecl*)(void)>" },
+        { ".?AV?$NiTPrimitiveArray@P6AXAEAVNiStream@@PEAVNiObject@@@Z@@",
+          "class NiTPrimitiveArray<void (__cdecl*)(class NiStream & __ptr64,class NiObject * __ptr64)>" },
+        // References and cv-qualifiers.
+        { ".?AV?$NativeFunction1@VActor@@XAEBVBSFixedString@@@BSScript@@",
+          "class BSScript::NativeFunction1<class Actor,void,class BSFixedString const & __ptr64>" },
+        // Member function pointers, one with an enum return type and one
+        // naming its class by a backref ("1@") to the template's first argument.
+        { ".?AV?$CombatBehaviorTreeNodeCondition@V?$CombatBehaviorExpression@V?$CombatBehaviorBinaryExpression@"
+          "V?$CombatBehaviorMemberFunc@VActor@@P8ActorState@@EBA?AW4FLY_STATE@@XZ@@W4FLY_STATE@@UOpEquals@@@@@@@@",
+          "class CombatBehaviorTreeNodeCondition<class CombatBehaviorExpression<class CombatBehaviorBinaryExpression<"
+          "class CombatBehaviorMemberFunc<class Actor,enum FLY_STATE (__cdecl ActorState::*)(void)const __ptr64>,"
+          "enum FLY_STATE,struct OpEquals> > >" },
+        { ".?AV?$CombatBehaviorTreeValueNodeT@IV?$CombatBehaviorExpression@V?$CombatBehaviorMemberFunc@"
+          "VActor@@P81@EBA_NXZ@@@@@@",
+          "class CombatBehaviorTreeValueNodeT<unsigned int,class CombatBehaviorExpression<"
+          "class CombatBehaviorMemberFunc<class Actor,bool (__cdecl Actor::*)(void)const __ptr64> > >" },
+        // Name backrefs ("2@") across a template's arguments, and a negative
+        // integer.
+        { ".?AV?$hkgpTriangulatorType@UhkContainerHeapAllocator@@UVertexBase@hkgpTriangulatorBase@@UTriangleBase@3@"
+          "U?$DefaultEdgeData@UhkContainerHeapAllocator@@@3@U?$SparseEdgeDataPolicy@U?$DefaultEdgeData@"
+          "UhkContainerHeapAllocator@@@hkgpTriangulatorBase@@UhkContainerHeapAllocator@@@3@$0?0$03$0P@$0A@@@",
+          "class hkgpTriangulatorType<struct hkContainerHeapAllocator,struct hkgpTriangulatorBase::VertexBase,"
+          "struct hkgpTriangulatorBase::TriangleBase,struct hkgpTriangulatorBase::DefaultEdgeData<"
+          "struct hkContainerHeapAllocator>,struct hkgpTriangulatorBase::SparseEdgeDataPolicy<"
+          "struct hkgpTriangulatorBase::DefaultEdgeData<struct hkContainerHeapAllocator>,"
+          "struct hkContainerHeapAllocator>,-1,4,15,0>" },
+        // Classes local to a function, which shares the class's backrefs and
+        // has its own for its parameter types ("0").
+        { ".?AVTraverser@?1??RegisterPrefix@BSResource@@YAXPEBD0PEAVLocation@2@@Z@",
+          "class `__cdecl BSResource::RegisterPrefix(char const * __ptr64,char const * __ptr64,"
+          "class BSResource::Location * __ptr64)'::`2'::Traverser" },
+        { ".?AUPauser@?1??DoOnPreRunTask@IOManager@@EEAAXPEAVBSTaskThread@@@Z@",
+          "struct `private: virtual __cdecl IOManager::DoOnPreRunTask(class BSTaskThread * __ptr64) __ptr64'"
+          "::`2'::Pauser" },
+        // DbgHelp can't demangle anonymous namespaces, lambdas, pointers to
+        // objects or nullptr_t as template arguments, and gives the name back
+        // in its "??_R0...@8" form; so must we.
+        { ".?AVQueuedMagicItem@?A0x3cefe057@@", "??_R0?AVQueuedMagicItem@?A0x3cefe057@@@8" },
+        { ".?AUNoMusic@?A0x0dbb649b@@", "??_R0?AUNoMusic@?A0x0dbb649b@@@8" },
+        { ".?AV?$_Ref_count_resource@PEAEV<lambda_8116ba4fa2d997d4c55ff5306dc2e0ef>@@@std@@",
+          "??_R0?AV?$_Ref_count_resource@PEAEV<lambda_8116ba4fa2d997d4c55ff5306dc2e0ef>@@@std@@@8" },
+        { ".?AV?$BGSProcedureTyped@VBGSProcedureBase@@$1?kProcedureEatParamTypes@@3QBUBGSProcedureParamInfo@@B@@",
+          "??_R0?AV?$BGSProcedureTyped@VBGSProcedureBase@@$1?kProcedureEatParamTypes@@3QBUBGSProcedureParamInfo@@B@@@8" },
+        { ".?AV?$_Ref_count_resource_alloc@$$TU?$MemoryDeleter@PEAUHINSTANCE__@@@_impl@bnet@@V?$StdAllocator@X@23@@std@@",
+          "??_R0?AV?$_Ref_count_resource_alloc@$$TU?$MemoryDeleter@PEAUHINSTANCE__@@@_impl@bnet@@"
+          "V?$StdAllocator@X@23@@std@@@8" },
+    };
+
+    UInt32 numFailed = 0;
+    std::string unmangled;
+    for (const auto& t : UNMANGLED)
+    {
+        UnmangleRTTITypeName(t.mangled, unmangled);
+        if (unmangled != t.unmangled) {
+            _ERROR("self-test: %s demangled to \"%s\", not \"%s\"", t.mangled, unmangled.c_str(), t.unmangled);
+            numFailed++;
+        }
+    }
+
+    // Class arguments are indexed with and without their scope, like the
+    // templates.
+    static const char* const NAMES[] = {
+        "class BSScript::NativeFunction2<struct BSScript::StaticFunctionTag,void,class BSFixedString const & __ptr64,float>",
+        "class BSScript::NativeFunction1<class Actor,bool,int>",
+        "class ConcreteObjectFormFactory<class AlchemyItem,46,17,2>",
+        "class DNameNode",
+        "struct BSScript::IFunction",
+    };
+    static const struct { const char* pattern; UInt32 numMatches; } FOUND[] = {
+        { "BSScript::NativeFunction2<StaticFunctionTag>", 1 },
+        { "NativeFunction2<BSScript::StaticFunctionTag,*,*,float>", 1 },
+        { "NativeFunction1<Actor>", 1 },
+        { "NativeFunction1<BSScript::Actor>", 0 },
+        { "ConcreteObjectFormFactory<AlchemyItem,46>", 1 },
+        { "DNameNode", 1 },
+        { "DNameNode<int>", 0 },
+        { "IFunction", 1 },
+        { "BSScript::IFunction", 1 },
+        { "NativeFunction1", 1 },
+    };
+
+    RTTIDatabase db;
+    ClearRTTIDatabase(db);
+    for (const char* name : NAMES)
+    {
+        const UInt32 length = (UInt32)strlen(name);
+        db.names.push_back({ 0, (UInt32)db.nameText.size(), length });
+        db.nameText.insert(db.nameText.end(), name, name + length + 1);
+    }
+    RTTINameIndex index;
+    BuildRTTINameIndex(db, index);
+    std::vector<UInt32> names;
+    for (const auto& t : FOUND)
+    {
+        if (!FindRTTINames(index, t.pattern, names) || names.size() != t.numMatches) {
+            _ERROR("self-test: \"%s\" found %u name(s), not %u", t.pattern, (UInt32)names.size(), t.numMatches);
+            numFailed++;
+        }
+    }
+
+    // A function from an MSVC build (wininst-14.0-amd64.exe, at RVA 2C620),
+    // which the compiler split into three fragments:
+    //   2C620  its entry; the prolog saves rbp in the home space, pushes rdi,
+    //          r14 and r15 and allocates 20h bytes
+    //   2C637  the body, chained to the entry, with a prolog of its own that
+    //          saves rbx, rsi and r12 in the home space; the epilog restores
+    //          them, adds 20h to rsp and pops r15, r14 and rdi...
+    //   2C6EB  ... but its ret is a fragment of its own, chained to the entry.
+    // Its code, .pdata entries and UNWIND_INFOs are copied into a blank image
+    // at the same RVAs.
+    static const UInt8 UNWIND_CODE[] = {
+        0x48, 0x3B, 0xD1, 0x0F, 0x86, 0xC2, 0x00, 0x00, 0x00, 0x48, 0x89, 0x6C, 0x24, 0x20, 0x57, 0x41,
+        0x56, 0x41, 0x57, 0x48, 0x83, 0xEC, 0x20, 0x48, 0x89, 0x5C, 0x24, 0x40, 0x4D, 0x8B, 0xF1, 0x48,
+        0x89, 0x74, 0x24, 0x48, 0x49, 0x8B, 0xE8, 0x4C, 0x89, 0x64, 0x24, 0x50, 0x48, 0x8B, 0xFA, 0x4E,
+        0x8D, 0x24, 0x01, 0x4C, 0x8B, 0xF9, 0x66, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x49, 0x8B, 0xDF, 0x49, 0x8B, 0xF4, 0x4C, 0x3B, 0xE7, 0x77, 0x25, 0x0F, 0x1F, 0x44, 0x00, 0x00,
+        0x49, 0x8B, 0xCE, 0xFF, 0x15, 0x2F, 0x0F, 0x04, 0x00, 0x48, 0x8B, 0xD3, 0x48, 0x8B, 0xCE, 0x41,
+        0xFF, 0xD6, 0x85, 0xC0, 0x48, 0x0F, 0x4F, 0xDE, 0x48, 0x03, 0xF5, 0x48, 0x3B, 0xF7, 0x76, 0xE0,
+        0x4C, 0x8B, 0xC5, 0x48, 0x8B, 0xC7, 0x48, 0x3B, 0xDF, 0x74, 0x2B, 0x48, 0x85, 0xED, 0x74, 0x26,
+        0x48, 0x2B, 0xDF, 0x0F, 0x1F, 0x40, 0x00, 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x0F, 0xB6, 0x08, 0x0F, 0xB6, 0x14, 0x03, 0x88, 0x0C, 0x03, 0x88, 0x10, 0x48, 0x8D, 0x40, 0x01,
+        0x49, 0x83, 0xE8, 0x01, 0x75, 0xEA, 0x48, 0x2B, 0xFD, 0x49, 0x3B, 0xFF, 0x77, 0x92, 0x4C, 0x8B,
+        0x64, 0x24, 0x50, 0x48, 0x8B, 0x74, 0x24, 0x48, 0x48, 0x8B, 0x5C, 0x24, 0x40, 0x48, 0x8B, 0x6C,
+        0x24, 0x58, 0x48, 0x83, 0xC4, 0x20, 0x41, 0x5F, 0x41, 0x5E, 0x5F, 0xC3,
+    };
+    static const UInt8 UNWIND_INFO[] = {
+        // 81B30: the entry's
+        0x01, 0x17, 0x06, 0x00, 0x17, 0x54, 0x0B, 0x00, 0x17, 0x32, 0x13, 0xF0, 0x11, 0xE0, 0x0F, 0x70,
+        // 81B40: the body's
+        0x21, 0x15, 0x06, 0x00, 0x15, 0xC4, 0x0A, 0x00, 0x0D, 0x64, 0x09, 0x00, 0x05, 0x34, 0x08, 0x00,
+        0x20, 0xC6, 0x02, 0x00, 0x37, 0xC6, 0x02, 0x00, 0x30, 0x1B, 0x08, 0x00,
+        // 81B5C: the ret's
+        0x21, 0x00, 0x00, 0x00, 0x20, 0xC6, 0x02, 0x00, 0x37, 0xC6, 0x02, 0x00, 0x30, 0x1B, 0x08, 0x00,
+    };
+    std::vector<UInt8> image(0x82000);
+    memcpy(image.data() + 0x2C620, UNWIND_CODE, sizeof(UNWIND_CODE));
+    memcpy(image.data() + 0x81B30, UNWIND_INFO, sizeof(UNWIND_INFO));
+    ImageLayout layout;
+    layout.baseAddr = reinterpret_cast<UInt64>(image.data());
+    layout.sizeOfImage = (UInt32)image.size();
+    layout.functions = { { 0x2C620, 0x2C637, 0x81B30, 0x2C620 },
+                         { 0x2C637, 0x2C6EB, 0x81B40, 0x2C620 },
+                         { 0x2C6EB, 0x2C6EC, 0x81B5C, 0x2C620 } };
+    const UInt64 moduleBase = 0x140000000ULL;
+
+    // The stack as the body sees it: the home space of the functions it
+    // calls, then (from slot 4) r15, r14, rdi, the return address and the
+    // home space where rbx, rsi, r12 and rbp were saved.
+    UInt64 stackData[12];
+    for (UInt32 s = 0; s < 12; ++s) stackData[s] = 0x5100 + s;
+    stackData[7] = moduleBase + 0x1234;
+    const UInt64 stackBase = 0x7FFE0000ULL;
+    const StackMemory stack = { stackBase, sizeof(stackData), reinterpret_cast<const UInt8*>(stackData) };
+
+    // Each is unwound to the return address; 'saved' says which slot each of
+    // rbx, rbp, rsi, rdi, r12, r14 and r15 comes back from, or -1 for none.
+    static const StackRegister SAVED_REGS[7] = {
+        kReg_Rbx, kReg_Rbp, kReg_Rsi, kReg_Rdi, kReg_R12, kReg_R14, kReg_R15,
+    };
+    static const struct { UInt32 rva; UInt32 slot; UInt32 flags; int saved[7]; } UNWOUND[] = {
+        { 0x2C62E, 7, 0,                    { -1, -1, -1, -1, -1, -1, -1 } },    // entry's prolog, nothing pushed yet
+        { 0x2C634, 4, 0,                    { -1, -1, -1,  6, -1,  5,  4 } },    // ... pushed, not allocated yet
+        { 0x2C63C, 0, 0,                    {  8, 11, -1,  6, -1,  5,  4 } },    // body's prolog, only rbx saved yet
+        { 0x2C679, 0, 0,                    {  8, 11,  9,  6, 10,  5,  4 } },    // after a call in the body
+        { 0x2C6E2, 0, kStackFrame_Epilog,   { -1, -1, -1,  6, -1,  5,  4 } },    // epilog's add rsp
+        { 0x2C6E6, 4, kStackFrame_Epilog,   { -1, -1, -1,  6, -1,  5,  4 } },    // ... its pops, on into the ret's fragment
+        { 0x2C6EB, 7, kStackFrame_Epilog,   { -1, -1, -1, -1, -1, -1, -1 } },    // the ret's fragment
+    };
+    for (const auto& t : UNWOUND)
+    {
+        StackContext context;
+        context.rip = moduleBase + t.rva;
+        for (UInt32 r = 0; r < 16; ++r) context.regs[r] = 0xEE00 + r;
+        context.regs[kReg_Rsp] = stackBase + t.slot * 8;
+
+        UInt32 flags;
+        bool ok = UnwindStackFrame(layout, moduleBase, context, stack, flags) && flags == t.flags &&
+                  context.rip == stackData[7] && context.regs[kReg_Rsp] == stackBase + 8 * 8;
+        for (UInt32 r = 0; r < 7; ++r) {
+            const UInt64 expected = (t.saved[r] < 0) ? 0xEE00 + SAVED_REGS[r] : stackData[t.saved[r]];
+            ok = ok && context.regs[SAVED_REGS[r]] == expected;
+        }
+        if (!ok) {
+            _ERROR("self-test: unwinding from %llX went wrong", (unsigned long long)(moduleBase + t.rva));
+            numFailed++;
+        }
+    }
+
+    _MESSAGE("Self-test: %u check(s) failed.", numFailed);
+    return numFailed == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned numThreads = 0;
+    bool benchScan = false;
+    bool benchDecode = false;
+    bool benchCast = false;
+    bool selfTest = false;
+    bool useCache = true;
+    const char* cacheArg = nullptr;
+    UInt32 stepBudget = 0;    // microseconds; 0 for a normal (one-shot) run
+    std::vector<const char*> patterns;
+    std::vector<UInt64> addrs;
+    const char* stackPath = nullptr;
+
+    int arg = 1;
+    for (; arg < argc && !strncmp(argv[arg], "--", 2); ++arg)
+    {
+        if (!strcmp(argv[arg], "--threads") && arg + 1 < argc) {
+            numThreads = (unsigned)atoi(argv[++arg]);
+        }
+        else if (!strcmp(argv[arg], "--simd") && arg + 1 < argc) {
+            ++arg;
+            if (!strcmp(argv[arg], "scalar")) SetSimdLevel(kSimd_Scalar);
+            else if (!strcmp(argv[arg], "sse4.2")) SetSimdLevel(kSimd_SSE42);
+            else if (!strcmp(argv[arg], "avx2")) SetSimdLevel(kSimd_AVX2);
+            else { arg = argc; break; }
+        }
+        else if (!strcmp(argv[arg], "--bench-scan")) {
+            benchScan = true;
+        }
+        else if (!strcmp(argv[arg], "--bench-decode")) {
+            benchDecode = true;
+        }
+        else if (!strcmp(argv[arg], "--bench-cast")) {
+            benchCast = true;
+        }
+        else if (!strcmp(argv[arg], "--self-test")) {
+            selfTest = true;
+        }
+        else if (!strcmp(argv[arg], "--cache") && arg + 1 < argc) {
+            cacheArg = argv[++arg];
+        }
+        else if (!strcmp(argv[arg], "--no-cache")) {
+            useCache = false;
+        }
+        else if (!strcmp(argv[arg], "--incremental") && arg + 1 < argc && atoi(argv[arg + 1]) > 0) {
+            stepBudget = (UInt32)atoi(argv[++arg]);
+        }
+        else if (!strcmp(argv[arg], "--find") && arg + 1 < argc) {
+            patterns.push_back(argv[++arg]);
+        }
+        else if (!strcmp(argv[arg], "--addr") && arg + 1 < argc) {
+            addrs.push_back((UInt64)strtoull(argv[++arg], nullptr, 16));
+        }
+        else if (!strcmp(argv[arg], "--stack") && arg + 1 < argc) {
+            stackPath = argv[++arg];
+        }
+        else {
+            arg = argc;
+            break;
+        }
+    }
+    if (selfTest) {
+        return SelfTest() ? 0 : 1;
+    }
+    if (argc - arg < 1 || argc - arg > 2) {
+        fprintf(stderr, "Usage: %s [--threads N] [--simd scalar|sse4.2|avx2] [--bench-scan] [--bench-decode] [--bench-cast] "
+                        "[--cache FILE | --no-cache] [--incremental USEC] [--find PATTERN]... "
+                        "[--addr ADDRESS]... [--stack FILE] "
+                        "<path to SkyrimSE.exe> [output log]\n"
+                        "       %s --self-test\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+    const char* exePath = argv[arg];
+    const char* logPath = (argc - arg == 2) ? argv[arg + 1] : nullptr;
+
+    // By default the cache goes next to the log, as in the game. Without a
+    // log there's nowhere obvious to put it, so we don't use one.
+    std::string cachePath;
+    if (useCache && cacheArg) {
+        cachePath = cacheArg;
+    }
+    else if (useCache && logPath) {
+        cachePath = logPath;
+        std::size_t dot = cachePath.find_last_of("./\\");
+        if (dot != std::string::npos && cachePath[dot] == '.') cachePath.erase(dot);
+        cachePath += ".cache";
+    }
+
+    MappedFile file;
+    if (!MapFile(exePath, file)) {
+        _ERROR("couldn't open %s", exePath);
+        return 1;
+    }
+    UInt64 baseAddr = LoadImage(file);
+    UnmapFile(file);
+    if (!baseAddr) return 1;
+
+    LogFileCloser closeLog;
+    if (logPath) {
+        FILE* logFile = fopen(logPath, "w");
+        if (!logFile) {
+            _ERROR("couldn't open %s for writing", logPath);
+            return 1;
+        }
+        g_logFile = logFile;
+    }
+
+    _MESSAGE("====================== SkyRETK dump_rtti: offline analysis ====================");
+    _MESSAGE("Nox Sidereum's update of Himika's code at https://github.com/himika/libSkyrim.");
+    _MESSAGE("Section bounds and RTTI addresses are read from the executable's PE headers.");
+    _MESSAGE("================================================================================");
+
+    if (stepBudget) {
+        RTTIAnalysis analysis;
+        StartRTTIAnalysis(analysis, baseAddr, exePath, cachePath.empty() ? nullptr : cachePath.c_str(),
+                          nullptr, WriteLogFile);
+        while (StepRTTIAnalysis(analysis, stepBudget)) {}
+        if (analysis.stage == kAnalysis_Failed) return 1;
+
+        _MESSAGE("RTTI dump: finished; %u classes in %.3f s wall time, %.3f s CPU time "
+                 "(%u steps of %u us; longest %.2f ms).", (UInt32)analysis.db.types.size(),
+                 analysis.wallTime, analysis.cpuTime, analysis.numSteps, stepBudget, analysis.longestStep * 1e3);
+        return 0;
+    }
+
+    PrintModuleSummary(exePath, baseAddr);
+
+    ImageLayout layout;
+    if (benchScan) {
+        // Find the sections to scan, and locate type_info's VFT and _purecall.
+        if (!GetImageLayout(baseAddr, layout)) {
+            _ERROR("couldn't find the RTTI in %s", exePath);
+            return 1;
+        }
+        PrintImageLayout(layout);
+        BenchmarkScan(layout, numThreads ? numThreads : GetDefaultThreadCount());
+        return 0;
+    }
+
+    // Load the VFTs from the cache, or locate them, then print the class structures:
+    RTTIDatabase db;
+    if (!LoadRTTI(baseAddr, cachePath.empty() ? nullptr : cachePath.c_str(), layout, db, numThreads)) {
+        _ERROR("couldn't find the RTTI in %s", exePath);
+        return 1;
+    }
+    PrintImageLayout(layout);
+    if (benchDecode) {
+        BenchmarkDecode(layout, db);
+        return 0;
+    }
+    if (benchCast) {
+        BenchmarkCast(layout, db);
+        return 0;
+    }
+    if (!patterns.empty()) {
+        FindNames(db, patterns);
+        return 0;
+    }
+    if (!addrs.empty()) {
+        SymbolizeAddresses(layout, db, addrs);
+        return 0;
+    }
+    if (stackPath) {
+        return WalkStackSnapshot(layout, db, stackPath) ? 0 : 1;
+    }
+    LogWriter out;
+    OpenLogWriter(out, LOG_FLUSH_SIZE, WriteLogFile);
+    PrintVirtuals(out, layout, db, nullptr, numThreads);
+    return 0;
+}